@@ -0,0 +1,79 @@
+#include <QCoreApplication>
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <QtDebug>
+#include "Database.h"
+
+// Round trips a Map[String]String and a List[Int64] through the binary codec
+// and through QVariant and QDataStream, which is what compound properties
+// went through before the codec.
+
+const int ITERATIONS = 100000;
+
+template<class T>
+QByteArray variantEncode(const T& value) {
+    QByteArray ret;
+    QDataStream stream(&ret, QIODevice::WriteOnly);
+    stream << QVariant::fromValue(value);
+    return ret;
+}
+
+template<class T>
+T variantDecode(const QByteArray& bytes) {
+    QDataStream stream(bytes);
+    QVariant ret;
+    stream >> ret;
+    return ret.value<T>();
+}
+
+template<class T>
+void run(const char* name, const T& value) {
+    QElapsedTimer timer;
+    int size = 0;
+
+    timer.start();
+    for (int i = 0; i < ITERATIONS; i++) {
+        auto bytes = variantEncode(value);
+        size = bytes.size();
+        if (variantDecode<T>(bytes).size() != value.size()) {
+            qFatal("QVariant round trip lost elements");
+        }
+    }
+    auto variantTime = timer.nsecsElapsed();
+    auto variantSize = size;
+
+    timer.restart();
+    for (int i = 0; i < ITERATIONS; i++) {
+        auto bytes = PPBinary::encode(value);
+        size = bytes.size();
+        if (PPBinary::decode<T>(bytes).size() != value.size()) {
+            qFatal("codec round trip lost elements");
+        }
+    }
+    auto codecTime = timer.nsecsElapsed();
+
+    qInfo().noquote() << QStringLiteral("%1: QVariant %2 ns, %3 bytes; codec %4 ns, %5 bytes")
+        .arg(name)
+        .arg(variantTime / ITERATIONS).arg(variantSize)
+        .arg(codecTime / ITERATIONS).arg(size);
+}
+
+int main(int argc, char* argv[]) {
+    QCoreApplication app(argc, argv);
+    qRegisterMetaTypeStreamOperators<QMap<QString,QString>>();
+    qRegisterMetaTypeStreamOperators<QList<qint64>>();
+
+    QMap<QString,QString> metadata;
+    for (int i = 0; i < 16; i++) {
+        metadata[QStringLiteral("key%1").arg(i)] = QStringLiteral("value %1").arg(i * 31);
+    }
+    run("Map[String]String", metadata);
+
+    QList<qint64> numbers;
+    for (int i = 0; i < 256; i++) {
+        numbers << qint64(i) * i;
+    }
+    run("List[Int64]", numbers);
+
+    return 0;
+}
@@ -0,0 +1,55 @@
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QtDebug>
+#include "002.h"
+
+// Loads a million rows with importRows(), and compares the time per row with
+// creating and saving objects one at a time, which is what bulk loads went
+// through before.
+
+const int ROWS = 1000000;
+const int SAVED_ROWS = 10000;
+
+int main(int argc, char* argv[]) {
+    QCoreApplication app(argc, argv);
+    app.setApplicationName("pokipoki-bench-002");
+
+    QSqlQuery(pDB->connection()).exec("DROP TABLE IF EXISTS Item");
+
+    QElapsedTimer timer;
+    timer.start();
+    {
+        PPTransaction transaction;
+        for (int i = 0; i < SAVED_ROWS; i++) {
+            auto item = Item::newItem();
+            item->set_title(QStringLiteral("saved %1").arg(i));
+            item->set_rank(i);
+            item->set_score(i / 3.0);
+            if (!item->save()) {
+                qFatal("saving an item failed");
+            }
+        }
+        transaction.commit();
+    }
+    auto savedTime = timer.nsecsElapsed();
+
+    QVector<Item::Record> records;
+    records.reserve(ROWS);
+    for (int i = 0; i < ROWS; i++) {
+        records << Item::Record{QStringLiteral("imported %1").arg(i), i, i / 3.0};
+    }
+    timer.restart();
+    if (!Item::importRows(records)) {
+        qFatal("importing items failed");
+    }
+    auto importTime = timer.nsecsElapsed();
+
+    qInfo().noquote() << QStringLiteral("newItem() and save(): %1 ns per row; importRows(): %2 ns per row, %3 ms for %4 rows")
+        .arg(savedTime / SAVED_ROWS)
+        .arg(importTime / ROWS)
+        .arg(importTime / 1000000)
+        .arg(ROWS);
+
+    QSqlQuery(pDB->connection()).exec("DROP TABLE IF EXISTS Item");
+    return 0;
+}
@@ -3,7 +3,10 @@
 #pragma once
 
 #include <QAbstractListModel>
+#include <QCache>
 #include <QDebug>
+#include <QFuture>
+#include <QHash>
 #include <QMutex>
 #include <QMutexLocker>
 #include <QObject>
@@ -11,6 +14,8 @@
 #include <QSharedPointer>
 #include <QSqlError>
 #include <QSqlQuery>
+#include <QSqlRecord>
+#include <QStringList>
 #include <QUuid>
 #include <QVariant>
 #include <QString>
@@ -29,45 +34,188 @@ class Note : public QObject, PPUndoRedoable {
 	Q_OBJECT
 	Q_INTERFACES(PPUndoRedoable)
 
-	struct Change {
-		
-		
-		
-		Optional<QString> previoustitleValue;
-		
-		
-		
-		Optional<QMap<QString,QString>> previousmetadataValue;
-		
-	};
+	// An undo step only holds the properties a save changed, see PPDelta.
+	using Change = PPDelta;
 
 	Note(QUuid ID) : QObject(nullptr), m_ID(ID) {
-		static bool db_initialized = false;
-		if (!db_initialized) {
-			prepareDatabase();
-			db_initialized = true;
+		static bool db_initialized = (prepareDatabase(), true);
+		Q_UNUSED(db_initialized)
+	}
+
+	static QSharedPointer<Note> withID(QUuid ID, bool* created = nullptr) {
+		return PPIdentityMap<Note>::instance().obtain(ID, [ID] { return new Note(ID); }, created);
+	}
+
+	// Lets PPUndoRedoStack get hold of objects whose steps it reads back from its
+	// journal, without reloading the ones that are alive.
+	static QSharedPointer<QObject> journaled(const QUuid& ID) {
+		return withID(ID);
+	}
+	static inline const bool s_JOURNALED = PPUndoRedoStack::registerType(QStringLiteral("Note"), &journaled);
+
+	static PPRowChange reparented(const QUuid& ID, const QString& column, const QUuid& previous, const QUuid& parent) {
+		PPRowChange change;
+		change.kind = PPRowChange::Reparented;
+		change.table = QStringLiteral("Note");
+		change.ID = ID;
+		change.parentColumn = column;
+		change.previousParent = previous;
+		change.parent = parent;
+		return change;
+	}
+
+	static void publishReparented(const QUuid& ID, const QString& column, const QUuid& previous, const QUuid& parent) {
+		pDB->publishRowChange(reparented(ID, column, previous, parent));
+	}
+
+	// Called by the identity map once the last reference is gone. A staged deletion
+	// is queued with PPDatabase, which writes it in a batch with others.
+	void released() {
+		if (!m_DELETE_PENDING) {
+			return;
+		}
+		QVector<PPRowChange> changes;
+		if (!m_parent_Note_ID.isNull()) {
+			changes << reparented(m_ID, QStringLiteral("PARENT_Note_ID"), m_parent_Note_ID, QUuid());
 		}
+		PPRowChange change;
+		change.kind = PPRowChange::Deleted;
+		change.table = QStringLiteral("Note");
+		change.ID = m_ID;
+		changes << change;
+		pDB->queueDelete(QStringLiteral("Note"), m_ID, QStringList{QStringLiteral("Note_metadata")}, changes);
 	}
 
-	~Note() {
-		if (m_DELETE_PENDING) {
-			QSqlQuery query(PPDatabase::instance()->connection());
-			query.prepare(QStringLiteral("DELETE FROM Note WHERE ID = :ID"));
-			query.bindValue(":ID", QVariant::fromValue(m_ID));
-			query.exec();
+	// Each column has a bit in a mask, in the order of ColumnProperties. m_LOADED holds
+	// the columns whose members hold the stored value; @lazy ones and those left out
+	// of a projection are read the first time they're used.
+	static constexpr quint64 AllColumns = quint64(0) | (quint64(1) << 0);
+	static constexpr quint64 LazyColumns = quint64(0);
+	static constexpr quint64 EagerColumns = AllColumns & ~LazyColumns;
+
+	static QString selectColumns() {
+		return QStringLiteral("ID, title");
+	}
+
+	static QString selectColumns(quint64 columns) {
+		if (columns == EagerColumns) {
+			return selectColumns();
+		}
+		QStringList names{QStringLiteral("ID")};
+		if (columns & (quint64(1) << 0)) {
+			names << QStringLiteral("title");
 		}
+		return names.join(", ");
 	}
 
-	static QSharedPointer<Note> withID(QUuid ID) {
-		static QMap<QUuid,QPointer<Note>> s_instances;
-		static QMutex s_mutex;
+	static quint64 columnsNamed(const QStringList& properties) {
+		quint64 columns = 0;
+		for (const auto& name : properties) {
+			if (name == QLatin1String("title")) {
+				columns |= quint64(1) << 0;
+				continue;
+			}
+			qCritical() << "There is no column" << name << "in items of type Note";
+		}
+		return columns;
+	}
 
-		QMutexLocker locker(&s_mutex);
-		auto val = s_instances.value(ID, nullptr);
-		if (val.isNull()) {
-			s_instances[ID] = new Note(ID);
+	// Rows are read in the order of selectColumns(), so each member is filled by position
+	// without going through the property system. A column that wasn't loaded yet takes the
+	// row as is; one that was keeps its unsaved edits and only signals if it changed.
+	template<class Row>
+	void hydrate(const Row& row, quint64 columns) {
+		int column = 1;
+		if (columns & (quint64(1) << 0)) {
+			auto value = PPColumn<decltype(m_title)>::read(row.value(column++));
+			if (!(m_LOADED & (quint64(1) << 0))) {
+				m_title = std::move(value);
+			} else if (!m_title_dirty && !(value == m_title)) {
+				m_title = std::move(value);
+				Q_EMIT titleChanged();
+			}
+		}
+		m_LOADED |= columns;
+		Q_UNUSED(row)
+		Q_UNUSED(column)
+	}
+
+	template<class Row>
+	static QSharedPointer<Note> hydrated(const Row& row, quint64 columns = EagerColumns) {
+		auto ret = withID(PPKey::decode(row.value(0)));
+		ret->hydrate(row, columns);
+		return ret;
+	}
+
+	void load_columns(quint64 columns) const {
+		auto missing = columns & ~m_LOADED;
+		if (missing == 0) {
+			return;
+		}
+		// Getters are const, but loading only fills in what the database already holds.
+		auto self = const_cast<Note*>(this);
+		PPStatement query(QStringLiteral("SELECT %1 FROM Note WHERE ID = :id").arg(selectColumns(missing)));
+		query->bindValue(":id", PPKey::encode(m_ID));
+		if (!query->exec()) {
+			qCritical() << query->lastError() << "when loading the columns of an item of type Note";
+		} else if (query->next()) {
+			self->hydrate(*query, missing);
+		}
+		self->m_LOADED |= missing;
+	}
+
+	// Loads the given columns of every object that doesn't have them yet, a few hundred
+	// objects per query.
+	template<class Objects>
+	static void fetchColumns(const Objects& objects, quint64 columns) {
+		static const int chunk_size = 256;
+
+		QVector<Note*> pending;
+		quint64 missing = 0;
+		for (const auto& object : objects) {
+			if (object && (object->m_LOADED & columns) != columns) {
+				pending << object.data();
+				missing |= columns & ~object->m_LOADED;
+			}
+		}
+		for (int from = 0; from < pending.size(); from += chunk_size) {
+			QHash<QUuid,Note*> chunk;
+			QStringList placeholders;
+			for (int i = from; i < pending.size() && i < from + chunk_size; i++) {
+				chunk.insert(pending[i]->m_ID, pending[i]);
+				placeholders << QStringLiteral(":id%1").arg(i - from);
+			}
+			PPStatement query(QStringLiteral("SELECT %1 FROM Note WHERE ID IN (%2)").arg(selectColumns(missing), placeholders.join(", ")));
+			for (int i = from; i < pending.size() && i < from + chunk_size; i++) {
+				query->bindValue(placeholders[i - from], PPKey::encode(pending[i]->m_ID));
+			}
+			if (!query->exec()) {
+				qCritical() << query->lastError() << "when loading the columns of items of type Note";
+			}
+			while (query->next()) {
+				if (auto object = chunk.value(PPKey::decode(query->value(0)))) {
+					object->hydrate(*query, missing);
+				}
+			}
+			for (auto object : chunk) {
+				object->m_LOADED |= missing;
+			}
+		}
+	}
+
+	static QList<QSharedPointer<Note>> where(PredicateList predicates, quint64 columns) {
+		auto tq = QStringLiteral("SELECT %1 FROM Note%2").arg(selectColumns(columns), predicates.whereClause());
+		PPStatement query(tq);
+		predicates.bindAllPredicates(query.data());
+		auto ok = query->exec();
+		if (!ok) {
+			qCritical() << query->lastError() << "when running a where query on items of type Note";
+		}
+		QList<QSharedPointer<Note>> ret;
+		while (query->next()) {
+			ret << hydrated(*query, columns);
 		}
-		return QSharedPointer<Note>(s_instances[ID].data(), &QObject::deleteLater);
+		return ret;
 	}
 
 	
@@ -75,10 +223,16 @@ class Note : public QObject, PPUndoRedoable {
 	
 	
 	friend class NoteModel;
+	friend class PPCursor<Note>;
+	friend class PPIdentityMap<Note>;
 
 	QUuid m_ID;
 	bool m_NEW = false;
+	quint64 m_LOADED = 0;
 	bool m_DELETE_PENDING = false;
+	// The row was removed by deleteWhere(). Saves write nothing until undoing
+	// the deletion puts the row back.
+	bool m_DELETED = false;
 	bool m_DIRTY = false;
 	bool m_CAN_UNDO = false;
 	bool m_CAN_REDO = false;
@@ -97,15 +251,45 @@ class Note : public QObject, PPUndoRedoable {
 	Q_PROPERTY(QString title READ title WRITE set_title NOTIFY titleChanged)
 	QString m_title;
 	QString m_title_prev;
-	bool m_title_dirty;
+	bool m_title_dirty = false;
 	
 	
 	
 	Q_PROPERTY(QMap<QString,QString> metadata READ metadata WRITE set_metadata NOTIFY metadataChanged)
-	QMap<QString,QString> m_metadata;
-	QMap<QString,QString> m_metadata_prev;
-	bool m_metadata_dirty;
+	mutable QMap<QString,QString> m_metadata;
+	mutable QMap<QString,QString> m_metadata_prev;
+	bool m_metadata_dirty = false;
 	
+	
+	// metadata lives in Note_metadata and is loaded on first use.
+	// Mutators queue deltas, set_metadata() replaces the whole collection.
+	QList<PPMapTable<QMap<QString,QString>>::Delta> m_metadata_deltas;
+	mutable bool m_metadata_loaded = false;
+
+	void load_metadata() const {
+		if (!m_metadata_loaded) {
+			m_metadata_loaded = true;
+			m_metadata = PPMapTable<QMap<QString,QString>>::load(QStringLiteral("Note_metadata"), m_ID);
+			m_metadata_prev = m_metadata;
+		}
+	}
+
+	// The collection as last saved, before the deltas that aren't written yet.
+	QMap<QString,QString> saved_metadata() const {
+		auto saved = m_metadata;
+		for (auto it = m_metadata_deltas.crbegin(); it != m_metadata_deltas.crend(); ++it) {
+			PPMapTable<QMap<QString,QString>>::apply(saved, it->inverted());
+		}
+		return saved;
+	}
+
+	void push_metadata_delta(const PPMapTable<QMap<QString,QString>>::Delta& delta) {
+		m_metadata_deltas << delta;
+		Q_EMIT metadataChanged();
+		clear_redo();
+		evaluate_dirty_changed();
+		evaluate_can_undo_changed();
+	}
 
 	void evaluate_can_undo_changed() {
 		auto setUndo = [this](bool newUndo){
@@ -136,10 +320,125 @@ class Note : public QObject, PPUndoRedoable {
 	}
 
 	void clear_redo() {
+		for (int i = 0; i < m_REDO_STACK.size(); i++) {
+			pUR->redoItemRemoved(this);
+		}
 		m_REDO_STACK.clear();
 		evaluate_can_redo_changed();
 	}
 
+	// Puts the values and side table deltas of change into the object, and returns
+	// what they replaced, so applying the result reverses it again. Appends the
+	// writes that store the new values to writes.
+	Change swapChange(const Change& change, QVector<PPWrite>* writes) {
+		PPDelta::Reader reader(change);
+		PPDelta::Writer replaced;
+		quint64 columns = 0;
+		if (change.hasValue(0)) {
+			load_columns(quint64(1) << 0);
+			columns |= quint64(1) << 0;
+			replaced.value(0, m_title);
+			m_title = reader.value<decltype(m_title)>();
+			Q_EMIT titleChanged();
+		}
+		if (change.hasValue(1)) {
+			load_metadata();
+			replaced.value(1, m_metadata);
+			m_metadata = reader.value<decltype(m_metadata)>();
+			Q_EMIT metadataChanged();
+		}
+		if (columns != 0) {
+			PPWrite write;
+			write.statement = updateStatement(columns);
+			write.bind(":ID", PPKey::encode(m_ID));
+			if (columns & (quint64(1) << 0)) {
+				write.bind(":title", PPColumn<decltype(m_title)>::bind(m_title));
+			}
+			*writes << write;
+		}
+		
+		if (change.hasEdits(1)) {
+			load_metadata();
+			auto edits = reader.edits<PPMapTable<QMap<QString,QString>>::Delta>();
+			QList<PPMapTable<QMap<QString,QString>>::Delta> reversed;
+			for (auto it = edits.crbegin(); it != edits.crend(); ++it) {
+				PPMapTable<QMap<QString,QString>>::apply(m_metadata, it->inverted());
+				reversed << it->inverted();
+			}
+			replaced.edits(1, reversed);
+			for (const auto& delta : reversed) {
+				PPMapTable<QMap<QString,QString>>::write(writes, QStringLiteral("Note_metadata"), m_ID, delta);
+			}
+			Q_EMIT metadataChanged();
+		}
+		if (change.hasValue(1)) {
+			PPMapTable<QMap<QString,QString>>::replace(writes, QStringLiteral("Note_metadata"), m_ID, m_metadata);
+		}
+		return replaced.finish();
+	}
+
+	// Whether change touches a property with unsaved edits, which applying it
+	// would overwrite.
+	bool touchesPendingEdits(const Change& change) const {
+		if (change.hasValue(0) && m_title_dirty) {
+			return true;
+		}
+		if ((change.hasValue(1) || change.hasEdits(1)) && (m_metadata_dirty || !m_metadata_deltas.isEmpty())) {
+			return true;
+		}
+		Q_UNUSED(change)
+		return false;
+	}
+
+	// Applies the latest step on from, writing the values it puts back in one
+	// transaction with PPUndoRedoStack's record of the move, and pushes what
+	// it replaced onto to. Nothing moves if the write fails, or if the step
+	// would overwrite unsaved edits, which have to be saved or discarded first.
+	bool moveStep(QList<Change>& from, QList<Change>& to, bool redo) {
+		if (touchesPendingEdits(from.last())) {
+			qWarning() << "Not" << (redo ? "redoing" : "undoing") << "a change to an item of type Note over unsaved edits";
+			return false;
+		}
+		PPTransaction transaction;
+		if (!transaction.isOpen()) {
+			return false;
+		}
+		QVector<PPWrite> writes;
+		auto step = from.takeLast();
+		auto replaced = swapChange(step, &writes);
+		auto ok = true;
+		for (const auto& write : writes) {
+			if (!write.exec()) {
+				qCritical() << "when" << (redo ? "redoing" : "undoing") << "a change to an item of type Note";
+				ok = false;
+				break;
+			}
+		}
+		if (ok) {
+			PPRowChange change;
+			change.table = QStringLiteral("Note");
+			change.ID = m_ID;
+			change.properties = step.properties();
+			pDB->publishRowChange(change);
+			to << replaced;
+			redo ? pUR->stepRedone(this, replaced) : pUR->stepUndone(this, replaced);
+			ok = transaction.commit();
+			if (!ok) {
+				to.takeLast();
+				redo ? pUR->stepUndone(this, step) : pUR->stepRedone(this, step);
+			}
+		}
+		if (!ok) {
+			QVector<PPWrite> ignored;
+			swapChange(replaced, &ignored);
+			from << step;
+			return false;
+		}
+		evaluate_can_undo_changed();
+		evaluate_can_redo_changed();
+		return true;
+	}
+
 	void evaluate_dirty_changed() {
 		if (m_DIRTY) {
 			auto new_dirty = false;
@@ -152,6 +451,9 @@ class Note : public QObject, PPUndoRedoable {
 				new_dirty = true;
 			}
 			
+			if (!m_metadata_deltas.isEmpty()) {
+				new_dirty = true;
+			}
 			if (!new_dirty) {
 				m_DIRTY = false;
 			}
@@ -170,7 +472,165 @@ class Note : public QObject, PPUndoRedoable {
 				return;
 			}
 			
+			if (!m_metadata_deltas.isEmpty()) {
+				m_DIRTY = true;
+				Q_EMIT dirtyChanged();
+				return;
+			}
+		}
+		evaluate_can_undo_changed();
+	}
+
+	// Sets each of the columns from the placeholder named after it.
+	static QString assignments(quint64 columns) {
+		QStringList ret;
+		if (columns & (quint64(1) << 0)) {
+			ret << QStringLiteral("title = :title");
+		}
+		return ret.join(", ");
+	}
+
+	static QString updateStatement(quint64 columns) {
+		static QHash<quint64,QString> s_statements;
+		static QMutex s_mutex;
+
+		QMutexLocker locker(&s_mutex);
+		auto statement = s_statements.value(columns);
+		if (statement.isNull()) {
+			statement = QStringLiteral("UPDATE Note SET %1 WHERE ID = :ID").arg(assignments(columns));
+			s_statements.insert(columns, statement);
+		}
+		return statement;
+	}
+
+	static QString insertStatement(int rows) {
+		static QHash<int,QString> s_statements;
+		static QMutex s_mutex;
+
+		QMutexLocker locker(&s_mutex);
+		auto statement = s_statements.value(rows);
+		if (statement.isNull()) {
+			QStringList values;
+			for (int i = 0; i < rows; i++) {
+				values << QStringLiteral("(?, ?)");
+			}
+			statement = QStringLiteral("INSERT INTO Note (ID, title) VALUES %1").arg(values.join(", "));
+			s_statements.insert(rows, statement);
+		}
+		return statement;
+	}
+
+	// Turns the pending changes into writes and marks them as saved.
+	// restorePending() undoes this if a write fails, publishSave() records
+	// the undo step once it's committed. With PPUndoRedoStack's journal on,
+	// the step is written with the changes and step is its number.
+	QVector<PPWrite> takePendingWrites(Change* changes, qint64* step) {
+		QVector<PPWrite> writes;
+		if (m_DELETED) {
+			return writes;
+		}
+		if (m_NEW || m_DELETE_PENDING) {
+			load_columns(AllColumns);
+			PPWrite write;
+			write.statement = QStringLiteral(R"RJIENRLWEY(
+INSERT INTO Note
+(ID,title)
+VALUES
+(:ID, :title);
+			)RJIENRLWEY");
+			write.bind(":ID", PPKey::encode(m_ID));
+			write.bind(":title", PPColumn<decltype(m_title)>::bind(m_title));
+			m_title_dirty = false;
+			writes << write;
+			load_metadata();
+			PPMapTable<QMap<QString,QString>>::replace(&writes, QStringLiteral("Note_metadata"), m_ID, m_metadata);
+			m_metadata_prev = m_metadata;
+			m_metadata_dirty = false;
+			m_metadata_deltas.clear();
+			m_NEW = false;
+			if (m_DELETE_PENDING) {
+				m_DELETE_PENDING = false;
+				pendingDeleteChanged();
+			}
+			evaluate_dirty_changed();
+			return writes;
+		}
+
+		PPDelta::Writer previous;
+		quint64 columns = 0;
+		if (m_title_dirty) {
+			previous.value(0, m_title_prev);
+			columns |= quint64(1) << 0;
+		}
+		if (m_metadata_dirty) {
+			previous.value(1, m_metadata_prev);
+		}
+		if (!m_metadata_dirty && !m_metadata_deltas.isEmpty()) {
+			previous.edits(1, m_metadata_deltas);
+		}
+		*changes = previous.finish();
+		if (columns != 0) {
+			PPWrite write;
+			write.statement = updateStatement(columns);
+			write.bind(":ID", PPKey::encode(m_ID));
+			if (columns & (quint64(1) << 0)) {
+				write.bind(":title", PPColumn<decltype(m_title)>::bind(m_title));
+				m_title_dirty = false;
+			}
+			writes << write;
+		}
+		
+		if (m_metadata_dirty) {
+			PPMapTable<QMap<QString,QString>>::replace(&writes, QStringLiteral("Note_metadata"), m_ID, m_metadata);
+			m_metadata_dirty = false;
+		} else {
+			for (const auto& delta : m_metadata_deltas) {
+				PPMapTable<QMap<QString,QString>>::write(&writes, QStringLiteral("Note_metadata"), m_ID, delta);
+			}
+		}
+		m_metadata_prev = m_metadata;
+		m_metadata_deltas.clear();
+		if (!changes->isEmpty()) {
+			*step = pUR->journal(&writes, QStringLiteral("Note"), m_ID, *changes);
+		}
+		return writes;
+	}
+
+	void restorePending(bool wasNew, const Change& changes) {
+		if (wasNew) {
+			m_NEW = true;
+			return;
+		}
+		PPDelta::Reader reader(changes);
+		if (changes.hasValue(0)) {
+			m_title_prev = reader.value<decltype(m_title)>();
+			m_title_dirty = true;
+		}
+		if (changes.hasValue(1)) {
+			m_metadata_prev = reader.value<decltype(m_metadata)>();
+			m_metadata_dirty = true;
+		}
+		if (changes.hasEdits(1)) {
+			m_metadata_deltas = reader.edits<PPMapTable<QMap<QString,QString>>::Delta>() + m_metadata_deltas;
+		}
+		evaluate_dirty_changed();
+	}
+
+	void publishRow(bool wasNew, const Change& changes) {
+		PPRowChange change;
+		change.kind = wasNew ? PPRowChange::Inserted : PPRowChange::Updated;
+		change.table = QStringLiteral("Note");
+		change.ID = m_ID;
+		change.properties = changes.properties();
+		pDB->publishRowChange(change);
+	}
+
+	void publishSave(bool wasNew, const Change& changes, qint64 step) {
+		if (wasNew) {
+			return;
 		}
+		m_UNDO_STACK << changes;
+		pUR->undoItemAdded(this, changes.bytes(), step);
 		evaluate_can_undo_changed();
 	}
 
@@ -185,45 +645,48 @@ public:
 	bool canUndo() const { return m_CAN_UNDO; }
 	bool canRedo() const { return m_CAN_REDO; }
 
+	~Note() override {
+		pUR->itemDestroyed(this);
+	}
+
 	Q_INVOKABLE void undo() override {
 		if (!m_UNDO_STACK.empty()) {
-			pUR->undoItemRemoved(this);
-			auto last = m_UNDO_STACK.takeLast();
-			
-			if (last.previoustitleValue.has_value()) {
-				last.previoustitleValue.swap(m_title);
-			}
-			
-			if (last.previousmetadataValue.has_value()) {
-				last.previousmetadataValue.swap(m_metadata);
-			}
-			
-			m_REDO_STACK << last;
-			pUR->redoItemAdded(this);
-			evaluate_can_undo_changed();
-			evaluate_can_redo_changed();
+			moveStep(m_UNDO_STACK, m_REDO_STACK, false);
 		}
 	}
 
 	Q_INVOKABLE void redo() override {
 		if (!m_REDO_STACK.empty()) {
-			pUR->redoItemRemoved(this);
-			auto last = m_REDO_STACK.takeLast();
-			
-			if (last.previoustitleValue.has_value()) {
-				last.previoustitleValue.swap(m_title);
-			}
-			
-			if (last.previousmetadataValue.has_value()) {
-				last.previousmetadataValue.swap(m_metadata);
-			}
-			
-			m_UNDO_STACK << last;
+			moveStep(m_REDO_STACK, m_UNDO_STACK, true);
+		}
+	}
+
+	// PPUndoRedoStack drops the oldest steps first, which are at the front.
+	void undoStepDropped() override {
+		if (!m_UNDO_STACK.empty()) {
+			m_UNDO_STACK.removeFirst();
 			evaluate_can_undo_changed();
+		}
+	}
+
+	void redoStepDropped() override {
+		if (!m_REDO_STACK.empty()) {
+			m_REDO_STACK.removeFirst();
 			evaluate_can_redo_changed();
 		}
 	}
 
+	// Steps read back from the journal are older than any the object holds.
+	void undoStepLoaded(const PPDelta& delta) override {
+		m_UNDO_STACK.prepend(delta);
+		evaluate_can_undo_changed();
+	}
+
+	void redoStepLoaded(const PPDelta& delta) override {
+		m_REDO_STACK.prepend(delta);
+		evaluate_can_redo_changed();
+	}
+
 	Q_INVOKABLE void stageDelete() {
 		if (!m_DELETE_PENDING) {
 			m_DELETE_PENDING = true;
@@ -235,12 +698,15 @@ public:
 	
 	
 	Q_SIGNAL void titleChanged();
-	QString title() const { return m_title; };
+	QString title() const { load_columns(quint64(1) << 0); return m_title; };
 	void set_title(const QString& val) {
+		load_columns(quint64(1) << 0);
 		if (val == m_title) {
 			return;
 		}
-		m_title_prev = m_title;
+		if (!m_title_dirty) {
+			m_title_prev = m_title;
+		}
 		m_title_dirty = true;
 		m_title = val;
 		Q_EMIT void titleChanged();
@@ -260,12 +726,15 @@ public:
 	
 	
 	Q_SIGNAL void metadataChanged();
-	QMap<QString,QString> metadata() const { return m_metadata; };
+	QMap<QString,QString> metadata() const { load_metadata(); return m_metadata; };
 	void set_metadata(const QMap<QString,QString>& val) {
+		load_metadata();
 		if (val == m_metadata) {
 			return;
 		}
-		m_metadata_prev = m_metadata;
+		if (!m_metadata_dirty) {
+			m_metadata_prev = saved_metadata();
+		}
 		m_metadata_dirty = true;
 		m_metadata = val;
 		Q_EMIT void metadataChanged();
@@ -274,14 +743,46 @@ public:
 		evaluate_can_undo_changed();
 	}
 	void discard_metadata_changes() {
-		if (m_metadata_dirty) {
+		if (m_metadata_dirty || !m_metadata_deltas.isEmpty()) {
 			m_metadata_dirty = false;
-			m_metadata = m_metadata_prev;
+			m_metadata_deltas.clear();
+			m_metadata_loaded = false;
 			Q_EMIT void metadataChanged();
 			evaluate_dirty_changed();
 		}
 	}
 	
+	
+	
+	
+	bool insert_metadata(const QString& key, const QString& value) {
+		load_metadata();
+		auto delta = PPMapTable<QMap<QString,QString>>::insert(m_metadata, key, value);
+		if (delta.isNoop()) {
+			return false;
+		}
+		push_metadata_delta(delta);
+		return true;
+	}
+	bool remove_metadata(const QString& key) {
+		load_metadata();
+		if (!m_metadata.contains(key)) {
+			return false;
+		}
+		push_metadata_delta(PPMapTable<QMap<QString,QString>>::remove(m_metadata, key));
+		return true;
+	}
+	static Predicate* metadata_has(const QString& key) {
+		return new PPEntryPredicate(QStringLiteral("Note"), QStringLiteral("metadata"), QVector<QPair<QString,QVariant>>{
+			qMakePair(QStringLiteral("KEY"), PPColumn<QString>::bind(key)),
+		});
+	}
+	static Predicate* metadata_has(const QString& key, const QString& value) {
+		return new PPEntryPredicate(QStringLiteral("Note"), QStringLiteral("metadata"), QVector<QPair<QString,QVariant>>{
+			qMakePair(QStringLiteral("KEY"), PPColumn<QString>::bind(key)),
+			qMakePair(QStringLiteral("VALUE"), PPColumn<QString>::bind(value)),
+		});
+	}
 
 	void discard_all_changes() {
 		
@@ -291,169 +792,701 @@ public:
 			Q_EMIT void titleChanged();
 		}
 		
-		if (m_metadata_dirty) {
+		if (m_metadata_dirty || !m_metadata_deltas.isEmpty()) {
 			m_metadata_dirty = false;
-			m_metadata = m_metadata_prev;
+			m_metadata_deltas.clear();
+			m_metadata_loaded = false;
 			Q_EMIT void metadataChanged();
 		}
-		
 		evaluate_dirty_changed();
 	}
 
-	Q_INVOKABLE void save() {
-		if (m_NEW || m_DELETE_PENDING) {
-			auto tq = QStringLiteral(R"RJIENRLWEY(
-INSERT INTO Note
-(ID,title,metadata)
-VALUES
-(:ID,   :title  , :metadata );
-			)RJIENRLWEY");
-			QSqlQuery query(PPDatabase::instance()->connection());
-			query.prepare(tq);
-			query.bindValue(":ID", QVariant::fromValue(m_ID));
-			query.bindValue(":title", QVariant::fromValue(m_title));
-			
-			query.bindValue(":metadata", QVariant::fromValue(m_metadata));
-			auto res = query.exec();
-			if (!res) {
-				qCritical() << query.lastError() << "when creating a new item of Note";
+	Q_INVOKABLE bool save() {
+		PPTransaction transaction;
+		if (!transaction.isOpen()) {
+			return false;
+		}
+		QPointer<Note> self(this);
+		auto wasNew = m_NEW || m_DELETE_PENDING;
+		Change changes;
+		qint64 step = 0;
+		auto writes = takePendingWrites(&changes, &step);
+		if (writes.isEmpty()) {
+			return transaction.commit();
+		}
+		for (const auto& write : writes) {
+			if (!write.exec()) {
+				qCritical() << "when saving an item of type Note";
+				restorePending(wasNew, changes);
+				return false;
 			}
-			m_NEW = false;
-			if (m_DELETE_PENDING) {
-				m_DELETE_PENDING = false;
-				pendingDeleteChanged();
+		}
+		publishRow(wasNew, changes);
+		pDB->onCommit([self, wasNew, changes, step] {
+			if (self) {
+				self->publishSave(wasNew, changes, step);
 			}
-		} else {
+		});
+		pDB->onRollback([self, wasNew, changes] {
+			if (self) {
+				self->restorePending(wasNew, changes);
+			}
+		});
+		return transaction.commit();
+	}
+
+	// Like save(), but the write runs on PPDatabase's persistence thread. The
+	// future finishes on the calling thread, which needs a running event loop.
+	QFuture<bool> saveAsync() {
+		QPointer<Note> self(this);
+		auto wasNew = m_NEW || m_DELETE_PENDING;
 		Change changes;
-		
-		if (m_title_dirty) {
-			changes.previoustitleValue.copy(m_title_prev);
-			QSqlQuery query(PPDatabase::instance()->connection());
-			auto tq = QStringLiteral(R"RJIENRLWEY( UPDATE Note SET title = :val WHERE ID = :id )RJIENRLWEY");
-			query.prepare(tq);
-			query.bindValue(":val", QVariant::fromValue(m_title));
-			query.bindValue(":id", QVariant::fromValue(m_ID));
-			auto res = query.exec();
-			if (!res) {
-				qCritical() << query.lastError() << "when updating an item of type Note at row title";
+		qint64 step = 0;
+		auto writes = takePendingWrites(&changes, &step);
+		auto hasWrite = !writes.isEmpty();
+		return pDB->runAsync<bool, bool>([writes, hasWrite] {
+			if (!hasWrite) {
+				return true;
 			}
-			m_title_dirty = false;
-		}
-		
-		if (m_metadata_dirty) {
-			changes.previousmetadataValue.copy(m_metadata_prev);
-			QSqlQuery query(PPDatabase::instance()->connection());
-			auto tq = QStringLiteral(R"RJIENRLWEY( UPDATE Note SET metadata = :val WHERE ID = :id )RJIENRLWEY");
-			query.prepare(tq);
-			query.bindValue(":val", QVariant::fromValue(m_metadata));
-			query.bindValue(":id", QVariant::fromValue(m_ID));
-			auto res = query.exec();
-			if (!res) {
-				qCritical() << query.lastError() << "when updating an item of type Note at row metadata";
+			PPTransaction transaction;
+			if (!transaction.isOpen()) {
+				return false;
 			}
-			m_metadata_dirty = false;
-		}
-		
-		m_UNDO_STACK << changes;
-		pUR->undoItemAdded(this);
-		evaluate_can_undo_changed();
-		}
+			for (const auto& write : writes) {
+				if (!write.exec()) {
+					qCritical() << "when saving an item of type Note";
+					return false;
+				}
+			}
+			return transaction.commit();
+		}, [self, wasNew, changes, step, hasWrite](const bool& ok) {
+			if (self) {
+				if (!ok) {
+					self->restorePending(wasNew, changes);
+				} else if (hasWrite) {
+					self->publishRow(wasNew, changes);
+					self->publishSave(wasNew, changes, step);
+				}
+			}
+			return ok;
+		});
 	}
 
 	
 	Q_INVOKABLE QList<QSharedPointer<Note>> childNotes() {
-		auto tq = QStringLiteral("SELECT * FROM Note WHERE PARENT_Note_ID = :parent_id");
-		QSqlQuery query(PPDatabase::instance()->connection());
-		query.prepare(tq);
-		query.bindValue(":parent_id", m_ID);
-		auto ok = query.exec();
+		auto tq = QStringLiteral("SELECT %1 FROM Note WHERE PARENT_Note_ID = :parent_id").arg(Note::selectColumns());
+		PPStatement query(tq);
+		query->bindValue(":parent_id", PPKey::encode(m_ID));
+		auto ok = query->exec();
 		if (!ok) {
-			qCritical() << query.lastError() << "when loading an Note children of a Note";
+			qCritical() << query->lastError() << "when loading an Note children of a Note";
 		}
 		QList<QSharedPointer<Note>> ret;
-		
-		while (query.next()) {
-			auto add = Note::withID(query.value("ID").value<QUuid>());
-		
-			add->setProperty("title", query.value("title"));
-		
-			add->setProperty("metadata", query.value("metadata"));
-		
-			ret << add;
+		while (query->next()) {
+			ret << Note::hydrated(*query);
 		}
 		return ret;
 	}
-	Q_INVOKABLE void addChildNote(QSharedPointer<Note> child) {
-		auto tq = QStringLiteral("UPDATE Note SET PARENT_Note_ID = :new_parent_id WHERE ID = :child_id ");
-		QSqlQuery query(PPDatabase::instance()->connection());
-		query.prepare(tq);
-		query.bindValue(":new_parent_id", m_ID);
-		query.bindValue(":child_id", child->m_ID);
-		auto ok = query.exec();
+	PPCursor<Note> streamChildNotes() {
+		PPCursor<Note> ret(QStringLiteral("SELECT %1 FROM Note WHERE PARENT_Note_ID = :parent_id").arg(Note::selectColumns()));
+		ret.query()->bindValue(":parent_id", PPKey::encode(m_ID));
+		ret.exec();
+		return ret;
+	}
+	Q_INVOKABLE bool addChildNote(QSharedPointer<Note> child) {
+		PPTransaction transaction;
+		if (!transaction.isOpen()) {
+			return false;
+		}
+		auto tq = QStringLiteral("UPDATE Note SET PARENT_Note_ID = :new_parent_id WHERE ID = :child_id ");
+		PPStatement query(tq);
+		query->bindValue(":new_parent_id", PPKey::encode(m_ID));
+		query->bindValue(":child_id", PPKey::encode(child->m_ID));
+		auto ok = query->exec();
 		if (!ok) {
-			qCritical() << query.lastError() << "when adding a new Note to a parent Note";
+			qCritical() << query->lastError() << "when adding a new Note to a parent Note";
+			return false;
 		}
+		QPointer<Note> rollbackChild(child.data());
+		pDB->onRollback([rollbackChild, previous = child->m_parent_Note_ID] {
+			if (rollbackChild) {
+				rollbackChild->m_parent_Note_ID = previous;
+			}
+		});
+		Note::publishReparented(child->m_ID, QStringLiteral("PARENT_Note_ID"), child->m_parent_Note_ID, m_ID);
 		child->m_parent_Note_ID = m_ID;
+		return transaction.commit();
 	}
-	Q_INVOKABLE void removeChildNote(QSharedPointer<Note> child) {
+	Q_INVOKABLE bool removeChildNote(QSharedPointer<Note> child) {
+		PPTransaction transaction;
+		if (!transaction.isOpen()) {
+			return false;
+		}
 		auto tq = QStringLiteral("UPDATE Note SET PARENT_Note_ID = NULL WHERE ID = :child_id ");
-		QSqlQuery query(PPDatabase::instance()->connection());
-		query.prepare(tq);
-		query.bindValue(":child_id", child->m_ID);
-		auto ok = query.exec();
+		PPStatement query(tq);
+		query->bindValue(":child_id", PPKey::encode(child->m_ID));
+		auto ok = query->exec();
 		if (!ok) {
-			qCritical() << query.lastError() << "when removing a Note from a parent Note";
+			qCritical() << query->lastError() << "when removing a Note from a parent Note";
+			return false;
 		}
+		QPointer<Note> rollbackChild(child.data());
+		pDB->onRollback([rollbackChild, previous = child->m_parent_Note_ID] {
+			if (rollbackChild) {
+				rollbackChild->m_parent_Note_ID = previous;
+			}
+		});
+		Note::publishReparented(child->m_ID, QStringLiteral("PARENT_Note_ID"), child->m_parent_Note_ID, QUuid());
 		child->m_parent_Note_ID = QUuid();
+		return transaction.commit();
 	}
 	
 
 	static QSharedPointer<Note> newNote() {
 		auto ret = Note::withID(QUuid::createUuid());
 		ret->m_NEW = true;
+		ret->m_LOADED = AllColumns;
+		ret->m_metadata_loaded = true;
 		return ret;
 	}
 
 	static QSharedPointer<Note> load(const QUuid& ID) {
-		auto tq = QStringLiteral("SELECT * FROM Note WHERE ID = :id");
-		QSqlQuery query(PPDatabase::instance()->connection());
-		query.prepare(tq);
-		query.bindValue(":id", ID);
-		auto ok = query.exec();
+		auto tq = QStringLiteral("SELECT %1 FROM Note WHERE ID = :id").arg(selectColumns());
+		PPStatement query(tq);
+		query->bindValue(":id", PPKey::encode(ID));
+		auto ok = query->exec();
 		if (!ok) {
-			qCritical() << query.lastError() << "when loading an item of type Note";
+			qCritical() << query->lastError() << "when loading an item of type Note";
 		}
 		auto ret = Note::withID(ID);
-		while (query.next()) {
-			ret->setProperty("title", query.value("title"));
-			ret->setProperty("metadata", query.value("metadata"));
-			
+		while (query->next()) {
+			ret->hydrate(*query, EagerColumns);
 		}
 		return ret;
 	}
 
 	static QList<QSharedPointer<Note>> where(PredicateList predicates) {
-		auto tq = QStringLiteral("SELECT * FROM Note WHERE %1").arg(predicates.allPredicatesToWhere().join(","));
-		QSqlQuery query(PPDatabase::instance()->connection());
-		query.prepare(tq);
-		predicates.bindAllPredicates(&query);
-		auto ok = query.exec();
-		if (!ok) {
-			qCritical() << query.lastError() << "when running a where query on items of type Note";
+		return where(std::move(predicates), EagerColumns);
+	}
+
+	// Like where(), but only reads the given properties. The others are read the first
+	// time they're used, or for many objects at once with fetch().
+	static QList<QSharedPointer<Note>> where(PredicateList predicates, const QStringList& properties) {
+		return where(std::move(predicates), columnsNamed(properties));
+	}
+
+	// Aggregates over the rows matching all of the predicates, computed by
+	// SQLite without reading the rows.
+	static qint64 count(PredicateList predicates = PredicateList()) {
+		return PPAggregate::value(QStringLiteral("Note"), QStringLiteral("COUNT(*)"), predicates).toLongLong();
+	}
+	static bool exists(PredicateList predicates = PredicateList()) {
+		return PPAggregate::exists(QStringLiteral("Note"), predicates);
+	}
+
+	// Like where(), but hands the rows out one at a time as they're read.
+	static PPCursor<Note> streamWhere(PredicateList predicates) {
+		PPCursor<Note> ret(QStringLiteral("SELECT %1 FROM Note%2").arg(selectColumns(), predicates.whereClause()));
+		predicates.bindAllPredicates(ret.query());
+		ret.exec();
+		return ret;
+	}
+
+	// The values of a row for importRows() and insertMany(). Collections stored
+	// in side tables start out empty.
+	struct Record {
+		QString title{};
+	};
+
+	// Writes records as new rows in one transaction, a few hundred rows per
+	// INSERT, without creating any objects. IDs receives the IDs of the rows.
+	template<class Records>
+	static bool importRows(const Records& records, QVector<QUuid>* IDs = nullptr) {
+		return importRecords(records, IDs, nullptr);
+	}
+
+	// Like importRows(), but also hands back an object for each row.
+	template<class Records>
+	static QList<QSharedPointer<Note>> insertMany(const Records& records) {
+		QVector<QUuid> IDs;
+		QVector<Record> written;
+		if (!importRecords(records, &IDs, &written)) {
+			return {};
 		}
 		QList<QSharedPointer<Note>> ret;
-		while (query.next()) {
-			auto add = Note::withID(query.value("ID").value<QUuid>());
-			
-			add->setProperty("title", query.value("title"));
-			
-			add->setProperty("metadata", query.value("metadata"));
-			
-			ret << add;
+		ret.reserve(IDs.size());
+		for (int i = 0; i < IDs.size(); i++) {
+			auto object = withID(IDs[i]);
+			object->m_title = written[i].title;
+			object->m_LOADED = AllColumns;
+			ret << object;
 		}
 		return ret;
 	}
 
+	// Reads records in a single pass, so any range will do, and keeps a copy
+	// of each in written when given.
+	template<class Records>
+	static bool importRecords(const Records& records, QVector<QUuid>* IDs, QVector<Record>* written) {
+		// SQLite allows 999 bound values per statement unless built otherwise.
+		static const int batch_size = qMax(1, 999 / 2);
+
+		PPTransaction transaction;
+		if (!transaction.isOpen()) {
+			return false;
+		}
+		// Rows are held as their bound values rather than pointers into records,
+		// whose iterators may hand out temporaries.
+		QVector<QVariant> batch;
+		batch.reserve(batch_size * 2);
+		int rows = 0;
+		auto any = false;
+		auto flush = [&batch, &rows] {
+			PPStatement query(insertStatement(rows));
+			for (int position = 0; position < batch.size(); position++) {
+				query->bindValue(position, batch.at(position));
+			}
+			batch.clear();
+			rows = 0;
+			if (!query->exec()) {
+				qCritical() << query->lastError() << "when importing items of type Note";
+				return false;
+			}
+			return true;
+		};
+		for (const Record& record : records) {
+			auto ID = QUuid::createUuid();
+			batch << PPKey::encode(ID);
+			batch << PPColumn<decltype(m_title)>::bind(record.title);
+			if (IDs != nullptr) {
+				*IDs << ID;
+			}
+			if (written != nullptr) {
+				*written << record;
+			}
+			any = true;
+			if (++rows == batch_size && !flush()) {
+				return false;
+			}
+		}
+		if (rows > 0 && !flush()) {
+			return false;
+		}
+		if (!any) {
+			return transaction.commit();
+		}
+
+		PPRowChange change;
+		change.kind = PPRowChange::Reset;
+		change.table = QStringLiteral("Note");
+		pDB->publishRowChange(change);
+		return transaction.commit();
+	}
+
+	// New values for some of the properties stored in the table, for updateWhere().
+	class Patch
+	{
+		friend class Note;
+
+		quint64 m_columns = 0;
+		QVector<QVariant> m_values = QVector<QVariant>(1);
+
+		void bindTo(QSqlQuery* query) const {
+			if (m_columns & (quint64(1) << 0)) {
+				query->bindValue(":title", m_values[0]);
+			}
+			Q_UNUSED(query)
+		}
+		// The values in the order hydrate() reads them, after the ID's place.
+		PPValueRow row() const {
+			PPValueRow ret;
+			ret.values << QVariant();
+			for (int i = 0; i < m_values.size(); i++) {
+				if (m_columns & (quint64(1) << i)) {
+					ret.values << m_values[i];
+				}
+			}
+			return ret;
+		}
+
+	public:
+		Patch& set_title(const QString& value) {
+			m_values[0] = PPColumn<QString>::bind(value);
+			m_columns |= quint64(1) << 0;
+			return *this;
+		}
+	};
+
+	// The properties, as bits in declaration order, of the given columns.
+	static quint64 propertiesOf(quint64 columns) {
+		quint64 ret = 0;
+		if (columns & (quint64(1) << 0)) {
+			ret |= quint64(1) << 0;
+		}
+		return ret;
+	}
+
+	static void publishChanges(PPRowChange::Kind kind, const QVector<QUuid>& IDs, quint64 properties) {
+		PPRowChange change;
+		change.table = QStringLiteral("Note");
+		if (IDs.size() > PPRowChange::ResetThreshold) {
+			change.kind = PPRowChange::Reset;
+			pDB->publishRowChange(change);
+			return;
+		}
+		change.kind = kind;
+		change.properties = properties;
+		for (const auto& ID : IDs) {
+			change.ID = ID;
+			pDB->publishRowChange(change);
+		}
+	}
+
+	// Gives the live objects among IDs the patch's values, unless they have unsaved
+	// edits to them, and publishes the change.
+	static void applyPatch(const QVector<QUuid>& IDs, const Patch& patch) {
+		auto row = patch.row();
+		auto& map = PPIdentityMap<Note>::instance();
+		for (const auto& ID : IDs) {
+			if (auto object = map.value(ID)) {
+				object->hydrate(row, patch.m_columns);
+			}
+		}
+		publishChanges(PPRowChange::Updated, IDs, propertiesOf(patch.m_columns));
+	}
+
+	// Writes the patch to each of the rows in IDs, for redoing updateWhere().
+	static void writePatch(const QVector<QUuid>& IDs, const Patch& patch) {
+		PPTransaction transaction;
+		if (!transaction.isOpen()) {
+			return;
+		}
+		PPStatement query(updateStatement(patch.m_columns));
+		for (const auto& ID : IDs) {
+			patch.bindTo(query.data());
+			query->bindValue(":ID", PPKey::encode(ID));
+			if (!query->exec()) {
+				qCritical() << query->lastError() << "when redoing an update of items of type Note";
+				return;
+			}
+		}
+		pDB->onCommit([IDs, patch] { applyPatch(IDs, patch); });
+		transaction.commit();
+	}
+
+	// Writes back the values rows had before updateWhere(), read in the order of
+	// selectColumns(columns).
+	static void restoreRows(const QList<QSqlRecord>& rows, quint64 columns) {
+		PPTransaction transaction;
+		if (!transaction.isOpen()) {
+			return;
+		}
+		PPStatement query(updateStatement(columns));
+		QVector<QUuid> IDs;
+		for (const auto& row : rows) {
+			int column = 1;
+			if (columns & (quint64(1) << 0)) {
+				query->bindValue(":title", row.value(column++));
+			}
+			query->bindValue(":ID", row.value(0));
+			if (!query->exec()) {
+				qCritical() << query->lastError() << "when undoing an update of items of type Note";
+				return;
+			}
+			IDs << PPKey::decode(row.value(0));
+			Q_UNUSED(column)
+		}
+		pDB->onCommit([rows, columns, IDs] {
+			auto& map = PPIdentityMap<Note>::instance();
+			for (const auto& row : rows) {
+				if (auto object = map.value(PPKey::decode(row.value(0)))) {
+					object->hydrate(row, columns);
+				}
+			}
+			publishChanges(PPRowChange::Updated, IDs, propertiesOf(columns));
+		});
+		transaction.commit();
+	}
+
+	// Sets the patch's properties on every row matching all of the predicates, or
+	// every row if there are none, with one UPDATE. Live objects among them take the
+	// new values, except for properties with unsaved edits. With undoable, the whole
+	// update is a single step on PPUndoRedoStack, which writes the old values back.
+	static bool updateWhere(PredicateList predicates, const Patch& patch, bool undoable = false) {
+		auto columns = patch.m_columns;
+		if (columns == 0) {
+			return true;
+		}
+		PPTransaction transaction;
+		if (!transaction.isOpen()) {
+			return false;
+		}
+		auto where = predicates.whereClause();
+		// The rows' IDs, and for undo their values, before they change.
+		PPStatement select(QStringLiteral("SELECT %1 FROM Note%2").arg(undoable ? selectColumns(columns) : QStringLiteral("ID"), where));
+		predicates.bindAllPredicates(select.data());
+		if (!select->exec()) {
+			qCritical() << select->lastError() << "when finding items of type Note to update";
+			return false;
+		}
+		auto rows = PPDatabase::records(select.data());
+		if (rows.isEmpty()) {
+			return transaction.commit();
+		}
+		PPStatement update(QStringLiteral("UPDATE Note SET %1%2").arg(assignments(columns), where));
+		predicates.bindAllPredicates(update.data());
+		patch.bindTo(update.data());
+		if (!update->exec()) {
+			qCritical() << update->lastError() << "when updating items of type Note";
+			return false;
+		}
+		QVector<QUuid> IDs;
+		IDs.reserve(rows.size());
+		for (const auto& row : rows) {
+			IDs << PPKey::decode(row.value(0));
+		}
+		pDB->onCommit([IDs, patch] { applyPatch(IDs, patch); });
+		if (undoable) {
+			PPUndoStep::record([rows, columns] { restoreRows(rows, columns); }, [IDs, patch] { writePatch(IDs, patch); }, PPUndoStep::bytesOf(rows));
+		}
+		return transaction.commit();
+	}
+
+	// Live objects whose rows were deleted stop saving, until an undo writes
+	// the rows back.
+	static void markDeleted(const QVector<QUuid>& IDs, bool deleted) {
+		auto& map = PPIdentityMap<Note>::instance();
+		for (const auto& ID : IDs) {
+			if (auto object = map.value(ID)) {
+				object->m_DELETED = deleted;
+			}
+		}
+	}
+
+	// Deletes the rows in IDs again, for redoing deleteWhere().
+	static void deleteRows(const QVector<QUuid>& IDs) {
+		PPTransaction transaction;
+		if (!transaction.isOpen()) {
+			return;
+		}
+		PPStatement query(QStringLiteral("DELETE FROM Note WHERE ID = :ID"));
+		for (const auto& ID : IDs) {
+			query->bindValue(":ID", PPKey::encode(ID));
+			auto ok = query->exec();
+			ok = ok && PPSideTable::clear(QStringLiteral("Note_metadata"), ID).exec();
+			if (!ok) {
+				qCritical() << query->lastError() << "when redoing a deletion of items of type Note";
+				return;
+			}
+		}
+		pDB->onCommit([IDs] { markDeleted(IDs, true); });
+		publishChanges(PPRowChange::Reset, {}, 0);
+		transaction.commit();
+	}
+
+	// Deletes every row matching all of the predicates, or every row if there are
+	// none, with one DELETE per table. With undoable, the whole deletion is a single
+	// step on PPUndoRedoStack, which writes the rows back.
+	static bool deleteWhere(PredicateList predicates, bool undoable = false) {
+		PPTransaction transaction;
+		if (!transaction.isOpen()) {
+			return false;
+		}
+		auto where = predicates.whereClause();
+		// For undo, the rows are read whole, with the rowid SELECT * leaves out.
+		PPStatement select(QStringLiteral("SELECT %1 FROM Note%2").arg(undoable ? QStringLiteral("rowid AS rowid, *") : QStringLiteral("ID, PARENT_Note_ID"), where));
+		predicates.bindAllPredicates(select.data());
+		if (!select->exec()) {
+			qCritical() << select->lastError() << "when finding items of type Note to delete";
+			return false;
+		}
+		auto rows = PPDatabase::records(select.data());
+		if (rows.isEmpty()) {
+			return transaction.commit();
+		}
+		QHash<QUuid,qint64> rowids;
+		// Models find where the rows were by their rowids.
+		if (rows.size() <= PPRowChange::ResetThreshold) {
+			PPStatement query(QStringLiteral("SELECT ID, rowid FROM Note%1").arg(where));
+			predicates.bindAllPredicates(query.data());
+			if (query->exec()) {
+				while (query->next()) {
+					rowids.insert(PPKey::decode(query->value(0)), query->value(1).toLongLong());
+				}
+			}
+		}
+		// Side table rows are read for undo and deleted by their owner's ID.
+		QList<QPair<QString,QList<QSqlRecord>>> entries;
+		{
+			auto owners = QStringLiteral(" WHERE OWNER_ID IN (SELECT ID FROM Note%1)").arg(where);
+			if (undoable) {
+				PPStatement query(QStringLiteral("SELECT * FROM Note_metadata") + owners);
+				predicates.bindAllPredicates(query.data());
+				if (!query->exec()) {
+					qCritical() << query->lastError() << "when reading Note_metadata to delete";
+					return false;
+				}
+				entries << qMakePair(QStringLiteral("Note_metadata"), PPDatabase::records(query.data()));
+			}
+			PPStatement query(QStringLiteral("DELETE FROM Note_metadata") + owners);
+			predicates.bindAllPredicates(query.data());
+			if (!query->exec()) {
+				qCritical() << query->lastError() << "when deleting from Note_metadata";
+				return false;
+			}
+		}
+		PPStatement query(QStringLiteral("DELETE FROM Note%1").arg(where));
+		predicates.bindAllPredicates(query.data());
+		if (!query->exec()) {
+			qCritical() << query->lastError() << "when deleting items of type Note";
+			return false;
+		}
+
+		QVector<QUuid> IDs;
+		IDs.reserve(rows.size());
+		for (const auto& row : rows) {
+			IDs << PPKey::decode(row.value(QStringLiteral("ID")));
+		}
+		pDB->onCommit([IDs] { markDeleted(IDs, true); });
+		if (IDs.size() > PPRowChange::ResetThreshold) {
+			publishChanges(PPRowChange::Reset, {}, 0);
+		} else {
+			for (const auto& row : rows) {
+				auto ID = PPKey::decode(row.value(QStringLiteral("ID")));
+				auto parent_Note = PPKey::decode(row.value(QStringLiteral("PARENT_Note_ID")));
+				if (!parent_Note.isNull()) {
+					publishReparented(ID, QStringLiteral("PARENT_Note_ID"), parent_Note, QUuid());
+				}
+				PPRowChange change;
+				change.kind = PPRowChange::Deleted;
+				change.table = QStringLiteral("Note");
+				change.ID = ID;
+				change.rowid = rowids.value(ID);
+				pDB->publishRowChange(change);
+			}
+		}
+		if (undoable) {
+			auto bytes = PPUndoStep::bytesOf(rows);
+			for (const auto& entry : entries) {
+				bytes += PPUndoStep::bytesOf(entry.second);
+			}
+			PPUndoStep::record([rows, entries, IDs] {
+				PPTransaction transaction;
+				if (!transaction.isOpen()) {
+					return;
+				}
+				// Rows go back under their old rowids, and so in their old place,
+				// unless a row inserted since has taken one.
+				QList<QSqlRecord> placed;
+				QList<QSqlRecord> moved;
+				PPStatement taken(QStringLiteral("SELECT 1 FROM Note WHERE rowid = :rowid"));
+				for (auto row : rows) {
+					taken->bindValue(":rowid", row.value(QStringLiteral("rowid")));
+					if (taken->exec() && taken->next()) {
+						row.remove(row.indexOf(QStringLiteral("rowid")));
+						moved << row;
+					} else {
+						placed << row;
+					}
+					taken->finish();
+				}
+				auto ok = PPDatabase::insertRecords(QStringLiteral("Note"), placed)
+					&& PPDatabase::insertRecords(QStringLiteral("Note"), moved);
+				for (const auto& entry : entries) {
+					ok = ok && PPDatabase::insertRecords(entry.first, entry.second);
+				}
+				if (ok) {
+					pDB->onCommit([IDs] { markDeleted(IDs, false); });
+					publishChanges(PPRowChange::Reset, {}, 0);
+					transaction.commit();
+				}
+			}, [IDs] { deleteRows(IDs); }, bytes);
+		}
+		return transaction.commit();
+	}
+
+	static void fetch(const QList<QSharedPointer<Note>>& objects, const QStringList& properties) {
+		fetchColumns(objects, columnsNamed(properties));
+	}
+
+	// A typed query over the properties stored in the table, like
+	// Note::query().title.equals(value).limit(10).all().
+	class Query : public PPQuery<Query>
+	{
+	public:
+		Query() = default;
+		// Fields point at the query that holds them, so copies only take the clauses.
+		Query(const Query& other) : PPQuery<Query>(other) {}
+		Query& operator=(const Query& other) {
+			PPQuery<Query>::operator=(other);
+			return *this;
+		}
+		PPField<Query, QString> title{this, 0};
+
+		PPCursor<Note> stream() const {
+			static const char* const columns[] = {"title", nullptr };
+			PPCursor<Note> ret(PPQueryBase::statement(QStringLiteral("Note"), Note::selectColumns(), columns));
+			PPQueryBase::bind(ret.query());
+			ret.exec();
+			return ret;
+		}
+
+		QList<QSharedPointer<Note>> all() const {
+			QList<QSharedPointer<Note>> ret;
+			for (const auto& row : stream()) {
+				ret << row;
+			}
+			return ret;
+		}
+
+		QSharedPointer<Note> first() const {
+			auto ret = Query(*this).limit(1).all();
+			return ret.isEmpty() ? QSharedPointer<Note>() : ret.first();
+		}
+	};
+
+	static Query query() {
+		return Query();
+	}
+
+	static QFuture<QSharedPointer<Note>> loadAsync(const QUuid& ID) {
+		return pDB->runAsync<QList<QSqlRecord>, QSharedPointer<Note>>([ID] {
+			PPStatement query(QStringLiteral("SELECT %1 FROM Note WHERE ID = :id").arg(selectColumns()));
+			query->bindValue(":id", PPKey::encode(ID));
+			auto ok = query->exec();
+			if (!ok) {
+				qCritical() << query->lastError() << "when loading an item of type Note";
+			}
+			return PPDatabase::records(query.data());
+		}, [ID](const QList<QSqlRecord>& records) {
+			auto ret = Note::withID(ID);
+			for (const auto& record : records) {
+				ret->hydrate(record, EagerColumns);
+			}
+			return ret;
+		});
+	}
+
+	static QFuture<QList<QSharedPointer<Note>>> whereAsync(PredicateList predicates) {
+		auto tq = QStringLiteral("SELECT %1 FROM Note%2").arg(selectColumns(), predicates.whereClause());
+		auto shared = QSharedPointer<PredicateList>::create(std::move(predicates));
+		return pDB->runAsync<QList<QSqlRecord>, QList<QSharedPointer<Note>>>([tq, shared] {
+			PPStatement query(tq);
+			shared->bindAllPredicates(query.data());
+			auto ok = query->exec();
+			if (!ok) {
+				qCritical() << query->lastError() << "when running a where query on items of type Note";
+			}
+			return PPDatabase::records(query.data());
+		}, [](const QList<QSqlRecord>& records) {
+			QList<QSharedPointer<Note>> ret;
+			for (const auto& record : records) {
+				ret << hydrated(record);
+			}
+			return ret;
+		});
+	}
+
 	static void prepareDatabase() {
 		volatile auto db = PPDatabase::instance();
 		Q_UNUSED(db)
@@ -465,7 +1498,6 @@ VALUES
 			PARENT_Note_ID BLOB,
 			
 			title TEXT NOT NULL,
-			metadata BLOB NOT NULL,
 			PRIMARY KEY (ID))
 		)RJIENRLWEY");
 		QSqlQuery query(PPDatabase::instance()->connection());
@@ -474,6 +1506,19 @@ VALUES
 		if (!ok) {
 			qCritical() << query.lastError();
 		}
+		for (const auto& index : QStringList{
+			PPSideTable::createStatement(QStringLiteral("Note_metadata"), QStringLiteral("TEXT"), QStringLiteral("TEXT")),
+			QStringLiteral("CREATE INDEX IF NOT EXISTS Note_PARENT_Note_ID ON Note(PARENT_Note_ID)"),
+			QStringLiteral("CREATE INDEX IF NOT EXISTS Note_title ON Note(title)"),
+		}) {
+			if (!query.exec(index)) {
+				qCritical() << query.lastError();
+			}
+		}
+		PPDatabase::instance()->migrateKeys(QStringLiteral("Note"), QStringList{
+			QStringLiteral("ID"),
+			QStringLiteral("PARENT_Note_ID"),
+		});
 	}
 
 };
@@ -481,44 +1526,273 @@ VALUES
 class NoteModel : public QAbstractListModel {
 	Q_OBJECT
 
-	mutable QSqlQuery m_query = QSqlQuery(PPDatabase::instance()->connection());
-	static const int fetch_size = 255;
-	int m_rowCount = 0;
-	int m_bottom = 0;
-	bool m_atEnd = false;
+	// Rows are read a page at a time in the order they were inserted, by rowid,
+	// or in ID order for WITHOUT ROWID tables, which have nothing else to go by.
+	// A page starts after the key that ends the page before it, so once that
+	// key is known reading it is an index seek, and only a window of recently
+	// used pages is kept hydrated. Finding the key of a page first reached by
+	// a jump skips the rows since the nearest known one inside SQLite, which
+	// only walks the key's index, so it still grows with the distance.
+	static const int page_size = 256;
+	static const int window_pages = 8;
+
+	static QString orderKey() {
+		return QStringLiteral("rowid");
+	}
+
+	QString m_parentColumn;
 	QUuid m_parentID;
-	mutable QMap<int,QSharedPointer<Note>> m_items;
+	int m_rowCount = 0;
+	// m_anchors[k] is the key of the last row of page k - 1. Page 0 has none.
+	// Pages reached by a jump leave gaps before them.
+	mutable QMap<int,QVariant> m_anchors;
+	mutable QCache<int,QVector<QSharedPointer<Note>>> m_pages;
 	QSharedPointer<Note> m_staging;
 	ModelTypes m_parentedKind;
 
 	Q_PROPERTY(Note* staging READ staging NOTIFY stagingItemChanged)
 
-	void prefetch(int toRow) {
-		if (m_atEnd || toRow <= m_bottom)
+	NoteModel(ModelTypes parentedKind, const QString& parentColumn, const QUuid& parentID) : QAbstractListModel(nullptr), m_parentColumn(parentColumn), m_parentID(parentID), m_pages(window_pages), m_parentedKind(parentedKind)
+	{
+		connect(pDB, &PPDatabase::rowChanged, this, &NoteModel::applyRowChange);
+		refresh();
+	}
+
+	QString select(const QString& columns, const QString& condition, const QString& tail) const {
+		QStringList conditions;
+		if (!m_parentColumn.isEmpty()) {
+			conditions << QStringLiteral("%1 = :parent_id").arg(m_parentColumn);
+		}
+		if (!condition.isEmpty()) {
+			conditions << condition;
+		}
+		auto ret = QStringLiteral("SELECT %1 FROM Note").arg(columns);
+		if (!conditions.isEmpty()) {
+			ret += QStringLiteral(" WHERE ") + conditions.join(QStringLiteral(" AND "));
+		}
+		return ret + tail;
+	}
+
+	void bindParent(QSqlQuery* query) const {
+		if (!m_parentColumn.isEmpty()) {
+			query->bindValue(":parent_id", PPKey::encode(m_parentID));
+		}
+	}
+
+	void refresh() {
+		beginResetModel();
+		m_anchors.clear();
+		m_anchors.insert(0, QVariant());
+		m_pages.clear();
+		PredicateList predicates;
+		if (!m_parentColumn.isEmpty()) {
+			predicates << new Equals(m_parentColumn, PPKey::encode(m_parentID));
+		}
+		m_rowCount = int(Note::count(std::move(predicates)));
+		endResetModel();
+	}
+
+	// Finds the anchor of page with one query that skips to it from the
+	// nearest known anchor before it. Each anchor is found once.
+	bool anchor(int page) const {
+		if (m_anchors.contains(page)) {
+			return true;
+		}
+		auto known = std::prev(m_anchors.lowerBound(page));
+		auto afterAnchor = known.key() > 0;
+		PPStatement query(select(orderKey(), afterAnchor ? orderKey() + QStringLiteral(" > :anchor") : QString(), QStringLiteral(" ORDER BY %1 LIMIT 1 OFFSET %2").arg(orderKey()).arg((page - known.key()) * page_size - 1)));
+		bindParent(query.data());
+		if (afterAnchor) {
+			query->bindValue(":anchor", known.value());
+		}
+		if (!query->exec()) {
+			qCritical() << query->lastError() << "when paging items of type Note";
+			return false;
+		}
+		if (!query->next()) {
+			return false;
+		}
+		m_anchors.insert(page, query->value(0));
+		return true;
+	}
+
+	QVector<QSharedPointer<Note>>* page(int index) const {
+		if (auto cached = m_pages.object(index)) {
+			return cached;
+		}
+		if (!anchor(index)) {
+			return nullptr;
+		}
+		// The key is read after the object's columns, so hydrating ignores it.
+		auto columns = Note::selectColumns();
+		columns += QStringLiteral(", rowid");
+		PPStatement query(select(columns, index > 0 ? orderKey() + QStringLiteral(" > :anchor") : QString(), QStringLiteral(" ORDER BY %1 LIMIT %2").arg(orderKey()).arg(page_size)));
+		bindParent(query.data());
+		if (index > 0) {
+			query->bindValue(":anchor", m_anchors.value(index));
+		}
+		if (!query->exec()) {
+			qCritical() << query->lastError() << "when paging items of type Note";
+			return nullptr;
+		}
+		auto rows = new QVector<QSharedPointer<Note>>;
+		rows->reserve(page_size);
+		QVariant last;
+		while (query->next()) {
+			last = query->value(query->record().count() - 1);
+			*rows << Note::hydrated(*query);
+		}
+		if (rows->size() == page_size && !m_anchors.contains(index + 1)) {
+			m_anchors.insert(index + 1, last);
+		}
+		m_pages.insert(index, rows);
+		return rows;
+	}
+
+	// Committed changes are applied to the rows they touch: inserts and removals
+	// shift the rows after them and drop the pages that moved, updates of rows
+	// that are paged in emit dataChanged() for the properties that changed.
+	void applyRowChange(const PPRowChange& change) {
+		if (change.table != QLatin1String("Note")) {
 			return;
+		}
+		switch (change.kind) {
+		case PPRowChange::Inserted:
+			if (m_parentColumn.isEmpty()) {
+				insertItem(change.ID);
+			}
+			break;
+		case PPRowChange::Deleted:
+			if (m_parentColumn.isEmpty()) {
+				removeItem(change.ID, true, change.rowid);
+			}
+			break;
+		case PPRowChange::Reparented:
+			if (!m_parentColumn.isEmpty() && change.parentColumn == m_parentColumn) {
+				if (change.previousParent == m_parentID) {
+					removeItem(change.ID, false, 0);
+				}
+				if (change.parent == m_parentID) {
+					insertItem(change.ID);
+				}
+			}
+			break;
+		case PPRowChange::Updated:
+			updateItem(change.ID, change.properties);
+			break;
+		case PPRowChange::Reset:
+			refresh();
+			break;
+		}
+	}
 
-		int oldBottom = m_bottom;
-		int newBottom = 0;
-		
-		if (m_query.seek(toRow)) {
-			newBottom = toRow;
+	// The row an ID has, or would have, in the model's order. Outside of
+	// WITHOUT ROWID tables that needs the row, or the rowid it had.
+	int position(const QUuid& ID, qint64 rowid = 0) const {
+		PPStatement query(select(QStringLiteral("COUNT(*)"), rowid != 0 ? QStringLiteral("rowid < :rowid") : QStringLiteral("rowid < (SELECT rowid FROM Note WHERE ID = :id)"), QString()));
+		if (rowid != 0) {
+			query->bindValue(":rowid", rowid);
 		} else {
-			int i =	oldBottom;
-			if (m_query.seek(i)) {
-				do {
-					i++;
-				} while (m_query.next());
-				newBottom = i;
-			} else {
-				newBottom = -1;
+			query->bindValue(":id", PPKey::encode(ID));
+		}
+		bindParent(query.data());
+		if (!query->exec() || !query->next()) {
+			qCritical() << query->lastError() << "when finding the row of an item of type Note";
+			return -1;
+		}
+		return query->value(0).toInt();
+	}
+
+	// Pages up to the one holding row keep their rows and anchors.
+	void invalidateFrom(int row) {
+		auto page = row / page_size;
+		for (auto it = m_anchors.upperBound(page); it != m_anchors.end();) {
+			it = m_anchors.erase(it);
+		}
+		for (auto key : m_pages.keys()) {
+			if (key >= page) {
+				m_pages.remove(key);
 			}
-			m_atEnd = true;
 		}
-		if (newBottom >= 0 && newBottom >= oldBottom) {
-			beginInsertRows(QModelIndex(), oldBottom, newBottom - 1);
-			m_bottom = newBottom;
-			endInsertRows();
+	}
+
+	void insertItem(const QUuid& ID) {
+		auto row = position(ID);
+		if (row < 0) {
+			return;
+		}
+		row = qMin(row, m_rowCount);
+		beginInsertRows(QModelIndex(), row, row);
+		m_rowCount++;
+		invalidateFrom(row);
+		endInsertRows();
+	}
+
+	// The row of an ID that's paged in, or -1.
+	int cachedRow(const QUuid& ID) const {
+		for (auto key : m_pages.keys()) {
+			auto rows = m_pages.object(key);
+			for (int i = 0; i < rows->size(); i++) {
+				if (rows->at(i)->m_ID == ID) {
+					return key * page_size + i;
+				}
+			}
+		}
+		return -1;
+	}
+
+	// rowid is the one a deleted row had, if it's known.
+	void removeItem(const QUuid& ID, bool deleted, qint64 rowid) {
+		auto row = cachedRow(ID);
+		if (row < 0 && (!deleted || rowid != 0)) {
+			row = position(ID, rowid);
+		} else if (row < 0) {
+			// Without its rowid, there's nothing left to find the place of a
+			// deleted row by.
+			refresh();
+			return;
+		}
+		if (row < 0 || m_rowCount == 0) {
+			return;
 		}
+		row = qMin(row, m_rowCount - 1);
+		beginRemoveRows(QModelIndex(), row, row);
+		m_rowCount--;
+		invalidateFrom(row);
+		endRemoveRows();
+	}
+
+	void updateItem(const QUuid& ID, quint64 properties) {
+		auto row = cachedRow(ID);
+		if (row < 0) {
+			return;
+		}
+		QVector<int> roles;
+		for (int bit = 0; bit < 64; bit++) {
+			if (properties & (quint64(1) << bit)) {
+				roles << Qt::UserRole + bit;
+			}
+		}
+		auto changed = index(row);
+		Q_EMIT dataChanged(changed, changed, roles);
+	}
+
+	// The first @lazy property read on a page loads them for the whole page.
+	void fetchLazy(int row, const QSharedPointer<Note>& object) const {
+		if ((object->m_LOADED & Note::LazyColumns) == Note::LazyColumns) {
+			return;
+		}
+		if (auto rows = m_pages.object(row / page_size)) {
+			Note::fetchColumns(*rows, Note::LazyColumns);
+		}
+	}
+
+	QSharedPointer<Note> itemAt(int row) const {
+		auto rows = page(row / page_size);
+		if (rows == nullptr || row % page_size >= rows->size()) {
+			return QSharedPointer<Note>();
+		}
+		return rows->at(row % page_size);
 	}
 
 public:
@@ -544,67 +1818,57 @@ public:
 	}
 
 	Q_INVOKABLE void commitStaging() {
-		m_staging->save();
+		PPTransaction transaction;
+		if (!transaction.isOpen()) {
+			return;
+		}
+		if (!m_staging->save()) {
+			return;
+		}
 		if (!m_parentID.isNull()) {
 			
 			if (m_parentedKind == ModelTypes::NoteKind) {
 				auto tq = QStringLiteral("UPDATE Note SET PARENT_Note_ID = :new_parent_id WHERE ID = :child_id ");
-				QSqlQuery query(PPDatabase::instance()->connection());
-				query.prepare(tq);
-				query.bindValue(":new_parent_id", m_parentID);
-				query.bindValue(":child_id", m_staging->m_ID);
-				auto ok = query.exec();
+				PPStatement query(tq);
+				query->bindValue(":new_parent_id", PPKey::encode(m_parentID));
+				query->bindValue(":child_id", PPKey::encode(m_staging->m_ID));
+				auto ok = query->exec();
 				if (!ok) {
-					qCritical() << query.lastError() << "when adding a new Note to a parent Note";
+					qCritical() << query->lastError() << "when adding a new Note to a parent Note";
+					return;
 				}
+				Note::publishReparented(m_staging->m_ID, QStringLiteral("PARENT_Note_ID"), m_staging->m_parent_Note_ID, m_parentID);
 				m_staging->m_parent_Note_ID = m_parentID;
 			}
 			
 		}
-		m_query.exec();
-		m_atEnd = false;
-		prefetch(fetch_size);
+		// The new row reaches this and every other model through PPDatabase::rowChanged().
+		if (!transaction.commit()) {
+			return;
+		}
 		m_staging = nullptr;
 		Q_EMIT stagingItemChanged();
 	}
 
-	NoteModel(QObject *parent = nullptr) : QAbstractListModel(parent)
+	NoteModel(QObject *parent = nullptr) : QAbstractListModel(parent), m_pages(window_pages)
 	{
-		m_query.prepare("SELECT * FROM Note");
-		m_query.exec();
-		prefetch(fetch_size);
+		connect(pDB, &PPDatabase::rowChanged, this, &NoteModel::applyRowChange);
+		refresh();
 	}
 
 	
 	static NoteModel* withNoteParent(const QUuid& id) {
 		static QMap<QUuid,QPointer<NoteModel>> s_models;
 		if (s_models.value(id).isNull()) {
-			auto childModel = new NoteModel();
-			childModel->m_parentedKind = ModelTypes::NoteKind;
-			childModel->m_query.prepare("SELECT * FROM Note WHERE PARENT_Note_ID = :parent_id");
-			childModel->m_query.bindValue(":parent_id", id);
-			childModel->m_bottom = 0;
-			childModel->m_parentID = id;
-			childModel->m_query.exec();
-			childModel->m_atEnd = false;
-			childModel->prefetch(fetch_size);
-			s_models[id] = childModel;
+			s_models[id] = new NoteModel(ModelTypes::NoteKind, QStringLiteral("PARENT_Note_ID"), id);
 		}
 		return s_models[id].data();
 	}
 	
 
-	void fetchMore(const QModelIndex &parent) override {
-		prefetch(m_bottom + fetch_size);
-	}
-
-	bool canFetchMore(const QModelIndex &parent) const override {
-		return !m_atEnd;
-	}
-
 	int rowCount(const QModelIndex &parent = QModelIndex()) const override {
 		Q_UNUSED(parent)
-		return m_bottom;
+		return m_rowCount;
 	}
 
 	QHash<int, QByteArray> roleNames() const override {
@@ -621,32 +1885,22 @@ public:
 	QVariant data(const QModelIndex &item, int role) const override {
 		if (!item.isValid()) return QVariant();
 
-		if (!m_items.contains(item.row())) {
-			if (!m_query.seek(item.row())) {
-				qCritical() << m_query.lastError() << "when seeking data for Note";
-				return QVariant();
-			}
-
-			auto add = Note::withID(m_query.value("ID").value<QUuid>());
-			
-			add->setProperty("title", m_query.value("title"));
-			
-			add->setProperty("metadata", m_query.value("metadata"));
-			
-			m_items.insert(item.row(), add);
+		auto object = itemAt(item.row());
+		if (object.isNull()) {
+			return QVariant();
 		}
 
 		switch (role) {
 		case NoteData::title:
-			return QVariant::fromValue(m_items[item.row()]->title());
+			return QVariant::fromValue(object->title());
 		case NoteData::metadata:
-			return QVariant::fromValue(m_items[item.row()]->metadata());
+			return QVariant::fromValue(object->metadata());
 		
 		case NoteData::childrenNote:
-			return QVariant::fromValue(NoteModel::withNoteParent(m_items[item.row()]->m_ID));
+			return QVariant::fromValue(NoteModel::withNoteParent(object->m_ID));
 		
 		case NoteData::object:
-			return QVariant::fromValue(m_items[item.row()].data());
+			return QVariant::fromValue(object.data());
 		}
 
 		return QVariant();
@@ -657,32 +1911,22 @@ public:
 	}
 
 	bool setData(const QModelIndex &item, const QVariant &value, int role = Qt::EditRole) override {
-		if (!m_items.contains(item.row())) {
-			if (!m_query.seek(item.row())) {
-				qCritical() << m_query.lastError() << "when seeking data for Note";
-				return false;
-			}
-
-			auto add = Note::withID(m_query.value("ID").value<QUuid>());
-			
-			add->setProperty("title", m_query.value("title"));
-			
-			add->setProperty("metadata", m_query.value("metadata"));
-			
-			m_items.insert(item.row(), add);
+		auto object = itemAt(item.row());
+		if (object.isNull()) {
+			return false;
 		}
 
 		switch (role) {
 			
 			
 			case NoteData::title:
-				m_items[item.row()]->set_title(value.value<QString>());
+				object->set_title(value.value<QString>());
 				Q_EMIT dataChanged(item, item, {role});
 				return true;
 			
 			
 			case NoteData::metadata:
-				m_items[item.row()]->set_metadata(value.value<QMap<QString,QString>>());
+				object->set_metadata(value.value<QMap<QString,QString>>());
 				Q_EMIT dataChanged(item, item, {role});
 				return true;
 			
@@ -1,41 +1,279 @@
+#include <QAtomicInt>
+#include <QCache>
 #include <QCoreApplication>
 #include <QDebug>
 #include <QDir>
+#include <QMap>
 #include <QMetaProperty>
 #include <QMutex>
+#include <QMutexLocker>
 #include <QPointer>
 #include <QSqlDatabase>
 #include <QSqlError>
 #include <QSqlQuery>
 #include <QStandardPaths>
 #include <QStringList>
+#include <QThread>
+#include <QThreadStorage>
+#include <QTimer>
 #include <QVariant>
+#include <cstdlib>
 
 #include "Database.h"
 
 const QString DRIVER("QSQLITE");
+// How long a delete queue that couldn't be written waits before trying again.
+const int FLUSH_RETRY_MS = 1000;
 
 class PPDatabase::Private
 {
     friend class PPDatabase;
-    QSqlDatabase db;
+
+    struct Level {
+        QList<std::function<void()>> committed;
+        QList<std::function<void()>> rolledBack;
+        QVector<PPRowChange> changes;
+        // Where the latest change of each row is in changes.
+        QHash<QPair<QString,QUuid>,int> latest;
+    };
+
+    struct PendingDelete {
+        QString table;
+        QUuid ID;
+        QStringList sideTables;
+        QVector<PPRowChange> changes;
+    };
+
+    // Everything tied to one QSqlDatabase, which Qt only allows to be used
+    // from the thread that opened it.
+    struct Connection {
+        QString name;
+        QSqlDatabase db;
+        QList<Level> levels;
+        QCache<QString,QSqlQuery> statements;
+        QList<PendingDelete> deletes;
+        bool flushScheduled = false;
+        // Whether each table deleted from has a rowid.
+        QHash<QString,bool> rowids;
+
+        Connection(const QString& name, int statementCapacity) : name(name), statements(statementCapacity) {}
+        ~Connection() {
+            // Nothing is left to publish the changes to once the thread is gone.
+            if (!deletes.isEmpty() && levels.isEmpty() && exec(QStringLiteral("BEGIN IMMEDIATE"))) {
+                exec(runDeletes() ? QStringLiteral("COMMIT") : QStringLiteral("ROLLBACK"));
+            }
+            statements.clear();
+            db.close();
+            db = QSqlDatabase();
+            QSqlDatabase::removeDatabase(name);
+        }
+
+        bool exec(const QString& statement) {
+            QSqlQuery query(db);
+            auto ok = query.exec(statement);
+            if (!ok) {
+                qCritical() << query.lastError() << "when running" << statement;
+            }
+            return ok;
+        }
+        // WITHOUT ROWID tables can't be asked for one.
+        bool hasRowid(const QString& table) {
+            auto known = rowids.constFind(table);
+            if (known != rowids.constEnd()) {
+                return *known;
+            }
+            QSqlQuery query(db);
+            auto ret = query.exec(QStringLiteral("SELECT rowid FROM %1 LIMIT 0").arg(table));
+            rowids.insert(table, ret);
+            return ret;
+        }
+
+        // Fills in the rowids of the rows entries are about to delete.
+        void readRowids(const QString& table, const QVector<PendingDelete*>& entries, const QString& IDs) {
+            if (!hasRowid(table)) {
+                return;
+            }
+            QSqlQuery query(db);
+            query.prepare(QStringLiteral("SELECT ID, rowid FROM %1 WHERE ID IN (%2)").arg(table, IDs));
+            for (int i = 0; i < entries.size(); i++) {
+                query.bindValue(i, PPKey::encode(entries[i]->ID));
+            }
+            if (!query.exec()) {
+                return;
+            }
+            QHash<QUuid,qint64> rowidOf;
+            while (query.next()) {
+                rowidOf.insert(PPKey::decode(query.value(0)), query.value(1).toLongLong());
+            }
+            for (auto entry : entries) {
+                for (auto& change : entry->changes) {
+                    if (change.kind == PPRowChange::Deleted) {
+                        change.rowid = rowidOf.value(entry->ID);
+                    }
+                }
+            }
+        }
+
+        // Writes the queued deletions inside the open transaction, grouped by
+        // table, a few hundred IDs per statement.
+        bool runDeletes() {
+            static const int chunk_size = 500;
+
+            QMap<QString,QVector<PendingDelete*>> tables;
+            for (auto& entry : deletes) {
+                tables[entry.table] << &entry;
+            }
+            for (auto it = tables.cbegin(); it != tables.cend(); ++it) {
+                const auto& entries = it.value();
+                for (int from = 0; from < entries.size(); from += chunk_size) {
+                    auto count = qMin(chunk_size, entries.size() - from);
+                    QStringList placeholders;
+                    for (int i = 0; i < count; i++) {
+                        placeholders << QStringLiteral("?");
+                    }
+                    auto IDs = placeholders.join(", ");
+                    readRowids(it.key(), entries.mid(from, count), IDs);
+                    QStringList statements{QStringLiteral("DELETE FROM %1 WHERE ID IN (%2)").arg(it.key(), IDs)};
+                    for (const auto& sideTable : entries.first()->sideTables) {
+                        statements << QStringLiteral("DELETE FROM %1 WHERE OWNER_ID IN (%2)").arg(sideTable, IDs);
+                    }
+                    for (const auto& statement : statements) {
+                        QSqlQuery query(db);
+                        query.prepare(statement);
+                        for (int i = 0; i < count; i++) {
+                            query.bindValue(i, PPKey::encode(entries[from + i]->ID));
+                        }
+                        if (!query.exec()) {
+                            qCritical() << query.lastError() << "when running" << statement;
+                            return false;
+                        }
+                    }
+                }
+            }
+            return true;
+        }
+
+        // Writes the queue as part of the outermost transaction before it
+        // commits, in a savepoint of its own, so failing deletions stay queued
+        // without rolling back the rest. Returns how many were written.
+        int writeDeletes() {
+            if (deletes.isEmpty() || !exec(QStringLiteral("SAVEPOINT pp_deletes"))) {
+                return 0;
+            }
+            int ret = deletes.size();
+            if (!runDeletes()) {
+                exec(QStringLiteral("ROLLBACK TO SAVEPOINT pp_deletes"));
+                ret = 0;
+            }
+            exec(QStringLiteral("RELEASE SAVEPOINT pp_deletes"));
+            return ret;
+        }
+    };
+
+    QString path;
+    QMutex configMutex;
+    PPStorageConfig config;
+    QThreadStorage<Connection*> connections;
+    QAtomicInt connectionCounter;
+    QAtomicInt statementCapacity = 128;
+    QAtomicInteger<quint64> statementHits = 0;
+    QAtomicInteger<quint64> statementMisses = 0;
+
+    QMutex writerMutex;
+    QThread* writerThread = nullptr;
+    QObject* writer = nullptr;
+    QThreadStorage<QObject*> contexts;
+
+    Connection* current() {
+        if (!connections.hasLocalData()) {
+            auto name = QStringLiteral("pokipoki-%1").arg(connectionCounter.fetchAndAddRelaxed(1));
+            auto connection = new Connection(name, statementCapacity.loadRelaxed());
+            connection->db = QSqlDatabase::addDatabase(DRIVER, name);
+            connection->db.setDatabaseName(path);
+            auto result = connection->db.open();
+            if (!result) {
+                qCritical() << connection->db.lastError() << "when opening" << path;
+            }
+            configMutex.lock();
+            auto settings = config;
+            configMutex.unlock();
+            configure(connection, settings);
+            connections.setLocalData(connection);
+        }
+        return connections.localData();
+    }
+
+    static void configure(Connection* connection, const PPStorageConfig& config) {
+        static const char* journalModes[] = {"DELETE", "TRUNCATE", "PERSIST", "MEMORY", "WAL", "OFF"};
+        static const char* synchronousLevels[] = {"OFF", "NORMAL", "FULL", "EXTRA"};
+
+        // page_size has to come before journal_mode, as a WAL database can't
+        // change it anymore.
+        connection->exec(QStringLiteral("PRAGMA page_size = %1").arg(config.pageSize));
+        connection->exec(QStringLiteral("PRAGMA journal_mode = %1").arg(journalModes[int(config.journalMode)]));
+        connection->exec(QStringLiteral("PRAGMA synchronous = %1").arg(synchronousLevels[int(config.synchronous)]));
+        connection->exec(QStringLiteral("PRAGMA cache_size = %1").arg(-config.cacheSize));
+        connection->exec(QStringLiteral("PRAGMA mmap_size = %1").arg(config.mmapSize));
+        connection->exec(QStringLiteral("PRAGMA temp_store = %1").arg(int(config.tempStore)));
+        connection->exec(QStringLiteral("PRAGMA busy_timeout = %1").arg(config.busyTimeout));
+    }
+
+    // Folds an update into an earlier update or insert of the same row, so a
+    // row written several times in one transaction is published once.
+    static void coalesce(Level& level, const PPRowChange& change) {
+        auto key = qMakePair(change.table, change.ID);
+        auto latest = level.latest.constFind(key);
+        if (change.kind == PPRowChange::Updated && latest != level.latest.constEnd()) {
+            auto& earlier = level.changes[*latest];
+            if (earlier.kind == PPRowChange::Updated) {
+                earlier.properties |= change.properties;
+                return;
+            }
+            if (earlier.kind == PPRowChange::Inserted) {
+                return;
+            }
+        }
+        level.latest.insert(key, level.changes.size());
+        level.changes << change;
+    }
+
+    static void runRollbackHooks(const Level& level) {
+        for (auto it = level.rolledBack.crbegin(); it != level.rolledBack.crend(); it++) {
+            (*it)();
+        }
+    }
 };
 
 PPDatabase::PPDatabase(QObject *parent) : QObject(parent)
 {
     d_ptr = new Private;
+    qRegisterMetaType<PPRowChange>();
 
     assert(QSqlDatabase::isDriverAvailable(DRIVER));
     auto ok = QDir().mkpath(QDir::cleanPath(QStandardPaths::writableLocation(QStandardPaths::DataLocation)));
     assert(ok);
 
-    d_ptr->db = QSqlDatabase::addDatabase(DRIVER);
-    d_ptr->db.setDatabaseName(QDir::cleanPath(QStandardPaths::writableLocation(QStandardPaths::DataLocation) + "/" + qAppName()));
+    d_ptr->path = QDir::cleanPath(QStandardPaths::writableLocation(QStandardPaths::DataLocation) + "/" + qAppName());
 
-    QDir::cleanPath(QStandardPaths::writableLocation(QStandardPaths::DataLocation) + "/" + qAppName());
+    connect(qApp, &QCoreApplication::aboutToQuit, this, [this] {
+        flushDeletes();
+    });
+}
 
-    auto result = d_ptr->db.open();
-    assert(result);
+PPDatabase::~PPDatabase()
+{
+    if (d_ptr->connections.hasLocalData()) {
+        flushDeletes();
+    }
+    QMutexLocker locker(&d_ptr->writerMutex);
+    if (d_ptr->writerThread != nullptr) {
+        // Quitting from a job lets everything enqueued before it finish.
+        auto thread = d_ptr->writerThread;
+        QMetaObject::invokeMethod(d_ptr->writer, [thread] { thread->quit(); }, Qt::QueuedConnection);
+        thread->wait();
+        delete d_ptr->writer;
+        delete thread;
+    }
 }
 
 PPDatabase* PPDatabase::instance()
@@ -44,7 +282,9 @@ PPDatabase* PPDatabase::instance()
     mutex.lock();
     static QPointer<PPDatabase> db;
     if (db.isNull()) {
-        db = new PPDatabase(qApp);
+        db = new PPDatabase(nullptr);
+        db->moveToThread(qApp->thread());
+        db->setParent(qApp);
     }
     mutex.unlock();
     return db;
@@ -52,13 +292,903 @@ PPDatabase* PPDatabase::instance()
 
 QSqlDatabase& PPDatabase::connection()
 {
-    return d_ptr->db;
+    return d_ptr->current()->db;
+}
+
+PPStorageConfig PPStorageConfig::durable()
+{
+    return PPStorageConfig();
+}
+
+PPStorageConfig PPStorageConfig::throughput()
+{
+    PPStorageConfig config;
+    config.journalMode = JournalMode::WAL;
+    config.synchronous = Synchronous::Normal;
+    config.cacheSize = 64 * 1024;
+    config.mmapSize = 256 * 1024 * 1024;
+    config.tempStore = TempStore::Memory;
+    return config;
+}
+
+void PPDatabase::setStorageConfig(const PPStorageConfig& config)
+{
+    if (d_ptr->connectionCounter.loadRelaxed() > 0) {
+        qWarning() << "PPDatabase::setStorageConfig called after connections were opened, they keep their old settings";
+    }
+    QMutexLocker locker(&d_ptr->configMutex);
+    d_ptr->config = config;
+}
+
+PPStorageConfig PPDatabase::storageConfig() const
+{
+    QMutexLocker locker(&d_ptr->configMutex);
+    return d_ptr->config;
+}
+
+void PPDatabase::releaseConnection()
+{
+    if (d_ptr->connections.hasLocalData()) {
+        d_ptr->connections.setLocalData(nullptr);
+    }
+}
+
+bool PPDatabase::transaction()
+{
+    auto connection = d_ptr->current();
+    if (connection->levels.isEmpty()) {
+        // Take the write lock up front, so two connections upgrading from
+        // a read lock can't deadlock each other.
+        if (!connection->exec(QStringLiteral("BEGIN IMMEDIATE"))) {
+            return false;
+        }
+    } else if (!connection->exec(QStringLiteral("SAVEPOINT pp_%1").arg(connection->levels.length()))) {
+        return false;
+    }
+    connection->levels << Private::Level();
+    return true;
+}
+
+bool PPDatabase::commit()
+{
+    auto connection = d_ptr->current();
+    if (connection->levels.isEmpty()) {
+        return false;
+    }
+
+    if (connection->levels.length() > 1) {
+        if (!connection->exec(QStringLiteral("RELEASE SAVEPOINT pp_%1").arg(connection->levels.length() - 1))) {
+            rollback();
+            return false;
+        }
+        auto level = connection->levels.takeLast();
+        connection->levels.last().committed << level.committed;
+        connection->levels.last().rolledBack << level.rolledBack;
+        for (const auto& change : level.changes) {
+            Private::coalesce(connection->levels.last(), change);
+        }
+        return true;
+    }
+
+    auto deletes = connection->writeDeletes();
+    if (!connection->db.commit()) {
+        qCritical() << connection->db.lastError() << "when committing a transaction";
+        rollback();
+        return false;
+    }
+    auto level = connection->levels.takeLast();
+    for (const auto& callback : level.committed) {
+        callback();
+    }
+    for (const auto& change : level.changes) {
+        Q_EMIT rowChanged(change);
+    }
+    for (int i = 0; i < deletes; i++) {
+        for (const auto& change : connection->deletes.takeFirst().changes) {
+            Q_EMIT rowChanged(change);
+        }
+    }
+    return true;
+}
+
+bool PPDatabase::rollback()
+{
+    auto connection = d_ptr->current();
+    if (connection->levels.isEmpty()) {
+        return false;
+    }
+
+    bool ok;
+    if (connection->levels.length() > 1) {
+        auto name = QStringLiteral("pp_%1").arg(connection->levels.length() - 1);
+        ok = connection->exec(QStringLiteral("ROLLBACK TO SAVEPOINT %1").arg(name))
+          && connection->exec(QStringLiteral("RELEASE SAVEPOINT %1").arg(name));
+    } else {
+        ok = connection->db.rollback();
+        if (!ok) {
+            qCritical() << connection->db.lastError() << "when rolling back a transaction";
+        }
+    }
+    Private::runRollbackHooks(connection->levels.takeLast());
+    return ok;
+}
+
+bool PPDatabase::inTransaction() const
+{
+    return !d_ptr->current()->levels.isEmpty();
+}
+
+int PPDatabase::transactionDepth() const
+{
+    return d_ptr->current()->levels.length();
+}
+
+void PPDatabase::onCommit(std::function<void()> callback)
+{
+    auto connection = d_ptr->current();
+    if (connection->levels.isEmpty()) {
+        callback();
+        return;
+    }
+    connection->levels.last().committed << callback;
+}
+
+void PPDatabase::onRollback(std::function<void()> callback)
+{
+    auto connection = d_ptr->current();
+    if (connection->levels.isEmpty()) {
+        return;
+    }
+    connection->levels.last().rolledBack << callback;
+}
+
+void PPDatabase::queueDelete(const QString& table, const QUuid& ID, const QStringList& sideTables, const QVector<PPRowChange>& changes)
+{
+    // Applications that never quit their event loop still write the main
+    // thread's queue when they exit.
+    static bool flushAtExit = (std::atexit([] {
+        if (QCoreApplication::instance() != nullptr) {
+            pDB->flushDeletes();
+        }
+    }), true);
+    Q_UNUSED(flushAtExit)
+
+    auto connection = d_ptr->current();
+    connection->deletes << Private::PendingDelete{table, ID, sideTables, changes};
+    if (!connection->flushScheduled) {
+        connection->flushScheduled = true;
+        QMetaObject::invokeMethod(threadContext(), [this] {
+            flushDeletes();
+        }, Qt::QueuedConnection);
+    }
+}
+
+bool PPDatabase::flushDeletes()
+{
+    auto connection = d_ptr->current();
+    connection->flushScheduled = false;
+    if (connection->deletes.isEmpty()) {
+        return true;
+    }
+    auto ok = !connection->levels.isEmpty() || (transaction() && commit() && connection->deletes.isEmpty());
+    // Whatever is still queued, because BEGIN or a deletion failed or the open
+    // transaction may yet roll back, is tried again later.
+    if (!connection->deletes.isEmpty() && !connection->flushScheduled) {
+        connection->flushScheduled = true;
+        QTimer::singleShot(FLUSH_RETRY_MS, threadContext(), [this] {
+            flushDeletes();
+        });
+    }
+    return ok;
+}
+
+int PPDatabase::pendingDeletes() const
+{
+    return d_ptr->current()->deletes.size();
+}
+
+void PPDatabase::publishRowChange(const PPRowChange& change)
+{
+    auto connection = d_ptr->current();
+    if (connection->levels.isEmpty()) {
+        Q_EMIT rowChanged(change);
+        return;
+    }
+    Private::coalesce(connection->levels.last(), change);
+}
+
+QSqlQuery* PPDatabase::checkoutStatement(const QString& statement, bool* prepared)
+{
+    auto connection = d_ptr->current();
+    auto query = connection->statements.take(statement);
+    if (query != nullptr) {
+        d_ptr->statementHits.fetchAndAddRelaxed(1);
+        *prepared = true;
+        return query;
+    }
+
+    d_ptr->statementMisses.fetchAndAddRelaxed(1);
+    query = new QSqlQuery(connection->db);
+    query->setForwardOnly(true);
+    *prepared = query->prepare(statement);
+    if (!*prepared) {
+        qCritical() << query->lastError() << "when preparing" << statement;
+    }
+    return query;
+}
+
+void PPDatabase::checkinStatement(const QString& statement, QSqlQuery* query, bool prepared)
+{
+    if (!prepared) {
+        delete query;
+        return;
+    }
+    query->finish();
+    d_ptr->current()->statements.insert(statement, query);
+}
+
+int PPDatabase::statementCacheCapacity() const
+{
+    return d_ptr->statementCapacity.loadRelaxed();
+}
+
+void PPDatabase::setStatementCacheCapacity(int capacity)
+{
+    d_ptr->statementCapacity.storeRelaxed(capacity);
+    d_ptr->current()->statements.setMaxCost(capacity);
+}
+
+quint64 PPDatabase::statementCacheHits() const
+{
+    return d_ptr->statementHits.loadRelaxed();
+}
+
+quint64 PPDatabase::statementCacheMisses() const
+{
+    return d_ptr->statementMisses.loadRelaxed();
+}
+
+void PPDatabase::enqueue(std::function<void()> job)
+{
+    QMutexLocker locker(&d_ptr->writerMutex);
+    if (d_ptr->writerThread == nullptr) {
+        d_ptr->writerThread = new QThread;
+        d_ptr->writerThread->setObjectName(QStringLiteral("pokipoki persistence"));
+        d_ptr->writer = new QObject;
+        d_ptr->writer->moveToThread(d_ptr->writerThread);
+        d_ptr->writerThread->start();
+    }
+    QMetaObject::invokeMethod(d_ptr->writer, std::move(job), Qt::QueuedConnection);
+}
+
+void PPDatabase::waitForQueue()
+{
+    QMutexLocker locker(&d_ptr->writerMutex);
+    if (d_ptr->writerThread == nullptr || QThread::currentThread() == d_ptr->writerThread) {
+        return;
+    }
+    auto writer = d_ptr->writer;
+    locker.unlock();
+    QMetaObject::invokeMethod(writer, [] {}, Qt::BlockingQueuedConnection);
+}
+
+QObject* PPDatabase::threadContext()
+{
+    if (!d_ptr->contexts.hasLocalData()) {
+        d_ptr->contexts.setLocalData(new QObject);
+    }
+    return d_ptr->contexts.localData();
+}
+
+QList<QSqlRecord> PPDatabase::records(QSqlQuery* query)
+{
+    QList<QSqlRecord> ret;
+    while (query->next()) {
+        ret << query->record();
+    }
+    return ret;
+}
+
+bool PPDatabase::insertRecords(const QString& table, const QList<QSqlRecord>& records)
+{
+    if (records.isEmpty()) {
+        return true;
+    }
+    QStringList columns;
+    QStringList placeholders;
+    for (int i = 0; i < records.first().count(); i++) {
+        columns << records.first().fieldName(i);
+        placeholders << QStringLiteral("?");
+    }
+    PPStatement query(QStringLiteral("INSERT INTO %1 (%2) VALUES (%3)").arg(table, columns.join(", "), placeholders.join(", ")));
+    for (const auto& record : records) {
+        for (int i = 0; i < record.count(); i++) {
+            query->bindValue(i, record.value(i));
+        }
+        if (!query->exec()) {
+            qCritical() << query->lastError() << "when writing rows back into" << table;
+            return false;
+        }
+    }
+    return true;
+}
+
+QVariant PPKey::encode(const QUuid& ID)
+{
+    if (ID.isNull()) {
+        return QVariant(QVariant::ByteArray);
+    }
+    return ID.toRfc4122();
+}
+
+QUuid PPKey::decode(const QVariant& value)
+{
+    if (value.isNull()) {
+        return QUuid();
+    }
+    if (value.userType() == QMetaType::QByteArray) {
+        auto bytes = value.toByteArray();
+        if (bytes.size() == 16) {
+            return QUuid::fromRfc4122(bytes);
+        }
+        return QUuid(bytes);
+    }
+    if (value.userType() == QMetaType::QUuid) {
+        return value.value<QUuid>();
+    }
+    return QUuid(value.toString());
+}
+
+QVariant PPColumn<QVariant>::bind(const QVariant& value)
+{
+    switch (value.userType()) {
+    case QMetaType::Bool:
+    case QMetaType::Char:
+    case QMetaType::SChar:
+    case QMetaType::UChar:
+    case QMetaType::Short:
+    case QMetaType::UShort:
+    case QMetaType::Int:
+    case QMetaType::UInt:
+    case QMetaType::Long:
+    case QMetaType::ULong:
+    case QMetaType::LongLong:
+    case QMetaType::ULongLong:
+        return value.toLongLong();
+    case QMetaType::Float:
+    case QMetaType::Double:
+        return value.toDouble();
+    case QMetaType::QUuid:
+        return PPKey::encode(value.value<QUuid>());
+    default:
+        return value;
+    }
+}
+
+const int KEY_FORMAT = 1;
+
+bool PPDatabase::migrateKeys(const QString& table, const QStringList& columns)
+{
+    QSqlQuery query(connection());
+    if (!query.exec("CREATE TABLE IF NOT EXISTS pokipoki_meta(name TEXT NOT NULL, key TEXT NOT NULL, value, PRIMARY KEY (name, key)) WITHOUT ROWID")) {
+        qCritical() << query.lastError();
+        return false;
+    }
+    query.prepare("SELECT value FROM pokipoki_meta WHERE name = :name AND key = 'keyFormat'");
+    query.bindValue(":name", table);
+    if (query.exec() && query.next() && query.value(0).toInt() >= KEY_FORMAT) {
+        return true;
+    }
+
+    PPTransaction transaction;
+    if (!transaction.isOpen()) {
+        return false;
+    }
+    // Map each distinct old key to its new form in a temporary table, then
+    // rewrite every column in a single pass instead of one UPDATE per key.
+    if (!query.exec("CREATE TEMP TABLE IF NOT EXISTS pokipoki_keymap(old TEXT PRIMARY KEY, new BLOB NOT NULL)")) {
+        qCritical() << query.lastError();
+        return false;
+    }
+    for (const auto& column : columns) {
+        query.exec("DELETE FROM temp.pokipoki_keymap");
+        QSqlQuery select(connection());
+        if (!select.exec(QStringLiteral("SELECT DISTINCT %1 FROM %2 WHERE typeof(%1) = 'text'").arg(column, table))) {
+            qCritical() << select.lastError();
+            return false;
+        }
+        query.prepare("INSERT INTO temp.pokipoki_keymap(old, new) VALUES (:old, :new)");
+        while (select.next()) {
+            query.bindValue(":old", select.value(0));
+            query.bindValue(":new", PPKey::encode(PPKey::decode(select.value(0))));
+            if (!query.exec()) {
+                qCritical() << query.lastError();
+                return false;
+            }
+        }
+        auto update = QStringLiteral("UPDATE %2 SET %1 = (SELECT new FROM temp.pokipoki_keymap WHERE old = %2.%1) WHERE typeof(%1) = 'text'");
+        if (!query.exec(update.arg(column, table))) {
+            qCritical() << query.lastError();
+            return false;
+        }
+    }
+    query.exec("DELETE FROM temp.pokipoki_keymap");
+
+    query.prepare("INSERT OR REPLACE INTO pokipoki_meta(name, key, value) VALUES (:name, 'keyFormat', :value)");
+    query.bindValue(":name", table);
+    query.bindValue(":value", KEY_FORMAT);
+    if (!query.exec()) {
+        qCritical() << query.lastError();
+        return false;
+    }
+    return transaction.commit();
+}
+
+bool PPWrite::exec() const
+{
+    PPStatement query(statement);
+    bindTo(query.data());
+    if (!query->exec()) {
+        qCritical() << query->lastError() << "when running" << statement;
+        return false;
+    }
+    return true;
+}
+
+QString PPSideTable::createStatement(const QString& table, const QString& keyType, const QString& valueType)
+{
+    return QStringLiteral("CREATE TABLE IF NOT EXISTS %1(OWNER_ID BLOB NOT NULL, KEY %2 NOT NULL, VALUE %3 NOT NULL, PRIMARY KEY (OWNER_ID, KEY)) WITHOUT ROWID").arg(table, keyType, valueType);
+}
+
+PPWrite PPSideTable::clear(const QString& table, const QUuid& owner)
+{
+    PPWrite write;
+    write.statement = QStringLiteral("DELETE FROM %1 WHERE OWNER_ID = :owner").arg(table);
+    write.bind(":owner", PPKey::encode(owner));
+    return write;
+}
+
+PPWrite PPSideTable::insert(const QString& table, const QUuid& owner, const QVariant& key, const QVariant& value)
+{
+    PPWrite write;
+    write.statement = QStringLiteral("INSERT OR REPLACE INTO %1(OWNER_ID, KEY, VALUE) VALUES (:owner, :key, :value)").arg(table);
+    write.bind(":owner", PPKey::encode(owner));
+    write.bind(":key", key);
+    write.bind(":value", value);
+    return write;
+}
+
+QList<QPair<QVariant,QVariant>> PPSideTable::load(const QString& table, const QUuid& owner)
+{
+    QList<QPair<QVariant,QVariant>> ret;
+    PPStatement query(QStringLiteral("SELECT KEY, VALUE FROM %1 WHERE OWNER_ID = :owner ORDER BY KEY").arg(table));
+    query->bindValue(":owner", PPKey::encode(owner));
+    if (!query->exec()) {
+        qCritical() << query->lastError() << "when loading" << table;
+        return ret;
+    }
+    while (query->next()) {
+        ret << qMakePair(query->value(0), query->value(1));
+    }
+    return ret;
+}
+
+PPStatement::PPStatement(const QString& statement) : m_statement(statement)
+{
+    m_query = pDB->checkoutStatement(m_statement, &m_prepared);
+}
+
+PPStatement::~PPStatement()
+{
+    pDB->checkinStatement(m_statement, m_query, m_prepared);
+}
+
+PPTransaction::PPTransaction()
+{
+    m_open = pDB->transaction();
+}
+
+PPTransaction::~PPTransaction()
+{
+    if (m_open) {
+        pDB->rollback();
+    }
+}
+
+bool PPTransaction::commit()
+{
+    if (!m_open) {
+        return false;
+    }
+    m_open = false;
+    return pDB->commit();
+}
+
+void PPTransaction::rollback()
+{
+    if (m_open) {
+        m_open = false;
+        pDB->rollback();
+    }
+}
+
+static QMutex s_identityMapsMutex;
+static QList<PPIdentityMapBase*> s_identityMaps;
+
+PPIdentityMapBase::PPIdentityMapBase(const char* typeName) : m_typeName(typeName)
+{
+    QMutexLocker locker(&s_identityMapsMutex);
+    s_identityMaps << this;
+}
+
+PPIdentityMapBase::~PPIdentityMapBase()
+{
+    QMutexLocker locker(&s_identityMapsMutex);
+    s_identityMaps.removeOne(this);
+}
+
+QList<PPIdentityMapBase*> PPIdentityMapBase::all()
+{
+    QMutexLocker locker(&s_identityMapsMutex);
+    return s_identityMaps;
 }
 
+// Steps grouped by PPUndoRedoStack::beginMacro(), which the stack holds as one.
+// Members are in the order they were last applied, so undoing or redoing the
+// macro goes through them backwards.
+class PPUndoMacro : public QObject, public PPUndoRedoable
+{
+public:
+    struct Member
+    {
+        PPUndoRedoable* item;
+        // Steps of objects that are gone are skipped.
+        QPointer<QObject> object;
+        qint64 bytes;
+        qint64 step;
+    };
+
+    using QObject::QObject;
+
+    QVector<Member> members;
+    // Tags the journal rows of the macro's steps, or 0.
+    qint64 number = 0;
+
+    qint64 bytes() const {
+        qint64 ret = 0;
+        for (const auto& member : members) {
+            ret += member.bytes;
+        }
+        return ret;
+    }
+
+    void undo() override {
+        pUR->replay(this, false);
+    }
+    void redo() override {
+        pUR->replay(this, true);
+    }
+    // The macro's steps are the oldest of their items too.
+    void undoStepDropped() override {
+        for (const auto& member : qAsConst(members)) {
+            if (member.object) {
+                member.item->undoStepDropped();
+            }
+        }
+        deleteLater();
+    }
+    void redoStepDropped() override {
+        for (const auto& member : qAsConst(members)) {
+            if (member.object) {
+                member.item->redoStepDropped();
+            }
+        }
+        deleteLater();
+    }
+};
+
 class PPUndoRedoStack::Private
 {
-    QList<PPUndoRedoable*> undoItems;
-    QList<PPUndoRedoable*> redoItems;
+    // A step on one of the stacks. Steps of the same item are chained too, so
+    // an item's latest step is found without searching the stack.
+    struct Node
+    {
+        PPUndoRedoable* item;
+        qint64 bytes;
+        // The step's row in the journal, or 0.
+        qint64 step;
+        Node* older = nullptr;
+        Node* newer = nullptr;
+        Node* olderOfItem = nullptr;
+        Node* newerOfItem = nullptr;
+    };
+
+    struct Stack
+    {
+        Node* oldest = nullptr;
+        Node* newest = nullptr;
+        int size = 0;
+        QHash<PPUndoRedoable*,Node*> latest;
+
+        void push(PPUndoRedoable* item, qint64 bytes, qint64 step) {
+            auto node = new Node{item, bytes, step};
+            node->older = newest;
+            (newest ? newest->newer : oldest) = node;
+            newest = node;
+            auto& latestOfItem = latest[item];
+            node->olderOfItem = latestOfItem;
+            if (latestOfItem) {
+                latestOfItem->newerOfItem = node;
+            }
+            latestOfItem = node;
+            size++;
+        }
+        // Unlinks node, which the caller then owns.
+        Node* take(Node* node) {
+            (node->older ? node->older->newer : oldest) = node->newer;
+            (node->newer ? node->newer->older : newest) = node->older;
+            if (node->newerOfItem) {
+                node->newerOfItem->olderOfItem = node->olderOfItem;
+            } else if (node->olderOfItem) {
+                latest[node->item] = node->olderOfItem;
+            } else {
+                latest.remove(node->item);
+            }
+            if (node->olderOfItem) {
+                node->olderOfItem->newerOfItem = node->newerOfItem;
+            }
+            size--;
+            return node;
+        }
+        Node* takeLatest(PPUndoRedoable* item) {
+            auto node = latest.value(item);
+            return node ? take(node) : nullptr;
+        }
+        void clear() {
+            while (oldest) {
+                delete take(oldest);
+            }
+        }
+    };
+
+    // Accounts for the nodes and the hash entries pointing at them.
+    static const qint64 NodeBytes = sizeof(Node) + 2 * sizeof(void*);
+
+    Stack undo;
+    Stack redo;
+    qint64 bytes = 0;
+    PPUndoBudget budget;
+    bool journaled = false;
+    // The journal's rows in each state, so canUndo() and canRedo() don't have
+    // to ask the database.
+    qint64 journalRows[2] = {0, 0};
+    QAtomicInteger<qint64> nextStep{1};
+    // The macro steps are added to, which stays set after the outermost
+    // endMacro() until the saves in it are committed.
+    PPUndoMacro* recording = nullptr;
+    int macroDepth = 0;
+    bool macroTransaction = false;
+    // The member of a macro being undone or redone, which its item's calls
+    // update instead of the stacks.
+    PPUndoMacro::Member* replaying = nullptr;
+    bool replayingRedo = false;
+    bool replayed = false;
+
+    bool overBudget() const {
+        return (budget.maxSteps > 0 && undo.size + redo.size > budget.maxSteps)
+            || (budget.maxBytes > 0 && bytes > budget.maxBytes);
+    }
+
+    // Returns the step the node had in the journal.
+    qint64 release(Node* node) {
+        bytes -= node->bytes + NodeBytes;
+        auto step = node->step;
+        delete node;
+        return step;
+    }
+
+    enum State { Undoable = 0, Redoable = 1 };
+
+    // Whether the journal holds steps of the stack beyond those in memory. A
+    // stack only pages in once it's empty, so any of them will do.
+    bool inJournal(const Stack& stack, State state) const {
+        return journaled && stack.size == 0 && journalRows[state] > 0;
+    }
+
+    bool countJournal() {
+        PPStatement query(QStringLiteral("SELECT STATE, COUNT(*) FROM pokipoki_undo GROUP BY STATE"));
+        if (!query->exec()) {
+            qCritical() << query->lastError() << "when reading the undo journal";
+            return false;
+        }
+        journalRows[Undoable] = journalRows[Redoable] = 0;
+        while (query->next()) {
+            auto state = query->value(0).toInt();
+            if (state == Undoable || state == Redoable) {
+                journalRows[state] = query->value(1).toLongLong();
+            }
+        }
+        return true;
+    }
+
+    // Deletes the oldest undoable steps past the budget's maxJournalSteps,
+    // taking whole macros. Unless exact, the journal may grow a quarter past
+    // the limit first, so that saves don't each delete a row.
+    void pruneJournal(bool exact) {
+        auto limit = budget.maxJournalSteps;
+        if (!journaled || limit <= 0 || journalRows[Undoable] <= (exact ? limit : limit + qMax(1, limit / 4))) {
+            return;
+        }
+        PPStatement query(QStringLiteral(
+            "WITH cut AS (SELECT STEP FROM pokipoki_undo WHERE STATE = 0 ORDER BY STEP DESC LIMIT 1 OFFSET :keep) "
+            "DELETE FROM pokipoki_undo WHERE STATE = 0 AND (STEP <= (SELECT STEP FROM cut) "
+            "OR MACRO IN (SELECT MACRO FROM pokipoki_undo WHERE STATE = 0 AND MACRO != 0 AND STEP <= (SELECT STEP FROM cut)))"));
+        query->bindValue(":keep", limit);
+        if (!query->exec()) {
+            qCritical() << query->lastError() << "when pruning the undo journal";
+            return;
+        }
+        journalRows[Undoable] = qMax<qint64>(0, journalRows[Undoable] - query->numRowsAffected());
+    }
+
+    void setState(qint64 step, State state, const PPDelta& delta) {
+        PPStatement query(QStringLiteral("UPDATE pokipoki_undo SET STATE = :state, DELTA = :delta WHERE STEP = :step"));
+        query->bindValue(":state", int(state));
+        query->bindValue(":delta", PPBinary::encode(delta));
+        query->bindValue(":step", step);
+        if (!query->exec()) {
+            qCritical() << query->lastError() << "when moving a step in the undo journal";
+            return;
+        }
+        // Pruned steps may still be in memory, without a row to move.
+        auto moved = query->numRowsAffected();
+        if (moved > 0) {
+            journalRows[state == Undoable ? Redoable : Undoable] -= moved;
+            journalRows[state] += moved;
+        }
+    }
+
+    bool replays(PPUndoRedoable* item) const {
+        return replaying && replaying->item == item;
+    }
+
+    // Whether item's calls are for the member being replayed, which they then
+    // update. redo is the way the item says it moved the step, which is back
+    // again if it couldn't write it.
+    bool routed(PPUndoRedoable* item, qint64 bytes, bool redo) {
+        if (!replays(item)) {
+            return false;
+        }
+        replaying->bytes = bytes;
+        replayed = redo == replayingRedo;
+        return true;
+    }
+
+    // Applies the member's step through its item. Returns whether the item
+    // moved it.
+    bool apply(PPUndoMacro::Member* member, bool redo) {
+        replaying = member;
+        replayingRedo = redo;
+        replayed = false;
+        redo ? member->item->redo() : member->item->undo();
+        replaying = nullptr;
+        return replayed;
+    }
+
+    // Takes item's latest step off stack, when the item works on its steps by
+    // itself. The step may be in a macro newer than the item's own latest
+    // node, which is then split out of it. Returns the step's number in the
+    // journal.
+    qint64 takeStep(Stack& stack, PPUndoRedoable* item, bool* found) {
+        auto own = stack.latest.value(item);
+        auto object = dynamic_cast<QObject*>(item);
+        for (auto node = stack.newest; node && node != own; node = node->older) {
+            auto macro = dynamic_cast<PPUndoMacro*>(node->item);
+            if (!macro) {
+                continue;
+            }
+            for (int i = macro->members.size() - 1; i >= 0; i--) {
+                // The object of a member that's gone may have left its address
+                // to a new one.
+                const auto& member = macro->members.at(i);
+                if (member.item != item || !member.object || member.object != object) {
+                    continue;
+                }
+                auto member = macro->members.takeAt(i);
+                node->bytes -= member.bytes;
+                bytes -= member.bytes;
+                if (macro->members.isEmpty()) {
+                    release(stack.take(node));
+                    macro->deleteLater();
+                }
+                if (member.step) {
+                    ungroup(member.step);
+                }
+                *found = true;
+                return member.step;
+            }
+        }
+        *found = own != nullptr;
+        return own ? release(stack.take(own)) : 0;
+    }
+
+    // Drops the members of the macro on stack whose objects are gone, with no
+    // journaled step to read them back from.
+    void pruneMembers(Stack& stack, PPUndoMacro* macro) {
+        auto node = stack.latest.value(macro);
+        for (int i = macro->members.size() - 1; i >= 0; i--) {
+            const auto& member = macro->members.at(i);
+            if (member.object || member.step) {
+                continue;
+            }
+            node->bytes -= member.bytes;
+            bytes -= member.bytes;
+            macro->members.removeAt(i);
+        }
+    }
+
+    static void ungroup(qint64 step) {
+        PPStatement query(QStringLiteral("UPDATE pokipoki_undo SET MACRO = 0 WHERE STEP = :step"));
+        query->bindValue(":step", step);
+        if (!query->exec()) {
+            qCritical() << query->lastError() << "when taking a step out of a macro in the undo journal";
+        }
+    }
+
+    // Reads a step back from the journal and gives it to its object, which the
+    // returned pointer keeps alive. Steps of types that no longer exist are
+    // discarded.
+    QSharedPointer<QObject> loadStep(qint64 step, bool redo, PPUndoRedoable** item, qint64* bytes) {
+        PPStatement query(QStringLiteral("SELECT TYPE, ID, DELTA FROM pokipoki_undo WHERE STEP = :step"));
+        query->bindValue(":step", step);
+        if (!query->exec() || !query->next()) {
+            qCritical() << query->lastError() << "when reading the undo journal";
+            return QSharedPointer<QObject>();
+        }
+        auto type = query->value(0).toString();
+        auto ID = PPKey::decode(query->value(1));
+        bool ok;
+        auto delta = PPBinary::decode<PPDelta>(query->value(2).toByteArray(), &ok);
+        query->finish();
+
+        std::function<QSharedPointer<QObject>(const QUuid&)> load;
+        {
+            QMutexLocker locker(&typesMutex());
+            load = types().value(type);
+        }
+        auto object = load && ok ? load(ID) : QSharedPointer<QObject>();
+        *item = qobject_cast<PPUndoRedoable*>(object.data());
+        if (!*item) {
+            qWarning() << "Discarding a step of type" << type << "that can't be read back from the undo journal";
+            discard(step, redo ? Redoable : Undoable);
+            return QSharedPointer<QObject>();
+        }
+        redo ? (*item)->redoStepLoaded(delta) : (*item)->undoStepLoaded(delta);
+        *bytes = delta.bytes();
+        return object;
+    }
+
+    void discard(qint64 step, State state) {
+        PPStatement query(QStringLiteral("DELETE FROM pokipoki_undo WHERE STEP = :step"));
+        query->bindValue(":step", step);
+        if (!query->exec()) {
+            qCritical() << query->lastError() << "when discarding a step from the undo journal";
+            return;
+        }
+        journalRows[state] = qMax<qint64>(0, journalRows[state] - query->numRowsAffected());
+    }
+
+    // Types register themselves during static initialisation, so these can't
+    // be plain statics.
+    static QMutex& typesMutex() {
+        static QMutex s_mutex;
+        return s_mutex;
+    }
+    static QHash<QString,std::function<QSharedPointer<QObject>(const QUuid&)>>& types() {
+        static QHash<QString,std::function<QSharedPointer<QObject>(const QUuid&)>> s_types;
+        return s_types;
+    }
+
     friend class PPUndoRedoStack;
 };
 
@@ -67,6 +1197,13 @@ PPUndoRedoStack::PPUndoRedoStack(QObject *parent) : QObject(parent)
     d_ptr = new Private;
 }
 
+PPUndoRedoStack::~PPUndoRedoStack()
+{
+    d_ptr->undo.clear();
+    d_ptr->redo.clear();
+    delete d_ptr;
+}
+
 PPUndoRedoStack* PPUndoRedoStack::instance()
 {
     static QMutex mutex;
@@ -80,57 +1217,632 @@ PPUndoRedoStack* PPUndoRedoStack::instance()
 };
 
 bool PPUndoRedoStack::canUndo() const {
-    return d_ptr->undoItems.length() > 0;
+    return d_ptr->undo.size > 0 || d_ptr->inJournal(d_ptr->undo, Private::Undoable);
 }
 
 bool PPUndoRedoStack::canRedo() const {
-    return d_ptr->redoItems.length() > 0;
+    return d_ptr->redo.size > 0 || d_ptr->inJournal(d_ptr->redo, Private::Redoable);
 }
 
+void PPUndoRedoStack::setBudget(const PPUndoBudget& budget) {
+    d_ptr->budget = budget;
+    trim();
+    d_ptr->pruneJournal(true);
+}
+
+PPUndoBudget PPUndoRedoStack::budget() const {
+    return d_ptr->budget;
+}
+
+int PPUndoRedoStack::undoSteps() const {
+    return d_ptr->undo.size;
+}
+
+int PPUndoRedoStack::redoSteps() const {
+    return d_ptr->redo.size;
+}
 
-void PPUndoRedoStack::undoItemAdded(PPUndoRedoable* item) {
-    d_ptr->undoItems << item;
-    if (d_ptr->undoItems.length()-1 == 0) {
+qint64 PPUndoRedoStack::bytes() const {
+    return d_ptr->bytes;
+}
+
+// Drops the oldest steps until the stacks fit the budget. The latest undo step,
+// which may just have been paged in, goes after the redo steps. Items are told
+// after the step is gone, so they can't find it again. Journaled steps stay in
+// the journal.
+void PPUndoRedoStack::trim() {
+    if (!d_ptr->overBudget()) {
+        return;
+    }
+    auto couldUndo = canUndo();
+    auto couldRedo = canRedo();
+    while (d_ptr->overBudget()) {
+        if (d_ptr->undo.oldest && (d_ptr->undo.size > 1 || !d_ptr->redo.oldest)) {
+            auto item = d_ptr->undo.oldest->item;
+            d_ptr->release(d_ptr->undo.take(d_ptr->undo.oldest));
+            item->undoStepDropped();
+        } else if (d_ptr->redo.oldest) {
+            auto item = d_ptr->redo.oldest->item;
+            d_ptr->release(d_ptr->redo.take(d_ptr->redo.oldest));
+            item->redoStepDropped();
+        } else {
+            break;
+        }
+    }
+    if (couldUndo != canUndo()) {
         Q_EMIT canUndoChanged();
     }
+    if (couldRedo != canRedo()) {
+        Q_EMIT canRedoChanged();
+    }
+}
+
+void PPUndoRedoStack::push(bool redo, PPUndoRedoable* item, qint64 bytes, qint64 step) {
+    auto& stack = redo ? d_ptr->redo : d_ptr->undo;
+    stack.push(item, bytes, step);
+    d_ptr->bytes += bytes + Private::NodeBytes;
+    if (stack.size == 1) {
+        if (redo) {
+            Q_EMIT canRedoChanged();
+        } else {
+            Q_EMIT canUndoChanged();
+        }
+    }
+    trim();
+}
+
+// Calls from the item of a macro's step that's being applied only update the
+// step, and new steps inside a macro join it.
+void PPUndoRedoStack::undoItemAdded(PPUndoRedoable* item, qint64 bytes, qint64 step) {
+    if (d_ptr->routed(item, bytes, true)) {
+        return;
+    }
+    // The step's row was just committed, and the redo steps of its object
+    // deleted with it. Only those have to be counted again.
+    if (step) {
+        auto couldRedo = canRedo();
+        if (d_ptr->journalRows[Private::Redoable] > 0) {
+            d_ptr->countJournal();
+        } else {
+            d_ptr->journalRows[Private::Undoable]++;
+        }
+        d_ptr->pruneJournal(false);
+        if (couldRedo != canRedo()) {
+            Q_EMIT canRedoChanged();
+        }
+    }
+    if (d_ptr->recording) {
+        d_ptr->recording->members << PPUndoMacro::Member{item, dynamic_cast<QObject*>(item), bytes, step};
+        return;
+    }
+    push(false, item, bytes, step);
+    Q_EMIT historyChanged();
 }
 
 void PPUndoRedoStack::undoItemRemoved(PPUndoRedoable* item) {
-    auto idx = d_ptr->undoItems.lastIndexOf(item);
-    if (idx == -1) {
+    if (d_ptr->replays(item)) {
+        return;
+    }
+    bool found;
+    auto step = d_ptr->takeStep(d_ptr->undo, item, &found);
+    if (!found) {
+        return;
+    }
+    if (step) {
+        d_ptr->discard(step, Private::Undoable);
+    }
+    if (!canUndo()) {
+        Q_EMIT canUndoChanged();
+    }
+}
+
+void PPUndoRedoStack::redoItemAdded(PPUndoRedoable* item, qint64 bytes, qint64 step) {
+    if (d_ptr->routed(item, bytes, false)) {
+        return;
+    }
+    push(true, item, bytes, step);
+    Q_EMIT historyChanged();
+}
+
+void PPUndoRedoStack::redoItemRemoved(PPUndoRedoable* item) {
+    if (d_ptr->replays(item)) {
         return;
     }
-    d_ptr->undoItems.removeAt(idx);
-    if (d_ptr->undoItems.length() == 0) {
+    bool found;
+    auto step = d_ptr->takeStep(d_ptr->redo, item, &found);
+    if (!found) {
+        return;
+    }
+    if (step) {
+        d_ptr->discard(step, Private::Redoable);
+    }
+    if (!canRedo()) {
+        Q_EMIT canRedoChanged();
+    }
+}
+
+void PPUndoRedoStack::stepUndone(PPUndoRedoable* item, const PPDelta& delta) {
+    if (d_ptr->routed(item, delta.bytes(), false)) {
+        if (d_ptr->replaying->step) {
+            d_ptr->setState(d_ptr->replaying->step, Private::Redoable, delta);
+        }
+        return;
+    }
+    bool found;
+    auto step = d_ptr->takeStep(d_ptr->undo, item, &found);
+    if (step) {
+        d_ptr->setState(step, Private::Redoable, delta);
+    }
+    if (!canUndo()) {
         Q_EMIT canUndoChanged();
     }
+    push(true, item, delta.bytes(), step);
+    Q_EMIT historyChanged();
 }
 
-void PPUndoRedoStack::redoItemAdded(PPUndoRedoable* item) {
-    d_ptr->redoItems << item;
-    if (d_ptr->redoItems.length()-1 == 0) {
+void PPUndoRedoStack::stepRedone(PPUndoRedoable* item, const PPDelta& delta) {
+    if (d_ptr->routed(item, delta.bytes(), true)) {
+        if (d_ptr->replaying->step) {
+            d_ptr->setState(d_ptr->replaying->step, Private::Undoable, delta);
+        }
+        return;
+    }
+    bool found;
+    auto step = d_ptr->takeStep(d_ptr->redo, item, &found);
+    if (step) {
+        d_ptr->setState(step, Private::Undoable, delta);
+    }
+    if (!canRedo()) {
         Q_EMIT canRedoChanged();
     }
+    push(false, item, delta.bytes(), step);
+    Q_EMIT historyChanged();
 }
 
-void PPUndoRedoStack::redoItemRemoved(PPUndoRedoable* item) {
-    auto idx = d_ptr->redoItems.lastIndexOf(item);
-    if (idx == -1) {
+void PPUndoRedoStack::itemDestroyed(PPUndoRedoable* item) {
+    auto couldUndo = canUndo();
+    auto couldRedo = canRedo();
+    while (auto node = d_ptr->undo.takeLatest(item)) {
+        d_ptr->release(node);
+    }
+    while (auto node = d_ptr->redo.takeLatest(item)) {
+        d_ptr->release(node);
+    }
+    if (couldUndo != canUndo()) {
+        Q_EMIT canUndoChanged();
+    }
+    if (couldRedo != canRedo()) {
+        Q_EMIT canRedoChanged();
+    }
+}
+
+void PPUndoRedoStack::beginMacro() {
+    if (d_ptr->macroDepth++ > 0) {
+        return;
+    }
+    if (!d_ptr->recording) {
+        d_ptr->recording = new PPUndoMacro(this);
+        if (d_ptr->journaled) {
+            d_ptr->recording->number = d_ptr->nextStep.fetchAndAddRelaxed(1);
+        }
+    }
+    d_ptr->macroTransaction = pDB->transaction();
+}
+
+void PPUndoRedoStack::endMacro() {
+    if (d_ptr->macroDepth == 0 || --d_ptr->macroDepth > 0) {
+        return;
+    }
+    // Saves add their steps once the outermost transaction commits, which
+    // may be one the macro is nested in.
+    auto macro = d_ptr->recording;
+    pDB->onCommit([this, macro] {
+        finishMacro(macro);
+    });
+    pDB->onRollback([this, macro] {
+        finishMacro(macro);
+    });
+    if (d_ptr->macroTransaction) {
+        pDB->commit();
+    }
+}
+
+bool PPUndoRedoStack::inMacro() const {
+    return d_ptr->macroDepth > 0;
+}
+
+void PPUndoRedoStack::finishMacro(PPUndoMacro* macro) {
+    if (d_ptr->recording != macro) {
+        return;
+    }
+    d_ptr->recording = nullptr;
+    if (macro->members.isEmpty()) {
+        delete macro;
+        return;
+    }
+    push(false, macro, macro->bytes(), 0);
+    Q_EMIT historyChanged();
+}
+
+// Applies the steps of a macro, latest first, in one transaction. Steps of
+// objects that are gone are read back from the journal, or left out without
+// it. If a step can't be applied, including one that would overwrite unsaved
+// edits, those that were are applied back before the transaction rolls back,
+// so the macro stays where it was.
+void PPUndoRedoStack::replay(PPUndoMacro* macro, bool redo) {
+    auto& from = redo ? d_ptr->redo : d_ptr->undo;
+    if (d_ptr->replaying || !from.latest.contains(macro)) {
+        return;
+    }
+    d_ptr->pruneMembers(from, macro);
+
+    PPTransaction transaction;
+    if (!transaction.isOpen()) {
+        qCritical() << "Couldn't" << (redo ? "redo" : "undo") << "a macro without a transaction";
         return;
     }
-    d_ptr->redoItems.removeAt(idx);
-    if (d_ptr->redoItems.length() == 0) {
+    QList<QSharedPointer<QObject>> loaded;
+    QVector<PPUndoMacro::Member> applied;
+    auto ok = true;
+    for (int i = macro->members.size() - 1; ok && i >= 0; i--) {
+        auto member = macro->members.at(i);
+        if (!member.object && member.step) {
+            auto object = d_ptr->loadStep(member.step, redo, &member.item, &member.bytes);
+            member.object = object.data();
+            loaded << object;
+        }
+        if (!member.object) {
+            continue;
+        }
+        ok = d_ptr->apply(&member, redo);
+        if (ok) {
+            applied << member;
+        }
+    }
+    if (!ok || !transaction.commit()) {
+        qCritical() << "Couldn't" << (redo ? "redo" : "undo") << "a macro, applying its steps back";
+        // Applying the steps back restores the objects and the stacks. Its
+        // writes are rolled back, then the failed transaction if it's still
+        // open, which leaves the database as it was.
+        PPTransaction reverting;
+        for (auto it = applied.rbegin(); it != applied.rend(); ++it) {
+            d_ptr->apply(&*it, !redo);
+        }
+        reverting.rollback();
+        transaction.rollback();
+        return;
+    }
+
+    d_ptr->release(from.takeLatest(macro));
+    if (redo ? !canRedo() : !canUndo()) {
+        if (redo) {
+            Q_EMIT canRedoChanged();
+        } else {
+            Q_EMIT canUndoChanged();
+        }
+    }
+    macro->members = applied;
+    if (macro->members.isEmpty()) {
+        macro->deleteLater();
+        return;
+    }
+    push(!redo, macro, macro->bytes(), 0);
+    Q_EMIT historyChanged();
+}
+
+bool PPUndoRedoStack::setJournaled(bool journaled) {
+    if (journaled && !d_ptr->journaled) {
+        QSqlQuery query(pDB->connection());
+        if (!query.exec(QStringLiteral("CREATE TABLE IF NOT EXISTS pokipoki_undo(STEP INTEGER PRIMARY KEY, STATE INTEGER NOT NULL, TYPE TEXT NOT NULL, ID BLOB NOT NULL, DELTA BLOB NOT NULL, MACRO INTEGER NOT NULL DEFAULT 0)"))) {
+            qCritical() << query.lastError() << "when creating the undo journal";
+            return false;
+        }
+        // Journals written before macros existed lack their column.
+        if (!query.exec(QStringLiteral("SELECT MACRO FROM pokipoki_undo LIMIT 0"))
+            && !query.exec(QStringLiteral("ALTER TABLE pokipoki_undo ADD COLUMN MACRO INTEGER NOT NULL DEFAULT 0"))) {
+            qCritical() << query.lastError() << "when adding macros to the undo journal";
+            return false;
+        }
+        for (const auto& statement : {
+            QStringLiteral("CREATE INDEX IF NOT EXISTS pokipoki_undo_STATE ON pokipoki_undo(STATE, STEP)"),
+            QStringLiteral("CREATE INDEX IF NOT EXISTS pokipoki_undo_MACRO ON pokipoki_undo(MACRO, STEP)"),
+        }) {
+            if (!query.exec(statement)) {
+                qCritical() << query.lastError() << "when creating the undo journal";
+                return false;
+            }
+        }
+        // Macros take their numbers from the same sequence as steps.
+        if (!query.exec(QStringLiteral("SELECT MAX(MAX(STEP), MAX(MACRO)) FROM pokipoki_undo")) || !query.next()) {
+            qCritical() << query.lastError() << "when reading the undo journal";
+            return false;
+        }
+        d_ptr->nextStep.storeRelaxed(query.value(0).toLongLong() + 1);
+        if (!d_ptr->countJournal()) {
+            return false;
+        }
+    }
+    auto couldUndo = canUndo();
+    auto couldRedo = canRedo();
+    d_ptr->journaled = journaled;
+    d_ptr->pruneJournal(true);
+    if (couldUndo != canUndo()) {
+        Q_EMIT canUndoChanged();
+    }
+    if (couldRedo != canRedo()) {
         Q_EMIT canRedoChanged();
     }
+    return true;
 }
 
+bool PPUndoRedoStack::journaled() const {
+    return d_ptr->journaled;
+}
+
+qint64 PPUndoRedoStack::journal(QVector<PPWrite>* writes, const QString& type, const QUuid& ID, const PPDelta& delta) {
+    if (!d_ptr->journaled) {
+        return 0;
+    }
+    auto step = d_ptr->nextStep.fetchAndAddRelaxed(1);
+    PPWrite write;
+    write.statement = QStringLiteral("INSERT INTO pokipoki_undo(STEP, STATE, TYPE, ID, DELTA, MACRO) VALUES (:step, 0, :type, :ID, :delta, :macro)");
+    write.bind(":step", step);
+    write.bind(":type", type);
+    write.bind(":ID", PPKey::encode(ID));
+    write.bind(":delta", PPBinary::encode(delta));
+    write.bind(":macro", d_ptr->recording ? d_ptr->recording->number : 0);
+    *writes << write;
+    // A new step leaves the object's redo steps behind, including those no
+    // longer in memory.
+    PPWrite redone;
+    redone.statement = QStringLiteral("DELETE FROM pokipoki_undo WHERE STATE = 1 AND ID = :ID");
+    redone.bind(":ID", PPKey::encode(ID));
+    *writes << redone;
+    return step;
+}
+
+bool PPUndoRedoStack::registerType(const QString& type, std::function<QSharedPointer<QObject>(const QUuid&)> load) {
+    QMutexLocker locker(&Private::typesMutex());
+    Private::types().insert(type, std::move(load));
+    return true;
+}
+
+// Reads the next step of a stack back from the journal, which the returned
+// objects are kept alive for. The steps of a macro come back together: each
+// object's stack is filled from its latest step down, and the macro applies
+// them in the opposite order to the one they're read in.
+QList<QSharedPointer<QObject>> PPUndoRedoStack::pageIn(bool redo) {
+    QList<QSharedPointer<QObject>> ret;
+    PPStatement query(redo
+        ? QStringLiteral("SELECT STEP, MACRO FROM pokipoki_undo WHERE STATE = 1 ORDER BY STEP LIMIT 1")
+        : QStringLiteral("SELECT STEP, MACRO FROM pokipoki_undo WHERE STATE = 0 ORDER BY STEP DESC LIMIT 1"));
+    while (ret.isEmpty() && query->exec() && query->next()) {
+        auto step = query->value(0).toLongLong();
+        auto number = query->value(1).toLongLong();
+        query->finish();
+
+        PPUndoRedoable* item;
+        qint64 bytes;
+        if (number == 0) {
+            auto object = d_ptr->loadStep(step, redo, &item, &bytes);
+            if (object) {
+                push(redo, item, bytes, step);
+                ret << object;
+            }
+            continue;
+        }
+
+        QVector<qint64> steps;
+        {
+            PPStatement members(redo
+                ? QStringLiteral("SELECT STEP FROM pokipoki_undo WHERE MACRO = :macro AND STATE = 1 ORDER BY STEP")
+                : QStringLiteral("SELECT STEP FROM pokipoki_undo WHERE MACRO = :macro AND STATE = 0 ORDER BY STEP DESC"));
+            members->bindValue(":macro", number);
+            if (!members->exec()) {
+                qCritical() << members->lastError() << "when reading the undo journal";
+                return ret;
+            }
+            while (members->next()) {
+                steps << members->value(0).toLongLong();
+            }
+        }
+        auto macro = new PPUndoMacro(this);
+        macro->number = number;
+        for (auto member : steps) {
+            auto object = d_ptr->loadStep(member, redo, &item, &bytes);
+            if (object) {
+                macro->members.prepend(PPUndoMacro::Member{item, object.data(), bytes, member});
+                ret << object;
+            }
+        }
+        if (macro->members.isEmpty()) {
+            delete macro;
+            continue;
+        }
+        push(redo, macro, macro->bytes(), 0);
+    }
+    if (query->lastError().isValid()) {
+        qCritical() << query->lastError() << "when reading the undo journal";
+    } else if (ret.isEmpty()) {
+        // A count left over from a rolled back move is put right here.
+        d_ptr->journalRows[redo ? Private::Redoable : Private::Undoable] = 0;
+    }
+    return ret;
+}
 
 void PPUndoRedoStack::undo() {
-    if (d_ptr->undoItems.empty()) return;
-    d_ptr->undoItems.last()->undo();
+    QList<QSharedPointer<QObject>> pagedIn;
+    if (!d_ptr->undo.newest && d_ptr->journaled) {
+        pagedIn = pageIn(false);
+    }
+    if (!d_ptr->undo.newest) return;
+    d_ptr->undo.newest->item->undo();
 }
 
 void PPUndoRedoStack::redo() {
-    if (d_ptr->redoItems.empty()) return;
-    d_ptr->redoItems.last()->redo();
+    QList<QSharedPointer<QObject>> pagedIn;
+    if (!d_ptr->redo.newest && d_ptr->journaled) {
+        pagedIn = pageIn(true);
+    }
+    if (!d_ptr->redo.newest) return;
+    d_ptr->redo.newest->item->redo();
+}
+
+PPUndoStep::PPUndoStep(std::function<void()> undo, std::function<void()> redo, QObject* parent)
+    : QObject(parent), m_undo(std::move(undo)), m_redo(std::move(redo))
+{
+}
+
+void PPUndoStep::record(std::function<void()> undo, std::function<void()> redo, qint64 bytes)
+{
+    pDB->onCommit([undo, redo, bytes] {
+        auto step = new PPUndoStep(undo, redo, pUR);
+        step->m_bytes = bytes;
+        pUR->undoItemAdded(step, bytes);
+    });
+}
+
+qint64 PPUndoStep::bytesOf(const QList<QSqlRecord>& rows)
+{
+    qint64 ret = 0;
+    for (const auto& row : rows) {
+        for (int i = 0; i < row.count(); i++) {
+            auto value = row.value(i);
+            ret += qint64(sizeof(QVariant));
+            if (value.type() == QVariant::ByteArray || value.type() == QVariant::String) {
+                ret += value.toByteArray().size();
+            }
+        }
+    }
+    return ret;
+}
+
+void PPUndoStep::undo()
+{
+    pUR->undoItemRemoved(this);
+    m_undo();
+    pUR->redoItemAdded(this, m_bytes);
+}
+
+void PPUndoStep::redo()
+{
+    pUR->redoItemRemoved(this);
+    m_redo();
+    pUR->undoItemAdded(this, m_bytes);
+}
+
+// A step is only ever on one of the stacks, so once it's dropped nothing
+// refers to it anymore.
+void PPUndoStep::undoStepDropped()
+{
+    deleteLater();
+}
+
+void PPUndoStep::redoStepDropped()
+{
+    deleteLater();
+}
+
+static QString aggregateStatement(const QString& table, const QString& expression, PredicateList& predicates, const QString& tail)
+{
+    return QStringLiteral("SELECT %1 FROM %2").arg(expression, table) + predicates.whereClause() + tail;
+}
+
+QVariant PPAggregate::value(const QString& table, const QString& expression, PredicateList& predicates)
+{
+    PPStatement query(aggregateStatement(table, expression, predicates, QString()));
+    predicates.bindAllPredicates(query.data());
+    if (!query->exec() || !query->next()) {
+        qCritical() << query->lastError() << "when computing" << expression << "over" << table;
+        return QVariant();
+    }
+    return query->value(0);
+}
+
+bool PPAggregate::exists(const QString& table, PredicateList& predicates)
+{
+    PPStatement query(aggregateStatement(table, QStringLiteral("1"), predicates, QStringLiteral(" LIMIT 1")));
+    predicates.bindAllPredicates(query.data());
+    if (!query->exec()) {
+        qCritical() << query->lastError() << "when looking for rows in" << table;
+        return false;
+    }
+    return query->next();
+}
+
+QString PPQueryBase::statement(const QString& table, const QString& select, const char* const* columns) const
+{
+    static const char* const operators[] = { "=", "!=", "<", ">", "<=", ">=", "LIKE" };
+    static QHash<QString,QHash<QByteArray,QString>> s_statements;
+    static QMutex s_mutex;
+
+    // The shape is everything the SQL depends on: the clauses' columns,
+    // operators and connectives, the ordering and whether there's a limit.
+    QVarLengthArray<char, 64> shape;
+    auto appendCount = [&shape](int count) {
+        shape.append(reinterpret_cast<const char*>(&count), sizeof(count));
+    };
+    appendCount(m_clauses.size());
+    for (const auto& clause : m_clauses) {
+        shape.append(char(clause.column));
+        shape.append(char(clause.op | (clause.startsOr ? 0x80 : 0)));
+    }
+    appendCount(m_ordering.size());
+    for (const auto& ordering : m_ordering) {
+        shape.append(char(ordering.first));
+        shape.append(char(ordering.second));
+    }
+    shape.append(m_limit >= 0 || m_offset > 0 ? 1 : 0);
+
+    QMutexLocker locker(&s_mutex);
+    auto& statements = s_statements[table];
+    auto found = statements.constFind(QByteArray::fromRawData(shape.constData(), shape.size()));
+    if (found != statements.constEnd()) {
+        return *found;
+    }
+
+    QStringList disjuncts;
+    QStringList conjuncts;
+    for (const auto& clause : m_clauses) {
+        if (clause.startsOr && !conjuncts.isEmpty()) {
+            disjuncts << conjuncts.join(QStringLiteral(" AND "));
+            conjuncts.clear();
+        }
+        conjuncts << QStringLiteral("%1 %2 ?").arg(QLatin1String(columns[clause.column]), QLatin1String(operators[clause.op]));
+    }
+    if (!conjuncts.isEmpty()) {
+        disjuncts << conjuncts.join(QStringLiteral(" AND "));
+    }
+
+    auto ret = QStringLiteral("SELECT %1 FROM %2").arg(select, table);
+    if (disjuncts.length() == 1) {
+        ret += QStringLiteral(" WHERE ") + disjuncts.first();
+    } else if (!disjuncts.isEmpty()) {
+        ret += QStringLiteral(" WHERE (") + disjuncts.join(QStringLiteral(") OR (")) + QStringLiteral(")");
+    }
+    QStringList ordering;
+    for (const auto& order : m_ordering) {
+        ordering << QStringLiteral("%1 %2").arg(QLatin1String(columns[order.first]), order.second == Qt::AscendingOrder ? QStringLiteral("ASC") : QStringLiteral("DESC"));
+    }
+    if (!ordering.isEmpty()) {
+        ret += QStringLiteral(" ORDER BY ") + ordering.join(QStringLiteral(", "));
+    }
+    if (m_limit >= 0 || m_offset > 0) {
+        ret += QStringLiteral(" LIMIT ? OFFSET ?");
+    }
+
+    statements.insert(QByteArray(shape.constData(), shape.size()), ret);
+    return ret;
+}
+
+void PPQueryBase::bind(QSqlQuery* query) const
+{
+    int position = 0;
+    for (const auto& clause : m_clauses) {
+        query->bindValue(position++, clause.value);
+    }
+    if (m_limit >= 0 || m_offset > 0) {
+        query->bindValue(position++, m_limit);
+        query->bindValue(position++, m_offset);
+    }
 }
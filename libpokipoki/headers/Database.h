@@ -1,26 +1,887 @@
 #pragma once
 
+#include <QAtomicInteger>
+#include <QDataStream>
+#include <QDebug>
+#include <QtEndian>
+#include <QFuture>
+#include <QFutureInterface>
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
 #include <QObject>
+#include <QPointer>
+#include <QSharedPointer>
+#include <QSqlError>
 #include <QSqlQuery>
+#include <QSqlRecord>
+#include <QLinkedList>
 #include <QList>
+#include <QMap>
+#include <QPair>
+#include <QStringList>
+#include <QUuid>
 #include <QVariant>
+#include <QVarLengthArray>
+#include <QVector>
+#include <functional>
+#include <iterator>
+#include <type_traits>
 #include <utility>
 
 #define pDB PPDatabase::instance()
 #define pUR PPUndoRedoStack::instance()
 
+// Storage settings applied to every connection as it is opened, before any
+// schema work runs on it.
+struct PPStorageConfig
+{
+    enum class JournalMode { Delete, Truncate, Persist, Memory, WAL, Off };
+    enum class Synchronous { Off, Normal, Full, Extra };
+    enum class TempStore { Default, File, Memory };
+
+    JournalMode journalMode = JournalMode::Delete;
+    Synchronous synchronous = Synchronous::Full;
+    // Page cache per connection, in KiB.
+    int cacheSize = 2000;
+    // Bytes of the file to memory map, 0 disables mmap.
+    qint64 mmapSize = 0;
+    TempStore tempStore = TempStore::Default;
+    // Only takes effect when the database file is created.
+    int pageSize = 4096;
+    // How long a connection waits for another one's lock, in milliseconds.
+    int busyTimeout = 5000;
+
+    // SQLite's defaults: a rollback journal and a sync on every commit, so a
+    // committed transaction survives power loss. Readers block the writer.
+    static PPStorageConfig durable();
+    // WAL with synchronous=NORMAL, a 64 MiB cache, 256 MiB of mmap and
+    // temporary tables in memory. Readers and the writer no longer block each
+    // other. A power loss can drop the last commits but not corrupt the file.
+    static PPStorageConfig throughput();
+};
+
+// IDs are stored as the 16 bytes of the UUID in RFC 4122 order, so keys are
+// fixed width and compare with a plain memcmp. decode() also reads the text
+// form that files written before the switch contain.
+struct PPKey
+{
+    static QVariant encode(const QUuid& ID);
+    static QUuid decode(const QVariant& value);
+};
+
+// How a property's type is bound to and read from its column. Integers and
+// booleans are bound as 64-bit integers and floating point numbers as doubles,
+// which SQLite stores natively in INTEGER and REAL columns. Anything else is
+// left to the driver, which serialises what it doesn't know.
+template<class T, class Enable = void>
+struct PPColumn
+{
+    static QVariant bind(const T& value) { return QVariant::fromValue(value); }
+    static T read(const QVariant& value) { return value.value<T>(); }
+};
+
+template<class T>
+struct PPColumn<T, typename std::enable_if<std::is_integral<T>::value>::type>
+{
+    static QVariant bind(T value) { return QVariant(qlonglong(value)); }
+    static T read(const QVariant& value) { return T(value.toLongLong()); }
+};
+
+template<class T>
+struct PPColumn<T, typename std::enable_if<std::is_floating_point<T>::value>::type>
+{
+    static QVariant bind(T value) { return QVariant(double(value)); }
+    static T read(const QVariant& value) { return T(value.toDouble()); }
+};
+
+// Compound properties are stored in pokipoki's own binary format: a version
+// byte followed by the value. Sizes and integers are varints, with integers
+// zigzag encoded, floating point numbers are their little endian IEEE bits,
+// and strings are UTF-8. Containers are their element count followed by their
+// elements. Types the format doesn't know are written with QDataStream,
+// prefixed by their length.
+class PPCodecWriter
+{
+    QByteArray m_buffer;
+
+public:
+    void writeVarint(quint64 value) {
+        while (value >= 0x80) {
+            m_buffer.append(char(value | 0x80));
+            value >>= 7;
+        }
+        m_buffer.append(char(value));
+    }
+    void writeBytes(const char* data, int size) {
+        writeVarint(quint64(size));
+        m_buffer.append(data, size);
+    }
+    void writeFixed(const char* data, int size) {
+        m_buffer.append(data, size);
+    }
+    QByteArray buffer() const { return m_buffer; }
+};
+
+// Reads straight from the buffer it's given, which must outlive it. A read
+// past the end marks the reader as failed and returns empty values.
+class PPCodecReader
+{
+    const char* m_pos;
+    const char* m_end;
+    bool m_ok = true;
+
+public:
+    PPCodecReader(const char* data, int size) : m_pos(data), m_end(data + size) {}
+
+    bool ok() const { return m_ok; }
+    bool atEnd() const { return m_pos == m_end; }
+
+    quint64 readVarint() {
+        quint64 ret = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (m_pos == m_end) {
+                m_ok = false;
+                return 0;
+            }
+            auto byte = quint8(*m_pos++);
+            ret |= quint64(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                return ret;
+            }
+        }
+        m_ok = false;
+        return 0;
+    }
+    // Returns a pointer into the buffer, or nullptr if it is too short.
+    const char* readFixed(int size) {
+        if (!m_ok || size < 0 || m_end - m_pos < size) {
+            m_ok = false;
+            return nullptr;
+        }
+        auto ret = m_pos;
+        m_pos += size;
+        return ret;
+    }
+    const char* readBytes(int* size) {
+        auto length = readVarint();
+        if (length > quint64(m_end - m_pos)) {
+            m_ok = false;
+            *size = 0;
+            return nullptr;
+        }
+        *size = int(length);
+        return readFixed(*size);
+    }
+    // Element counts are bounded by the bytes left, so a corrupt count can't
+    // make a container reserve more than the value could hold.
+    int readCount() {
+        auto count = readVarint();
+        if (count > quint64(m_end - m_pos)) {
+            m_ok = false;
+            return 0;
+        }
+        return int(count);
+    }
+};
+
+template<class T, class Enable = void>
+struct PPCodec
+{
+    static void write(PPCodecWriter& writer, const T& value) {
+        QByteArray bytes;
+        QDataStream stream(&bytes, QIODevice::WriteOnly);
+        stream << value;
+        writer.writeBytes(bytes.constData(), bytes.size());
+    }
+    static T read(PPCodecReader& reader) {
+        int size;
+        auto data = reader.readBytes(&size);
+        T ret;
+        if (data != nullptr) {
+            auto bytes = QByteArray::fromRawData(data, size);
+            QDataStream stream(bytes);
+            stream >> ret;
+        }
+        return ret;
+    }
+};
+
+template<class T>
+struct PPCodec<T, typename std::enable_if<std::is_integral<T>::value>::type>
+{
+    static void write(PPCodecWriter& writer, T value) {
+        auto wide = qint64(value);
+        writer.writeVarint((quint64(wide) << 1) ^ quint64(wide >> 63));
+    }
+    static T read(PPCodecReader& reader) {
+        auto zigzag = reader.readVarint();
+        return T(qint64(zigzag >> 1) ^ -qint64(zigzag & 1));
+    }
+};
+
+template<class T>
+struct PPCodec<T, typename std::enable_if<std::is_floating_point<T>::value>::type>
+{
+    static void write(PPCodecWriter& writer, T value) {
+        auto bits = qToLittleEndian(value);
+        writer.writeFixed(reinterpret_cast<const char*>(&bits), sizeof(T));
+    }
+    static T read(PPCodecReader& reader) {
+        auto data = reader.readFixed(sizeof(T));
+        return data == nullptr ? T() : qFromLittleEndian<T>(data);
+    }
+};
+
+template<>
+struct PPCodec<QString>
+{
+    static void write(PPCodecWriter& writer, const QString& value) {
+        auto utf8 = value.toUtf8();
+        writer.writeBytes(utf8.constData(), utf8.size());
+    }
+    static QString read(PPCodecReader& reader) {
+        int size;
+        auto data = reader.readBytes(&size);
+        return data == nullptr ? QString() : QString::fromUtf8(data, size);
+    }
+};
+
+template<>
+struct PPCodec<QByteArray>
+{
+    static void write(PPCodecWriter& writer, const QByteArray& value) {
+        writer.writeBytes(value.constData(), value.size());
+    }
+    static QByteArray read(PPCodecReader& reader) {
+        int size;
+        auto data = reader.readBytes(&size);
+        return data == nullptr ? QByteArray() : QByteArray(data, size);
+    }
+};
+
+template<class Sequence>
+struct PPSequenceCodec
+{
+    using Element = typename Sequence::value_type;
+
+    static void write(PPCodecWriter& writer, const Sequence& value) {
+        writer.writeVarint(quint64(value.size()));
+        for (const auto& element : value) {
+            PPCodec<Element>::write(writer, element);
+        }
+    }
+    static Sequence read(PPCodecReader& reader) {
+        Sequence ret;
+        auto count = reader.readCount();
+        reserve(ret, count);
+        for (int i = 0; i < count && reader.ok(); i++) {
+            ret.append(PPCodec<Element>::read(reader));
+        }
+        return ret;
+    }
+
+private:
+    template<class S>
+    static auto reserve(S& sequence, int count) -> decltype(sequence.reserve(count)) {
+        sequence.reserve(count);
+    }
+    static void reserve(...) {}
+};
+
+template<class T>
+struct PPCodec<QList<T>> : PPSequenceCodec<QList<T>> {};
+template<class T>
+struct PPCodec<QVector<T>> : PPSequenceCodec<QVector<T>> {};
+template<class T>
+struct PPCodec<QLinkedList<T>> : PPSequenceCodec<QLinkedList<T>> {};
+
+template<class Map>
+struct PPMapCodec
+{
+    using Key = typename Map::key_type;
+    using Value = typename Map::mapped_type;
+
+    static void write(PPCodecWriter& writer, const Map& value) {
+        writer.writeVarint(quint64(value.size()));
+        for (auto it = value.cbegin(); it != value.cend(); ++it) {
+            PPCodec<Key>::write(writer, it.key());
+            PPCodec<Value>::write(writer, it.value());
+        }
+    }
+    static Map read(PPCodecReader& reader) {
+        Map ret;
+        auto count = reader.readCount();
+        reserve(ret, count);
+        for (int i = 0; i < count && reader.ok(); i++) {
+            auto key = PPCodec<Key>::read(reader);
+            insert(ret, key, PPCodec<Value>::read(reader));
+        }
+        return ret;
+    }
+
+private:
+    template<class M>
+    static auto reserve(M& map, int count) -> decltype(map.reserve(count)) {
+        map.reserve(count);
+    }
+    static void reserve(...) {}
+    // Keys were written in order, so each one goes at the end of a QMap.
+    static void insert(QMap<Key,Value>& map, const Key& key, const Value& value) {
+        map.insert(map.cend(), key, value);
+    }
+    static void insert(QHash<Key,Value>& hash, const Key& key, const Value& value) {
+        hash.insert(key, value);
+    }
+};
+
+template<class K, class V>
+struct PPCodec<QMap<K,V>> : PPMapCodec<QMap<K,V>> {};
+template<class K, class V>
+struct PPCodec<QHash<K,V>> : PPMapCodec<QHash<K,V>> {};
+
+template<class A, class B>
+struct PPCodec<QPair<A,B>>
+{
+    static void write(PPCodecWriter& writer, const QPair<A,B>& value) {
+        PPCodec<A>::write(writer, value.first);
+        PPCodec<B>::write(writer, value.second);
+    }
+    static QPair<A,B> read(PPCodecReader& reader) {
+        auto first = PPCodec<A>::read(reader);
+        return qMakePair(first, PPCodec<B>::read(reader));
+    }
+};
+
+struct PPBinary
+{
+    static const char Version = 1;
+
+    template<class T>
+    static QByteArray encode(const T& value) {
+        PPCodecWriter writer;
+        writer.writeFixed(&Version, 1);
+        PPCodec<T>::write(writer, value);
+        return writer.buffer();
+    }
+    // Decodes from bytes' own buffer. Anything that isn't a complete value in
+    // a known version, like the strings older versions stored, decodes to an
+    // empty T.
+    template<class T>
+    static T decode(const QByteArray& bytes, bool* ok = nullptr) {
+        PPCodecReader reader(bytes.constData(), bytes.size());
+        auto version = reader.readFixed(1);
+        T ret;
+        bool valid = version != nullptr && *version == Version;
+        if (valid) {
+            ret = PPCodec<T>::read(reader);
+            valid = reader.ok() && reader.atEnd();
+            if (!valid) {
+                ret = T();
+            }
+        }
+        if (ok != nullptr) {
+            *ok = valid;
+        }
+        return ret;
+    }
+};
+
+template<class T>
+struct PPBinaryColumn
+{
+    static QVariant bind(const T& value) { return PPBinary::encode(value); }
+    static T read(const QVariant& value) { return PPBinary::decode<T>(value.toByteArray()); }
+};
+
+template<class T>
+struct PPColumn<QList<T>> : PPBinaryColumn<QList<T>> {};
+template<class T>
+struct PPColumn<QVector<T>> : PPBinaryColumn<QVector<T>> {};
+template<class T>
+struct PPColumn<QLinkedList<T>> : PPBinaryColumn<QLinkedList<T>> {};
+template<class K, class V>
+struct PPColumn<QMap<K,V>> : PPBinaryColumn<QMap<K,V>> {};
+template<class K, class V>
+struct PPColumn<QHash<K,V>> : PPBinaryColumn<QHash<K,V>> {};
+template<class A, class B>
+struct PPColumn<QPair<A,B>> : PPBinaryColumn<QPair<A,B>> {};
+
+// Values of unknown type, like predicate operands, are normalised the same way
+// by looking at what the variant holds.
+template<>
+struct PPColumn<QVariant>
+{
+    static QVariant bind(const QVariant& value);
+    static QVariant read(const QVariant& value) { return value; }
+};
+
+// A statement and the values to bind to it, detached from any connection so
+// it can be run on another thread.
+struct PPWrite
+{
+    QString statement;
+    QVector<QPair<QString,QVariant>> bindings;
+
+    void bind(const QString& placeholder, const QVariant& value) {
+        bindings << qMakePair(placeholder, value);
+    }
+    void bindTo(QSqlQuery* query) const {
+        for (const auto& binding : bindings) {
+            query->bindValue(binding.first, binding.second);
+        }
+    }
+    // Runs the statement on the calling thread's connection.
+    bool exec() const;
+};
+
+// A change to one row of an object's table, published by PPDatabase once
+// the transaction that made it commits.
+struct PPRowChange
+{
+    // Reset means many rows of the table changed at once, as with a bulk
+    // insert, and subscribers should read it again.
+    enum Kind { Inserted, Updated, Deleted, Reparented, Reset };
+    // Set-based writes touching more rows than this publish one Reset
+    // instead of a change per row.
+    static const int ResetThreshold = 256;
+
+    Kind kind = Updated;
+    QString table;
+    QUuid ID;
+    // For updates, the properties that changed, as bits in the order the
+    // object declares them.
+    quint64 properties = 0;
+    // For reparents, the parent column that changed and its values. Deleting
+    // a row with parents reparents it to none before it's deleted.
+    QString parentColumn;
+    QUuid previousParent;
+    QUuid parent;
+    // For deletions from tables with a rowid, the rowid the row had, so models
+    // ordered by it can find where it was. 0 when it isn't known.
+    qint64 rowid = 0;
+};
+Q_DECLARE_METATYPE(PPRowChange)
+
 class PPDatabase : public QObject
 {
     Q_OBJECT
 
 private:
     PPDatabase(QObject *parent);
+    ~PPDatabase() override;
     class Private;
     Private *d_ptr;
 
+    friend class PPStatement;
+    QSqlQuery* checkoutStatement(const QString& statement, bool* prepared);
+    void checkinStatement(const QString& statement, QSqlQuery* query, bool prepared);
+
 public:
     static PPDatabase* instance();
+
+    // Each thread gets its own connection to the database file, opened on
+    // first use and closed when the thread exits. releaseConnection() closes
+    // the calling thread's connection early, e.g. for pooled threads.
     QSqlDatabase& connection();
+    void releaseConnection();
+
+    // Call before the first object is touched. Connections that are already
+    // open keep the settings they were opened with.
+    void setStorageConfig(const PPStorageConfig& config);
+    PPStorageConfig storageConfig() const;
+
+    // Unit of work on the calling thread's connection. The outermost
+    // transaction() issues a BEGIN IMMEDIATE, nested calls open savepoints
+    // that commit() releases and rollback() unwinds.
+    bool transaction();
+    bool commit();
+    bool rollback();
+    bool inTransaction() const;
+    int transactionDepth() const;
+
+    // Callbacks run once the outermost transaction commits, or when the
+    // level they were registered at (or an enclosing one) is rolled back.
+    // Outside of a transaction onCommit runs immediately.
+    void onCommit(std::function<void()> callback);
+    void onRollback(std::function<void()> callback);
+
+    // Emits rowChanged() once the current transaction commits, on the
+    // calling thread, after its onCommit() callbacks. Changes that are rolled
+    // back are never published, and updates of a row are folded into its
+    // earlier update or insert in the same transaction.
+    void publishRowChange(const PPRowChange& change);
+    Q_SIGNAL void rowChanged(const PPRowChange& change);
+
+    // Deleted rows are queued on the calling thread's connection, with the
+    // IDs' entries in sideTables, and written with one DELETE per table for
+    // every few hundred IDs. The queue is written as part of the next commit,
+    // on the next turn of the thread's event loop, by flushDeletes(), and
+    // when the connection closes or the application quits. changes are
+    // published once the deletion commits.
+    void queueDelete(const QString& table, const QUuid& ID, const QStringList& sideTables, const QVector<PPRowChange>& changes);
+    // Writes the queue now, unless a transaction is open, which writes it
+    // when it commits. Failed deletions stay queued and are tried again a
+    // second later.
+    bool flushDeletes();
+    int pendingDeletes() const;
+
+    // Prepared statements are kept in a bounded least-recently-used cache
+    // per connection, keyed by their SQL text. Use PPStatement to borrow one.
+    // The counters are totals over all connections.
+    int statementCacheCapacity() const;
+    void setStatementCacheCapacity(int capacity);
+    quint64 statementCacheHits() const;
+    quint64 statementCacheMisses() const;
+
+    // The persistence thread owns its own connection and runs enqueued jobs
+    // one at a time, in the order they were enqueued. waitForQueue() blocks
+    // until every job enqueued so far has run.
+    void enqueue(std::function<void()> job);
+    void waitForQueue();
+
+    // An object living in the calling thread, for posting results back to it.
+    QObject* threadContext();
+
+    // Runs work on the persistence thread, then finish on the calling thread
+    // with work's result. The future reports finish's result, so finish is the
+    // place to touch objects that belong to the caller.
+    template<class Rows, class Result>
+    QFuture<Result> runAsync(std::function<Rows()> work, std::function<Result(const Rows&)> finish) {
+        auto promise = QSharedPointer<QFutureInterface<Result>>::create();
+        promise->reportStarted();
+        QPointer<QObject> context(threadContext());
+        enqueue([promise, context, work, finish] {
+            auto rows = work();
+            if (context.isNull()) {
+                promise->reportCanceled();
+                promise->reportFinished();
+                return;
+            }
+            QMetaObject::invokeMethod(context.data(), [promise, rows, finish] {
+                promise->reportResult(finish(rows));
+                promise->reportFinished();
+            }, Qt::QueuedConnection);
+        });
+        return promise->future();
+    }
+
+    // Rewrites the IDs stored as text by older versions in the given columns
+    // of table as 16-byte keys, in place and in one transaction. Tables record
+    // their key format in pokipoki_meta, so this only scans them once.
+    bool migrateKeys(const QString& table, const QStringList& columns);
+
+    static QList<QSqlRecord> records(QSqlQuery* query);
+    // Writes records back into table as new rows, with the columns they hold.
+    static bool insertRecords(const QString& table, const QList<QSqlRecord>& records);
+};
+
+// PPStatement borrows a prepared statement from PPDatabase's cache for as long
+// as it lives, preparing it on a miss. A statement that is already borrowed is
+// prepared again rather than shared, so statements can be nested freely.
+class PPStatement
+{
+    QString m_statement;
+    QSqlQuery* m_query;
+    bool m_prepared;
+
+public:
+    explicit PPStatement(const QString& statement);
+    ~PPStatement();
+
+    QSqlQuery* data() const { return m_query; }
+    QSqlQuery* operator->() const { return m_query; }
+    QSqlQuery& operator*() const { return *m_query; }
+
+    PPStatement(const PPStatement&) = delete;
+    PPStatement& operator=(const PPStatement&) = delete;
+};
+
+class PPTransaction
+{
+    bool m_open;
+
+public:
+    PPTransaction();
+    ~PPTransaction();
+    // False when BEGIN failed, in which case nothing should be written under it.
+    bool isOpen() const { return m_open; }
+    bool commit();
+    void rollback();
+
+    PPTransaction(const PPTransaction&) = delete;
+    PPTransaction& operator=(const PPTransaction&) = delete;
+};
+
+// Collection properties marked with @table are stored in a side table of
+// (OWNER_ID, KEY, VALUE) rows, where lists are keyed by position. Mutators
+// record a delta per change, so a save only writes the rows that changed and
+// an undo step only holds the deltas.
+struct PPSideTable
+{
+    static QString createStatement(const QString& table, const QString& keyType, const QString& valueType);
+    static PPWrite clear(const QString& table, const QUuid& owner);
+    static PPWrite insert(const QString& table, const QUuid& owner, const QVariant& key, const QVariant& value);
+    static QList<QPair<QVariant,QVariant>> load(const QString& table, const QUuid& owner);
+};
+
+template<class Map>
+struct PPMapTable
+{
+    using Key = typename Map::key_type;
+    using Value = typename Map::mapped_type;
+
+    struct Delta {
+        Key key;
+        bool hadValue;
+        Value previous;
+        bool hasValue;
+        Value value;
+
+        Delta inverted() const { return {key, hasValue, value, hadValue, previous}; }
+        bool isNoop() const { return hadValue == hasValue && (!hasValue || previous == value); }
+
+        void write(PPCodecWriter& writer) const {
+            PPCodec<Key>::write(writer, key);
+            writer.writeVarint(quint64(hadValue) | quint64(hasValue) << 1);
+            if (hadValue) {
+                PPCodec<Value>::write(writer, previous);
+            }
+            if (hasValue) {
+                PPCodec<Value>::write(writer, value);
+            }
+        }
+        static Delta read(PPCodecReader& reader) {
+            Delta ret{PPCodec<Key>::read(reader), false, Value(), false, Value()};
+            auto flags = reader.readVarint();
+            ret.hadValue = flags & 1;
+            ret.hasValue = flags & 2;
+            if (ret.hadValue) {
+                ret.previous = PPCodec<Value>::read(reader);
+            }
+            if (ret.hasValue) {
+                ret.value = PPCodec<Value>::read(reader);
+            }
+            return ret;
+        }
+    };
+
+    static Delta insert(Map& map, const Key& key, const Value& value) {
+        Delta delta{key, map.contains(key), map.value(key), true, value};
+        map.insert(key, value);
+        return delta;
+    }
+    static Delta remove(Map& map, const Key& key) {
+        Delta delta{key, map.contains(key), map.value(key), false, Value()};
+        map.remove(key);
+        return delta;
+    }
+    static void apply(Map& map, const Delta& delta) {
+        if (delta.hasValue) {
+            map.insert(delta.key, delta.value);
+        } else {
+            map.remove(delta.key);
+        }
+    }
+
+    static void write(QVector<PPWrite>* writes, const QString& table, const QUuid& owner, const Delta& delta) {
+        if (delta.hasValue) {
+            *writes << PPSideTable::insert(table, owner, PPColumn<Key>::bind(delta.key), PPColumn<Value>::bind(delta.value));
+            return;
+        }
+        PPWrite write;
+        write.statement = QStringLiteral("DELETE FROM %1 WHERE OWNER_ID = :owner AND KEY = :key").arg(table);
+        write.bind(":owner", PPKey::encode(owner));
+        write.bind(":key", PPColumn<Key>::bind(delta.key));
+        *writes << write;
+    }
+    static void replace(QVector<PPWrite>* writes, const QString& table, const QUuid& owner, const Map& map) {
+        *writes << PPSideTable::clear(table, owner);
+        for (auto it = map.cbegin(); it != map.cend(); ++it) {
+            *writes << PPSideTable::insert(table, owner, PPColumn<Key>::bind(it.key()), PPColumn<Value>::bind(it.value()));
+        }
+    }
+    static Map load(const QString& table, const QUuid& owner) {
+        Map ret;
+        for (const auto& row : PPSideTable::load(table, owner)) {
+            ret.insert(PPColumn<Key>::read(row.first), PPColumn<Value>::read(row.second));
+        }
+        return ret;
+    }
+};
+
+template<class List>
+struct PPListTable
+{
+    using Value = typename List::value_type;
+
+    struct Delta {
+        bool inserted;
+        int index;
+        Value value;
+
+        Delta inverted() const { return {!inserted, index, value}; }
+        bool isNoop() const { return false; }
+
+        // The index is shifted left to make room for inserted.
+        void write(PPCodecWriter& writer) const {
+            writer.writeVarint(quint64(index) << 1 | quint64(inserted));
+            PPCodec<Value>::write(writer, value);
+        }
+        static Delta read(PPCodecReader& reader) {
+            auto head = reader.readVarint();
+            return {bool(head & 1), int(head >> 1), PPCodec<Value>::read(reader)};
+        }
+    };
+
+    static Delta insert(List& list, int index, const Value& value) {
+        list.insert(index, value);
+        return {true, index, value};
+    }
+    static Delta remove(List& list, int index) {
+        Delta delta{false, index, list.at(index)};
+        list.removeAt(index);
+        return delta;
+    }
+    static void apply(List& list, const Delta& delta) {
+        if (delta.inserted) {
+            list.insert(delta.index, delta.value);
+        } else {
+            list.removeAt(delta.index);
+        }
+    }
+
+    static void write(QVector<PPWrite>* writes, const QString& table, const QUuid& owner, const Delta& delta) {
+        if (delta.inserted) {
+            shift(writes, table, owner, delta.index, 1);
+            *writes << PPSideTable::insert(table, owner, delta.index, PPColumn<Value>::bind(delta.value));
+            return;
+        }
+        PPWrite write;
+        write.statement = QStringLiteral("DELETE FROM %1 WHERE OWNER_ID = :owner AND KEY = :key").arg(table);
+        write.bind(":owner", PPKey::encode(owner));
+        write.bind(":key", delta.index);
+        *writes << write;
+        shift(writes, table, owner, delta.index + 1, -1);
+    }
+    static void replace(QVector<PPWrite>* writes, const QString& table, const QUuid& owner, const List& list) {
+        *writes << PPSideTable::clear(table, owner);
+        for (int i = 0; i < list.size(); i++) {
+            *writes << PPSideTable::insert(table, owner, i, PPColumn<Value>::bind(list.at(i)));
+        }
+    }
+    static List load(const QString& table, const QUuid& owner) {
+        List ret;
+        for (const auto& row : PPSideTable::load(table, owner)) {
+            ret.append(PPColumn<Value>::read(row.second));
+        }
+        return ret;
+    }
+
+private:
+    // SQLite checks the primary key row by row, so the positions from on are
+    // moved out of the way to negative values first.
+    static void shift(QVector<PPWrite>* writes, const QString& table, const QUuid& owner, int from, int by) {
+        PPWrite out;
+        out.statement = QStringLiteral("UPDATE %1 SET KEY = -(KEY + :by) - 1 WHERE OWNER_ID = :owner AND KEY >= :from").arg(table);
+        out.bind(":by", by);
+        out.bind(":owner", PPKey::encode(owner));
+        out.bind(":from", from);
+        PPWrite back;
+        back.statement = QStringLiteral("UPDATE %1 SET KEY = -KEY - 1 WHERE OWNER_ID = :owner AND KEY < 0").arg(table);
+        back.bind(":owner", PPKey::encode(owner));
+        *writes << out << back;
+    }
+};
+
+// What an undo step of an object holds: the values its properties had before
+// the step, then the side table deltas it applied, each in property order and
+// in the PPCodec format. Properties the step didn't touch take no space.
+class PPDelta
+{
+    quint64 m_values = 0;
+    quint64 m_edits = 0;
+    QByteArray m_data;
+
+    friend struct PPCodec<PPDelta>;
+
+public:
+    // Values have to be added before edits, and both in property order.
+    class Writer
+    {
+        quint64 m_values = 0;
+        quint64 m_edits = 0;
+        PPCodecWriter m_writer;
+
+    public:
+        template<class T>
+        void value(int property, const T& value) {
+            m_values |= quint64(1) << property;
+            PPCodec<T>::write(m_writer, value);
+        }
+        template<class Delta>
+        void edits(int property, const QList<Delta>& deltas) {
+            m_edits |= quint64(1) << property;
+            m_writer.writeVarint(quint64(deltas.size()));
+            for (const auto& delta : deltas) {
+                delta.write(m_writer);
+            }
+        }
+        PPDelta finish() const {
+            PPDelta ret;
+            ret.m_values = m_values;
+            ret.m_edits = m_edits;
+            ret.m_data = m_writer.buffer();
+            ret.m_data.squeeze();
+            return ret;
+        }
+    };
+
+    // Reads in the order the writer wrote, from the delta's own buffer.
+    class Reader
+    {
+        PPCodecReader m_reader;
+
+    public:
+        explicit Reader(const PPDelta& delta) : m_reader(delta.m_data.constData(), delta.m_data.size()) {}
+
+        template<class T>
+        T value() { return PPCodec<T>::read(m_reader); }
+        template<class Delta>
+        QList<Delta> edits() {
+            QList<Delta> ret;
+            auto count = m_reader.readCount();
+            for (int i = 0; i < count && m_reader.ok(); i++) {
+                ret << Delta::read(m_reader);
+            }
+            return ret;
+        }
+    };
+
+    bool isEmpty() const { return (m_values | m_edits) == 0; }
+    bool hasValue(int property) const { return m_values & (quint64(1) << property); }
+    bool hasEdits(int property) const { return m_edits & (quint64(1) << property); }
+    // Every property the step touched, as bits in declaration order.
+    quint64 properties() const { return m_values | m_edits; }
+    qint64 bytes() const { return qint64(sizeof(PPDelta)) + m_data.size(); }
+};
+
+// Lets PPBinary write deltas to the undo journal.
+template<>
+struct PPCodec<PPDelta>
+{
+    static void write(PPCodecWriter& writer, const PPDelta& value) {
+        writer.writeVarint(value.m_values);
+        writer.writeVarint(value.m_edits);
+        writer.writeBytes(value.m_data.constData(), value.m_data.size());
+    }
+    static PPDelta read(PPCodecReader& reader) {
+        PPDelta ret;
+        ret.m_values = reader.readVarint();
+        ret.m_edits = reader.readVarint();
+        ret.m_data = PPCodec<QByteArray>::read(reader);
+        return ret;
+    }
 };
 
 class PPUndoRedoable
@@ -29,9 +890,34 @@ public:
     virtual ~PPUndoRedoable() {}
     virtual void undo() = 0;
     virtual void redo() = 0;
+    // PPUndoRedoStack dropped the item's oldest undo or redo step to stay
+    // within its budget, so the item should forget it too.
+    virtual void undoStepDropped() {}
+    virtual void redoStepDropped() {}
+    // PPUndoRedoStack read a step of the item back from its journal, which is
+    // older than any the item holds. The stack records it itself.
+    virtual void undoStepLoaded(const PPDelta& delta) { Q_UNUSED(delta) }
+    virtual void redoStepLoaded(const PPDelta& delta) { Q_UNUSED(delta) }
 };
 Q_DECLARE_INTERFACE(PPUndoRedoable, "PPUndoRedoable")
 
+// How much history PPUndoRedoStack keeps in memory, counting both stacks. When
+// either limit is exceeded, the oldest undo steps are dropped, then the redo
+// steps furthest away, then the latest undo step. 0 means no limit. Steps in
+// the journal stay there.
+struct PPUndoBudget
+{
+    int maxSteps = 0;
+    // The bytes items report for their steps, plus the stack's own overhead.
+    qint64 maxBytes = 32 * 1024 * 1024;
+    // How many undoable steps the journal keeps, counting each step of a
+    // macro. The oldest are deleted when the journal is turned on or the
+    // budget set, and once new steps take it a quarter past the limit.
+    int maxJournalSteps = 0;
+};
+
+class PPUndoMacro;
+
 class PPUndoRedoStack : public QObject
 {
     Q_OBJECT
@@ -43,24 +929,219 @@ private:
     PPUndoRedoStack(QObject *parent);
     class Private;
     Private *d_ptr;
+    friend class PPUndoMacro;
+
+    void push(bool redo, PPUndoRedoable* item, qint64 bytes, qint64 step);
+    void trim();
+    QList<QSharedPointer<QObject>> pageIn(bool redo);
+    void finishMacro(PPUndoMacro* macro);
+    void replay(PPUndoMacro* macro, bool redo);
 
 public:
     static PPUndoRedoStack* instance();
-    void undoItemAdded(PPUndoRedoable* item);
+    ~PPUndoRedoStack() override;
+
+    // Items push a step with its size in bytes and its number in the journal,
+    // if it has one, and remove their latest step when they discard it. All of
+    // these take constant time, unless the item's latest step is in a macro.
+    // Removing a journaled step deletes its row. Undoing or redoing a step of
+    // a macro by itself takes it out of the macro.
+    void undoItemAdded(PPUndoRedoable* item, qint64 bytes = 0, qint64 step = 0);
     void undoItemRemoved(PPUndoRedoable* item);
-    void redoItemAdded(PPUndoRedoable* item);
+    void redoItemAdded(PPUndoRedoable* item, qint64 bytes = 0, qint64 step = 0);
     void redoItemRemoved(PPUndoRedoable* item);
+    // Moves item's latest step to the other stack, where it's now delta.
+    void stepUndone(PPUndoRedoable* item, const PPDelta& delta);
+    void stepRedone(PPUndoRedoable* item, const PPDelta& delta);
+    // Drops every step of item from memory, as it's going away.
+    void itemDestroyed(PPUndoRedoable* item);
+
+    // With the journal on, steps of objects are also written to the
+    // pokipoki_undo table of the calling thread's connection, which keeps them
+    // across sessions. Only the budget is kept in memory, and undo() and redo()
+    // read older steps back one at a time when they reach them.
+    bool setJournaled(bool journaled);
+    bool journaled() const;
+    // Appends the writes recording a new step of the object to writes, so they
+    // commit with them, which also drop the object's journaled redo steps.
+    // Returns the step's number, or 0 with the journal off.
+    qint64 journal(QVector<PPWrite>* writes, const QString& type, const QUuid& ID, const PPDelta& delta);
+    // How to get hold of the object with an ID, for steps read back from the
+    // journal. Generated code registers every type.
+    static bool registerType(const QString& type, std::function<QSharedPointer<QObject>(const QUuid&)> load);
+
+    // Groups the steps of every save() on the calling thread until the
+    // matching endMacro() into one step, which undo() and redo() apply in a
+    // single transaction. The outermost beginMacro() opens a transaction that
+    // endMacro() commits, so the saves are written together too. Macros nest.
+    // saveAsync() adds its step once the write finishes, so it only joins a
+    // macro that's still open by then.
+    void beginMacro();
+    void endMacro();
+    bool inMacro() const;
+
+    void setBudget(const PPUndoBudget& budget);
+    PPUndoBudget budget() const;
+    int undoSteps() const;
+    int redoSteps() const;
+    qint64 bytes() const;
+
     bool canUndo() const;
     bool canRedo() const;
     Q_SIGNAL void canUndoChanged();
     Q_SIGNAL void canRedoChanged();
+    // Emitted once for every step added, undone or redone. A macro is one
+    // step.
+    Q_SIGNAL void historyChanged();
+    // Apply the latest step, unless it would overwrite unsaved edits of its
+    // object, or of any object in a macro, in which case nothing changes.
     Q_INVOKABLE void undo();
     Q_INVOKABLE void redo();
 };
 
+// An undo step for a change that isn't held by an object, like a set-based
+// update, that undoes and redoes itself through callbacks.
+class PPUndoStep : public QObject, public PPUndoRedoable
+{
+    Q_OBJECT
+    Q_INTERFACES(PPUndoRedoable)
+
+    std::function<void()> m_undo;
+    std::function<void()> m_redo;
+
+public:
+    PPUndoStep(std::function<void()> undo, std::function<void()> redo, QObject* parent = nullptr);
+    // Adds a step to PPUndoRedoStack once the current transaction commits.
+    // bytes is roughly what the callbacks hold, for the stack's budget.
+    static void record(std::function<void()> undo, std::function<void()> redo, qint64 bytes = 0);
+    static qint64 bytesOf(const QList<QSqlRecord>& rows);
+
+    void undo() override;
+    void redo() override;
+    void undoStepDropped() override;
+    void redoStepDropped() override;
+
+private:
+    qint64 m_bytes = 0;
+};
+
+// A row held in memory, read by position like a query's current row.
+struct PPValueRow
+{
+    QVector<QVariant> values;
+
+    QVariant value(int index) const {
+        return values.value(index);
+    }
+};
+
+// Common interface of every type's identity map, for statistics.
+class PPIdentityMapBase
+{
+public:
+    PPIdentityMapBase(const char* typeName);
+    virtual ~PPIdentityMapBase();
+
+    const char* typeName() const { return m_typeName; }
+    // Number of IDs currently mapped to a live instance.
+    virtual int size() const = 0;
+    quint64 hits() const { return m_hits.loadRelaxed(); }
+    quint64 misses() const { return m_misses.loadRelaxed(); }
+    quint64 pruned() const { return m_pruned.loadRelaxed(); }
+
+    static QList<PPIdentityMapBase*> all();
+
+protected:
+    const char* m_typeName;
+    QAtomicInteger<quint64> m_hits = 0;
+    QAtomicInteger<quint64> m_misses = 0;
+    QAtomicInteger<quint64> m_pruned = 0;
+};
+
+// Maps IDs to the one live instance of T with that ID. Entries are weak, and
+// are pruned by the deleter of the QSharedPointer that owns the instance, so
+// the map only ever holds live objects. Lookups lock one of a fixed number of
+// shards, picked by the ID's hash.
+template<class T>
+class PPIdentityMap : public PPIdentityMapBase
+{
+    static const int ShardCount = 16;
+
+    struct Shard {
+        mutable QMutex mutex;
+        QHash<QUuid,QWeakPointer<T>> entries;
+    };
+    Shard m_shards[ShardCount];
+
+    Shard& shardFor(const QUuid& ID) {
+        return m_shards[qHash(ID) % ShardCount];
+    }
+
+    void prune(const QUuid& ID) {
+        auto& shard = shardFor(ID);
+        QMutexLocker locker(&shard.mutex);
+        auto it = shard.entries.find(ID);
+        // A new instance can already have taken the ID's place.
+        if (it != shard.entries.end() && it.value().isNull()) {
+            shard.entries.erase(it);
+            m_pruned.fetchAndAddRelaxed(1);
+        }
+    }
+
+    PPIdentityMap() : PPIdentityMapBase(T::staticMetaObject.className()) {}
+
+public:
+    // Never destroyed, as instances can outlive static destruction.
+    static PPIdentityMap<T>& instance() {
+        static auto map = new PPIdentityMap<T>;
+        return *map;
+    }
+
+    QSharedPointer<T> value(const QUuid& ID) {
+        auto& shard = shardFor(ID);
+        QMutexLocker locker(&shard.mutex);
+        return shard.entries.value(ID).toStrongRef();
+    }
+
+    // Returns the live instance for ID, or one made by create if there is
+    // none, setting created accordingly.
+    template<class Factory>
+    QSharedPointer<T> obtain(const QUuid& ID, Factory create, bool* created = nullptr) {
+        auto& shard = shardFor(ID);
+        QMutexLocker locker(&shard.mutex);
+        auto ret = shard.entries.value(ID).toStrongRef();
+        if (created != nullptr) {
+            *created = ret.isNull();
+        }
+        if (!ret.isNull()) {
+            m_hits.fetchAndAddRelaxed(1);
+            return ret;
+        }
+        m_misses.fetchAndAddRelaxed(1);
+        ret = QSharedPointer<T>(create(), [this, ID](T* object) {
+            prune(ID);
+            object->released();
+            object->deleteLater();
+        });
+        shard.entries.insert(ID, ret);
+        return ret;
+    }
+
+    int size() const override {
+        int ret = 0;
+        for (const auto& shard : m_shards) {
+            QMutexLocker locker(&shard.mutex);
+            ret += shard.entries.size();
+        }
+        return ret;
+    }
+};
+
+// Predicates name their placeholders after the prefix they're given, which
+// PredicateList makes unique, so a column can appear in more than one.
 struct Predicate {
-    virtual QString toWhere() = 0;
-    virtual void bindToQuery(QSqlQuery *query) = 0;
+    virtual QString toWhere(const QString& prefix) = 0;
+    virtual void bindToQuery(QSqlQuery *query, const QString& prefix) = 0;
     virtual ~Predicate() {}
 };
 
@@ -77,9 +1158,9 @@ struct Predicate {
     QString column;\
     QVariant value;\
 \
-    name(QString col, QVariant val) : column(col), value(val) {}\
-    QString toWhere() override { return QStringLiteral("%1 " #operator " :" #name "_%2").arg(this->column).arg(this->column); }\
-    void bindToQuery(QSqlQuery *query) override { query->bindValue(QStringLiteral(":" #name "_%1").arg(this->column), this->value); }\
+    name(QString col, QVariant val) : column(col), value(PPColumn<QVariant>::bind(val)) {}\
+    QString toWhere(const QString& prefix) override { return QStringLiteral("%1 " #operator " %2").arg(this->column, prefix); }\
+    void bindToQuery(QSqlQuery *query, const QString& prefix) override { query->bindValue(prefix, this->value); }\
 };
 
 operatorPredicate(Equals, =)
@@ -94,18 +1175,45 @@ struct Between : Predicate {
     QString column;
     QVariant first;
     QVariant second;
-    Between(QString col, QVariant first, QVariant second) : column(col), first(first), second(second) {}
-    QString toWhere() override { return QStringLiteral("%1 BETWEEN :between_first_%2, :between_second_%2").arg(this->column).arg(this->column).arg(this->column); }
-    void bindToQuery(QSqlQuery *query) override {
-        query->bindValue(QStringLiteral(":between_first_%1").arg(this->column), this->first);
-        query->bindValue(QStringLiteral(":between_second_%1").arg(this->column), this->second);
+    Between(QString col, QVariant first, QVariant second) : column(col), first(PPColumn<QVariant>::bind(first)), second(PPColumn<QVariant>::bind(second)) {}
+    QString toWhere(const QString& prefix) override { return QStringLiteral("%1 BETWEEN %2_first AND %2_second").arg(this->column, prefix); }
+    void bindToQuery(QSqlQuery *query, const QString& prefix) override {
+        query->bindValue(prefix + QStringLiteral("_first"), this->first);
+        query->bindValue(prefix + QStringLiteral("_second"), this->second);
+    }
+};
+
+// Matches objects whose side table has a row with the given KEY and VALUE
+// columns, e.g. {{"KEY", key}} for a map entry or {{"VALUE", value}} for a
+// list element.
+struct PPEntryPredicate : Predicate {
+    QString owner;
+    QString property;
+    QVector<QPair<QString,QVariant>> matches;
+
+    PPEntryPredicate(QString owner, QString property, QVector<QPair<QString,QVariant>> matches) : owner(owner), property(property), matches(matches) {
+        for (auto& match : this->matches) {
+            match.second = PPColumn<QVariant>::bind(match.second);
+        }
+    }
+    QString toWhere(const QString& prefix) override {
+        auto ret = QStringLiteral("EXISTS (SELECT 1 FROM %1_%2 WHERE OWNER_ID = %1.ID").arg(this->owner, this->property);
+        for (const auto& match : this->matches) {
+            ret += QStringLiteral(" AND %1 = %2_%1").arg(match.first, prefix);
+        }
+        return ret + QStringLiteral(")");
+    }
+    void bindToQuery(QSqlQuery *query, const QString& prefix) override {
+        for (const auto& match : this->matches) {
+            query->bindValue(QStringLiteral("%1_%2").arg(prefix, match.first), match.second);
+        }
     }
 };
 
 template<class T>
 struct Optional {
 private:
-    bool hasValue;
+    bool hasValue = false;
     T value;
 public:
     ~Optional<T>() {}
@@ -134,14 +1242,15 @@ public:
 class PredicateList : public QList<Predicate*>
 {
 public:
-    PredicateList(Predicate* item...) {
-        va_list args;
-        va_start(args, item);
-
+    PredicateList() {}
+    template<class... Rest>
+    PredicateList(Predicate* item, Rest*... rest) {
         *this << item;
-
-        va_end(args);
+        (append(rest), ...);
     }
+    PredicateList(PredicateList&& other) : QList<Predicate*>(std::move(other)) {}
+    PredicateList(const PredicateList&) = delete;
+    PredicateList& operator=(const PredicateList&) = delete;
     ~PredicateList() {
         for (auto item : *this) {
             delete item;
@@ -149,14 +1258,234 @@ public:
     }
     QStringList allPredicatesToWhere() {
         QStringList ret;
-        for (auto predicate : *this) {
-            ret << predicate->toWhere();
+        for (int i = 0; i < length(); i++) {
+            ret << at(i)->toWhere(placeholder(i));
         }
         return ret;
     };
+    // All of the predicates have to match.
+    QString toWhere() {
+        return allPredicatesToWhere().join(QStringLiteral(" AND "));
+    }
+    // " WHERE " and the predicates, or nothing to match every row.
+    QString whereClause() {
+        return isEmpty() ? QString() : QStringLiteral(" WHERE ") + toWhere();
+    }
     void bindAllPredicates(QSqlQuery *query) {
-        for (auto predicate : *this) {
-            predicate->bindToQuery(query);
+        for (int i = 0; i < length(); i++) {
+            at(i)->bindToQuery(query, placeholder(i));
         }
     }
-};
\ No newline at end of file
+
+private:
+    static QString placeholder(int index) {
+        return QStringLiteral(":p%1").arg(index);
+    }
+};
+// Aggregates computed by SQLite over the rows of a table that match all of
+// the predicates, or every row if there are none, without reading the rows.
+struct PPAggregate
+{
+    // The value of expression, like COUNT(*) or MAX(rank), or an invalid
+    // variant if the query fails. Most aggregates are NULL over no rows.
+    static QVariant value(const QString& table, const QString& expression, PredicateList& predicates);
+    static bool exists(const QString& table, PredicateList& predicates);
+};
+
+// One condition of a typed query, kept by value.
+struct PPClause
+{
+    enum Operator : quint8 { Equals, NotEquals, LessThan, GreaterThan, LessThanOrEqualTo, GreaterThanOrEqualTo, Like };
+
+    quint8 column;
+    Operator op;
+    // Clauses are ANDed together unless they start an OR. AND binds tighter,
+    // so a AND b OR c reads as (a AND b) OR c.
+    bool startsOr;
+    QVariant value;
+};
+
+// The part of a generated query builder that doesn't depend on the type.
+// Clauses and ordering live in inline arrays, so building a query doesn't
+// allocate for the common case. The SQL for each shape of query, which is
+// everything but the values, is built once per table and cached, so running
+// the same shape again reuses both the string and the prepared statement.
+class PPQueryBase
+{
+protected:
+    QVarLengthArray<PPClause, 8> m_clauses;
+    QVarLengthArray<QPair<quint8,Qt::SortOrder>, 4> m_ordering;
+    int m_limit = -1;
+    int m_offset = 0;
+    bool m_or = false;
+
+    void addClause(quint8 column, PPClause::Operator op, const QVariant& value) {
+        m_clauses.append(PPClause{column, op, m_or && !m_clauses.isEmpty(), value});
+        m_or = false;
+    }
+    void addOrdering(quint8 column, Qt::SortOrder order) {
+        m_ordering.append(qMakePair(column, order));
+    }
+
+    // columns holds the table's column names by index, ending with nullptr.
+    QString statement(const QString& table, const QString& select, const char* const* columns) const;
+    void bind(QSqlQuery* query) const;
+};
+
+template<class Query>
+class PPQuery;
+
+// A column of a generated query builder, like Note::query().title. The
+// comparisons are named apart from the eq()/lt() predicate macros, and
+// matches() takes a LIKE pattern.
+template<class Query, class T>
+class PPField
+{
+    // Called through the base, so properties named like its members can't hide them.
+    PPQuery<Query>* m_query;
+    quint8 m_column;
+
+public:
+    PPField(Query* query, quint8 column) : m_query(query), m_column(column) {}
+
+    Query& equals(const T& value) { return m_query->add(m_column, PPClause::Equals, PPColumn<T>::bind(value)); }
+    Query& notEquals(const T& value) { return m_query->add(m_column, PPClause::NotEquals, PPColumn<T>::bind(value)); }
+    Query& lessThan(const T& value) { return m_query->add(m_column, PPClause::LessThan, PPColumn<T>::bind(value)); }
+    Query& greaterThan(const T& value) { return m_query->add(m_column, PPClause::GreaterThan, PPColumn<T>::bind(value)); }
+    Query& atMost(const T& value) { return m_query->add(m_column, PPClause::LessThanOrEqualTo, PPColumn<T>::bind(value)); }
+    Query& atLeast(const T& value) { return m_query->add(m_column, PPClause::GreaterThanOrEqualTo, PPColumn<T>::bind(value)); }
+    Query& matches(const QString& pattern) { return m_query->add(m_column, PPClause::Like, pattern); }
+    Query& orderBy(Qt::SortOrder order = Qt::AscendingOrder) { return m_query->order(m_column, order); }
+};
+
+template<class Query>
+class PPQuery : public PPQueryBase
+{
+    template<class Q, class T>
+    friend class PPField;
+
+    Query& self() { return static_cast<Query&>(*this); }
+    Query& add(quint8 column, PPClause::Operator op, const QVariant& value) {
+        addClause(column, op, value);
+        return self();
+    }
+    Query& order(quint8 column, Qt::SortOrder order) {
+        addOrdering(column, order);
+        return self();
+    }
+
+public:
+    // The next clause starts an OR instead of being ANDed to the previous one.
+    Query& orWhere() {
+        m_or = true;
+        return self();
+    }
+    Query& limit(int count) {
+        m_limit = count;
+        return self();
+    }
+    Query& offset(int count) {
+        m_offset = count;
+        return self();
+    }
+};
+
+// Streams the rows of a generated query, hydrating each one only when it's
+// reached. Nothing holds on to the objects it hands out, so tables of any
+// size can be walked in constant memory. A cursor is a single pass over its
+// rows. Copies share the statement, so a row read through one of them is gone
+// for the others, but each keeps its own current row.
+template<class T>
+class PPCursor
+{
+    QSharedPointer<PPStatement> m_statement;
+    QSharedPointer<T> m_current;
+    bool m_started = false;
+    bool m_ok = false;
+
+    void advance() {
+        m_started = true;
+        if (m_statement && (*m_statement)->next()) {
+            m_current = T::hydrated(**m_statement);
+            return;
+        }
+        m_current.clear();
+        // Give the statement back to the cache as soon as the rows run out.
+        m_statement.clear();
+    }
+
+public:
+    explicit PPCursor(const QString& statement) : m_statement(QSharedPointer<PPStatement>::create(statement)) {}
+
+    // For binding values before exec().
+    QSqlQuery* query() const { return m_statement ? m_statement->data() : nullptr; }
+
+    // Runs the statement once. A cursor that failed or ran out of rows has
+    // given it back already, so running it again fails.
+    bool exec() {
+        if (!m_statement) {
+            return m_ok = false;
+        }
+        m_ok = (*m_statement)->exec();
+        if (!m_ok) {
+            qCritical() << (*m_statement)->lastError() << "when streaming a query";
+            m_statement.clear();
+        }
+        return m_ok;
+    }
+    bool ok() const { return m_ok; }
+
+    // The next row, or a null pointer once there are no more.
+    QSharedPointer<T> next() {
+        advance();
+        return m_current;
+    }
+
+    // Hands the rows to callback in lists of up to size rows, until they run
+    // out or callback returns false. Returns whether every row was handed out.
+    bool forEachBatch(int size, const std::function<bool(const QList<QSharedPointer<T>>&)>& callback) {
+        QList<QSharedPointer<T>> batch;
+        batch.reserve(size);
+        while (auto row = next()) {
+            batch << row;
+            if (batch.size() == size) {
+                if (!callback(batch)) {
+                    return false;
+                }
+                batch.clear();
+            }
+        }
+        return batch.isEmpty() || callback(batch);
+    }
+
+    class iterator
+    {
+        PPCursor* m_cursor;
+
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = QSharedPointer<T>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const QSharedPointer<T>*;
+        using reference = const QSharedPointer<T>&;
+
+        explicit iterator(PPCursor* cursor) : m_cursor(cursor) {}
+        reference operator*() const { return m_cursor->m_current; }
+        pointer operator->() const { return &m_cursor->m_current; }
+        iterator& operator++() {
+            m_cursor->advance();
+            return *this;
+        }
+        bool atEnd() const { return m_cursor == nullptr || m_cursor->m_current.isNull(); }
+        bool operator==(const iterator& other) const { return atEnd() == other.atEnd(); }
+        bool operator!=(const iterator& other) const { return !(*this == other); }
+    };
+
+    iterator begin() {
+        if (!m_started) {
+            advance();
+        }
+        return iterator(this);
+    }
+    iterator end() { return iterator(nullptr); }
+};
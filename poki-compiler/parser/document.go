@@ -1,16 +1,64 @@
 package parser
 
+import (
+	"sort"
+	"strings"
+)
+
 // PokiPokiProperty represents a type definition of an object's property
 type PokiPokiProperty struct {
 	Name string
 	Type []string
 }
 
+// PokiPokiAnnotation represents an @ line in an object's body
+type PokiPokiAnnotation struct {
+	Name     string
+	Args     []string
+	Position string
+}
+
 // PokiPokiObject represents a type definition of an object
 type PokiPokiObject struct {
-	Name       string
-	Properties []PokiPokiProperty
-	Children   []string
+	Name        string
+	Properties  []PokiPokiProperty
+	Children    []string
+	Annotations []PokiPokiAnnotation
+}
+
+// Annotated returns the object's annotations with the given name
+func (o PokiPokiObject) Annotated(name string) (ret []PokiPokiAnnotation) {
+	for _, annotation := range o.Annotations {
+		if annotation.Name == name {
+			ret = append(ret, annotation)
+		}
+	}
+	return
+}
+
+// HasProperty returns whether the object has a property with the given name
+func (o PokiPokiObject) HasProperty(name string) bool {
+	for _, prop := range o.Properties {
+		if prop.Name == name {
+			return true
+		}
+	}
+	return false
+}
+
+// KeyLayouts are the table layouts an object can pick with @key
+var KeyLayouts = map[string]struct{}{
+	"default":      {},
+	"rowid":        {},
+	"withoutrowid": {},
+}
+
+// KeyLayout returns how the object's table stores its primary key
+func (o PokiPokiObject) KeyLayout() string {
+	if keys := o.Annotated("key"); len(keys) > 0 {
+		return keys[0].Args[0]
+	}
+	return "default"
 }
 
 // PokiPokiDocument represents the parsed form of a pokipoki file
@@ -19,3 +67,178 @@ type PokiPokiDocument struct {
 	SchemaVersion int64
 	Objects       map[string]PokiPokiObject
 }
+
+// ObjectsInOrder returns the objects sorted by name, except that every object comes
+// after its children, so the code generated for a parent sees complete child types
+func (d PokiPokiDocument) ObjectsInOrder() (ret []PokiPokiObject) {
+	names := make([]string, 0, len(d.Objects))
+	for name := range d.Objects {
+		names = append(names, name)
+	}
+	sort.Strings(names)
+	seen := map[string]bool{}
+	var place func(name string)
+	place = func(name string) {
+		obj, ok := d.Objects[name]
+		if !ok || seen[name] {
+			return
+		}
+		seen[name] = true
+		for _, child := range obj.Children {
+			place(child)
+		}
+		ret = append(ret, obj)
+	}
+	for _, name := range names {
+		place(name)
+	}
+	return
+}
+
+// PokiPokiIndex represents an index declared with @index
+type PokiPokiIndex struct {
+	Unique  bool
+	Columns []string
+}
+
+// Name returns the name of the index in the database
+func (i PokiPokiIndex) Name(object string) string {
+	return object + "_" + strings.Join(i.Columns, "_")
+}
+
+// Indexes returns the indexes declared on the object
+func (o PokiPokiObject) Indexes() (ret []PokiPokiIndex) {
+	for _, annotation := range o.Annotated("index") {
+		index := PokiPokiIndex{Columns: annotation.Args}
+		if len(index.Columns) > 0 && index.Columns[0] == "unique" {
+			index.Unique = true
+			index.Columns = index.Columns[1:]
+		}
+		ret = append(ret, index)
+	}
+	return
+}
+
+// ColumnProperties returns the properties stored in the object's own table
+func (o PokiPokiObject) ColumnProperties() (ret []PokiPokiProperty) {
+	for _, prop := range o.Properties {
+		if !o.InSideTable(prop.Name) {
+			ret = append(ret, prop)
+		}
+	}
+	return
+}
+
+// SelectColumns returns the columns rows of the object are read with by default,
+// leaving out @lazy properties
+func (o PokiPokiObject) SelectColumns() string {
+	columns := []string{"ID"}
+	for _, prop := range o.ColumnProperties() {
+		if !o.IsLazy(prop.Name) {
+			columns = append(columns, prop.Name)
+		}
+	}
+	return strings.Join(columns, ", ")
+}
+
+// ColumnIndex returns the position of a property among ColumnProperties, which is
+// its bit in the generated column masks
+func (o PokiPokiObject) ColumnIndex(name string) int {
+	for i, prop := range o.ColumnProperties() {
+		if prop.Name == name {
+			return i
+		}
+	}
+	return -1
+}
+
+// PropertyIndex returns the position of the named property among all properties, or -1
+func (o PokiPokiObject) PropertyIndex(name string) int {
+	for i, prop := range o.Properties {
+		if prop.Name == name {
+			return i
+		}
+	}
+	return -1
+}
+
+// NumericProperties returns the properties stored as numbers, which get aggregates
+func (o PokiPokiObject) NumericProperties() (ret []PokiPokiProperty) {
+	for _, prop := range o.ColumnProperties() {
+		if kind := SqlType(prop.Type); prop.Type[0] != "Boolean" && (kind == "INTEGER" || kind == "REAL") {
+			ret = append(ret, prop)
+		}
+	}
+	return
+}
+
+// IsLazy returns whether a property is left out of queries with @lazy and read on first use
+func (o PokiPokiObject) IsLazy(name string) bool {
+	for _, annotation := range o.Annotated("lazy") {
+		for _, arg := range annotation.Args {
+			if arg == name {
+				return true
+			}
+		}
+	}
+	return false
+}
+
+// InSideTable returns whether a property is stored in a side table with @table
+func (o PokiPokiObject) InSideTable(name string) bool {
+	for _, annotation := range o.Annotated("table") {
+		for _, arg := range annotation.Args {
+			if arg == name {
+				return true
+			}
+		}
+	}
+	return false
+}
+
+// PokiPokiSideTable represents a collection property stored in its own table
+type PokiPokiSideTable struct {
+	Table    string
+	Property PokiPokiProperty
+	// Map is false for lists, which are keyed by position
+	Map bool
+	// KeyType and ValueType are schema types, Key and Value C++ types
+	KeyType   []string
+	ValueType []string
+	Key       []string
+	Value     []string
+	// Type is the property's C++ type and Helper the libpokipoki template
+	// that stores it
+	Type   string
+	Helper string
+}
+
+// SideTables returns the collection properties of an object stored with @table
+func (d PokiPokiDocument) SideTables(o PokiPokiObject) (ret []PokiPokiSideTable) {
+	for _, prop := range o.Properties {
+		if !o.InSideTable(prop.Name) {
+			continue
+		}
+		table := PokiPokiSideTable{Table: o.Name + "_" + prop.Name, Property: prop}
+		table.Type = strings.Join(d.AlwaysType(prop.Type), "")
+		if key, value, ok := d.MapArguments(prop.Type); ok {
+			table.Map = true
+			table.KeyType = key
+			table.ValueType = value
+			table.Key = d.AlwaysType(key)
+			table.Value = d.AlwaysType(value)
+		} else if value, ok := d.ListArgument(prop.Type); ok {
+			table.KeyType = []string{"Int32"}
+			table.ValueType = value
+			table.Key = []string{"int"}
+			table.Value = d.AlwaysType(value)
+		}
+		if table.Map {
+			table.Helper = "PPMapTable<" + table.Type + ">"
+		} else {
+			table.Helper = "PPListTable<" + table.Type + ">"
+		}
+		ret = append(ret, table)
+	}
+	return
+}
@@ -9,12 +9,17 @@ import (
 var tmpl = template.Must(template.New("").Funcs(template.FuncMap{
 	"StringJoin": strings.Join,
 	"TypeDef":    SqlType,
+	"SumType":    SumType,
+	"inc":        func(i int) int { return i + 1 },
 }).Parse(`
 {{ $root := . }}
 #pragma once
 
 #include <QAbstractListModel>
+#include <QCache>
 #include <QDebug>
+#include <QFuture>
+#include <QHash>
 #include <QMutex>
 #include <QMutexLocker>
 #include <QObject>
@@ -22,6 +27,8 @@ var tmpl = template.Must(template.New("").Funcs(template.FuncMap{
 #include <QSharedPointer>
 #include <QSqlError>
 #include <QSqlQuery>
+#include <QSqlRecord>
+#include <QStringList>
 #include <QUuid>
 #include <QVariant>
 {{ StringJoin $root.LocateImports "\n" }}
@@ -39,47 +46,202 @@ class {{ .Name }};
 class {{ .Name }}Model;
 {{ end -}}
 
-{{- range $item := .Objects }}
+{{- range $item := .ObjectsInOrder }}
 
 class {{ .Name }} : public QObject, PPUndoRedoable {
 	Q_OBJECT
 	Q_INTERFACES(PPUndoRedoable)
 
-	struct Change {
-		{{ range $prop := .Properties }}
-		{{ $propType := $root.AlwaysType $prop.Type }}
-		{{ $propTypeName := StringJoin $propType "" }}
-		Optional<{{ $propTypeName }}> previous{{ $prop.Name }}Value;
-		{{ end }}
-	};
+	// An undo step only holds the properties a save changed, see PPDelta.
+	using Change = PPDelta;
 
 	{{ .Name }}(QUuid ID) : QObject(nullptr), m_ID(ID) {
-		static bool db_initialized = false;
-		if (!db_initialized) {
-			prepareDatabase();
-			db_initialized = true;
+		static bool db_initialized = (prepareDatabase(), true);
+		Q_UNUSED(db_initialized)
+	}
+
+	static QSharedPointer<{{ .Name }}> withID(QUuid ID, bool* created = nullptr) {
+		return PPIdentityMap<{{ .Name }}>::instance().obtain(ID, [ID] { return new {{ .Name }}(ID); }, created);
+	}
+
+	// Lets PPUndoRedoStack get hold of objects whose steps it reads back from its
+	// journal, without reloading the ones that are alive.
+	static QSharedPointer<QObject> journaled(const QUuid& ID) {
+		return withID(ID);
+	}
+	static inline const bool s_JOURNALED = PPUndoRedoStack::registerType(QStringLiteral("{{ .Name }}"), &journaled);
+
+	static PPRowChange reparented(const QUuid& ID, const QString& column, const QUuid& previous, const QUuid& parent) {
+		PPRowChange change;
+		change.kind = PPRowChange::Reparented;
+		change.table = QStringLiteral("{{ .Name }}");
+		change.ID = ID;
+		change.parentColumn = column;
+		change.previousParent = previous;
+		change.parent = parent;
+		return change;
+	}
+
+	static void publishReparented(const QUuid& ID, const QString& column, const QUuid& previous, const QUuid& parent) {
+		pDB->publishRowChange(reparented(ID, column, previous, parent));
+	}
+
+	// Called by the identity map once the last reference is gone. A staged deletion
+	// is queued with PPDatabase, which writes it in a batch with others.
+	void released() {
+		if (!m_DELETE_PENDING) {
+			return;
 		}
+		QVector<PPRowChange> changes;
+		{{- range $parent := $root.ParentedBy .Name }}
+		if (!m_parent_{{ $parent }}_ID.isNull()) {
+			changes << reparented(m_ID, QStringLiteral("PARENT_{{ $parent }}_ID"), m_parent_{{ $parent }}_ID, QUuid());
+		}
+		{{- end }}
+		PPRowChange change;
+		change.kind = PPRowChange::Deleted;
+		change.table = QStringLiteral("{{ .Name }}");
+		change.ID = m_ID;
+		changes << change;
+		pDB->queueDelete(QStringLiteral("{{ .Name }}"), m_ID, QStringList{ {{- range $i, $table := $root.SideTables $item }}{{ if $i }}, {{ end }}QStringLiteral("{{ $table.Table }}"){{ end -}} }, changes);
+	}
+
+	// Each column has a bit in a mask, in the order of ColumnProperties. m_LOADED holds
+	// the columns whose members hold the stored value; @lazy ones and those left out
+	// of a projection are read the first time they're used.
+	static constexpr quint64 AllColumns = quint64(0){{ range $index, $prop := .ColumnProperties }} | (quint64(1) << {{ $index }}){{ end }};
+	static constexpr quint64 LazyColumns = quint64(0){{ range $index, $prop := .ColumnProperties }}{{ if $item.IsLazy $prop.Name }} | (quint64(1) << {{ $index }}){{ end }}{{ end }};
+	static constexpr quint64 EagerColumns = AllColumns & ~LazyColumns;
+
+	static QString selectColumns() {
+		return QStringLiteral("{{ .SelectColumns }}");
 	}
 
-	~{{ .Name }}() {
-		if (m_DELETE_PENDING) {
-			QSqlQuery query(PPDatabase::instance()->connection());
-			query.prepare(QStringLiteral("DELETE FROM {{ .Name }} WHERE ID = :ID"));
-			query.bindValue(":ID", QVariant::fromValue(m_ID));
-			query.exec();
+	static QString selectColumns(quint64 columns) {
+		if (columns == EagerColumns) {
+			return selectColumns();
 		}
+		QStringList names{QStringLiteral("ID")};
+		{{- range $index, $prop := .ColumnProperties }}
+		if (columns & (quint64(1) << {{ $index }})) {
+			names << QStringLiteral("{{ $prop.Name }}");
+		}
+		{{- end }}
+		return names.join(", ");
 	}
 
-	static QSharedPointer<{{ .Name }}> withID(QUuid ID) {
-		static QMap<QUuid,QPointer<{{.Name}}>> s_instances;
-		static QMutex s_mutex;
+	static quint64 columnsNamed(const QStringList& properties) {
+		quint64 columns = 0;
+		for (const auto& name : properties) {
+			{{- range $index, $prop := .ColumnProperties }}
+			if (name == QLatin1String("{{ $prop.Name }}")) {
+				columns |= quint64(1) << {{ $index }};
+				continue;
+			}
+			{{- end }}
+			qCritical() << "There is no column" << name << "in items of type {{ $item.Name }}";
+		}
+		return columns;
+	}
 
-		QMutexLocker locker(&s_mutex);
-		auto val = s_instances.value(ID, nullptr);
-		if (val.isNull()) {
-			s_instances[ID] = new {{.Name}}(ID);
+	// Rows are read in the order of selectColumns(), so each member is filled by position
+	// without going through the property system. A column that wasn't loaded yet takes the
+	// row as is; one that was keeps its unsaved edits and only signals if it changed.
+	template<class Row>
+	void hydrate(const Row& row, quint64 columns) {
+		int column = 1;
+		{{- range $index, $prop := .ColumnProperties }}
+		if (columns & (quint64(1) << {{ $index }})) {
+			auto value = PPColumn<decltype(m_{{ $prop.Name }})>::read(row.value(column++));
+			if (!(m_LOADED & (quint64(1) << {{ $index }}))) {
+				m_{{ $prop.Name }} = std::move(value);
+			} else if (!m_{{ $prop.Name }}_dirty && !(value == m_{{ $prop.Name }})) {
+				m_{{ $prop.Name }} = std::move(value);
+				Q_EMIT {{ $prop.Name }}Changed();
+			}
 		}
-		return QSharedPointer<{{ .Name }}>(s_instances[ID].data(), &QObject::deleteLater);
+		{{- end }}
+		m_LOADED |= columns;
+		Q_UNUSED(row)
+		Q_UNUSED(column)
+	}
+
+	template<class Row>
+	static QSharedPointer<{{ .Name }}> hydrated(const Row& row, quint64 columns = EagerColumns) {
+		auto ret = withID(PPKey::decode(row.value(0)));
+		ret->hydrate(row, columns);
+		return ret;
+	}
+
+	void load_columns(quint64 columns) const {
+		auto missing = columns & ~m_LOADED;
+		if (missing == 0) {
+			return;
+		}
+		// Getters are const, but loading only fills in what the database already holds.
+		auto self = const_cast<{{ .Name }}*>(this);
+		PPStatement query(QStringLiteral("SELECT %1 FROM {{ .Name }} WHERE ID = :id").arg(selectColumns(missing)));
+		query->bindValue(":id", PPKey::encode(m_ID));
+		if (!query->exec()) {
+			qCritical() << query->lastError() << "when loading the columns of an item of type {{ .Name }}";
+		} else if (query->next()) {
+			self->hydrate(*query, missing);
+		}
+		self->m_LOADED |= missing;
+	}
+
+	// Loads the given columns of every object that doesn't have them yet, a few hundred
+	// objects per query.
+	template<class Objects>
+	static void fetchColumns(const Objects& objects, quint64 columns) {
+		static const int chunk_size = 256;
+
+		QVector<{{ .Name }}*> pending;
+		quint64 missing = 0;
+		for (const auto& object : objects) {
+			if (object && (object->m_LOADED & columns) != columns) {
+				pending << object.data();
+				missing |= columns & ~object->m_LOADED;
+			}
+		}
+		for (int from = 0; from < pending.size(); from += chunk_size) {
+			QHash<QUuid,{{ .Name }}*> chunk;
+			QStringList placeholders;
+			for (int i = from; i < pending.size() && i < from + chunk_size; i++) {
+				chunk.insert(pending[i]->m_ID, pending[i]);
+				placeholders << QStringLiteral(":id%1").arg(i - from);
+			}
+			PPStatement query(QStringLiteral("SELECT %1 FROM {{ .Name }} WHERE ID IN (%2)").arg(selectColumns(missing), placeholders.join(", ")));
+			for (int i = from; i < pending.size() && i < from + chunk_size; i++) {
+				query->bindValue(placeholders[i - from], PPKey::encode(pending[i]->m_ID));
+			}
+			if (!query->exec()) {
+				qCritical() << query->lastError() << "when loading the columns of items of type {{ .Name }}";
+			}
+			while (query->next()) {
+				if (auto object = chunk.value(PPKey::decode(query->value(0)))) {
+					object->hydrate(*query, missing);
+				}
+			}
+			for (auto object : chunk) {
+				object->m_LOADED |= missing;
+			}
+		}
+	}
+
+	static QList<QSharedPointer<{{ .Name }}>> where(PredicateList predicates, quint64 columns) {
+		auto tq = QStringLiteral("SELECT %1 FROM {{ $item.Name }}%2").arg(selectColumns(columns), predicates.whereClause());
+		PPStatement query(tq);
+		predicates.bindAllPredicates(query.data());
+		auto ok = query->exec();
+		if (!ok) {
+			qCritical() << query->lastError() << "when running a where query on items of type {{ $item.Name }}";
+		}
+		QList<QSharedPointer<{{ .Name }}>> ret;
+		while (query->next()) {
+			ret << hydrated(*query, columns);
+		}
+		return ret;
 	}
 
 	{{ range $parent := $root.ParentedBy .Name }}
@@ -89,10 +251,16 @@ class {{ .Name }} : public QObject, PPUndoRedoable {
 	{{ end }}
 	{{ end }}
 	friend class {{ .Name }}Model;
+	friend class PPCursor<{{ .Name }}>;
+	friend class PPIdentityMap<{{ .Name }}>;
 
 	QUuid m_ID;
 	bool m_NEW = false;
+	quint64 m_LOADED = 0;
 	bool m_DELETE_PENDING = false;
+	// The row was removed by deleteWhere(). Saves write nothing until undoing
+	// the deletion puts the row back.
+	bool m_DELETED = false;
 	bool m_DIRTY = false;
 	bool m_CAN_UNDO = false;
 	bool m_CAN_REDO = false;
@@ -109,11 +277,44 @@ class {{ .Name }} : public QObject, PPUndoRedoable {
 	{{ $propType := $root.AlwaysType $prop.Type }}
 	{{ $propTypeName := StringJoin $propType "" }}
 	Q_PROPERTY({{ $propTypeName }} {{ $prop.Name }} READ {{ $prop.Name }} WRITE set_{{ $prop.Name }} NOTIFY {{$prop.Name}}Changed)
-	{{ $propTypeName }} m_{{$prop.Name}};
-	{{ $propTypeName }} m_{{$prop.Name}}_prev;
-	bool m_{{$prop.Name}}_dirty;
+	{{ if $item.InSideTable $prop.Name }}mutable {{ end }}{{ $propTypeName }} m_{{$prop.Name}};
+	{{ if $item.InSideTable $prop.Name }}mutable {{ end }}{{ $propTypeName }} m_{{$prop.Name}}_prev;
+	bool m_{{$prop.Name}}_dirty = false;
 	{{ end }}
 
+	{{- range $table := $root.SideTables $item }}
+	{{ $name := $table.Property.Name }}
+	// {{ $name }} lives in {{ $table.Table }} and is loaded on first use.
+	// Mutators queue deltas, set_{{ $name }}() replaces the whole collection.
+	QList<{{ $table.Helper }}::Delta> m_{{ $name }}_deltas;
+	mutable bool m_{{ $name }}_loaded = false;
+
+	void load_{{ $name }}() const {
+		if (!m_{{ $name }}_loaded) {
+			m_{{ $name }}_loaded = true;
+			m_{{ $name }} = {{ $table.Helper }}::load(QStringLiteral("{{ $table.Table }}"), m_ID);
+			m_{{ $name }}_prev = m_{{ $name }};
+		}
+	}
+
+	// The collection as last saved, before the deltas that aren't written yet.
+	{{ $table.Type }} saved_{{ $name }}() const {
+		auto saved = m_{{ $name }};
+		for (auto it = m_{{ $name }}_deltas.crbegin(); it != m_{{ $name }}_deltas.crend(); ++it) {
+			{{ $table.Helper }}::apply(saved, it->inverted());
+		}
+		return saved;
+	}
+
+	void push_{{ $name }}_delta(const {{ $table.Helper }}::Delta& delta) {
+		m_{{ $name }}_deltas << delta;
+		Q_EMIT {{ $name }}Changed();
+		clear_redo();
+		evaluate_dirty_changed();
+		evaluate_can_undo_changed();
+	}
+	{{- end }}
+
 	void evaluate_can_undo_changed() {
 		auto setUndo = [this](bool newUndo){
 			if (newUndo != m_CAN_UNDO) {
@@ -143,10 +344,136 @@ class {{ .Name }} : public QObject, PPUndoRedoable {
 	}
 
 	void clear_redo() {
+		for (int i = 0; i < m_REDO_STACK.size(); i++) {
+			pUR->redoItemRemoved(this);
+		}
 		m_REDO_STACK.clear();
 		evaluate_can_redo_changed();
 	}
 
+	// Puts the values and side table deltas of change into the object, and returns
+	// what they replaced, so applying the result reverses it again. Appends the
+	// writes that store the new values to writes.
+	Change swapChange(const Change& change, QVector<PPWrite>* writes) {
+		PPDelta::Reader reader(change);
+		PPDelta::Writer replaced;
+		quint64 columns = 0;
+		{{- range $index, $prop := .Properties }}
+		if (change.hasValue({{ $index }})) {
+			{{- if $item.InSideTable $prop.Name }}
+			load_{{ $prop.Name }}();
+			{{- else }}
+			load_columns(quint64(1) << {{ $item.ColumnIndex $prop.Name }});
+			columns |= quint64(1) << {{ $item.ColumnIndex $prop.Name }};
+			{{- end }}
+			replaced.value({{ $index }}, m_{{ $prop.Name }});
+			m_{{ $prop.Name }} = reader.value<decltype(m_{{ $prop.Name }})>();
+			Q_EMIT {{ $prop.Name }}Changed();
+		}
+		{{- end }}
+		if (columns != 0) {
+			PPWrite write;
+			write.statement = updateStatement(columns);
+			write.bind(":ID", PPKey::encode(m_ID));
+			{{- range $index, $prop := .ColumnProperties }}
+			if (columns & (quint64(1) << {{ $index }})) {
+				write.bind(":{{ $prop.Name }}", PPColumn<decltype(m_{{$prop.Name}})>::bind(m_{{$prop.Name}}));
+			}
+			{{- end }}
+			*writes << write;
+		}
+		{{- range $table := $root.SideTables $item }}
+		{{ $name := $table.Property.Name }}
+		if (change.hasEdits({{ $item.PropertyIndex $name }})) {
+			load_{{ $name }}();
+			auto edits = reader.edits<{{ $table.Helper }}::Delta>();
+			QList<{{ $table.Helper }}::Delta> reversed;
+			for (auto it = edits.crbegin(); it != edits.crend(); ++it) {
+				{{ $table.Helper }}::apply(m_{{ $name }}, it->inverted());
+				reversed << it->inverted();
+			}
+			replaced.edits({{ $item.PropertyIndex $name }}, reversed);
+			for (const auto& delta : reversed) {
+				{{ $table.Helper }}::write(writes, QStringLiteral("{{ $table.Table }}"), m_ID, delta);
+			}
+			Q_EMIT {{ $name }}Changed();
+		}
+		if (change.hasValue({{ $item.PropertyIndex $name }})) {
+			{{ $table.Helper }}::replace(writes, QStringLiteral("{{ $table.Table }}"), m_ID, m_{{ $name }});
+		}
+		{{- end }}
+		return replaced.finish();
+	}
+
+	// Whether change touches a property with unsaved edits, which applying it
+	// would overwrite.
+	bool touchesPendingEdits(const Change& change) const {
+		{{- range $index, $prop := .Properties }}
+		{{- if not ($item.InSideTable $prop.Name) }}
+		if (change.hasValue({{ $index }}) && m_{{ $prop.Name }}_dirty) {
+			return true;
+		}
+		{{- end }}
+		{{- end }}
+		{{- range $table := $root.SideTables $item }}
+		{{- $index := $item.PropertyIndex $table.Property.Name }}
+		if ((change.hasValue({{ $index }}) || change.hasEdits({{ $index }})) && (m_{{ $table.Property.Name }}_dirty || !m_{{ $table.Property.Name }}_deltas.isEmpty())) {
+			return true;
+		}
+		{{- end }}
+		Q_UNUSED(change)
+		return false;
+	}
+
+	// Applies the latest step on from, writing the values it puts back in one
+	// transaction with PPUndoRedoStack's record of the move, and pushes what
+	// it replaced onto to. Nothing moves if the write fails, or if the step
+	// would overwrite unsaved edits, which have to be saved or discarded first.
+	bool moveStep(QList<Change>& from, QList<Change>& to, bool redo) {
+		if (touchesPendingEdits(from.last())) {
+			qWarning() << "Not" << (redo ? "redoing" : "undoing") << "a change to an item of type {{ $item.Name }} over unsaved edits";
+			return false;
+		}
+		PPTransaction transaction;
+		if (!transaction.isOpen()) {
+			return false;
+		}
+		QVector<PPWrite> writes;
+		auto step = from.takeLast();
+		auto replaced = swapChange(step, &writes);
+		auto ok = true;
+		for (const auto& write : writes) {
+			if (!write.exec()) {
+				qCritical() << "when" << (redo ? "redoing" : "undoing") << "a change to an item of type {{ $item.Name }}";
+				ok = false;
+				break;
+			}
+		}
+		if (ok) {
+			PPRowChange change;
+			change.table = QStringLiteral("{{ .Name }}");
+			change.ID = m_ID;
+			change.properties = step.properties();
+			pDB->publishRowChange(change);
+			to << replaced;
+			redo ? pUR->stepRedone(this, replaced) : pUR->stepUndone(this, replaced);
+			ok = transaction.commit();
+			if (!ok) {
+				to.takeLast();
+				redo ? pUR->stepUndone(this, step) : pUR->stepRedone(this, step);
+			}
+		}
+		if (!ok) {
+			QVector<PPWrite> ignored;
+			swapChange(replaced, &ignored);
+			from << step;
+			return false;
+		}
+		evaluate_can_undo_changed();
+		evaluate_can_redo_changed();
+		return true;
+	}
+
 	void evaluate_dirty_changed() {
 		if (m_DIRTY) {
 			auto new_dirty = false;
@@ -155,6 +482,11 @@ class {{ .Name }} : public QObject, PPUndoRedoable {
 				new_dirty = true;
 			}
 			{{ end }}
+			{{- range $table := $root.SideTables $item }}
+			if (!m_{{ $table.Property.Name }}_deltas.isEmpty()) {
+				new_dirty = true;
+			}
+			{{- end }}
 			if (!new_dirty) {
 				m_DIRTY = false;
 			}
@@ -167,7 +499,184 @@ class {{ .Name }} : public QObject, PPUndoRedoable {
 				return;
 			}
 			{{ end }}
+			{{- range $table := $root.SideTables $item }}
+			if (!m_{{ $table.Property.Name }}_deltas.isEmpty()) {
+				m_DIRTY = true;
+				Q_EMIT dirtyChanged();
+				return;
+			}
+			{{- end }}
+		}
+		evaluate_can_undo_changed();
+	}
+
+	// Sets each of the columns from the placeholder named after it.
+	static QString assignments(quint64 columns) {
+		QStringList ret;
+		{{- range $index, $prop := .ColumnProperties }}
+		if (columns & (quint64(1) << {{ $index }})) {
+			ret << QStringLiteral("{{ $prop.Name }} = :{{ $prop.Name }}");
+		}
+		{{- end }}
+		return ret.join(", ");
+	}
+
+	static QString updateStatement(quint64 columns) {
+		static QHash<quint64,QString> s_statements;
+		static QMutex s_mutex;
+
+		QMutexLocker locker(&s_mutex);
+		auto statement = s_statements.value(columns);
+		if (statement.isNull()) {
+			statement = QStringLiteral("UPDATE {{ $item.Name }} SET %1 WHERE ID = :ID").arg(assignments(columns));
+			s_statements.insert(columns, statement);
+		}
+		return statement;
+	}
+
+	static QString insertStatement(int rows) {
+		static QHash<int,QString> s_statements;
+		static QMutex s_mutex;
+
+		QMutexLocker locker(&s_mutex);
+		auto statement = s_statements.value(rows);
+		if (statement.isNull()) {
+			QStringList values;
+			for (int i = 0; i < rows; i++) {
+				values << QStringLiteral("(?{{ range $prop := .ColumnProperties }}, ?{{ end }})");
+			}
+			statement = QStringLiteral("INSERT INTO {{ $item.Name }} (ID{{ range $prop := .ColumnProperties }}, {{ $prop.Name }}{{ end }}) VALUES %1").arg(values.join(", "));
+			s_statements.insert(rows, statement);
+		}
+		return statement;
+	}
+
+	// Turns the pending changes into writes and marks them as saved.
+	// restorePending() undoes this if a write fails, publishSave() records
+	// the undo step once it's committed. With PPUndoRedoStack's journal on,
+	// the step is written with the changes and step is its number.
+	QVector<PPWrite> takePendingWrites(Change* changes, qint64* step) {
+		QVector<PPWrite> writes;
+		if (m_DELETED) {
+			return writes;
+		}
+		if (m_NEW || m_DELETE_PENDING) {
+			load_columns(AllColumns);
+			PPWrite write;
+			write.statement = QStringLiteral(R"RJIENRLWEY(
+INSERT INTO {{ $item.Name }}
+(ID
+{{- range $prop := .ColumnProperties -}}
+,{{- $prop.Name -}}
+{{- end -}}
+)
+VALUES
+(:ID{{ range $prop := .ColumnProperties }}, :{{- $prop.Name }}{{ end }});
+			)RJIENRLWEY");
+			write.bind(":ID", PPKey::encode(m_ID));
+			{{- range $prop := .ColumnProperties }}
+			write.bind(":{{- $prop.Name -}}", PPColumn<decltype(m_{{$prop.Name}})>::bind(m_{{$prop.Name}}));
+			m_{{$prop.Name}}_dirty = false;
+			{{- end }}
+			writes << write;
+			{{- range $table := $root.SideTables $item }}
+			load_{{ $table.Property.Name }}();
+			{{ $table.Helper }}::replace(&writes, QStringLiteral("{{ $table.Table }}"), m_ID, m_{{ $table.Property.Name }});
+			m_{{ $table.Property.Name }}_prev = m_{{ $table.Property.Name }};
+			m_{{ $table.Property.Name }}_dirty = false;
+			m_{{ $table.Property.Name }}_deltas.clear();
+			{{- end }}
+			m_NEW = false;
+			if (m_DELETE_PENDING) {
+				m_DELETE_PENDING = false;
+				pendingDeleteChanged();
+			}
+			evaluate_dirty_changed();
+			return writes;
+		}
+
+		PPDelta::Writer previous;
+		quint64 columns = 0;
+		{{- range $index, $prop := .Properties }}
+		if (m_{{$prop.Name}}_dirty) {
+			previous.value({{ $index }}, m_{{ $prop.Name }}_prev);
+			{{- if not ($item.InSideTable $prop.Name) }}
+			columns |= quint64(1) << {{ $item.ColumnIndex $prop.Name }};
+			{{- end }}
+		}
+		{{- end }}
+		{{- range $table := $root.SideTables $item }}
+		if (!m_{{ $table.Property.Name }}_dirty && !m_{{ $table.Property.Name }}_deltas.isEmpty()) {
+			previous.edits({{ $item.PropertyIndex $table.Property.Name }}, m_{{ $table.Property.Name }}_deltas);
+		}
+		{{- end }}
+		*changes = previous.finish();
+		if (columns != 0) {
+			PPWrite write;
+			write.statement = updateStatement(columns);
+			write.bind(":ID", PPKey::encode(m_ID));
+			{{- range $index, $prop := .ColumnProperties }}
+			if (columns & (quint64(1) << {{ $index }})) {
+				write.bind(":{{ $prop.Name }}", PPColumn<decltype(m_{{$prop.Name}})>::bind(m_{{$prop.Name}}));
+				m_{{$prop.Name}}_dirty = false;
+			}
+			{{- end }}
+			writes << write;
+		}
+		{{- range $table := $root.SideTables $item }}
+		{{ $name := $table.Property.Name }}
+		if (m_{{ $name }}_dirty) {
+			{{ $table.Helper }}::replace(&writes, QStringLiteral("{{ $table.Table }}"), m_ID, m_{{ $name }});
+			m_{{ $name }}_dirty = false;
+		} else {
+			for (const auto& delta : m_{{ $name }}_deltas) {
+				{{ $table.Helper }}::write(&writes, QStringLiteral("{{ $table.Table }}"), m_ID, delta);
+			}
+		}
+		m_{{ $name }}_prev = m_{{ $name }};
+		m_{{ $name }}_deltas.clear();
+		{{- end }}
+		if (!changes->isEmpty()) {
+			*step = pUR->journal(&writes, QStringLiteral("{{ .Name }}"), m_ID, *changes);
+		}
+		return writes;
+	}
+
+	void restorePending(bool wasNew, const Change& changes) {
+		if (wasNew) {
+			m_NEW = true;
+			return;
+		}
+		PPDelta::Reader reader(changes);
+		{{- range $index, $prop := .Properties }}
+		if (changes.hasValue({{ $index }})) {
+			m_{{ $prop.Name }}_prev = reader.value<decltype(m_{{ $prop.Name }})>();
+			m_{{$prop.Name}}_dirty = true;
+		}
+		{{- end }}
+		{{- range $table := $root.SideTables $item }}
+		if (changes.hasEdits({{ $item.PropertyIndex $table.Property.Name }})) {
+			m_{{ $table.Property.Name }}_deltas = reader.edits<{{ $table.Helper }}::Delta>() + m_{{ $table.Property.Name }}_deltas;
+		}
+		{{- end }}
+		evaluate_dirty_changed();
+	}
+
+	void publishRow(bool wasNew, const Change& changes) {
+		PPRowChange change;
+		change.kind = wasNew ? PPRowChange::Inserted : PPRowChange::Updated;
+		change.table = QStringLiteral("{{ .Name }}");
+		change.ID = m_ID;
+		change.properties = changes.properties();
+		pDB->publishRowChange(change);
+	}
+
+	void publishSave(bool wasNew, const Change& changes, qint64 step) {
+		if (wasNew) {
+			return;
 		}
+		m_UNDO_STACK << changes;
+		pUR->undoItemAdded(this, changes.bytes(), step);
 		evaluate_can_undo_changed();
 	}
 
@@ -182,37 +691,48 @@ public:
 	bool canUndo() const { return m_CAN_UNDO; }
 	bool canRedo() const { return m_CAN_REDO; }
 
+	~{{ .Name }}() override {
+		pUR->itemDestroyed(this);
+	}
+
 	Q_INVOKABLE void undo() override {
 		if (!m_UNDO_STACK.empty()) {
-			pUR->undoItemRemoved(this);
-			auto last = m_UNDO_STACK.takeLast();
-			{{ range $prop := .Properties }}
-			if (last.previous{{ $prop.Name }}Value.has_value()) {
-				last.previous{{ $prop.Name }}Value.swap(m_{{$prop.Name}});
-			}
-			{{ end }}
-			m_REDO_STACK << last;
-			pUR->redoItemAdded(this);
-			evaluate_can_undo_changed();
-			evaluate_can_redo_changed();
+			moveStep(m_UNDO_STACK, m_REDO_STACK, false);
 		}
 	}
 
 	Q_INVOKABLE void redo() override {
 		if (!m_REDO_STACK.empty()) {
-			pUR->redoItemRemoved(this);
-			auto last = m_REDO_STACK.takeLast();
-			{{ range $prop := .Properties }}
-			if (last.previous{{ $prop.Name }}Value.has_value()) {
-				last.previous{{ $prop.Name }}Value.swap(m_{{$prop.Name}});
-			}
-			{{ end }}
-			m_UNDO_STACK << last;
+			moveStep(m_REDO_STACK, m_UNDO_STACK, true);
+		}
+	}
+
+	// PPUndoRedoStack drops the oldest steps first, which are at the front.
+	void undoStepDropped() override {
+		if (!m_UNDO_STACK.empty()) {
+			m_UNDO_STACK.removeFirst();
 			evaluate_can_undo_changed();
+		}
+	}
+
+	void redoStepDropped() override {
+		if (!m_REDO_STACK.empty()) {
+			m_REDO_STACK.removeFirst();
 			evaluate_can_redo_changed();
 		}
 	}
 
+	// Steps read back from the journal are older than any the object holds.
+	void undoStepLoaded(const PPDelta& delta) override {
+		m_UNDO_STACK.prepend(delta);
+		evaluate_can_undo_changed();
+	}
+
+	void redoStepLoaded(const PPDelta& delta) override {
+		m_REDO_STACK.prepend(delta);
+		evaluate_can_redo_changed();
+	}
+
 	Q_INVOKABLE void stageDelete() {
 		if (!m_DELETE_PENDING) {
 			m_DELETE_PENDING = true;
@@ -224,12 +744,27 @@ public:
 	{{ $propType := $root.AlwaysType $prop.Type }}
 	{{ $propTypeName := StringJoin $propType "" }}
 	Q_SIGNAL void {{$prop.Name}}Changed();
-	{{ $propTypeName }} {{$prop.Name}}() const { return m_{{$prop.Name}}; };
+	{{- if $item.InSideTable $prop.Name }}
+	{{ $propTypeName }} {{$prop.Name}}() const { load_{{$prop.Name}}(); return m_{{$prop.Name}}; };
+	{{- else }}
+	{{ $propTypeName }} {{$prop.Name}}() const { load_columns(quint64(1) << {{ $item.ColumnIndex $prop.Name }}); return m_{{$prop.Name}}; };
+	{{- end }}
 	void set_{{$prop.Name}}(const {{ $propTypeName }}& val) {
+		{{- if $item.InSideTable $prop.Name }}
+		load_{{$prop.Name}}();
+		{{- else }}
+		load_columns(quint64(1) << {{ $item.ColumnIndex $prop.Name }});
+		{{- end }}
 		if (val == m_{{$prop.Name}}) {
 			return;
 		}
-		m_{{$prop.Name}}_prev = m_{{$prop.Name}};
+		if (!m_{{$prop.Name}}_dirty) {
+			{{- if $item.InSideTable $prop.Name }}
+			m_{{$prop.Name}}_prev = saved_{{$prop.Name}}();
+			{{- else }}
+			m_{{$prop.Name}}_prev = m_{{$prop.Name}};
+			{{- end }}
+		}
 		m_{{$prop.Name}}_dirty = true;
 		m_{{$prop.Name}} = val;
 		Q_EMIT void {{$prop.Name}}Changed();
@@ -238,181 +773,859 @@ public:
 		evaluate_can_undo_changed();
 	}
 	void discard_{{$prop.Name}}_changes() {
+		{{- if $item.InSideTable $prop.Name }}
+		if (m_{{$prop.Name}}_dirty || !m_{{$prop.Name}}_deltas.isEmpty()) {
+			m_{{$prop.Name}}_dirty = false;
+			m_{{$prop.Name}}_deltas.clear();
+			m_{{$prop.Name}}_loaded = false;
+			Q_EMIT void {{$prop.Name}}Changed();
+			evaluate_dirty_changed();
+		}
+		{{- else }}
 		if (m_{{$prop.Name}}_dirty) {
 			m_{{$prop.Name}}_dirty = false;
 			m_{{$prop.Name}} = m_{{$prop.Name}}_prev;
 			Q_EMIT void {{$prop.Name}}Changed();
 			evaluate_dirty_changed();
 		}
+		{{- end }}
 	}
 	{{ end }}
 
+	{{- range $table := $root.SideTables $item }}
+	{{ $name := $table.Property.Name }}
+	{{ $key := StringJoin $table.Key "" }}
+	{{ $value := StringJoin $table.Value "" }}
+	{{- if $table.Map }}
+	bool insert_{{ $name }}(const {{ $key }}& key, const {{ $value }}& value) {
+		load_{{ $name }}();
+		auto delta = {{ $table.Helper }}::insert(m_{{ $name }}, key, value);
+		if (delta.isNoop()) {
+			return false;
+		}
+		push_{{ $name }}_delta(delta);
+		return true;
+	}
+	bool remove_{{ $name }}(const {{ $key }}& key) {
+		load_{{ $name }}();
+		if (!m_{{ $name }}.contains(key)) {
+			return false;
+		}
+		push_{{ $name }}_delta({{ $table.Helper }}::remove(m_{{ $name }}, key));
+		return true;
+	}
+	static Predicate* {{ $name }}_has(const {{ $key }}& key) {
+		return new PPEntryPredicate(QStringLiteral("{{ $item.Name }}"), QStringLiteral("{{ $name }}"), QVector<QPair<QString,QVariant>>{
+			qMakePair(QStringLiteral("KEY"), PPColumn<{{ $key }}>::bind(key)),
+		});
+	}
+	static Predicate* {{ $name }}_has(const {{ $key }}& key, const {{ $value }}& value) {
+		return new PPEntryPredicate(QStringLiteral("{{ $item.Name }}"), QStringLiteral("{{ $name }}"), QVector<QPair<QString,QVariant>>{
+			qMakePair(QStringLiteral("KEY"), PPColumn<{{ $key }}>::bind(key)),
+			qMakePair(QStringLiteral("VALUE"), PPColumn<{{ $value }}>::bind(value)),
+		});
+	}
+	{{- else }}
+	void append_{{ $name }}(const {{ $value }}& value) {
+		load_{{ $name }}();
+		push_{{ $name }}_delta({{ $table.Helper }}::insert(m_{{ $name }}, m_{{ $name }}.size(), value));
+	}
+	bool insert_{{ $name }}(int index, const {{ $value }}& value) {
+		load_{{ $name }}();
+		if (index < 0 || index > m_{{ $name }}.size()) {
+			return false;
+		}
+		push_{{ $name }}_delta({{ $table.Helper }}::insert(m_{{ $name }}, index, value));
+		return true;
+	}
+	bool remove_{{ $name }}(int index) {
+		load_{{ $name }}();
+		if (index < 0 || index >= m_{{ $name }}.size()) {
+			return false;
+		}
+		push_{{ $name }}_delta({{ $table.Helper }}::remove(m_{{ $name }}, index));
+		return true;
+	}
+	static Predicate* {{ $name }}_contains(const {{ $value }}& value) {
+		return new PPEntryPredicate(QStringLiteral("{{ $item.Name }}"), QStringLiteral("{{ $name }}"), QVector<QPair<QString,QVariant>>{
+			qMakePair(QStringLiteral("VALUE"), PPColumn<{{ $value }}>::bind(value)),
+		});
+	}
+	{{- end }}
+	{{- end }}
+
 	void discard_all_changes() {
-		{{ range $prop := .Properties }}
+		{{ range $prop := .ColumnProperties }}
 		if (m_{{$prop.Name}}_dirty) {
 			m_{{$prop.Name}}_dirty = false;
 			m_{{$prop.Name}} = m_{{$prop.Name}}_prev;
 			Q_EMIT void {{$prop.Name}}Changed();
 		}
 		{{ end }}
+		{{- range $table := $root.SideTables $item }}
+		if (m_{{ $table.Property.Name }}_dirty || !m_{{ $table.Property.Name }}_deltas.isEmpty()) {
+			m_{{ $table.Property.Name }}_dirty = false;
+			m_{{ $table.Property.Name }}_deltas.clear();
+			m_{{ $table.Property.Name }}_loaded = false;
+			Q_EMIT void {{ $table.Property.Name }}Changed();
+		}
+		{{- end }}
 		evaluate_dirty_changed();
 	}
 
-	Q_INVOKABLE void save() {
-		if (m_NEW || m_DELETE_PENDING) {
-			auto tq = QStringLiteral(R"RJIENRLWEY(
-INSERT INTO {{ $item.Name }}
-(ID,
-{{- range $index, $prop := .Properties -}}
-{{- if $index -}},{{- end -}}
-{{- $prop.Name -}}
-{{- end -}}
-)
-VALUES
-(:ID, {{ range $index, $prop := .Properties }} {{ if $index }},{{ end }} :{{- $prop.Name }} {{ end }});
-			)RJIENRLWEY");
-			QSqlQuery query(PPDatabase::instance()->connection());
-			query.prepare(tq);
-			query.bindValue(":ID", QVariant::fromValue(m_ID));
-			{{- range $prop := .Properties }}
-			query.bindValue(":{{- $prop.Name -}}", QVariant::fromValue(m_{{$prop.Name}}));
-			{{ end -}}
-			auto res = query.exec();
-			if (!res) {
-				qCritical() << query.lastError() << "when creating a new item of {{ $item.Name }}";
+	Q_INVOKABLE bool save() {
+		PPTransaction transaction;
+		if (!transaction.isOpen()) {
+			return false;
+		}
+		QPointer<{{ .Name }}> self(this);
+		auto wasNew = m_NEW || m_DELETE_PENDING;
+		Change changes;
+		qint64 step = 0;
+		auto writes = takePendingWrites(&changes, &step);
+		if (writes.isEmpty()) {
+			return transaction.commit();
+		}
+		for (const auto& write : writes) {
+			if (!write.exec()) {
+				qCritical() << "when saving an item of type {{ $item.Name }}";
+				restorePending(wasNew, changes);
+				return false;
 			}
-			m_NEW = false;
-			if (m_DELETE_PENDING) {
-				m_DELETE_PENDING = false;
-				pendingDeleteChanged();
+		}
+		publishRow(wasNew, changes);
+		pDB->onCommit([self, wasNew, changes, step] {
+			if (self) {
+				self->publishSave(wasNew, changes, step);
 			}
-		} else {
+		});
+		pDB->onRollback([self, wasNew, changes] {
+			if (self) {
+				self->restorePending(wasNew, changes);
+			}
+		});
+		return transaction.commit();
+	}
+
+	// Like save(), but the write runs on PPDatabase's persistence thread. The
+	// future finishes on the calling thread, which needs a running event loop.
+	QFuture<bool> saveAsync() {
+		QPointer<{{ .Name }}> self(this);
+		auto wasNew = m_NEW || m_DELETE_PENDING;
 		Change changes;
-		{{ range $prop := .Properties }}
-		if (m_{{$prop.Name}}_dirty) {
-			changes.previous{{$prop.Name}}Value.copy(m_{{ $prop.Name }}_prev);
-			QSqlQuery query(PPDatabase::instance()->connection());
-			auto tq = QStringLiteral(R"RJIENRLWEY( UPDATE {{ $item.Name}} SET {{$prop.Name}} = :val WHERE ID = :id )RJIENRLWEY");
-			query.prepare(tq);
-			query.bindValue(":val", QVariant::fromValue(m_{{$prop.Name}}));
-			query.bindValue(":id", QVariant::fromValue(m_ID));
-			auto res = query.exec();
-			if (!res) {
-				qCritical() << query.lastError() << "when updating an item of type {{ $item.Name }} at row {{ $prop.Name }}";
+		qint64 step = 0;
+		auto writes = takePendingWrites(&changes, &step);
+		auto hasWrite = !writes.isEmpty();
+		return pDB->runAsync<bool, bool>([writes, hasWrite] {
+			if (!hasWrite) {
+				return true;
 			}
-			m_{{$prop.Name}}_dirty = false;
-		}
-		{{ end }}
-		m_UNDO_STACK << changes;
-		pUR->undoItemAdded(this);
-		evaluate_can_undo_changed();
-		}
+			PPTransaction transaction;
+			if (!transaction.isOpen()) {
+				return false;
+			}
+			for (const auto& write : writes) {
+				if (!write.exec()) {
+					qCritical() << "when saving an item of type {{ $item.Name }}";
+					return false;
+				}
+			}
+			return transaction.commit();
+		}, [self, wasNew, changes, step, hasWrite](const bool& ok) {
+			if (self) {
+				if (!ok) {
+					self->restorePending(wasNew, changes);
+				} else if (hasWrite) {
+					self->publishRow(wasNew, changes);
+					self->publishSave(wasNew, changes, step);
+				}
+			}
+			return ok;
+		});
 	}
 
 	{{ range $child := .Children }}
 	Q_INVOKABLE QList<QSharedPointer<{{ $child }}>> child{{ $child }}s() {
-		auto tq = QStringLiteral("SELECT * FROM {{ $child }} WHERE PARENT_{{ $item.Name }}_ID = :parent_id");
-		QSqlQuery query(PPDatabase::instance()->connection());
-		query.prepare(tq);
-		query.bindValue(":parent_id", m_ID);
-		auto ok = query.exec();
+		auto tq = QStringLiteral("SELECT %1 FROM {{ $child }} WHERE PARENT_{{ $item.Name }}_ID = :parent_id").arg({{ $child }}::selectColumns());
+		PPStatement query(tq);
+		query->bindValue(":parent_id", PPKey::encode(m_ID));
+		auto ok = query->exec();
 		if (!ok) {
-			qCritical() << query.lastError() << "when loading an {{ $child }} children of a {{ $item.Name }}";
+			qCritical() << query->lastError() << "when loading an {{ $child }} children of a {{ $item.Name }}";
 		}
 		QList<QSharedPointer<{{ $child }}>> ret;
-		{{ $childKind := index $root.Objects $child }}
-		while (query.next()) {
-			auto add = {{ $child }}::withID(query.value("ID").value<QUuid>());
-		{{ range $prop := $childKind.Properties }}
-			add->setProperty("{{ $prop.Name }}", query.value("{{ $prop.Name }}"));
-		{{ end }}
-			ret << add;
+		while (query->next()) {
+			ret << {{ $child }}::hydrated(*query);
 		}
 		return ret;
 	}
-	Q_INVOKABLE void addChild{{ $child }}(QSharedPointer<{{ $child }}> child) {
+	PPCursor<{{ $child }}> streamChild{{ $child }}s() {
+		PPCursor<{{ $child }}> ret(QStringLiteral("SELECT %1 FROM {{ $child }} WHERE PARENT_{{ $item.Name }}_ID = :parent_id").arg({{ $child }}::selectColumns()));
+		ret.query()->bindValue(":parent_id", PPKey::encode(m_ID));
+		ret.exec();
+		return ret;
+	}
+	Q_INVOKABLE bool addChild{{ $child }}(QSharedPointer<{{ $child }}> child) {
+		PPTransaction transaction;
+		if (!transaction.isOpen()) {
+			return false;
+		}
 		auto tq = QStringLiteral("UPDATE {{ $child }} SET PARENT_{{ $item.Name }}_ID = :new_parent_id WHERE ID = :child_id ");
-		QSqlQuery query(PPDatabase::instance()->connection());
-		query.prepare(tq);
-		query.bindValue(":new_parent_id", m_ID);
-		query.bindValue(":child_id", child->m_ID);
-		auto ok = query.exec();
+		PPStatement query(tq);
+		query->bindValue(":new_parent_id", PPKey::encode(m_ID));
+		query->bindValue(":child_id", PPKey::encode(child->m_ID));
+		auto ok = query->exec();
 		if (!ok) {
-			qCritical() << query.lastError() << "when adding a new {{ $child }} to a parent {{ $item.Name }}";
+			qCritical() << query->lastError() << "when adding a new {{ $child }} to a parent {{ $item.Name }}";
+			return false;
 		}
+		QPointer<{{ $child }}> rollbackChild(child.data());
+		pDB->onRollback([rollbackChild, previous = child->m_parent_{{ $item.Name }}_ID] {
+			if (rollbackChild) {
+				rollbackChild->m_parent_{{ $item.Name }}_ID = previous;
+			}
+		});
+		{{ $child }}::publishReparented(child->m_ID, QStringLiteral("PARENT_{{ $item.Name }}_ID"), child->m_parent_{{ $item.Name }}_ID, m_ID);
 		child->m_parent_{{ $item.Name }}_ID = m_ID;
+		return transaction.commit();
 	}
-	Q_INVOKABLE void removeChild{{ $child }}(QSharedPointer<{{ $child }}> child) {
+	Q_INVOKABLE bool removeChild{{ $child }}(QSharedPointer<{{ $child }}> child) {
+		PPTransaction transaction;
+		if (!transaction.isOpen()) {
+			return false;
+		}
 		auto tq = QStringLiteral("UPDATE {{ $child }} SET PARENT_{{ $item.Name }}_ID = NULL WHERE ID = :child_id ");
-		QSqlQuery query(PPDatabase::instance()->connection());
-		query.prepare(tq);
-		query.bindValue(":child_id", child->m_ID);
-		auto ok = query.exec();
+		PPStatement query(tq);
+		query->bindValue(":child_id", PPKey::encode(child->m_ID));
+		auto ok = query->exec();
 		if (!ok) {
-			qCritical() << query.lastError() << "when removing a {{ $child }} from a parent {{ $item.Name }}";
+			qCritical() << query->lastError() << "when removing a {{ $child }} from a parent {{ $item.Name }}";
+			return false;
 		}
+		QPointer<{{ $child }}> rollbackChild(child.data());
+		pDB->onRollback([rollbackChild, previous = child->m_parent_{{ $item.Name }}_ID] {
+			if (rollbackChild) {
+				rollbackChild->m_parent_{{ $item.Name }}_ID = previous;
+			}
+		});
+		{{ $child }}::publishReparented(child->m_ID, QStringLiteral("PARENT_{{ $item.Name }}_ID"), child->m_parent_{{ $item.Name }}_ID, QUuid());
 		child->m_parent_{{ $item.Name }}_ID = QUuid();
+		return transaction.commit();
 	}
 	{{ end }}
 
 	static QSharedPointer<{{ .Name }}> new{{ .Name }}() {
 		auto ret = {{.Name}}::withID(QUuid::createUuid());
 		ret->m_NEW = true;
+		ret->m_LOADED = AllColumns;
+		{{- range $table := $root.SideTables $item }}
+		ret->m_{{ $table.Property.Name }}_loaded = true;
+		{{- end }}
 		return ret;
 	}
 
 	static QSharedPointer<{{ .Name }}> load(const QUuid& ID) {
-		auto tq = QStringLiteral("SELECT * FROM {{ $item.Name }} WHERE ID = :id");
-		QSqlQuery query(PPDatabase::instance()->connection());
-		query.prepare(tq);
-		query.bindValue(":id", ID);
-		auto ok = query.exec();
+		auto tq = QStringLiteral("SELECT %1 FROM {{ $item.Name }} WHERE ID = :id").arg(selectColumns());
+		PPStatement query(tq);
+		query->bindValue(":id", PPKey::encode(ID));
+		auto ok = query->exec();
 		if (!ok) {
-			qCritical() << query.lastError() << "when loading an item of type {{ $item.Name }}";
+			qCritical() << query->lastError() << "when loading an item of type {{ $item.Name }}";
 		}
 		auto ret = {{.Name}}::withID(ID);
-		while (query.next()) {
-			{{ range $prop := .Properties -}}
-			ret->setProperty("{{ $prop.Name }}", query.value("{{ $prop.Name }}"));
-			{{ end }}
+		while (query->next()) {
+			ret->hydrate(*query, EagerColumns);
 		}
 		return ret;
 	}
 
 	static QList<QSharedPointer<{{ .Name }}>> where(PredicateList predicates) {
-		auto tq = QStringLiteral("SELECT * FROM {{ $item.Name }} WHERE %1").arg(predicates.allPredicatesToWhere().join(","));
-		QSqlQuery query(PPDatabase::instance()->connection());
-		query.prepare(tq);
-		predicates.bindAllPredicates(&query);
-		auto ok = query.exec();
-		if (!ok) {
-			qCritical() << query.lastError() << "when running a where query on items of type {{ $item.Name }}";
+		return where(std::move(predicates), EagerColumns);
+	}
+
+	// Like where(), but only reads the given properties. The others are read the first
+	// time they're used, or for many objects at once with fetch().
+	static QList<QSharedPointer<{{ .Name }}>> where(PredicateList predicates, const QStringList& properties) {
+		return where(std::move(predicates), columnsNamed(properties));
+	}
+
+	// Aggregates over the rows matching all of the predicates, computed by
+	// SQLite without reading the rows.
+	static qint64 count(PredicateList predicates = PredicateList()) {
+		return PPAggregate::value(QStringLiteral("{{ .Name }}"), QStringLiteral("COUNT(*)"), predicates).toLongLong();
+	}
+	static bool exists(PredicateList predicates = PredicateList()) {
+		return PPAggregate::exists(QStringLiteral("{{ .Name }}"), predicates);
+	}
+	{{- range $prop := .NumericProperties }}
+	{{- $propType := StringJoin ($root.AlwaysType $prop.Type) "" }}
+	// These are 0 when no rows match.
+	static {{ $propType }} min_{{ $prop.Name }}(PredicateList predicates = PredicateList()) {
+		return PPColumn<{{ $propType }}>::read(PPAggregate::value(QStringLiteral("{{ $item.Name }}"), QStringLiteral("MIN({{ $prop.Name }})"), predicates));
+	}
+	static {{ $propType }} max_{{ $prop.Name }}(PredicateList predicates = PredicateList()) {
+		return PPColumn<{{ $propType }}>::read(PPAggregate::value(QStringLiteral("{{ $item.Name }}"), QStringLiteral("MAX({{ $prop.Name }})"), predicates));
+	}
+	static {{ SumType $prop.Type }} sum_{{ $prop.Name }}(PredicateList predicates = PredicateList()) {
+		return PPColumn<{{ SumType $prop.Type }}>::read(PPAggregate::value(QStringLiteral("{{ $item.Name }}"), QStringLiteral("SUM({{ $prop.Name }})"), predicates));
+	}
+	static double avg_{{ $prop.Name }}(PredicateList predicates = PredicateList()) {
+		return PPAggregate::value(QStringLiteral("{{ $item.Name }}"), QStringLiteral("AVG({{ $prop.Name }})"), predicates).toDouble();
+	}
+	{{- end }}
+
+	// Like where(), but hands the rows out one at a time as they're read.
+	static PPCursor<{{ .Name }}> streamWhere(PredicateList predicates) {
+		PPCursor<{{ .Name }}> ret(QStringLiteral("SELECT %1 FROM {{ $item.Name }}%2").arg(selectColumns(), predicates.whereClause()));
+		predicates.bindAllPredicates(ret.query());
+		ret.exec();
+		return ret;
+	}
+
+	// The values of a row for importRows() and insertMany(). Collections stored
+	// in side tables start out empty.
+	struct Record {
+		{{- range $prop := .ColumnProperties }}
+		{{- $propType := $root.AlwaysType $prop.Type }}
+		{{ StringJoin $propType "" }} {{ $prop.Name }}{};
+		{{- end }}
+	};
+
+	// Writes records as new rows in one transaction, a few hundred rows per
+	// INSERT, without creating any objects. IDs receives the IDs of the rows.
+	template<class Records>
+	static bool importRows(const Records& records, QVector<QUuid>* IDs = nullptr) {
+		return importRecords(records, IDs, nullptr);
+	}
+
+	// Like importRows(), but also hands back an object for each row.
+	template<class Records>
+	static QList<QSharedPointer<{{ .Name }}>> insertMany(const Records& records) {
+		QVector<QUuid> IDs;
+		QVector<Record> written;
+		if (!importRecords(records, &IDs, &written)) {
+			return {};
 		}
 		QList<QSharedPointer<{{ .Name }}>> ret;
-		while (query.next()) {
-			auto add = {{ .Name }}::withID(query.value("ID").value<QUuid>());
-			{{ range $prop := .Properties }}
-			add->setProperty("{{ $prop.Name }}", query.value("{{ $prop.Name }}"));
-			{{ end }}
-			ret << add;
+		ret.reserve(IDs.size());
+		for (int i = 0; i < IDs.size(); i++) {
+			auto object = withID(IDs[i]);
+			{{- range $prop := .ColumnProperties }}
+			object->m_{{ $prop.Name }} = written[i].{{ $prop.Name }};
+			{{- end }}
+			object->m_LOADED = AllColumns;
+			ret << object;
 		}
 		return ret;
 	}
 
+	// Reads records in a single pass, so any range will do, and keeps a copy
+	// of each in written when given.
+	template<class Records>
+	static bool importRecords(const Records& records, QVector<QUuid>* IDs, QVector<Record>* written) {
+		// SQLite allows 999 bound values per statement unless built otherwise.
+		static const int batch_size = qMax(1, 999 / {{ len .ColumnProperties | inc }});
+
+		PPTransaction transaction;
+		if (!transaction.isOpen()) {
+			return false;
+		}
+		// Rows are held as their bound values rather than pointers into records,
+		// whose iterators may hand out temporaries.
+		QVector<QVariant> batch;
+		batch.reserve(batch_size * {{ len .ColumnProperties | inc }});
+		int rows = 0;
+		auto any = false;
+		auto flush = [&batch, &rows] {
+			PPStatement query(insertStatement(rows));
+			for (int position = 0; position < batch.size(); position++) {
+				query->bindValue(position, batch.at(position));
+			}
+			batch.clear();
+			rows = 0;
+			if (!query->exec()) {
+				qCritical() << query->lastError() << "when importing items of type {{ $item.Name }}";
+				return false;
+			}
+			return true;
+		};
+		for (const Record& record : records) {
+			auto ID = QUuid::createUuid();
+			batch << PPKey::encode(ID);
+			{{- range $prop := .ColumnProperties }}
+			batch << PPColumn<decltype(m_{{ $prop.Name }})>::bind(record.{{ $prop.Name }});
+			{{- end }}
+			if (IDs != nullptr) {
+				*IDs << ID;
+			}
+			if (written != nullptr) {
+				*written << record;
+			}
+			any = true;
+			if (++rows == batch_size && !flush()) {
+				return false;
+			}
+		}
+		if (rows > 0 && !flush()) {
+			return false;
+		}
+		if (!any) {
+			return transaction.commit();
+		}
+
+		PPRowChange change;
+		change.kind = PPRowChange::Reset;
+		change.table = QStringLiteral("{{ .Name }}");
+		pDB->publishRowChange(change);
+		return transaction.commit();
+	}
+
+	// New values for some of the properties stored in the table, for updateWhere().
+	class Patch
+	{
+		friend class {{ .Name }};
+
+		quint64 m_columns = 0;
+		QVector<QVariant> m_values = QVector<QVariant>({{ len .ColumnProperties }});
+
+		void bindTo(QSqlQuery* query) const {
+			{{- range $index, $prop := .ColumnProperties }}
+			if (m_columns & (quint64(1) << {{ $index }})) {
+				query->bindValue(":{{ $prop.Name }}", m_values[{{ $index }}]);
+			}
+			{{- end }}
+			Q_UNUSED(query)
+		}
+		// The values in the order hydrate() reads them, after the ID's place.
+		PPValueRow row() const {
+			PPValueRow ret;
+			ret.values << QVariant();
+			for (int i = 0; i < m_values.size(); i++) {
+				if (m_columns & (quint64(1) << i)) {
+					ret.values << m_values[i];
+				}
+			}
+			return ret;
+		}
+
+	public:
+		{{- range $index, $prop := .ColumnProperties }}
+		{{- $propType := StringJoin ($root.AlwaysType $prop.Type) "" }}
+		Patch& set_{{ $prop.Name }}(const {{ $propType }}& value) {
+			m_values[{{ $index }}] = PPColumn<{{ $propType }}>::bind(value);
+			m_columns |= quint64(1) << {{ $index }};
+			return *this;
+		}
+		{{- end }}
+	};
+
+	// The properties, as bits in declaration order, of the given columns.
+	static quint64 propertiesOf(quint64 columns) {
+		quint64 ret = 0;
+		{{- range $index, $prop := .ColumnProperties }}
+		if (columns & (quint64(1) << {{ $index }})) {
+			ret |= quint64(1) << {{ $item.PropertyIndex $prop.Name }};
+		}
+		{{- end }}
+		return ret;
+	}
+
+	static void publishChanges(PPRowChange::Kind kind, const QVector<QUuid>& IDs, quint64 properties) {
+		PPRowChange change;
+		change.table = QStringLiteral("{{ .Name }}");
+		if (IDs.size() > PPRowChange::ResetThreshold) {
+			change.kind = PPRowChange::Reset;
+			pDB->publishRowChange(change);
+			return;
+		}
+		change.kind = kind;
+		change.properties = properties;
+		for (const auto& ID : IDs) {
+			change.ID = ID;
+			pDB->publishRowChange(change);
+		}
+	}
+
+	// Gives the live objects among IDs the patch's values, unless they have unsaved
+	// edits to them, and publishes the change.
+	static void applyPatch(const QVector<QUuid>& IDs, const Patch& patch) {
+		auto row = patch.row();
+		auto& map = PPIdentityMap<{{ .Name }}>::instance();
+		for (const auto& ID : IDs) {
+			if (auto object = map.value(ID)) {
+				object->hydrate(row, patch.m_columns);
+			}
+		}
+		publishChanges(PPRowChange::Updated, IDs, propertiesOf(patch.m_columns));
+	}
+
+	// Writes the patch to each of the rows in IDs, for redoing updateWhere().
+	static void writePatch(const QVector<QUuid>& IDs, const Patch& patch) {
+		PPTransaction transaction;
+		if (!transaction.isOpen()) {
+			return;
+		}
+		PPStatement query(updateStatement(patch.m_columns));
+		for (const auto& ID : IDs) {
+			patch.bindTo(query.data());
+			query->bindValue(":ID", PPKey::encode(ID));
+			if (!query->exec()) {
+				qCritical() << query->lastError() << "when redoing an update of items of type {{ .Name }}";
+				return;
+			}
+		}
+		pDB->onCommit([IDs, patch] { applyPatch(IDs, patch); });
+		transaction.commit();
+	}
+
+	// Writes back the values rows had before updateWhere(), read in the order of
+	// selectColumns(columns).
+	static void restoreRows(const QList<QSqlRecord>& rows, quint64 columns) {
+		PPTransaction transaction;
+		if (!transaction.isOpen()) {
+			return;
+		}
+		PPStatement query(updateStatement(columns));
+		QVector<QUuid> IDs;
+		for (const auto& row : rows) {
+			int column = 1;
+			{{- range $index, $prop := .ColumnProperties }}
+			if (columns & (quint64(1) << {{ $index }})) {
+				query->bindValue(":{{ $prop.Name }}", row.value(column++));
+			}
+			{{- end }}
+			query->bindValue(":ID", row.value(0));
+			if (!query->exec()) {
+				qCritical() << query->lastError() << "when undoing an update of items of type {{ .Name }}";
+				return;
+			}
+			IDs << PPKey::decode(row.value(0));
+			Q_UNUSED(column)
+		}
+		pDB->onCommit([rows, columns, IDs] {
+			auto& map = PPIdentityMap<{{ .Name }}>::instance();
+			for (const auto& row : rows) {
+				if (auto object = map.value(PPKey::decode(row.value(0)))) {
+					object->hydrate(row, columns);
+				}
+			}
+			publishChanges(PPRowChange::Updated, IDs, propertiesOf(columns));
+		});
+		transaction.commit();
+	}
+
+	// Sets the patch's properties on every row matching all of the predicates, or
+	// every row if there are none, with one UPDATE. Live objects among them take the
+	// new values, except for properties with unsaved edits. With undoable, the whole
+	// update is a single step on PPUndoRedoStack, which writes the old values back.
+	static bool updateWhere(PredicateList predicates, const Patch& patch, bool undoable = false) {
+		auto columns = patch.m_columns;
+		if (columns == 0) {
+			return true;
+		}
+		PPTransaction transaction;
+		if (!transaction.isOpen()) {
+			return false;
+		}
+		auto where = predicates.whereClause();
+		// The rows' IDs, and for undo their values, before they change.
+		PPStatement select(QStringLiteral("SELECT %1 FROM {{ .Name }}%2").arg(undoable ? selectColumns(columns) : QStringLiteral("ID"), where));
+		predicates.bindAllPredicates(select.data());
+		if (!select->exec()) {
+			qCritical() << select->lastError() << "when finding items of type {{ .Name }} to update";
+			return false;
+		}
+		auto rows = PPDatabase::records(select.data());
+		if (rows.isEmpty()) {
+			return transaction.commit();
+		}
+		PPStatement update(QStringLiteral("UPDATE {{ .Name }} SET %1%2").arg(assignments(columns), where));
+		predicates.bindAllPredicates(update.data());
+		patch.bindTo(update.data());
+		if (!update->exec()) {
+			qCritical() << update->lastError() << "when updating items of type {{ .Name }}";
+			return false;
+		}
+		QVector<QUuid> IDs;
+		IDs.reserve(rows.size());
+		for (const auto& row : rows) {
+			IDs << PPKey::decode(row.value(0));
+		}
+		pDB->onCommit([IDs, patch] { applyPatch(IDs, patch); });
+		if (undoable) {
+			PPUndoStep::record([rows, columns] { restoreRows(rows, columns); }, [IDs, patch] { writePatch(IDs, patch); }, PPUndoStep::bytesOf(rows));
+		}
+		return transaction.commit();
+	}
+
+	// Live objects whose rows were deleted stop saving, until an undo writes
+	// the rows back.
+	static void markDeleted(const QVector<QUuid>& IDs, bool deleted) {
+		auto& map = PPIdentityMap<{{ .Name }}>::instance();
+		for (const auto& ID : IDs) {
+			if (auto object = map.value(ID)) {
+				object->m_DELETED = deleted;
+			}
+		}
+	}
+
+	// Deletes the rows in IDs again, for redoing deleteWhere().
+	static void deleteRows(const QVector<QUuid>& IDs) {
+		PPTransaction transaction;
+		if (!transaction.isOpen()) {
+			return;
+		}
+		PPStatement query(QStringLiteral("DELETE FROM {{ .Name }} WHERE ID = :ID"));
+		for (const auto& ID : IDs) {
+			query->bindValue(":ID", PPKey::encode(ID));
+			auto ok = query->exec();
+			{{- range $table := $root.SideTables $item }}
+			ok = ok && PPSideTable::clear(QStringLiteral("{{ $table.Table }}"), ID).exec();
+			{{- end }}
+			if (!ok) {
+				qCritical() << query->lastError() << "when redoing a deletion of items of type {{ .Name }}";
+				return;
+			}
+		}
+		pDB->onCommit([IDs] { markDeleted(IDs, true); });
+		publishChanges(PPRowChange::Reset, {}, 0);
+		transaction.commit();
+	}
+
+	// Deletes every row matching all of the predicates, or every row if there are
+	// none, with one DELETE per table. With undoable, the whole deletion is a single
+	// step on PPUndoRedoStack, which writes the rows back.
+	static bool deleteWhere(PredicateList predicates, bool undoable = false) {
+		PPTransaction transaction;
+		if (!transaction.isOpen()) {
+			return false;
+		}
+		auto where = predicates.whereClause();
+		// For undo, the rows are read whole, with the rowid SELECT * leaves out.
+		PPStatement select(QStringLiteral("SELECT %1 FROM {{ .Name }}%2").arg(undoable ? QStringLiteral("{{ if eq .KeyLayout "default" }}rowid AS rowid, {{ end }}*") : QStringLiteral("ID{{ range $parent := $root.ParentedBy .Name }}, PARENT_{{ $parent }}_ID{{ end }}"), where));
+		predicates.bindAllPredicates(select.data());
+		if (!select->exec()) {
+			qCritical() << select->lastError() << "when finding items of type {{ .Name }} to delete";
+			return false;
+		}
+		auto rows = PPDatabase::records(select.data());
+		if (rows.isEmpty()) {
+			return transaction.commit();
+		}
+		QHash<QUuid,qint64> rowids;
+		{{- if ne .KeyLayout "withoutrowid" }}
+		// Models find where the rows were by their rowids.
+		if (rows.size() <= PPRowChange::ResetThreshold) {
+			PPStatement query(QStringLiteral("SELECT ID, rowid FROM {{ .Name }}%1").arg(where));
+			predicates.bindAllPredicates(query.data());
+			if (query->exec()) {
+				while (query->next()) {
+					rowids.insert(PPKey::decode(query->value(0)), query->value(1).toLongLong());
+				}
+			}
+		}
+		{{- end }}
+		// Side table rows are read for undo and deleted by their owner's ID.
+		QList<QPair<QString,QList<QSqlRecord>>> entries;
+		{{- range $table := $root.SideTables $item }}
+		{
+			auto owners = QStringLiteral(" WHERE OWNER_ID IN (SELECT ID FROM {{ $item.Name }}%1)").arg(where);
+			if (undoable) {
+				PPStatement query(QStringLiteral("SELECT * FROM {{ $table.Table }}") + owners);
+				predicates.bindAllPredicates(query.data());
+				if (!query->exec()) {
+					qCritical() << query->lastError() << "when reading {{ $table.Table }} to delete";
+					return false;
+				}
+				entries << qMakePair(QStringLiteral("{{ $table.Table }}"), PPDatabase::records(query.data()));
+			}
+			PPStatement query(QStringLiteral("DELETE FROM {{ $table.Table }}") + owners);
+			predicates.bindAllPredicates(query.data());
+			if (!query->exec()) {
+				qCritical() << query->lastError() << "when deleting from {{ $table.Table }}";
+				return false;
+			}
+		}
+		{{- end }}
+		PPStatement query(QStringLiteral("DELETE FROM {{ .Name }}%1").arg(where));
+		predicates.bindAllPredicates(query.data());
+		if (!query->exec()) {
+			qCritical() << query->lastError() << "when deleting items of type {{ .Name }}";
+			return false;
+		}
+
+		QVector<QUuid> IDs;
+		IDs.reserve(rows.size());
+		for (const auto& row : rows) {
+			IDs << PPKey::decode(row.value(QStringLiteral("ID")));
+		}
+		pDB->onCommit([IDs] { markDeleted(IDs, true); });
+		if (IDs.size() > PPRowChange::ResetThreshold) {
+			publishChanges(PPRowChange::Reset, {}, 0);
+		} else {
+			for (const auto& row : rows) {
+				auto ID = PPKey::decode(row.value(QStringLiteral("ID")));
+				{{- range $parent := $root.ParentedBy .Name }}
+				auto parent_{{ $parent }} = PPKey::decode(row.value(QStringLiteral("PARENT_{{ $parent }}_ID")));
+				if (!parent_{{ $parent }}.isNull()) {
+					publishReparented(ID, QStringLiteral("PARENT_{{ $parent }}_ID"), parent_{{ $parent }}, QUuid());
+				}
+				{{- end }}
+				PPRowChange change;
+				change.kind = PPRowChange::Deleted;
+				change.table = QStringLiteral("{{ .Name }}");
+				change.ID = ID;
+				change.rowid = rowids.value(ID);
+				pDB->publishRowChange(change);
+			}
+		}
+		if (undoable) {
+			auto bytes = PPUndoStep::bytesOf(rows);
+			for (const auto& entry : entries) {
+				bytes += PPUndoStep::bytesOf(entry.second);
+			}
+			PPUndoStep::record([rows, entries, IDs] {
+				PPTransaction transaction;
+				if (!transaction.isOpen()) {
+					return;
+				}
+				{{- if eq .KeyLayout "withoutrowid" }}
+				auto ok = PPDatabase::insertRecords(QStringLiteral("{{ .Name }}"), rows);
+				{{- else }}
+				// Rows go back under their old rowids, and so in their old place,
+				// unless a row inserted since has taken one.
+				QList<QSqlRecord> placed;
+				QList<QSqlRecord> moved;
+				PPStatement taken(QStringLiteral("SELECT 1 FROM {{ .Name }} WHERE rowid = :rowid"));
+				for (auto row : rows) {
+					taken->bindValue(":rowid", row.value(QStringLiteral("{{ if eq .KeyLayout "rowid" }}ROW_ID{{ else }}rowid{{ end }}")));
+					if (taken->exec() && taken->next()) {
+						row.remove(row.indexOf(QStringLiteral("{{ if eq .KeyLayout "rowid" }}ROW_ID{{ else }}rowid{{ end }}")));
+						moved << row;
+					} else {
+						placed << row;
+					}
+					taken->finish();
+				}
+				auto ok = PPDatabase::insertRecords(QStringLiteral("{{ .Name }}"), placed)
+					&& PPDatabase::insertRecords(QStringLiteral("{{ .Name }}"), moved);
+				{{- end }}
+				for (const auto& entry : entries) {
+					ok = ok && PPDatabase::insertRecords(entry.first, entry.second);
+				}
+				if (ok) {
+					pDB->onCommit([IDs] { markDeleted(IDs, false); });
+					publishChanges(PPRowChange::Reset, {}, 0);
+					transaction.commit();
+				}
+			}, [IDs] { deleteRows(IDs); }, bytes);
+		}
+		return transaction.commit();
+	}
+
+	static void fetch(const QList<QSharedPointer<{{ .Name }}>>& objects, const QStringList& properties) {
+		fetchColumns(objects, columnsNamed(properties));
+	}
+
+	// A typed query over the properties stored in the table, like
+	// {{ .Name }}::query(){{ range $index, $prop := .ColumnProperties }}{{ if eq $index 0 }}.{{ $prop.Name }}.equals(value){{ end }}{{ end }}.limit(10).all().
+	class Query : public PPQuery<Query>
+	{
+	public:
+		Query() = default;
+		// Fields point at the query that holds them, so copies only take the clauses.
+		Query(const Query& other) : PPQuery<Query>(other) {}
+		Query& operator=(const Query& other) {
+			PPQuery<Query>::operator=(other);
+			return *this;
+		}
+
+		{{- range $index, $prop := .ColumnProperties }}
+		{{- $propType := $root.AlwaysType $prop.Type }}
+		PPField<Query, {{ StringJoin $propType "" }}> {{ $prop.Name }}{this, {{ $index }}};
+		{{- end }}
+
+		PPCursor<{{ $item.Name }}> stream() const {
+			static const char* const columns[] = { {{- range $prop := $item.ColumnProperties }}"{{ $prop.Name }}", {{ end -}} nullptr };
+			PPCursor<{{ $item.Name }}> ret(PPQueryBase::statement(QStringLiteral("{{ $item.Name }}"), {{ $item.Name }}::selectColumns(), columns));
+			PPQueryBase::bind(ret.query());
+			ret.exec();
+			return ret;
+		}
+
+		QList<QSharedPointer<{{ $item.Name }}>> all() const {
+			QList<QSharedPointer<{{ $item.Name }}>> ret;
+			for (const auto& row : stream()) {
+				ret << row;
+			}
+			return ret;
+		}
+
+		QSharedPointer<{{ $item.Name }}> first() const {
+			auto ret = Query(*this).limit(1).all();
+			return ret.isEmpty() ? QSharedPointer<{{ $item.Name }}>() : ret.first();
+		}
+	};
+
+	static Query query() {
+		return Query();
+	}
+
+	static QFuture<QSharedPointer<{{ .Name }}>> loadAsync(const QUuid& ID) {
+		return pDB->runAsync<QList<QSqlRecord>, QSharedPointer<{{ .Name }}>>([ID] {
+			PPStatement query(QStringLiteral("SELECT %1 FROM {{ $item.Name }} WHERE ID = :id").arg(selectColumns()));
+			query->bindValue(":id", PPKey::encode(ID));
+			auto ok = query->exec();
+			if (!ok) {
+				qCritical() << query->lastError() << "when loading an item of type {{ $item.Name }}";
+			}
+			return PPDatabase::records(query.data());
+		}, [ID](const QList<QSqlRecord>& records) {
+			auto ret = {{.Name}}::withID(ID);
+			for (const auto& record : records) {
+				ret->hydrate(record, EagerColumns);
+			}
+			return ret;
+		});
+	}
+
+	static QFuture<QList<QSharedPointer<{{ .Name }}>>> whereAsync(PredicateList predicates) {
+		auto tq = QStringLiteral("SELECT %1 FROM {{ $item.Name }}%2").arg(selectColumns(), predicates.whereClause());
+		auto shared = QSharedPointer<PredicateList>::create(std::move(predicates));
+		return pDB->runAsync<QList<QSqlRecord>, QList<QSharedPointer<{{ .Name }}>>>([tq, shared] {
+			PPStatement query(tq);
+			shared->bindAllPredicates(query.data());
+			auto ok = query->exec();
+			if (!ok) {
+				qCritical() << query->lastError() << "when running a where query on items of type {{ $item.Name }}";
+			}
+			return PPDatabase::records(query.data());
+		}, [](const QList<QSqlRecord>& records) {
+			QList<QSharedPointer<{{ .Name }}>> ret;
+			for (const auto& record : records) {
+				ret << hydrated(record);
+			}
+			return ret;
+		});
+	}
+
 	static void prepareDatabase() {
 		volatile auto db = PPDatabase::instance();
 		Q_UNUSED(db)
 
 		auto tq = QStringLiteral(R"RJIENRLWEY(
 		CREATE TABLE IF NOT EXISTS {{ $item.Name }}(
+			{{ if eq .KeyLayout "rowid" }}ROW_ID INTEGER PRIMARY KEY,
+			{{ end -}}
 			ID BLOB NOT NULL,
 			{{ range $parent := $root.ParentedBy .Name }}
 			PARENT_{{ $parent }}_ID BLOB,
 			{{ end }}
-			{{ range $prop := .Properties -}}
+			{{ range $prop := .ColumnProperties -}}
 			{{ $prop.Name }} {{ TypeDef $prop.Type }} NOT NULL,
 			{{ end -}}
-			PRIMARY KEY (ID))
+			{{ if eq .KeyLayout "rowid" }}UNIQUE (ID)){{ else }}PRIMARY KEY (ID)){{ end }}
+			{{- if eq .KeyLayout "withoutrowid" }} WITHOUT ROWID{{ end }}
 		)RJIENRLWEY");
 		QSqlQuery query(PPDatabase::instance()->connection());
 		query.prepare(tq);
@@ -420,6 +1633,27 @@ VALUES
 		if (!ok) {
 			qCritical() << query.lastError();
 		}
+		for (const auto& index : QStringList{
+			{{- range $table := $root.SideTables $item }}
+			PPSideTable::createStatement(QStringLiteral("{{ $table.Table }}"), QStringLiteral("{{ TypeDef $table.KeyType }}"), QStringLiteral("{{ TypeDef $table.ValueType }}")),
+			{{- end }}
+			{{- range $parent := $root.ParentedBy .Name }}
+			QStringLiteral("CREATE INDEX IF NOT EXISTS {{ $item.Name }}_PARENT_{{ $parent }}_ID ON {{ $item.Name }}(PARENT_{{ $parent }}_ID)"),
+			{{- end }}
+			{{- range $index := .Indexes }}
+			QStringLiteral("CREATE {{ if $index.Unique }}UNIQUE {{ end }}INDEX IF NOT EXISTS {{ $index.Name $item.Name }} ON {{ $item.Name }}({{ StringJoin $index.Columns ", " }})"),
+			{{- end }}
+		}) {
+			if (!query.exec(index)) {
+				qCritical() << query.lastError();
+			}
+		}
+		PPDatabase::instance()->migrateKeys(QStringLiteral("{{ $item.Name }}"), QStringList{
+			QStringLiteral("ID"),
+			{{- range $parent := $root.ParentedBy .Name }}
+			QStringLiteral("PARENT_{{ $parent }}_ID"),
+			{{- end }}
+		});
 	}
 
 };
@@ -427,44 +1661,288 @@ VALUES
 class {{ .Name }}Model : public QAbstractListModel {
 	Q_OBJECT
 
-	mutable QSqlQuery m_query = QSqlQuery(PPDatabase::instance()->connection());
-	static const int fetch_size = 255;
-	int m_rowCount = 0;
-	int m_bottom = 0;
-	bool m_atEnd = false;
+	// Rows are read a page at a time in the order they were inserted, by rowid,
+	// or in ID order for WITHOUT ROWID tables, which have nothing else to go by.
+	// A page starts after the key that ends the page before it, so once that
+	// key is known reading it is an index seek, and only a window of recently
+	// used pages is kept hydrated. Finding the key of a page first reached by
+	// a jump skips the rows since the nearest known one inside SQLite, which
+	// only walks the key's index, so it still grows with the distance.
+	static const int page_size = 256;
+	static const int window_pages = 8;
+
+	static QString orderKey() {
+		return QStringLiteral("{{ if eq .KeyLayout "withoutrowid" }}ID{{ else }}rowid{{ end }}");
+	}
+
+	QString m_parentColumn;
 	QUuid m_parentID;
-	mutable QMap<int,QSharedPointer<{{.Name}}>> m_items;
+	int m_rowCount = 0;
+	// m_anchors[k] is the key of the last row of page k - 1. Page 0 has none.
+	// Pages reached by a jump leave gaps before them.
+	mutable QMap<int,QVariant> m_anchors;
+	mutable QCache<int,QVector<QSharedPointer<{{ .Name }}>>> m_pages;
 	QSharedPointer<{{ .Name }}> m_staging;
 	ModelTypes m_parentedKind;
 
 	Q_PROPERTY({{ .Name }}* staging READ staging NOTIFY stagingItemChanged)
 
-	void prefetch(int toRow) {
-		if (m_atEnd || toRow <= m_bottom)
+	{{ .Name }}Model(ModelTypes parentedKind, const QString& parentColumn, const QUuid& parentID) : QAbstractListModel(nullptr), m_parentColumn(parentColumn), m_parentID(parentID), m_pages(window_pages), m_parentedKind(parentedKind)
+	{
+		connect(pDB, &PPDatabase::rowChanged, this, &{{ .Name }}Model::applyRowChange);
+		refresh();
+	}
+
+	QString select(const QString& columns, const QString& condition, const QString& tail) const {
+		QStringList conditions;
+		if (!m_parentColumn.isEmpty()) {
+			conditions << QStringLiteral("%1 = :parent_id").arg(m_parentColumn);
+		}
+		if (!condition.isEmpty()) {
+			conditions << condition;
+		}
+		auto ret = QStringLiteral("SELECT %1 FROM {{ .Name }}").arg(columns);
+		if (!conditions.isEmpty()) {
+			ret += QStringLiteral(" WHERE ") + conditions.join(QStringLiteral(" AND "));
+		}
+		return ret + tail;
+	}
+
+	void bindParent(QSqlQuery* query) const {
+		if (!m_parentColumn.isEmpty()) {
+			query->bindValue(":parent_id", PPKey::encode(m_parentID));
+		}
+	}
+
+	void refresh() {
+		beginResetModel();
+		m_anchors.clear();
+		m_anchors.insert(0, QVariant());
+		m_pages.clear();
+		PredicateList predicates;
+		if (!m_parentColumn.isEmpty()) {
+			predicates << new Equals(m_parentColumn, PPKey::encode(m_parentID));
+		}
+		m_rowCount = int({{ .Name }}::count(std::move(predicates)));
+		endResetModel();
+	}
+
+	// Finds the anchor of page with one query that skips to it from the
+	// nearest known anchor before it. Each anchor is found once.
+	bool anchor(int page) const {
+		if (m_anchors.contains(page)) {
+			return true;
+		}
+		auto known = std::prev(m_anchors.lowerBound(page));
+		auto afterAnchor = known.key() > 0;
+		PPStatement query(select(orderKey(), afterAnchor ? orderKey() + QStringLiteral(" > :anchor") : QString(), QStringLiteral(" ORDER BY %1 LIMIT 1 OFFSET %2").arg(orderKey()).arg((page - known.key()) * page_size - 1)));
+		bindParent(query.data());
+		if (afterAnchor) {
+			query->bindValue(":anchor", known.value());
+		}
+		if (!query->exec()) {
+			qCritical() << query->lastError() << "when paging items of type {{ $item.Name }}";
+			return false;
+		}
+		if (!query->next()) {
+			return false;
+		}
+		m_anchors.insert(page, query->value(0));
+		return true;
+	}
+
+	QVector<QSharedPointer<{{ .Name }}>>* page(int index) const {
+		if (auto cached = m_pages.object(index)) {
+			return cached;
+		}
+		if (!anchor(index)) {
+			return nullptr;
+		}
+		// The key is read after the object's columns, so hydrating ignores it.
+		auto columns = {{ .Name }}::selectColumns();
+		{{- if ne .KeyLayout "withoutrowid" }}
+		columns += QStringLiteral(", rowid");
+		{{- end }}
+		PPStatement query(select(columns, index > 0 ? orderKey() + QStringLiteral(" > :anchor") : QString(), QStringLiteral(" ORDER BY %1 LIMIT %2").arg(orderKey()).arg(page_size)));
+		bindParent(query.data());
+		if (index > 0) {
+			query->bindValue(":anchor", m_anchors.value(index));
+		}
+		if (!query->exec()) {
+			qCritical() << query->lastError() << "when paging items of type {{ $item.Name }}";
+			return nullptr;
+		}
+		auto rows = new QVector<QSharedPointer<{{ .Name }}>>;
+		rows->reserve(page_size);
+		QVariant last;
+		while (query->next()) {
+			last = query->value({{ if eq .KeyLayout "withoutrowid" }}0{{ else }}query->record().count() - 1{{ end }});
+			*rows << {{ .Name }}::hydrated(*query);
+		}
+		if (rows->size() == page_size && !m_anchors.contains(index + 1)) {
+			m_anchors.insert(index + 1, last);
+		}
+		m_pages.insert(index, rows);
+		return rows;
+	}
+
+	// Committed changes are applied to the rows they touch: inserts and removals
+	// shift the rows after them and drop the pages that moved, updates of rows
+	// that are paged in emit dataChanged() for the properties that changed.
+	void applyRowChange(const PPRowChange& change) {
+		if (change.table != QLatin1String("{{ .Name }}")) {
 			return;
+		}
+		switch (change.kind) {
+		case PPRowChange::Inserted:
+			if (m_parentColumn.isEmpty()) {
+				insertItem(change.ID);
+			}
+			break;
+		case PPRowChange::Deleted:
+			if (m_parentColumn.isEmpty()) {
+				removeItem(change.ID, true, change.rowid);
+			}
+			break;
+		case PPRowChange::Reparented:
+			if (!m_parentColumn.isEmpty() && change.parentColumn == m_parentColumn) {
+				if (change.previousParent == m_parentID) {
+					removeItem(change.ID, false, 0);
+				}
+				if (change.parent == m_parentID) {
+					insertItem(change.ID);
+				}
+			}
+			break;
+		case PPRowChange::Updated:
+			updateItem(change.ID, change.properties);
+			break;
+		case PPRowChange::Reset:
+			refresh();
+			break;
+		}
+	}
 
-		int oldBottom = m_bottom;
-		int newBottom = 0;
-		
-		if (m_query.seek(toRow)) {
-			newBottom = toRow;
+	// The row an ID has, or would have, in the model's order. Outside of
+	// WITHOUT ROWID tables that needs the row, or the rowid it had.
+	int position(const QUuid& ID, qint64 rowid = 0) const {
+		{{- if eq .KeyLayout "withoutrowid" }}
+		Q_UNUSED(rowid)
+		PPStatement query(select(QStringLiteral("COUNT(*)"), QStringLiteral("ID < :id"), QString()));
+		query->bindValue(":id", PPKey::encode(ID));
+		{{- else }}
+		PPStatement query(select(QStringLiteral("COUNT(*)"), rowid != 0 ? QStringLiteral("rowid < :rowid") : QStringLiteral("rowid < (SELECT rowid FROM {{ .Name }} WHERE ID = :id)"), QString()));
+		if (rowid != 0) {
+			query->bindValue(":rowid", rowid);
 		} else {
-			int i =	oldBottom;
-			if (m_query.seek(i)) {
-				do {
-					i++;
-				} while (m_query.next());
-				newBottom = i;
-			} else {
-				newBottom = -1;
+			query->bindValue(":id", PPKey::encode(ID));
+		}
+		{{- end }}
+		bindParent(query.data());
+		if (!query->exec() || !query->next()) {
+			qCritical() << query->lastError() << "when finding the row of an item of type {{ $item.Name }}";
+			return -1;
+		}
+		return query->value(0).toInt();
+	}
+
+	// Pages up to the one holding row keep their rows and anchors.
+	void invalidateFrom(int row) {
+		auto page = row / page_size;
+		for (auto it = m_anchors.upperBound(page); it != m_anchors.end();) {
+			it = m_anchors.erase(it);
+		}
+		for (auto key : m_pages.keys()) {
+			if (key >= page) {
+				m_pages.remove(key);
+			}
+		}
+	}
+
+	void insertItem(const QUuid& ID) {
+		auto row = position(ID);
+		if (row < 0) {
+			return;
+		}
+		row = qMin(row, m_rowCount);
+		beginInsertRows(QModelIndex(), row, row);
+		m_rowCount++;
+		invalidateFrom(row);
+		endInsertRows();
+	}
+
+	// The row of an ID that's paged in, or -1.
+	int cachedRow(const QUuid& ID) const {
+		for (auto key : m_pages.keys()) {
+			auto rows = m_pages.object(key);
+			for (int i = 0; i < rows->size(); i++) {
+				if (rows->at(i)->m_ID == ID) {
+					return key * page_size + i;
+				}
+			}
+		}
+		return -1;
+	}
+
+	// rowid is the one a deleted row had, if it's known.
+	void removeItem(const QUuid& ID, bool deleted, qint64 rowid) {
+		auto row = cachedRow(ID);
+		{{- if eq .KeyLayout "withoutrowid" }}
+		Q_UNUSED(deleted)
+		if (row < 0) {
+			row = position(ID, rowid);
+		}
+		{{- else }}
+		if (row < 0 && (!deleted || rowid != 0)) {
+			row = position(ID, rowid);
+		} else if (row < 0) {
+			// Without its rowid, there's nothing left to find the place of a
+			// deleted row by.
+			refresh();
+			return;
+		}
+		{{- end }}
+		if (row < 0 || m_rowCount == 0) {
+			return;
+		}
+		row = qMin(row, m_rowCount - 1);
+		beginRemoveRows(QModelIndex(), row, row);
+		m_rowCount--;
+		invalidateFrom(row);
+		endRemoveRows();
+	}
+
+	void updateItem(const QUuid& ID, quint64 properties) {
+		auto row = cachedRow(ID);
+		if (row < 0) {
+			return;
+		}
+		QVector<int> roles;
+		for (int bit = 0; bit < 64; bit++) {
+			if (properties & (quint64(1) << bit)) {
+				roles << Qt::UserRole + bit;
 			}
-			m_atEnd = true;
 		}
-		if (newBottom >= 0 && newBottom >= oldBottom) {
-			beginInsertRows(QModelIndex(), oldBottom, newBottom - 1);
-			m_bottom = newBottom;
-			endInsertRows();
+		auto changed = index(row);
+		Q_EMIT dataChanged(changed, changed, roles);
+	}
+
+	// The first @lazy property read on a page loads them for the whole page.
+	void fetchLazy(int row, const QSharedPointer<{{ .Name }}>& object) const {
+		if ((object->m_LOADED & {{ .Name }}::LazyColumns) == {{ .Name }}::LazyColumns) {
+			return;
+		}
+		if (auto rows = m_pages.object(row / page_size)) {
+			{{ .Name }}::fetchColumns(*rows, {{ .Name }}::LazyColumns);
+		}
+	}
+
+	QSharedPointer<{{ .Name }}> itemAt(int row) const {
+		auto rows = page(row / page_size);
+		if (rows == nullptr || row % page_size >= rows->size()) {
+			return QSharedPointer<{{ .Name }}>();
 		}
+		return rows->at(row % page_size);
 	}
 
 public:
@@ -491,67 +1969,57 @@ public:
 	}
 
 	Q_INVOKABLE void commitStaging() {
-		m_staging->save();
+		PPTransaction transaction;
+		if (!transaction.isOpen()) {
+			return;
+		}
+		if (!m_staging->save()) {
+			return;
+		}
 		if (!m_parentID.isNull()) {
 			{{ range $parent := $root.ParentedBy .Name }}
 			if (m_parentedKind == ModelTypes::{{ $parent }}Kind) {
 				auto tq = QStringLiteral("UPDATE {{ $item.Name }} SET PARENT_{{ $parent }}_ID = :new_parent_id WHERE ID = :child_id ");
-				QSqlQuery query(PPDatabase::instance()->connection());
-				query.prepare(tq);
-				query.bindValue(":new_parent_id", m_parentID);
-				query.bindValue(":child_id", m_staging->m_ID);
-				auto ok = query.exec();
+				PPStatement query(tq);
+				query->bindValue(":new_parent_id", PPKey::encode(m_parentID));
+				query->bindValue(":child_id", PPKey::encode(m_staging->m_ID));
+				auto ok = query->exec();
 				if (!ok) {
-					qCritical() << query.lastError() << "when adding a new {{ $item.Name }} to a parent {{ $parent }}";
+					qCritical() << query->lastError() << "when adding a new {{ $item.Name }} to a parent {{ $parent }}";
+					return;
 				}
+				{{ $item.Name }}::publishReparented(m_staging->m_ID, QStringLiteral("PARENT_{{ $parent }}_ID"), m_staging->m_parent_{{ $parent }}_ID, m_parentID);
 				m_staging->m_parent_{{ $parent }}_ID = m_parentID;
 			}
 			{{ end }}
 		}
-		m_query.exec();
-		m_atEnd = false;
-		prefetch(fetch_size);
+		// The new row reaches this and every other model through PPDatabase::rowChanged().
+		if (!transaction.commit()) {
+			return;
+		}
 		m_staging = nullptr;
 		Q_EMIT stagingItemChanged();
 	}
 
-	{{.Name}}Model(QObject *parent = nullptr) : QAbstractListModel(parent)
+	{{.Name}}Model(QObject *parent = nullptr) : QAbstractListModel(parent), m_pages(window_pages)
 	{
-		m_query.prepare("SELECT * FROM {{ .Name }}");
-		m_query.exec();
-		prefetch(fetch_size);
+		connect(pDB, &PPDatabase::rowChanged, this, &{{ .Name }}Model::applyRowChange);
+		refresh();
 	}
 
 	{{ range $parent := $root.ParentedBy .Name }}
 	static {{ $item.Name }}Model* with{{ $parent }}Parent(const QUuid& id) {
 		static QMap<QUuid,QPointer<{{ $item.Name }}Model>> s_models;
 		if (s_models.value(id).isNull()) {
-			auto childModel = new {{ $item.Name }}Model();
-			childModel->m_parentedKind = ModelTypes::{{ $parent }}Kind;
-			childModel->m_query.prepare("SELECT * FROM {{ $item.Name }} WHERE PARENT_{{ $parent}}_ID = :parent_id");
-			childModel->m_query.bindValue(":parent_id", id);
-			childModel->m_bottom = 0;
-			childModel->m_parentID = id;
-			childModel->m_query.exec();
-			childModel->m_atEnd = false;
-			childModel->prefetch(fetch_size);
-			s_models[id] = childModel;
+			s_models[id] = new {{ $item.Name }}Model(ModelTypes::{{ $parent }}Kind, QStringLiteral("PARENT_{{ $parent }}_ID"), id);
 		}
 		return s_models[id].data();
 	}
 	{{ end }}
 
-	void fetchMore(const QModelIndex &parent) override {
-		prefetch(m_bottom + fetch_size);
-	}
-
-	bool canFetchMore(const QModelIndex &parent) const override {
-		return !m_atEnd;
-	}
-
 	int rowCount(const QModelIndex &parent = QModelIndex()) const override {
 		Q_UNUSED(parent)
-		return m_bottom;
+		return m_rowCount;
 	}
 
 	QHash<int, QByteArray> roleNames() const override {
@@ -569,30 +2037,25 @@ public:
 	QVariant data(const QModelIndex &item, int role) const override {
 		if (!item.isValid()) return QVariant();
 
-		if (!m_items.contains(item.row())) {
-			if (!m_query.seek(item.row())) {
-				qCritical() << m_query.lastError() << "when seeking data for {{ $item.Name }}";
-				return QVariant();
-			}
-
-			auto add = {{ .Name }}::withID(m_query.value("ID").value<QUuid>());
-			{{ range $prop := .Properties }}
-			add->setProperty("{{ $prop.Name }}", m_query.value("{{ $prop.Name }}"));
-			{{ end }}
-			m_items.insert(item.row(), add);
+		auto object = itemAt(item.row());
+		if (object.isNull()) {
+			return QVariant();
 		}
 
 		switch (role) {
 		{{ range $index, $prop := .Properties -}}
 		case {{ $item.Name }}Data::{{ $prop.Name }}:
-			return QVariant::fromValue(m_items[item.row()]->{{ $prop.Name }}());
+			{{- if $item.IsLazy $prop.Name }}
+			fetchLazy(item.row(), object);
+			{{- end }}
+			return QVariant::fromValue(object->{{ $prop.Name }}());
 		{{ end }}
 		{{ range $child := .Children -}}
 		case {{ $item.Name }}Data::children{{ $child }}:
-			return QVariant::fromValue({{ $child }}Model::with{{ $item.Name }}Parent(m_items[item.row()]->m_ID));
+			return QVariant::fromValue({{ $child }}Model::with{{ $item.Name }}Parent(object->m_ID));
 		{{ end }}
 		case {{ $item.Name }}Data::object:
-			return QVariant::fromValue(m_items[item.row()].data());
+			return QVariant::fromValue(object.data());
 		}
 
 		return QVariant();
@@ -603,17 +2066,9 @@ public:
 	}
 
 	bool setData(const QModelIndex &item, const QVariant &value, int role = Qt::EditRole) override {
-		if (!m_items.contains(item.row())) {
-			if (!m_query.seek(item.row())) {
-				qCritical() << m_query.lastError() << "when seeking data for {{ $item.Name }}";
-				return false;
-			}
-
-			auto add = {{ .Name }}::withID(m_query.value("ID").value<QUuid>());
-			{{ range $prop := .Properties }}
-			add->setProperty("{{ $prop.Name }}", m_query.value("{{ $prop.Name }}"));
-			{{ end }}
-			m_items.insert(item.row(), add);
+		auto object = itemAt(item.row());
+		if (object.isNull()) {
+			return false;
 		}
 
 		switch (role) {
@@ -621,7 +2076,7 @@ public:
 			{{ $propType := $root.AlwaysType $prop.Type }}
 			{{ $propTypeName := StringJoin $propType "" }}
 			case {{ $item.Name }}Data::{{ $prop.Name }}:
-				m_items[item.row()]->set_{{ $prop.Name }}(value.value<{{ $propTypeName }}>());
+				object->set_{{ $prop.Name }}(value.value<{{ $propTypeName }}>());
 				Q_EMIT dataChanged(item, item, {role});
 				return true;
 			{{ end }}
@@ -74,13 +74,18 @@ func ParseFile(file string) (PokiPokiDocument, error) {
 		return PokiPokiDocument{}, nil
 	}
 
+	return Parse(path.Base(file), string(data)), nil
+}
+
+// Parse returns a parsed PokiPokiDocument from the contents of a file
+func Parse(filename string, data string) PokiPokiDocument {
 	doku := PokiPokiDocument{
 		Objects: map[string]PokiPokiObject{},
 	}
 
 	var s customScanner
-	s.Init(strings.NewReader(string(data)))
-	s.Filename = path.Base(file)
+	s.Init(strings.NewReader(data))
+	s.Filename = filename
 
 	for tok := s.Scan(); tok != scanner.EOF; tok = s.Scan() {
 		if s.TokenText() != "object" && s.TokenText() != "schema" {
@@ -104,6 +109,14 @@ func ParseFile(file string) (PokiPokiDocument, error) {
 				break
 			}
 
+			if next == '@' {
+				annotation := PokiPokiAnnotation{Position: s.Position.String()}
+				annotation.Name = s.ScanIdent()
+				annotation.Args = s.ScanToEOL()
+				obj.Annotations = append(obj.Annotations, annotation)
+				continue
+			}
+
 			prop := PokiPokiProperty{}
 			if isName(s.TokenText()) {
 				obj.Children = append(obj.Children, s.TokenText())
@@ -121,5 +134,5 @@ func ParseFile(file string) (PokiPokiDocument, error) {
 		doku.Objects[obj.Name] = obj
 	}
 
-	return doku, nil
+	return doku
 }
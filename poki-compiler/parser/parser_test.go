@@ -114,3 +114,38 @@ func TestCustomScannerNumberXFail(t *testing.T) {
 		s.ScanNumber()
 	}
 }
+
+func TestParseAnnotations(t *testing.T) {
+	doku := Parse("test.pokipoki", `object Note {
+    @key withoutrowid
+    title String
+}`)
+	note := doku.Objects["Note"]
+	if len(note.Properties) != 1 || len(note.Annotations) != 1 {
+		t.Fatalf("got %d properties and %d annotations, want 1 and 1", len(note.Properties), len(note.Annotations))
+	}
+	if note.KeyLayout() != "withoutrowid" {
+		t.Fatalf("got key layout '%s', want 'withoutrowid'", note.KeyLayout())
+	}
+	if (PokiPokiObject{}).KeyLayout() != "default" {
+		t.Fatalf("objects without @key should use the default layout")
+	}
+}
+
+func TestObjectsInOrder(t *testing.T) {
+	doku := Parse("test.pokipoki", `object Folder {
+    title String
+    Note
+}
+
+object Note {
+    title String
+}`)
+	var names []string
+	for _, obj := range doku.ObjectsInOrder() {
+		names = append(names, obj.Name)
+	}
+	if len(names) != 2 || names[0] != "Note" || names[1] != "Folder" {
+		t.Fatalf("got %v, want children before their parents", names)
+	}
+}
@@ -5,19 +5,46 @@ import (
 	"strings"
 )
 
+// sqlKind maps scalar types to the column type giving them the matching
+// SQLite affinity. Anything not listed is serialised into a BLOB.
 var sqlKind = map[string]string{
+	"Boolean":  "INTEGER",
+	"Int8":     "INTEGER",
+	"Int16":    "INTEGER",
+	"Int32":    "INTEGER",
+	"Int64":    "INTEGER",
+	"Uint8":    "INTEGER",
+	"Uint16":   "INTEGER",
+	"Uint32":   "INTEGER",
+	"Uint64":   "INTEGER",
+	"Float32":  "REAL",
+	"Float64":  "REAL",
 	"String":   "TEXT",
+	"URL":      "TEXT",
 	"Date":     "DATE",
 	"DateTime": "DATETIME",
+	"Time":     "TIME",
 }
 
+// SqlType returns the column type of a property
 func SqlType(typeDef []string) string {
+	if len(typeDef) > 1 {
+		return "BLOB"
+	}
 	if val, ok := sqlKind[typeDef[0]]; ok {
 		return val
 	}
 	return "BLOB"
 }
 
+// SumType returns the C++ type the sum of a numeric property is read as
+func SumType(typeDef []string) string {
+	if SqlType(typeDef) == "REAL" {
+		return "double"
+	}
+	return "qint64"
+}
+
 var imports = map[string]string{
 	"QBitArray":          "QBitArray",
 	"QBrush":             "QBrush",
@@ -151,10 +178,10 @@ func (d PokiPokiDocument) SingularGenericTypes(typeDef []string) ([]string, bool
 	if _, ok := singularGenericTypes[typeDef[0]]; !ok {
 		return []string{}, false
 	}
-	if typeDef[len(typeDef)-1] != "]" {
+	if len(typeDef) < 4 || typeDef[1] != "[" || typeDef[len(typeDef)-1] != "]" {
 		return []string{}, false
 	}
-	inner, ok := d.Type(typeDef[1 : len(typeDef)-1])
+	inner, ok := d.Type(typeDef[2 : len(typeDef)-1])
 	if !ok {
 		return []string{}, false
 	}
@@ -170,14 +197,8 @@ var dualGenericTypes = map[string]string{
 	"Pair": "QPair",
 }
 
-// DualGenericTypes returns the typedef for a dual generic type
-func (d PokiPokiDocument) DualGenericTypes(typeDef []string) ([]string, bool) {
-	if _, ok := dualGenericTypes[typeDef[0]]; !ok {
-		return []string{}, false
-	}
-	var first []string
-	var second []string
-
+// splitDualGeneric splits Kind[First]Second into its type arguments
+func splitDualGeneric(typeDef []string) (first []string, second []string) {
 	opener := 1
 
 	for _, str := range typeDef[2:] {
@@ -199,6 +220,32 @@ func (d PokiPokiDocument) DualGenericTypes(typeDef []string) ([]string, bool) {
 		}
 		first = append(first, str)
 	}
+	return
+}
+
+// MapArguments returns the key and value types of a Map or Hash
+func (d PokiPokiDocument) MapArguments(typeDef []string) ([]string, []string, bool) {
+	if len(typeDef) < 4 || (typeDef[0] != "Map" && typeDef[0] != "Hash") || typeDef[1] != "[" {
+		return nil, nil, false
+	}
+	key, value := splitDualGeneric(typeDef)
+	return key, value, true
+}
+
+// ListArgument returns the element type of a List or Vector
+func (d PokiPokiDocument) ListArgument(typeDef []string) ([]string, bool) {
+	if len(typeDef) < 4 || (typeDef[0] != "List" && typeDef[0] != "Vector") || typeDef[1] != "[" || typeDef[len(typeDef)-1] != "]" {
+		return nil, false
+	}
+	return typeDef[2 : len(typeDef)-1], true
+}
+
+// DualGenericTypes returns the typedef for a dual generic type
+func (d PokiPokiDocument) DualGenericTypes(typeDef []string) ([]string, bool) {
+	if _, ok := dualGenericTypes[typeDef[0]]; !ok {
+		return []string{}, false
+	}
+	first, second := splitDualGeneric(typeDef)
 
 	prefix := dualGenericTypes[typeDef[0]]
 
@@ -243,9 +290,127 @@ func (d PokiPokiDocument) AlwaysType(typeDef []string) []string {
 	return ret
 }
 
+// MaxProperties is the number of properties an object can have, as generated
+// code tracks dirty columns in a 64-bit mask
+const MaxProperties = 64
+
+func verifyKey(obj PokiPokiObject, annotation PokiPokiAnnotation) {
+	if len(obj.Annotated("key")) > 1 {
+		log.Fatalf("%s: Object '%s' has more than one @key", annotation.Position, obj.Name)
+	}
+	if len(annotation.Args) != 1 {
+		log.Fatalf("%s: @key takes one layout", annotation.Position)
+	}
+	if _, ok := KeyLayouts[annotation.Args[0]]; !ok {
+		log.Fatalf("%s: Unknown key layout '%s'", annotation.Position, annotation.Args[0])
+	}
+}
+
+func verifyIndexes(obj PokiPokiObject, annotation PokiPokiAnnotation) {
+	seen := map[string]struct{}{}
+	for _, index := range obj.Indexes() {
+		if len(index.Columns) == 0 {
+			log.Fatalf("%s: @index needs at least one property", annotation.Position)
+		}
+		for _, column := range index.Columns {
+			if !obj.HasProperty(column) {
+				log.Fatalf("%s: Object '%s' has no property '%s' to index", annotation.Position, obj.Name, column)
+			}
+		}
+		name := index.Name(obj.Name)
+		if _, ok := seen[name]; ok {
+			log.Fatalf("%s: Object '%s' indexes '%s' more than once", annotation.Position, obj.Name, strings.Join(index.Columns, " "))
+		}
+		seen[name] = struct{}{}
+	}
+}
+
+func verifySideTables(obj PokiPokiObject, annotation PokiPokiAnnotation) {
+	if len(annotation.Args) == 0 {
+		log.Fatalf("%s: @table needs at least one property", annotation.Position)
+	}
+	var d PokiPokiDocument
+	for _, name := range annotation.Args {
+		var prop *PokiPokiProperty
+		for i := range obj.Properties {
+			if obj.Properties[i].Name == name {
+				prop = &obj.Properties[i]
+			}
+		}
+		if prop == nil {
+			log.Fatalf("%s: Object '%s' has no property '%s' to store in a table", annotation.Position, obj.Name, name)
+		}
+		var elements [][]string
+		if key, value, ok := d.MapArguments(prop.Type); ok {
+			elements = [][]string{key, value}
+		} else if value, ok := d.ListArgument(prop.Type); ok {
+			elements = [][]string{value}
+		} else {
+			log.Fatalf("%s: Only Map, Hash, List and Vector properties can be stored in a table, '%s' is a '%s'", annotation.Position, name, strings.Join(prop.Type, ""))
+		}
+		for _, element := range elements {
+			if _, ok := d.ScalarType(element); !ok {
+				log.Fatalf("%s: Tables can only hold scalar types, '%s' holds a '%s'", annotation.Position, name, strings.Join(element, ""))
+			}
+		}
+		for _, index := range obj.Indexes() {
+			for _, column := range index.Columns {
+				if column == name {
+					log.Fatalf("%s: '%s' is stored in a table and can't be indexed", annotation.Position, name)
+				}
+			}
+		}
+	}
+}
+
+func verifyLazy(obj PokiPokiObject, annotation PokiPokiAnnotation) {
+	if len(annotation.Args) == 0 {
+		log.Fatalf("%s: @lazy needs at least one property", annotation.Position)
+	}
+	for _, name := range annotation.Args {
+		if !obj.HasProperty(name) {
+			log.Fatalf("%s: Object '%s' has no property '%s' to load lazily", annotation.Position, obj.Name, name)
+		}
+		if obj.InSideTable(name) {
+			log.Fatalf("%s: '%s' is stored in a table, which is already loaded on first use", annotation.Position, name)
+		}
+	}
+}
+
+var annotations = map[string]func(PokiPokiObject, PokiPokiAnnotation){
+	"key":   verifyKey,
+	"index": verifyIndexes,
+	"table": verifySideTables,
+	"lazy":  verifyLazy,
+}
+
+// queryMembers are query(), the aggregates and the members of the query
+// builders query() returns, which properties would hide
+var queryMembers = map[string]bool{
+	"query":   true,
+	"count":   true,
+	"exists":  true,
+	"all":     true,
+	"first":   true,
+	"limit":   true,
+	"offset":  true,
+	"orWhere": true,
+	"stream":  true,
+}
+
 // Verify verifies that a PokiPokiDocument is valid
 func (d PokiPokiDocument) Verify() {
 	for _, obj := range d.Objects {
+		if len(obj.Properties) > MaxProperties {
+			log.Fatalf("Object '%s' has more than %d properties", obj.Name, MaxProperties)
+		}
+		for _, annotation := range obj.Annotations {
+			verify, ok := annotations[annotation.Name]
+			if !ok {
+				log.Fatalf("%s: Unknown annotation '@%s'", annotation.Position, annotation.Name)
+			}
+			verify(obj, annotation)
+		}
 	childrenLoop:
 		for _, child := range obj.Children {
 			for kind := range d.Objects {
@@ -259,6 +424,9 @@ func (d PokiPokiDocument) Verify() {
 			if _, ok := d.Type(prop.Type); !ok {
 				log.Fatalf("Unknown type '%s'", strings.Join(prop.Type, ""))
 			}
+			if queryMembers[prop.Name] {
+				log.Fatalf("Object '%s' can't have a property named '%s', which its query builder uses", obj.Name, prop.Name)
+			}
 		}
 	}
 }
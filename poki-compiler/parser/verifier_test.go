@@ -0,0 +1,168 @@
+package parser
+
+import (
+	"fmt"
+	"strings"
+	"testing"
+)
+
+func documentWithProperties(count int) PokiPokiDocument {
+	obj := PokiPokiObject{Name: "Wide"}
+	for i := 0; i < count; i++ {
+		obj.Properties = append(obj.Properties, PokiPokiProperty{
+			Name: fmt.Sprintf("prop%c%c", 'a'+i/26, 'a'+i%26),
+			Type: []string{"String"},
+		})
+	}
+	return PokiPokiDocument{Objects: map[string]PokiPokiObject{obj.Name: obj}}
+}
+
+func TestVerifyMaxProperties(t *testing.T) {
+	documentWithProperties(MaxProperties).Verify()
+}
+
+func TestVerifyMaxPropertiesXFail(t *testing.T) {
+	if Reexec(t, "TestVerifyMaxPropertiesXFail", 1) {
+		documentWithProperties(MaxProperties + 1).Verify()
+	}
+}
+
+func TestVerifyKeyLayout(t *testing.T) {
+	Parse("test.pokipoki", `object Note {
+    @key rowid
+    title String
+}`).Verify()
+}
+
+func TestVerifyKeyLayoutXFail(t *testing.T) {
+	if Reexec(t, "TestVerifyKeyLayoutXFail", 1) {
+		Parse("test.pokipoki", `object Note {
+    @key clustered
+    title String
+}`).Verify()
+	}
+}
+
+func TestVerifyUnknownAnnotationXFail(t *testing.T) {
+	if Reexec(t, "TestVerifyUnknownAnnotationXFail", 1) {
+		Parse("test.pokipoki", `object Note {
+    @colour blue
+}`).Verify()
+	}
+}
+
+func TestVerifyIndexes(t *testing.T) {
+	note := Parse("test.pokipoki", `object Note {
+    @index title
+    @index unique title created
+    title String
+    created DateTime
+}`)
+	note.Verify()
+	indexes := note.Objects["Note"].Indexes()
+	if len(indexes) != 2 || indexes[0].Unique || !indexes[1].Unique {
+		t.Fatalf("got %+v, want a plain and a unique index", indexes)
+	}
+	if name := indexes[1].Name("Note"); name != "Note_title_created" {
+		t.Fatalf("got index name '%s', want 'Note_title_created'", name)
+	}
+}
+
+func TestVerifyIndexUnknownPropertyXFail(t *testing.T) {
+	if Reexec(t, "TestVerifyIndexUnknownPropertyXFail", 1) {
+		Parse("test.pokipoki", `object Note {
+    @index body
+    title String
+}`).Verify()
+	}
+}
+
+func TestVerifyIndexDuplicateXFail(t *testing.T) {
+	if Reexec(t, "TestVerifyIndexDuplicateXFail", 1) {
+		Parse("test.pokipoki", `object Note {
+    @index title
+    @index unique title
+    title String
+}`).Verify()
+	}
+}
+
+func TestSingularGenericTypes(t *testing.T) {
+	doku := PokiPokiDocument{}
+	typ, ok := doku.Type([]string{"List", "[", "Vector", "[", "String", "]", "]"})
+	if !ok || strings.Join(typ, "") != "QList<QVector<QString>>" {
+		t.Fatalf("got '%s', want 'QList<QVector<QString>>'", strings.Join(typ, ""))
+	}
+}
+
+func TestVerifySideTables(t *testing.T) {
+	doku := Parse("test.pokipoki", `object Note {
+    @table metadata tags
+    title String
+    metadata Map[String]Int32
+    tags List[String]
+}`)
+	doku.Verify()
+	tables := doku.SideTables(doku.Objects["Note"])
+	if len(tables) != 2 || !tables[0].Map || tables[1].Map {
+		t.Fatalf("got %+v, want a map and a list table", tables)
+	}
+	if tables[0].Table != "Note_metadata" || tables[0].Helper != "PPMapTable<QMap<QString,qint32>>" {
+		t.Fatalf("got table '%s' with helper '%s'", tables[0].Table, tables[0].Helper)
+	}
+	if columns := doku.Objects["Note"].ColumnProperties(); len(columns) != 1 || columns[0].Name != "title" {
+		t.Fatalf("got columns %+v, want only title", columns)
+	}
+}
+
+func TestVerifySideTableScalarXFail(t *testing.T) {
+	if Reexec(t, "TestVerifySideTableScalarXFail", 1) {
+		Parse("test.pokipoki", `object Note {
+    @table title
+    title String
+}`).Verify()
+	}
+}
+
+func TestVerifySideTableNestedXFail(t *testing.T) {
+	if Reexec(t, "TestVerifySideTableNestedXFail", 1) {
+		Parse("test.pokipoki", `object Note {
+    @table tags
+    tags List[List[String]]
+}`).Verify()
+	}
+}
+
+func TestVerifyLazy(t *testing.T) {
+	doku := Parse("test.pokipoki", `object Note {
+    @lazy body
+    title String
+    body ByteArray
+}`)
+	doku.Verify()
+	note := doku.Objects["Note"]
+	if !note.IsLazy("body") || note.IsLazy("title") {
+		t.Fatalf("got lazy body %v and title %v", note.IsLazy("body"), note.IsLazy("title"))
+	}
+	if columns := note.SelectColumns(); columns != "ID, title" {
+		t.Fatalf("got columns '%s', want 'ID, title'", columns)
+	}
+}
+
+func TestVerifyLazySideTableXFail(t *testing.T) {
+	if Reexec(t, "TestVerifyLazySideTableXFail", 1) {
+		Parse("test.pokipoki", `object Note {
+    @table tags
+    @lazy tags
+    tags List[String]
+}`).Verify()
+	}
+}
+
+func TestVerifyQueryMemberXFail(t *testing.T) {
+	if Reexec(t, "TestVerifyQueryMemberXFail", 1) {
+		Parse("test.pokipoki", `object Page {
+    limit Int32
+}`).Verify()
+	}
+}
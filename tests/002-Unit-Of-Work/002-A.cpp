@@ -0,0 +1,63 @@
+#include <QCoreApplication>
+#include "002.h"
+
+int main(int argc, char* argv[]) {
+    auto app = new QCoreApplication(argc, argv);
+    app->setApplicationName("pokipoki-test-002");
+
+    QSqlQuery(pDB->connection()).exec("DROP TABLE IF EXISTS Item");
+
+    {
+        PPTransaction transaction;
+        for (int i = 0; i < 10; i++) {
+            auto item = Item::newItem();
+            item->set_prop("discarded");
+            item->save();
+        }
+        transaction.rollback();
+    }
+
+    auto model = new ItemModel;
+    if (model->rowCount() != 0) {
+        return 1;
+    }
+    delete model;
+
+    auto item = Item::newItem();
+    item->set_prop("kept");
+    {
+        PPTransaction transaction;
+        item->save();
+        {
+            PPTransaction nested;
+            auto other = Item::newItem();
+            other->set_prop("nested");
+            other->save();
+            nested.rollback();
+        }
+        if (!transaction.commit()) {
+            return 1;
+        }
+    }
+
+    model = new ItemModel;
+    if (model->rowCount() != 1) {
+        return 1;
+    }
+    delete model;
+
+    {
+        PPTransaction transaction;
+        item->set_prop("edited");
+        item->save();
+        if (pUR->canUndo()) {
+            return 1;
+        }
+        transaction.commit();
+    }
+    if (!pUR->canUndo()) {
+        return 1;
+    }
+
+    return 0;
+}
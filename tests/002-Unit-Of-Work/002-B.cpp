@@ -0,0 +1,15 @@
+#include <QCoreApplication>
+#include "002.h"
+
+int main(int argc, char* argv[]) {
+    auto app = new QCoreApplication(argc, argv);
+    app->setApplicationName("pokipoki-test-002");
+
+    auto model = new ItemModel;
+    if (model->rowCount() != 1) {
+        return 1;
+    }
+    delete model;
+
+    return 0;
+}
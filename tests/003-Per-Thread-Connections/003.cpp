@@ -0,0 +1,46 @@
+#include <QAtomicInt>
+#include <QCoreApplication>
+#include <QThread>
+#include "003.h"
+
+int main(int argc, char* argv[]) {
+    auto app = new QCoreApplication(argc, argv);
+    app->setApplicationName("pokipoki-test-003");
+
+    QSqlQuery(pDB->connection()).exec("DROP TABLE IF EXISTS Item");
+
+    {
+        PPTransaction transaction;
+        for (int i = 0; i < 100; i++) {
+            auto item = Item::newItem();
+            item->set_prop("shared");
+            item->save();
+        }
+        if (!transaction.commit()) {
+            return 1;
+        }
+    }
+
+    auto mainConnection = pDB->connection().connectionName();
+    QAtomicInt failures;
+    QList<QThread*> threads;
+    for (int i = 0; i < 4; i++) {
+        threads << QThread::create([&failures, mainConnection] {
+            if (pDB->connection().connectionName() == mainConnection) {
+                failures.ref();
+            }
+            if (Item::where(PredicateList(eq(prop, QStringLiteral("shared")))).length() != 100) {
+                failures.ref();
+            }
+        });
+    }
+    for (auto thread : threads) {
+        thread->start();
+    }
+    for (auto thread : threads) {
+        thread->wait();
+        delete thread;
+    }
+
+    return failures.load() == 0 ? 0 : 1;
+}
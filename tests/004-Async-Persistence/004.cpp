@@ -0,0 +1,35 @@
+#include <QCoreApplication>
+#include "004.h"
+
+int main(int argc, char* argv[]) {
+    auto app = new QCoreApplication(argc, argv);
+    app->setApplicationName("pokipoki-test-004");
+
+    QSqlQuery(pDB->connection()).exec("DROP TABLE IF EXISTS Item");
+
+    auto item = Item::newItem();
+    item->set_prop("async");
+    auto saved = item->saveAsync();
+    auto found = Item::whereAsync(PredicateList(eq(prop, QStringLiteral("async"))));
+    while (!saved.isFinished() || !found.isFinished()) {
+        QCoreApplication::processEvents();
+    }
+    if (!saved.result()) {
+        return 1;
+    }
+    if (found.result().length() != 1 || found.result().first().data() != item.data()) {
+        return 1;
+    }
+
+    item->set_prop("edited");
+    saved = item->saveAsync();
+    found = Item::whereAsync(PredicateList(eq(prop, QStringLiteral("edited"))));
+    while (!saved.isFinished() || !found.isFinished()) {
+        QCoreApplication::processEvents();
+    }
+    if (!saved.result() || found.result().length() != 1 || !pUR->canUndo()) {
+        return 1;
+    }
+
+    return 0;
+}
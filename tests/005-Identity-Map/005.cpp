@@ -0,0 +1,39 @@
+#include <QCoreApplication>
+#include "005.h"
+
+int main(int argc, char* argv[]) {
+    auto app = new QCoreApplication(argc, argv);
+    app->setApplicationName("pokipoki-test-005");
+
+    QSqlQuery(pDB->connection()).exec("DROP TABLE IF EXISTS Item");
+
+    auto& map = PPIdentityMap<Item>::instance();
+
+    auto item = Item::newItem();
+    item->set_prop("identity");
+    if (!item->save() || map.size() != 1) {
+        return 1;
+    }
+
+    auto found = Item::where(PredicateList(eq(prop, QStringLiteral("identity"))));
+    if (found.length() != 1 || found.first().data() != item.data()) {
+        return 1;
+    }
+    if (map.hits() < 1) {
+        return 1;
+    }
+
+    // Dropping the last reference prunes the entry.
+    found.clear();
+    item.clear();
+    if (map.size() != 0 || map.pruned() != 1) {
+        return 1;
+    }
+
+    found = Item::where(PredicateList(eq(prop, QStringLiteral("identity"))));
+    if (found.length() != 1 || map.size() != 1) {
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,40 @@
+#include <QCoreApplication>
+#include "006.h"
+
+int main(int argc, char* argv[]) {
+    auto app = new QCoreApplication(argc, argv);
+    app->setApplicationName("pokipoki-test-006");
+
+    // A table as older versions wrote it, with the ID stored as text.
+    QSqlQuery query(pDB->connection());
+    query.exec("DROP TABLE IF EXISTS Item");
+    query.exec("DELETE FROM pokipoki_meta WHERE name = 'Item'");
+    query.exec("CREATE TABLE Item(ID BLOB NOT NULL, prop TEXT NOT NULL, PRIMARY KEY (ID))");
+    auto legacy = QUuid::createUuid();
+    query.prepare("INSERT INTO Item(ID, prop) VALUES (:ID, :prop)");
+    query.bindValue(":ID", legacy.toString());
+    query.bindValue(":prop", QStringLiteral("legacy"));
+    if (!query.exec()) {
+        return 1;
+    }
+
+    // Touching the type prepares its table, which migrates the keys.
+    auto item = Item::newItem();
+    item->set_prop("compact");
+    if (!item->save()) {
+        return 1;
+    }
+
+    query.exec("SELECT typeof(ID), length(ID) FROM Item");
+    while (query.next()) {
+        if (query.value(0).toString() != "blob" || query.value(1).toInt() != 16) {
+            return 1;
+        }
+    }
+
+    if (Item::load(legacy)->prop() != "legacy") {
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,41 @@
+#include <QCoreApplication>
+#include "007.h"
+
+int main(int argc, char* argv[]) {
+    auto app = new QCoreApplication(argc, argv);
+    app->setApplicationName("pokipoki-test-007");
+
+    QSqlQuery query(pDB->connection());
+    query.exec("DROP TABLE IF EXISTS Item");
+
+    for (int i = 0; i < 20; i++) {
+        auto item = Item::newItem();
+        item->set_rank(i);
+        item->set_ratio(i / 2.0f);
+        item->set_flag(i % 2 == 0);
+        if (!item->save()) {
+            return 1;
+        }
+    }
+
+    query.exec("SELECT typeof(rank), typeof(ratio), typeof(flag) FROM Item");
+    while (query.next()) {
+        if (query.value(0).toString() != "integer" || query.value(1).toString() != "real" || query.value(2).toString() != "integer") {
+            return 1;
+        }
+    }
+
+    // Numbers compare as numbers, so 9 < 10 and the index serves the range.
+    if (Item::where(PredicateList(lt(rank, 10))).length() != 10) {
+        return 1;
+    }
+    if (Item::where(PredicateList(gte(ratio, 4.5f))).length() != 11) {
+        return 1;
+    }
+    query.exec("EXPLAIN QUERY PLAN SELECT * FROM Item WHERE rank < 10");
+    if (!query.next() || !query.value(3).toString().contains("Item_rank")) {
+        return 1;
+    }
+
+    return 0;
+}
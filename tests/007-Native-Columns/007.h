@@ -0,0 +1,1899 @@
+
+
+#pragma once
+
+#include <QAbstractListModel>
+#include <QCache>
+#include <QDebug>
+#include <QFuture>
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QObject>
+#include <QPointer>
+#include <QSharedPointer>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QSqlRecord>
+#include <QStringList>
+#include <QUuid>
+#include <QVariant>
+
+
+#include "Database.h"
+
+enum ModelTypes {
+	ItemKind,
+	};
+class Item;
+class ItemModel;
+
+
+class Item : public QObject, PPUndoRedoable {
+	Q_OBJECT
+	Q_INTERFACES(PPUndoRedoable)
+
+	// An undo step only holds the properties a save changed, see PPDelta.
+	using Change = PPDelta;
+
+	Item(QUuid ID) : QObject(nullptr), m_ID(ID) {
+		static bool db_initialized = (prepareDatabase(), true);
+		Q_UNUSED(db_initialized)
+	}
+
+	static QSharedPointer<Item> withID(QUuid ID, bool* created = nullptr) {
+		return PPIdentityMap<Item>::instance().obtain(ID, [ID] { return new Item(ID); }, created);
+	}
+
+	// Lets PPUndoRedoStack get hold of objects whose steps it reads back from its
+	// journal, without reloading the ones that are alive.
+	static QSharedPointer<QObject> journaled(const QUuid& ID) {
+		return withID(ID);
+	}
+	static inline const bool s_JOURNALED = PPUndoRedoStack::registerType(QStringLiteral("Item"), &journaled);
+
+	static PPRowChange reparented(const QUuid& ID, const QString& column, const QUuid& previous, const QUuid& parent) {
+		PPRowChange change;
+		change.kind = PPRowChange::Reparented;
+		change.table = QStringLiteral("Item");
+		change.ID = ID;
+		change.parentColumn = column;
+		change.previousParent = previous;
+		change.parent = parent;
+		return change;
+	}
+
+	static void publishReparented(const QUuid& ID, const QString& column, const QUuid& previous, const QUuid& parent) {
+		pDB->publishRowChange(reparented(ID, column, previous, parent));
+	}
+
+	// Called by the identity map once the last reference is gone. A staged deletion
+	// is queued with PPDatabase, which writes it in a batch with others.
+	void released() {
+		if (!m_DELETE_PENDING) {
+			return;
+		}
+		QVector<PPRowChange> changes;
+		PPRowChange change;
+		change.kind = PPRowChange::Deleted;
+		change.table = QStringLiteral("Item");
+		change.ID = m_ID;
+		changes << change;
+		pDB->queueDelete(QStringLiteral("Item"), m_ID, QStringList{}, changes);
+	}
+
+	// Each column has a bit in a mask, in the order of ColumnProperties. m_LOADED holds
+	// the columns whose members hold the stored value; @lazy ones and those left out
+	// of a projection are read the first time they're used.
+	static constexpr quint64 AllColumns = quint64(0) | (quint64(1) << 0) | (quint64(1) << 1) | (quint64(1) << 2);
+	static constexpr quint64 LazyColumns = quint64(0);
+	static constexpr quint64 EagerColumns = AllColumns & ~LazyColumns;
+
+	static QString selectColumns() {
+		return QStringLiteral("ID, rank, ratio, flag");
+	}
+
+	static QString selectColumns(quint64 columns) {
+		if (columns == EagerColumns) {
+			return selectColumns();
+		}
+		QStringList names{QStringLiteral("ID")};
+		if (columns & (quint64(1) << 0)) {
+			names << QStringLiteral("rank");
+		}
+		if (columns & (quint64(1) << 1)) {
+			names << QStringLiteral("ratio");
+		}
+		if (columns & (quint64(1) << 2)) {
+			names << QStringLiteral("flag");
+		}
+		return names.join(", ");
+	}
+
+	static quint64 columnsNamed(const QStringList& properties) {
+		quint64 columns = 0;
+		for (const auto& name : properties) {
+			if (name == QLatin1String("rank")) {
+				columns |= quint64(1) << 0;
+				continue;
+			}
+			if (name == QLatin1String("ratio")) {
+				columns |= quint64(1) << 1;
+				continue;
+			}
+			if (name == QLatin1String("flag")) {
+				columns |= quint64(1) << 2;
+				continue;
+			}
+			qCritical() << "There is no column" << name << "in items of type Item";
+		}
+		return columns;
+	}
+
+	// Rows are read in the order of selectColumns(), so each member is filled by position
+	// without going through the property system. A column that wasn't loaded yet takes the
+	// row as is; one that was keeps its unsaved edits and only signals if it changed.
+	template<class Row>
+	void hydrate(const Row& row, quint64 columns) {
+		int column = 1;
+		if (columns & (quint64(1) << 0)) {
+			auto value = PPColumn<decltype(m_rank)>::read(row.value(column++));
+			if (!(m_LOADED & (quint64(1) << 0))) {
+				m_rank = std::move(value);
+			} else if (!m_rank_dirty && !(value == m_rank)) {
+				m_rank = std::move(value);
+				Q_EMIT rankChanged();
+			}
+		}
+		if (columns & (quint64(1) << 1)) {
+			auto value = PPColumn<decltype(m_ratio)>::read(row.value(column++));
+			if (!(m_LOADED & (quint64(1) << 1))) {
+				m_ratio = std::move(value);
+			} else if (!m_ratio_dirty && !(value == m_ratio)) {
+				m_ratio = std::move(value);
+				Q_EMIT ratioChanged();
+			}
+		}
+		if (columns & (quint64(1) << 2)) {
+			auto value = PPColumn<decltype(m_flag)>::read(row.value(column++));
+			if (!(m_LOADED & (quint64(1) << 2))) {
+				m_flag = std::move(value);
+			} else if (!m_flag_dirty && !(value == m_flag)) {
+				m_flag = std::move(value);
+				Q_EMIT flagChanged();
+			}
+		}
+		m_LOADED |= columns;
+		Q_UNUSED(row)
+		Q_UNUSED(column)
+	}
+
+	template<class Row>
+	static QSharedPointer<Item> hydrated(const Row& row, quint64 columns = EagerColumns) {
+		auto ret = withID(PPKey::decode(row.value(0)));
+		ret->hydrate(row, columns);
+		return ret;
+	}
+
+	void load_columns(quint64 columns) const {
+		auto missing = columns & ~m_LOADED;
+		if (missing == 0) {
+			return;
+		}
+		// Getters are const, but loading only fills in what the database already holds.
+		auto self = const_cast<Item*>(this);
+		PPStatement query(QStringLiteral("SELECT %1 FROM Item WHERE ID = :id").arg(selectColumns(missing)));
+		query->bindValue(":id", PPKey::encode(m_ID));
+		if (!query->exec()) {
+			qCritical() << query->lastError() << "when loading the columns of an item of type Item";
+		} else if (query->next()) {
+			self->hydrate(*query, missing);
+		}
+		self->m_LOADED |= missing;
+	}
+
+	// Loads the given columns of every object that doesn't have them yet, a few hundred
+	// objects per query.
+	template<class Objects>
+	static void fetchColumns(const Objects& objects, quint64 columns) {
+		static const int chunk_size = 256;
+
+		QVector<Item*> pending;
+		quint64 missing = 0;
+		for (const auto& object : objects) {
+			if (object && (object->m_LOADED & columns) != columns) {
+				pending << object.data();
+				missing |= columns & ~object->m_LOADED;
+			}
+		}
+		for (int from = 0; from < pending.size(); from += chunk_size) {
+			QHash<QUuid,Item*> chunk;
+			QStringList placeholders;
+			for (int i = from; i < pending.size() && i < from + chunk_size; i++) {
+				chunk.insert(pending[i]->m_ID, pending[i]);
+				placeholders << QStringLiteral(":id%1").arg(i - from);
+			}
+			PPStatement query(QStringLiteral("SELECT %1 FROM Item WHERE ID IN (%2)").arg(selectColumns(missing), placeholders.join(", ")));
+			for (int i = from; i < pending.size() && i < from + chunk_size; i++) {
+				query->bindValue(placeholders[i - from], PPKey::encode(pending[i]->m_ID));
+			}
+			if (!query->exec()) {
+				qCritical() << query->lastError() << "when loading the columns of items of type Item";
+			}
+			while (query->next()) {
+				if (auto object = chunk.value(PPKey::decode(query->value(0)))) {
+					object->hydrate(*query, missing);
+				}
+			}
+			for (auto object : chunk) {
+				object->m_LOADED |= missing;
+			}
+		}
+	}
+
+	static QList<QSharedPointer<Item>> where(PredicateList predicates, quint64 columns) {
+		auto tq = QStringLiteral("SELECT %1 FROM Item%2").arg(selectColumns(columns), predicates.whereClause());
+		PPStatement query(tq);
+		predicates.bindAllPredicates(query.data());
+		auto ok = query->exec();
+		if (!ok) {
+			qCritical() << query->lastError() << "when running a where query on items of type Item";
+		}
+		QList<QSharedPointer<Item>> ret;
+		while (query->next()) {
+			ret << hydrated(*query, columns);
+		}
+		return ret;
+	}
+
+	
+	friend class ItemModel;
+	friend class PPCursor<Item>;
+	friend class PPIdentityMap<Item>;
+
+	QUuid m_ID;
+	bool m_NEW = false;
+	quint64 m_LOADED = 0;
+	bool m_DELETE_PENDING = false;
+	// The row was removed by deleteWhere(). Saves write nothing until undoing
+	// the deletion puts the row back.
+	bool m_DELETED = false;
+	bool m_DIRTY = false;
+	bool m_CAN_UNDO = false;
+	bool m_CAN_REDO = false;
+
+	Q_PROPERTY(bool pendingDelete READ pendingDelete NOTIFY pendingDeleteChanged)
+	Q_PROPERTY(bool dirty READ dirty NOTIFY dirtyChanged)
+	Q_PROPERTY(bool canUndo READ canUndo NOTIFY canUndoChanged)
+	Q_PROPERTY(bool canRedo READ canRedo NOTIFY canRedoChanged)
+
+	QList<Change> m_UNDO_STACK;
+	QList<Change> m_REDO_STACK;
+
+	
+	
+	
+	Q_PROPERTY(qint32 rank READ rank WRITE set_rank NOTIFY rankChanged)
+	qint32 m_rank;
+	qint32 m_rank_prev;
+	bool m_rank_dirty = false;
+	
+	
+	
+	Q_PROPERTY(float ratio READ ratio WRITE set_ratio NOTIFY ratioChanged)
+	float m_ratio;
+	float m_ratio_prev;
+	bool m_ratio_dirty = false;
+	
+	
+	
+	Q_PROPERTY(bool flag READ flag WRITE set_flag NOTIFY flagChanged)
+	bool m_flag;
+	bool m_flag_prev;
+	bool m_flag_dirty = false;
+	
+
+	void evaluate_can_undo_changed() {
+		auto setUndo = [this](bool newUndo){
+			if (newUndo != m_CAN_UNDO) {
+				m_CAN_UNDO = newUndo;
+				Q_EMIT canUndoChanged();
+			}
+		};
+		if (!m_UNDO_STACK.empty()) {
+			setUndo(true);
+			return;
+		}
+		setUndo(false);
+	}
+
+	void evaluate_can_redo_changed() {
+		auto setRedo = [this](bool newRedo){
+			if (newRedo != m_CAN_REDO) {
+				m_CAN_REDO = newRedo;
+				Q_EMIT canRedoChanged();
+			}
+		};
+		if (!m_REDO_STACK.empty()) {
+			setRedo(true);
+			return;
+		}
+		setRedo(false);
+	}
+
+	void clear_redo() {
+		for (int i = 0; i < m_REDO_STACK.size(); i++) {
+			pUR->redoItemRemoved(this);
+		}
+		m_REDO_STACK.clear();
+		evaluate_can_redo_changed();
+	}
+
+	// Puts the values and side table deltas of change into the object, and returns
+	// what they replaced, so applying the result reverses it again. Appends the
+	// writes that store the new values to writes.
+	Change swapChange(const Change& change, QVector<PPWrite>* writes) {
+		PPDelta::Reader reader(change);
+		PPDelta::Writer replaced;
+		quint64 columns = 0;
+		if (change.hasValue(0)) {
+			load_columns(quint64(1) << 0);
+			columns |= quint64(1) << 0;
+			replaced.value(0, m_rank);
+			m_rank = reader.value<decltype(m_rank)>();
+			Q_EMIT rankChanged();
+		}
+		if (change.hasValue(1)) {
+			load_columns(quint64(1) << 1);
+			columns |= quint64(1) << 1;
+			replaced.value(1, m_ratio);
+			m_ratio = reader.value<decltype(m_ratio)>();
+			Q_EMIT ratioChanged();
+		}
+		if (change.hasValue(2)) {
+			load_columns(quint64(1) << 2);
+			columns |= quint64(1) << 2;
+			replaced.value(2, m_flag);
+			m_flag = reader.value<decltype(m_flag)>();
+			Q_EMIT flagChanged();
+		}
+		if (columns != 0) {
+			PPWrite write;
+			write.statement = updateStatement(columns);
+			write.bind(":ID", PPKey::encode(m_ID));
+			if (columns & (quint64(1) << 0)) {
+				write.bind(":rank", PPColumn<decltype(m_rank)>::bind(m_rank));
+			}
+			if (columns & (quint64(1) << 1)) {
+				write.bind(":ratio", PPColumn<decltype(m_ratio)>::bind(m_ratio));
+			}
+			if (columns & (quint64(1) << 2)) {
+				write.bind(":flag", PPColumn<decltype(m_flag)>::bind(m_flag));
+			}
+			*writes << write;
+		}
+		return replaced.finish();
+	}
+
+	// Whether change touches a property with unsaved edits, which applying it
+	// would overwrite.
+	bool touchesPendingEdits(const Change& change) const {
+		if (change.hasValue(0) && m_rank_dirty) {
+			return true;
+		}
+		if (change.hasValue(1) && m_ratio_dirty) {
+			return true;
+		}
+		if (change.hasValue(2) && m_flag_dirty) {
+			return true;
+		}
+		Q_UNUSED(change)
+		return false;
+	}
+
+	// Applies the latest step on from, writing the values it puts back in one
+	// transaction with PPUndoRedoStack's record of the move, and pushes what
+	// it replaced onto to. Nothing moves if the write fails, or if the step
+	// would overwrite unsaved edits, which have to be saved or discarded first.
+	bool moveStep(QList<Change>& from, QList<Change>& to, bool redo) {
+		if (touchesPendingEdits(from.last())) {
+			qWarning() << "Not" << (redo ? "redoing" : "undoing") << "a change to an item of type Item over unsaved edits";
+			return false;
+		}
+		PPTransaction transaction;
+		if (!transaction.isOpen()) {
+			return false;
+		}
+		QVector<PPWrite> writes;
+		auto step = from.takeLast();
+		auto replaced = swapChange(step, &writes);
+		auto ok = true;
+		for (const auto& write : writes) {
+			if (!write.exec()) {
+				qCritical() << "when" << (redo ? "redoing" : "undoing") << "a change to an item of type Item";
+				ok = false;
+				break;
+			}
+		}
+		if (ok) {
+			PPRowChange change;
+			change.table = QStringLiteral("Item");
+			change.ID = m_ID;
+			change.properties = step.properties();
+			pDB->publishRowChange(change);
+			to << replaced;
+			redo ? pUR->stepRedone(this, replaced) : pUR->stepUndone(this, replaced);
+			ok = transaction.commit();
+			if (!ok) {
+				to.takeLast();
+				redo ? pUR->stepUndone(this, step) : pUR->stepRedone(this, step);
+			}
+		}
+		if (!ok) {
+			QVector<PPWrite> ignored;
+			swapChange(replaced, &ignored);
+			from << step;
+			return false;
+		}
+		evaluate_can_undo_changed();
+		evaluate_can_redo_changed();
+		return true;
+	}
+
+	void evaluate_dirty_changed() {
+		if (m_DIRTY) {
+			auto new_dirty = false;
+			
+			if (m_rank_dirty) {
+				new_dirty = true;
+			}
+			
+			if (m_ratio_dirty) {
+				new_dirty = true;
+			}
+			
+			if (m_flag_dirty) {
+				new_dirty = true;
+			}
+			
+			if (!new_dirty) {
+				m_DIRTY = false;
+			}
+			Q_EMIT dirtyChanged();
+		} else {
+			
+			if (m_rank_dirty) {
+				m_DIRTY = true;
+				Q_EMIT dirtyChanged();
+				return;
+			}
+			
+			if (m_ratio_dirty) {
+				m_DIRTY = true;
+				Q_EMIT dirtyChanged();
+				return;
+			}
+			
+			if (m_flag_dirty) {
+				m_DIRTY = true;
+				Q_EMIT dirtyChanged();
+				return;
+			}
+			
+		}
+		evaluate_can_undo_changed();
+	}
+
+	// Sets each of the columns from the placeholder named after it.
+	static QString assignments(quint64 columns) {
+		QStringList ret;
+		if (columns & (quint64(1) << 0)) {
+			ret << QStringLiteral("rank = :rank");
+		}
+		if (columns & (quint64(1) << 1)) {
+			ret << QStringLiteral("ratio = :ratio");
+		}
+		if (columns & (quint64(1) << 2)) {
+			ret << QStringLiteral("flag = :flag");
+		}
+		return ret.join(", ");
+	}
+
+	static QString updateStatement(quint64 columns) {
+		static QHash<quint64,QString> s_statements;
+		static QMutex s_mutex;
+
+		QMutexLocker locker(&s_mutex);
+		auto statement = s_statements.value(columns);
+		if (statement.isNull()) {
+			statement = QStringLiteral("UPDATE Item SET %1 WHERE ID = :ID").arg(assignments(columns));
+			s_statements.insert(columns, statement);
+		}
+		return statement;
+	}
+
+	static QString insertStatement(int rows) {
+		static QHash<int,QString> s_statements;
+		static QMutex s_mutex;
+
+		QMutexLocker locker(&s_mutex);
+		auto statement = s_statements.value(rows);
+		if (statement.isNull()) {
+			QStringList values;
+			for (int i = 0; i < rows; i++) {
+				values << QStringLiteral("(?, ?, ?, ?)");
+			}
+			statement = QStringLiteral("INSERT INTO Item (ID, rank, ratio, flag) VALUES %1").arg(values.join(", "));
+			s_statements.insert(rows, statement);
+		}
+		return statement;
+	}
+
+	// Turns the pending changes into writes and marks them as saved.
+	// restorePending() undoes this if a write fails, publishSave() records
+	// the undo step once it's committed. With PPUndoRedoStack's journal on,
+	// the step is written with the changes and step is its number.
+	QVector<PPWrite> takePendingWrites(Change* changes, qint64* step) {
+		QVector<PPWrite> writes;
+		if (m_DELETED) {
+			return writes;
+		}
+		if (m_NEW || m_DELETE_PENDING) {
+			load_columns(AllColumns);
+			PPWrite write;
+			write.statement = QStringLiteral(R"RJIENRLWEY(
+INSERT INTO Item
+(ID,rank,ratio,flag)
+VALUES
+(:ID, :rank, :ratio, :flag);
+			)RJIENRLWEY");
+			write.bind(":ID", PPKey::encode(m_ID));
+			write.bind(":rank", PPColumn<decltype(m_rank)>::bind(m_rank));
+			m_rank_dirty = false;
+			write.bind(":ratio", PPColumn<decltype(m_ratio)>::bind(m_ratio));
+			m_ratio_dirty = false;
+			write.bind(":flag", PPColumn<decltype(m_flag)>::bind(m_flag));
+			m_flag_dirty = false;
+			writes << write;
+			m_NEW = false;
+			if (m_DELETE_PENDING) {
+				m_DELETE_PENDING = false;
+				pendingDeleteChanged();
+			}
+			evaluate_dirty_changed();
+			return writes;
+		}
+
+		PPDelta::Writer previous;
+		quint64 columns = 0;
+		if (m_rank_dirty) {
+			previous.value(0, m_rank_prev);
+			columns |= quint64(1) << 0;
+		}
+		if (m_ratio_dirty) {
+			previous.value(1, m_ratio_prev);
+			columns |= quint64(1) << 1;
+		}
+		if (m_flag_dirty) {
+			previous.value(2, m_flag_prev);
+			columns |= quint64(1) << 2;
+		}
+		*changes = previous.finish();
+		if (columns != 0) {
+			PPWrite write;
+			write.statement = updateStatement(columns);
+			write.bind(":ID", PPKey::encode(m_ID));
+			if (columns & (quint64(1) << 0)) {
+				write.bind(":rank", PPColumn<decltype(m_rank)>::bind(m_rank));
+				m_rank_dirty = false;
+			}
+			if (columns & (quint64(1) << 1)) {
+				write.bind(":ratio", PPColumn<decltype(m_ratio)>::bind(m_ratio));
+				m_ratio_dirty = false;
+			}
+			if (columns & (quint64(1) << 2)) {
+				write.bind(":flag", PPColumn<decltype(m_flag)>::bind(m_flag));
+				m_flag_dirty = false;
+			}
+			writes << write;
+		}
+		if (!changes->isEmpty()) {
+			*step = pUR->journal(&writes, QStringLiteral("Item"), m_ID, *changes);
+		}
+		return writes;
+	}
+
+	void restorePending(bool wasNew, const Change& changes) {
+		if (wasNew) {
+			m_NEW = true;
+			return;
+		}
+		PPDelta::Reader reader(changes);
+		if (changes.hasValue(0)) {
+			m_rank_prev = reader.value<decltype(m_rank)>();
+			m_rank_dirty = true;
+		}
+		if (changes.hasValue(1)) {
+			m_ratio_prev = reader.value<decltype(m_ratio)>();
+			m_ratio_dirty = true;
+		}
+		if (changes.hasValue(2)) {
+			m_flag_prev = reader.value<decltype(m_flag)>();
+			m_flag_dirty = true;
+		}
+		evaluate_dirty_changed();
+	}
+
+	void publishRow(bool wasNew, const Change& changes) {
+		PPRowChange change;
+		change.kind = wasNew ? PPRowChange::Inserted : PPRowChange::Updated;
+		change.table = QStringLiteral("Item");
+		change.ID = m_ID;
+		change.properties = changes.properties();
+		pDB->publishRowChange(change);
+	}
+
+	void publishSave(bool wasNew, const Change& changes, qint64 step) {
+		if (wasNew) {
+			return;
+		}
+		m_UNDO_STACK << changes;
+		pUR->undoItemAdded(this, changes.bytes(), step);
+		evaluate_can_undo_changed();
+	}
+
+public:
+
+	Q_SIGNAL void pendingDeleteChanged();
+	Q_SIGNAL void dirtyChanged();
+	Q_SIGNAL void canUndoChanged();
+	Q_SIGNAL void canRedoChanged();
+	bool pendingDelete() const { return m_DELETE_PENDING; }
+	bool dirty() const { return m_DIRTY; }
+	bool canUndo() const { return m_CAN_UNDO; }
+	bool canRedo() const { return m_CAN_REDO; }
+
+	~Item() override {
+		pUR->itemDestroyed(this);
+	}
+
+	Q_INVOKABLE void undo() override {
+		if (!m_UNDO_STACK.empty()) {
+			moveStep(m_UNDO_STACK, m_REDO_STACK, false);
+		}
+	}
+
+	Q_INVOKABLE void redo() override {
+		if (!m_REDO_STACK.empty()) {
+			moveStep(m_REDO_STACK, m_UNDO_STACK, true);
+		}
+	}
+
+	// PPUndoRedoStack drops the oldest steps first, which are at the front.
+	void undoStepDropped() override {
+		if (!m_UNDO_STACK.empty()) {
+			m_UNDO_STACK.removeFirst();
+			evaluate_can_undo_changed();
+		}
+	}
+
+	void redoStepDropped() override {
+		if (!m_REDO_STACK.empty()) {
+			m_REDO_STACK.removeFirst();
+			evaluate_can_redo_changed();
+		}
+	}
+
+	// Steps read back from the journal are older than any the object holds.
+	void undoStepLoaded(const PPDelta& delta) override {
+		m_UNDO_STACK.prepend(delta);
+		evaluate_can_undo_changed();
+	}
+
+	void redoStepLoaded(const PPDelta& delta) override {
+		m_REDO_STACK.prepend(delta);
+		evaluate_can_redo_changed();
+	}
+
+	Q_INVOKABLE void stageDelete() {
+		if (!m_DELETE_PENDING) {
+			m_DELETE_PENDING = true;
+			pendingDeleteChanged();
+		}
+	}
+
+	
+	
+	
+	Q_SIGNAL void rankChanged();
+	qint32 rank() const { load_columns(quint64(1) << 0); return m_rank; };
+	void set_rank(const qint32& val) {
+		load_columns(quint64(1) << 0);
+		if (val == m_rank) {
+			return;
+		}
+		if (!m_rank_dirty) {
+			m_rank_prev = m_rank;
+		}
+		m_rank_dirty = true;
+		m_rank = val;
+		Q_EMIT void rankChanged();
+		clear_redo();
+		evaluate_dirty_changed();
+		evaluate_can_undo_changed();
+	}
+	void discard_rank_changes() {
+		if (m_rank_dirty) {
+			m_rank_dirty = false;
+			m_rank = m_rank_prev;
+			Q_EMIT void rankChanged();
+			evaluate_dirty_changed();
+		}
+	}
+	
+	
+	
+	Q_SIGNAL void ratioChanged();
+	float ratio() const { load_columns(quint64(1) << 1); return m_ratio; };
+	void set_ratio(const float& val) {
+		load_columns(quint64(1) << 1);
+		if (val == m_ratio) {
+			return;
+		}
+		if (!m_ratio_dirty) {
+			m_ratio_prev = m_ratio;
+		}
+		m_ratio_dirty = true;
+		m_ratio = val;
+		Q_EMIT void ratioChanged();
+		clear_redo();
+		evaluate_dirty_changed();
+		evaluate_can_undo_changed();
+	}
+	void discard_ratio_changes() {
+		if (m_ratio_dirty) {
+			m_ratio_dirty = false;
+			m_ratio = m_ratio_prev;
+			Q_EMIT void ratioChanged();
+			evaluate_dirty_changed();
+		}
+	}
+	
+	
+	
+	Q_SIGNAL void flagChanged();
+	bool flag() const { load_columns(quint64(1) << 2); return m_flag; };
+	void set_flag(const bool& val) {
+		load_columns(quint64(1) << 2);
+		if (val == m_flag) {
+			return;
+		}
+		if (!m_flag_dirty) {
+			m_flag_prev = m_flag;
+		}
+		m_flag_dirty = true;
+		m_flag = val;
+		Q_EMIT void flagChanged();
+		clear_redo();
+		evaluate_dirty_changed();
+		evaluate_can_undo_changed();
+	}
+	void discard_flag_changes() {
+		if (m_flag_dirty) {
+			m_flag_dirty = false;
+			m_flag = m_flag_prev;
+			Q_EMIT void flagChanged();
+			evaluate_dirty_changed();
+		}
+	}
+	
+
+	void discard_all_changes() {
+		
+		if (m_rank_dirty) {
+			m_rank_dirty = false;
+			m_rank = m_rank_prev;
+			Q_EMIT void rankChanged();
+		}
+		
+		if (m_ratio_dirty) {
+			m_ratio_dirty = false;
+			m_ratio = m_ratio_prev;
+			Q_EMIT void ratioChanged();
+		}
+		
+		if (m_flag_dirty) {
+			m_flag_dirty = false;
+			m_flag = m_flag_prev;
+			Q_EMIT void flagChanged();
+		}
+		
+		evaluate_dirty_changed();
+	}
+
+	Q_INVOKABLE bool save() {
+		PPTransaction transaction;
+		if (!transaction.isOpen()) {
+			return false;
+		}
+		QPointer<Item> self(this);
+		auto wasNew = m_NEW || m_DELETE_PENDING;
+		Change changes;
+		qint64 step = 0;
+		auto writes = takePendingWrites(&changes, &step);
+		if (writes.isEmpty()) {
+			return transaction.commit();
+		}
+		for (const auto& write : writes) {
+			if (!write.exec()) {
+				qCritical() << "when saving an item of type Item";
+				restorePending(wasNew, changes);
+				return false;
+			}
+		}
+		publishRow(wasNew, changes);
+		pDB->onCommit([self, wasNew, changes, step] {
+			if (self) {
+				self->publishSave(wasNew, changes, step);
+			}
+		});
+		pDB->onRollback([self, wasNew, changes] {
+			if (self) {
+				self->restorePending(wasNew, changes);
+			}
+		});
+		return transaction.commit();
+	}
+
+	// Like save(), but the write runs on PPDatabase's persistence thread. The
+	// future finishes on the calling thread, which needs a running event loop.
+	QFuture<bool> saveAsync() {
+		QPointer<Item> self(this);
+		auto wasNew = m_NEW || m_DELETE_PENDING;
+		Change changes;
+		qint64 step = 0;
+		auto writes = takePendingWrites(&changes, &step);
+		auto hasWrite = !writes.isEmpty();
+		return pDB->runAsync<bool, bool>([writes, hasWrite] {
+			if (!hasWrite) {
+				return true;
+			}
+			PPTransaction transaction;
+			if (!transaction.isOpen()) {
+				return false;
+			}
+			for (const auto& write : writes) {
+				if (!write.exec()) {
+					qCritical() << "when saving an item of type Item";
+					return false;
+				}
+			}
+			return transaction.commit();
+		}, [self, wasNew, changes, step, hasWrite](const bool& ok) {
+			if (self) {
+				if (!ok) {
+					self->restorePending(wasNew, changes);
+				} else if (hasWrite) {
+					self->publishRow(wasNew, changes);
+					self->publishSave(wasNew, changes, step);
+				}
+			}
+			return ok;
+		});
+	}
+
+	
+
+	static QSharedPointer<Item> newItem() {
+		auto ret = Item::withID(QUuid::createUuid());
+		ret->m_NEW = true;
+		ret->m_LOADED = AllColumns;
+		return ret;
+	}
+
+	static QSharedPointer<Item> load(const QUuid& ID) {
+		auto tq = QStringLiteral("SELECT %1 FROM Item WHERE ID = :id").arg(selectColumns());
+		PPStatement query(tq);
+		query->bindValue(":id", PPKey::encode(ID));
+		auto ok = query->exec();
+		if (!ok) {
+			qCritical() << query->lastError() << "when loading an item of type Item";
+		}
+		auto ret = Item::withID(ID);
+		while (query->next()) {
+			ret->hydrate(*query, EagerColumns);
+		}
+		return ret;
+	}
+
+	static QList<QSharedPointer<Item>> where(PredicateList predicates) {
+		return where(std::move(predicates), EagerColumns);
+	}
+
+	// Like where(), but only reads the given properties. The others are read the first
+	// time they're used, or for many objects at once with fetch().
+	static QList<QSharedPointer<Item>> where(PredicateList predicates, const QStringList& properties) {
+		return where(std::move(predicates), columnsNamed(properties));
+	}
+
+	// Aggregates over the rows matching all of the predicates, computed by
+	// SQLite without reading the rows.
+	static qint64 count(PredicateList predicates = PredicateList()) {
+		return PPAggregate::value(QStringLiteral("Item"), QStringLiteral("COUNT(*)"), predicates).toLongLong();
+	}
+	static bool exists(PredicateList predicates = PredicateList()) {
+		return PPAggregate::exists(QStringLiteral("Item"), predicates);
+	}
+	// These are 0 when no rows match.
+	static qint32 min_rank(PredicateList predicates = PredicateList()) {
+		return PPColumn<qint32>::read(PPAggregate::value(QStringLiteral("Item"), QStringLiteral("MIN(rank)"), predicates));
+	}
+	static qint32 max_rank(PredicateList predicates = PredicateList()) {
+		return PPColumn<qint32>::read(PPAggregate::value(QStringLiteral("Item"), QStringLiteral("MAX(rank)"), predicates));
+	}
+	static qint64 sum_rank(PredicateList predicates = PredicateList()) {
+		return PPColumn<qint64>::read(PPAggregate::value(QStringLiteral("Item"), QStringLiteral("SUM(rank)"), predicates));
+	}
+	static double avg_rank(PredicateList predicates = PredicateList()) {
+		return PPAggregate::value(QStringLiteral("Item"), QStringLiteral("AVG(rank)"), predicates).toDouble();
+	}
+	// These are 0 when no rows match.
+	static float min_ratio(PredicateList predicates = PredicateList()) {
+		return PPColumn<float>::read(PPAggregate::value(QStringLiteral("Item"), QStringLiteral("MIN(ratio)"), predicates));
+	}
+	static float max_ratio(PredicateList predicates = PredicateList()) {
+		return PPColumn<float>::read(PPAggregate::value(QStringLiteral("Item"), QStringLiteral("MAX(ratio)"), predicates));
+	}
+	static double sum_ratio(PredicateList predicates = PredicateList()) {
+		return PPColumn<double>::read(PPAggregate::value(QStringLiteral("Item"), QStringLiteral("SUM(ratio)"), predicates));
+	}
+	static double avg_ratio(PredicateList predicates = PredicateList()) {
+		return PPAggregate::value(QStringLiteral("Item"), QStringLiteral("AVG(ratio)"), predicates).toDouble();
+	}
+
+	// Like where(), but hands the rows out one at a time as they're read.
+	static PPCursor<Item> streamWhere(PredicateList predicates) {
+		PPCursor<Item> ret(QStringLiteral("SELECT %1 FROM Item%2").arg(selectColumns(), predicates.whereClause()));
+		predicates.bindAllPredicates(ret.query());
+		ret.exec();
+		return ret;
+	}
+
+	// The values of a row for importRows() and insertMany(). Collections stored
+	// in side tables start out empty.
+	struct Record {
+		qint32 rank{};
+		float ratio{};
+		bool flag{};
+	};
+
+	// Writes records as new rows in one transaction, a few hundred rows per
+	// INSERT, without creating any objects. IDs receives the IDs of the rows.
+	template<class Records>
+	static bool importRows(const Records& records, QVector<QUuid>* IDs = nullptr) {
+		return importRecords(records, IDs, nullptr);
+	}
+
+	// Like importRows(), but also hands back an object for each row.
+	template<class Records>
+	static QList<QSharedPointer<Item>> insertMany(const Records& records) {
+		QVector<QUuid> IDs;
+		QVector<Record> written;
+		if (!importRecords(records, &IDs, &written)) {
+			return {};
+		}
+		QList<QSharedPointer<Item>> ret;
+		ret.reserve(IDs.size());
+		for (int i = 0; i < IDs.size(); i++) {
+			auto object = withID(IDs[i]);
+			object->m_rank = written[i].rank;
+			object->m_ratio = written[i].ratio;
+			object->m_flag = written[i].flag;
+			object->m_LOADED = AllColumns;
+			ret << object;
+		}
+		return ret;
+	}
+
+	// Reads records in a single pass, so any range will do, and keeps a copy
+	// of each in written when given.
+	template<class Records>
+	static bool importRecords(const Records& records, QVector<QUuid>* IDs, QVector<Record>* written) {
+		// SQLite allows 999 bound values per statement unless built otherwise.
+		static const int batch_size = qMax(1, 999 / 4);
+
+		PPTransaction transaction;
+		if (!transaction.isOpen()) {
+			return false;
+		}
+		// Rows are held as their bound values rather than pointers into records,
+		// whose iterators may hand out temporaries.
+		QVector<QVariant> batch;
+		batch.reserve(batch_size * 4);
+		int rows = 0;
+		auto any = false;
+		auto flush = [&batch, &rows] {
+			PPStatement query(insertStatement(rows));
+			for (int position = 0; position < batch.size(); position++) {
+				query->bindValue(position, batch.at(position));
+			}
+			batch.clear();
+			rows = 0;
+			if (!query->exec()) {
+				qCritical() << query->lastError() << "when importing items of type Item";
+				return false;
+			}
+			return true;
+		};
+		for (const Record& record : records) {
+			auto ID = QUuid::createUuid();
+			batch << PPKey::encode(ID);
+			batch << PPColumn<decltype(m_rank)>::bind(record.rank);
+			batch << PPColumn<decltype(m_ratio)>::bind(record.ratio);
+			batch << PPColumn<decltype(m_flag)>::bind(record.flag);
+			if (IDs != nullptr) {
+				*IDs << ID;
+			}
+			if (written != nullptr) {
+				*written << record;
+			}
+			any = true;
+			if (++rows == batch_size && !flush()) {
+				return false;
+			}
+		}
+		if (rows > 0 && !flush()) {
+			return false;
+		}
+		if (!any) {
+			return transaction.commit();
+		}
+
+		PPRowChange change;
+		change.kind = PPRowChange::Reset;
+		change.table = QStringLiteral("Item");
+		pDB->publishRowChange(change);
+		return transaction.commit();
+	}
+
+	// New values for some of the properties stored in the table, for updateWhere().
+	class Patch
+	{
+		friend class Item;
+
+		quint64 m_columns = 0;
+		QVector<QVariant> m_values = QVector<QVariant>(3);
+
+		void bindTo(QSqlQuery* query) const {
+			if (m_columns & (quint64(1) << 0)) {
+				query->bindValue(":rank", m_values[0]);
+			}
+			if (m_columns & (quint64(1) << 1)) {
+				query->bindValue(":ratio", m_values[1]);
+			}
+			if (m_columns & (quint64(1) << 2)) {
+				query->bindValue(":flag", m_values[2]);
+			}
+			Q_UNUSED(query)
+		}
+		// The values in the order hydrate() reads them, after the ID's place.
+		PPValueRow row() const {
+			PPValueRow ret;
+			ret.values << QVariant();
+			for (int i = 0; i < m_values.size(); i++) {
+				if (m_columns & (quint64(1) << i)) {
+					ret.values << m_values[i];
+				}
+			}
+			return ret;
+		}
+
+	public:
+		Patch& set_rank(const qint32& value) {
+			m_values[0] = PPColumn<qint32>::bind(value);
+			m_columns |= quint64(1) << 0;
+			return *this;
+		}
+		Patch& set_ratio(const float& value) {
+			m_values[1] = PPColumn<float>::bind(value);
+			m_columns |= quint64(1) << 1;
+			return *this;
+		}
+		Patch& set_flag(const bool& value) {
+			m_values[2] = PPColumn<bool>::bind(value);
+			m_columns |= quint64(1) << 2;
+			return *this;
+		}
+	};
+
+	// The properties, as bits in declaration order, of the given columns.
+	static quint64 propertiesOf(quint64 columns) {
+		quint64 ret = 0;
+		if (columns & (quint64(1) << 0)) {
+			ret |= quint64(1) << 0;
+		}
+		if (columns & (quint64(1) << 1)) {
+			ret |= quint64(1) << 1;
+		}
+		if (columns & (quint64(1) << 2)) {
+			ret |= quint64(1) << 2;
+		}
+		return ret;
+	}
+
+	static void publishChanges(PPRowChange::Kind kind, const QVector<QUuid>& IDs, quint64 properties) {
+		PPRowChange change;
+		change.table = QStringLiteral("Item");
+		if (IDs.size() > PPRowChange::ResetThreshold) {
+			change.kind = PPRowChange::Reset;
+			pDB->publishRowChange(change);
+			return;
+		}
+		change.kind = kind;
+		change.properties = properties;
+		for (const auto& ID : IDs) {
+			change.ID = ID;
+			pDB->publishRowChange(change);
+		}
+	}
+
+	// Gives the live objects among IDs the patch's values, unless they have unsaved
+	// edits to them, and publishes the change.
+	static void applyPatch(const QVector<QUuid>& IDs, const Patch& patch) {
+		auto row = patch.row();
+		auto& map = PPIdentityMap<Item>::instance();
+		for (const auto& ID : IDs) {
+			if (auto object = map.value(ID)) {
+				object->hydrate(row, patch.m_columns);
+			}
+		}
+		publishChanges(PPRowChange::Updated, IDs, propertiesOf(patch.m_columns));
+	}
+
+	// Writes the patch to each of the rows in IDs, for redoing updateWhere().
+	static void writePatch(const QVector<QUuid>& IDs, const Patch& patch) {
+		PPTransaction transaction;
+		if (!transaction.isOpen()) {
+			return;
+		}
+		PPStatement query(updateStatement(patch.m_columns));
+		for (const auto& ID : IDs) {
+			patch.bindTo(query.data());
+			query->bindValue(":ID", PPKey::encode(ID));
+			if (!query->exec()) {
+				qCritical() << query->lastError() << "when redoing an update of items of type Item";
+				return;
+			}
+		}
+		pDB->onCommit([IDs, patch] { applyPatch(IDs, patch); });
+		transaction.commit();
+	}
+
+	// Writes back the values rows had before updateWhere(), read in the order of
+	// selectColumns(columns).
+	static void restoreRows(const QList<QSqlRecord>& rows, quint64 columns) {
+		PPTransaction transaction;
+		if (!transaction.isOpen()) {
+			return;
+		}
+		PPStatement query(updateStatement(columns));
+		QVector<QUuid> IDs;
+		for (const auto& row : rows) {
+			int column = 1;
+			if (columns & (quint64(1) << 0)) {
+				query->bindValue(":rank", row.value(column++));
+			}
+			if (columns & (quint64(1) << 1)) {
+				query->bindValue(":ratio", row.value(column++));
+			}
+			if (columns & (quint64(1) << 2)) {
+				query->bindValue(":flag", row.value(column++));
+			}
+			query->bindValue(":ID", row.value(0));
+			if (!query->exec()) {
+				qCritical() << query->lastError() << "when undoing an update of items of type Item";
+				return;
+			}
+			IDs << PPKey::decode(row.value(0));
+			Q_UNUSED(column)
+		}
+		pDB->onCommit([rows, columns, IDs] {
+			auto& map = PPIdentityMap<Item>::instance();
+			for (const auto& row : rows) {
+				if (auto object = map.value(PPKey::decode(row.value(0)))) {
+					object->hydrate(row, columns);
+				}
+			}
+			publishChanges(PPRowChange::Updated, IDs, propertiesOf(columns));
+		});
+		transaction.commit();
+	}
+
+	// Sets the patch's properties on every row matching all of the predicates, or
+	// every row if there are none, with one UPDATE. Live objects among them take the
+	// new values, except for properties with unsaved edits. With undoable, the whole
+	// update is a single step on PPUndoRedoStack, which writes the old values back.
+	static bool updateWhere(PredicateList predicates, const Patch& patch, bool undoable = false) {
+		auto columns = patch.m_columns;
+		if (columns == 0) {
+			return true;
+		}
+		PPTransaction transaction;
+		if (!transaction.isOpen()) {
+			return false;
+		}
+		auto where = predicates.whereClause();
+		// The rows' IDs, and for undo their values, before they change.
+		PPStatement select(QStringLiteral("SELECT %1 FROM Item%2").arg(undoable ? selectColumns(columns) : QStringLiteral("ID"), where));
+		predicates.bindAllPredicates(select.data());
+		if (!select->exec()) {
+			qCritical() << select->lastError() << "when finding items of type Item to update";
+			return false;
+		}
+		auto rows = PPDatabase::records(select.data());
+		if (rows.isEmpty()) {
+			return transaction.commit();
+		}
+		PPStatement update(QStringLiteral("UPDATE Item SET %1%2").arg(assignments(columns), where));
+		predicates.bindAllPredicates(update.data());
+		patch.bindTo(update.data());
+		if (!update->exec()) {
+			qCritical() << update->lastError() << "when updating items of type Item";
+			return false;
+		}
+		QVector<QUuid> IDs;
+		IDs.reserve(rows.size());
+		for (const auto& row : rows) {
+			IDs << PPKey::decode(row.value(0));
+		}
+		pDB->onCommit([IDs, patch] { applyPatch(IDs, patch); });
+		if (undoable) {
+			PPUndoStep::record([rows, columns] { restoreRows(rows, columns); }, [IDs, patch] { writePatch(IDs, patch); }, PPUndoStep::bytesOf(rows));
+		}
+		return transaction.commit();
+	}
+
+	// Live objects whose rows were deleted stop saving, until an undo writes
+	// the rows back.
+	static void markDeleted(const QVector<QUuid>& IDs, bool deleted) {
+		auto& map = PPIdentityMap<Item>::instance();
+		for (const auto& ID : IDs) {
+			if (auto object = map.value(ID)) {
+				object->m_DELETED = deleted;
+			}
+		}
+	}
+
+	// Deletes the rows in IDs again, for redoing deleteWhere().
+	static void deleteRows(const QVector<QUuid>& IDs) {
+		PPTransaction transaction;
+		if (!transaction.isOpen()) {
+			return;
+		}
+		PPStatement query(QStringLiteral("DELETE FROM Item WHERE ID = :ID"));
+		for (const auto& ID : IDs) {
+			query->bindValue(":ID", PPKey::encode(ID));
+			auto ok = query->exec();
+			if (!ok) {
+				qCritical() << query->lastError() << "when redoing a deletion of items of type Item";
+				return;
+			}
+		}
+		pDB->onCommit([IDs] { markDeleted(IDs, true); });
+		publishChanges(PPRowChange::Reset, {}, 0);
+		transaction.commit();
+	}
+
+	// Deletes every row matching all of the predicates, or every row if there are
+	// none, with one DELETE per table. With undoable, the whole deletion is a single
+	// step on PPUndoRedoStack, which writes the rows back.
+	static bool deleteWhere(PredicateList predicates, bool undoable = false) {
+		PPTransaction transaction;
+		if (!transaction.isOpen()) {
+			return false;
+		}
+		auto where = predicates.whereClause();
+		// For undo, the rows are read whole, with the rowid SELECT * leaves out.
+		PPStatement select(QStringLiteral("SELECT %1 FROM Item%2").arg(undoable ? QStringLiteral("rowid AS rowid, *") : QStringLiteral("ID"), where));
+		predicates.bindAllPredicates(select.data());
+		if (!select->exec()) {
+			qCritical() << select->lastError() << "when finding items of type Item to delete";
+			return false;
+		}
+		auto rows = PPDatabase::records(select.data());
+		if (rows.isEmpty()) {
+			return transaction.commit();
+		}
+		QHash<QUuid,qint64> rowids;
+		// Models find where the rows were by their rowids.
+		if (rows.size() <= PPRowChange::ResetThreshold) {
+			PPStatement query(QStringLiteral("SELECT ID, rowid FROM Item%1").arg(where));
+			predicates.bindAllPredicates(query.data());
+			if (query->exec()) {
+				while (query->next()) {
+					rowids.insert(PPKey::decode(query->value(0)), query->value(1).toLongLong());
+				}
+			}
+		}
+		// Side table rows are read for undo and deleted by their owner's ID.
+		QList<QPair<QString,QList<QSqlRecord>>> entries;
+		PPStatement query(QStringLiteral("DELETE FROM Item%1").arg(where));
+		predicates.bindAllPredicates(query.data());
+		if (!query->exec()) {
+			qCritical() << query->lastError() << "when deleting items of type Item";
+			return false;
+		}
+
+		QVector<QUuid> IDs;
+		IDs.reserve(rows.size());
+		for (const auto& row : rows) {
+			IDs << PPKey::decode(row.value(QStringLiteral("ID")));
+		}
+		pDB->onCommit([IDs] { markDeleted(IDs, true); });
+		if (IDs.size() > PPRowChange::ResetThreshold) {
+			publishChanges(PPRowChange::Reset, {}, 0);
+		} else {
+			for (const auto& row : rows) {
+				auto ID = PPKey::decode(row.value(QStringLiteral("ID")));
+				PPRowChange change;
+				change.kind = PPRowChange::Deleted;
+				change.table = QStringLiteral("Item");
+				change.ID = ID;
+				change.rowid = rowids.value(ID);
+				pDB->publishRowChange(change);
+			}
+		}
+		if (undoable) {
+			auto bytes = PPUndoStep::bytesOf(rows);
+			for (const auto& entry : entries) {
+				bytes += PPUndoStep::bytesOf(entry.second);
+			}
+			PPUndoStep::record([rows, entries, IDs] {
+				PPTransaction transaction;
+				if (!transaction.isOpen()) {
+					return;
+				}
+				// Rows go back under their old rowids, and so in their old place,
+				// unless a row inserted since has taken one.
+				QList<QSqlRecord> placed;
+				QList<QSqlRecord> moved;
+				PPStatement taken(QStringLiteral("SELECT 1 FROM Item WHERE rowid = :rowid"));
+				for (auto row : rows) {
+					taken->bindValue(":rowid", row.value(QStringLiteral("rowid")));
+					if (taken->exec() && taken->next()) {
+						row.remove(row.indexOf(QStringLiteral("rowid")));
+						moved << row;
+					} else {
+						placed << row;
+					}
+					taken->finish();
+				}
+				auto ok = PPDatabase::insertRecords(QStringLiteral("Item"), placed)
+					&& PPDatabase::insertRecords(QStringLiteral("Item"), moved);
+				for (const auto& entry : entries) {
+					ok = ok && PPDatabase::insertRecords(entry.first, entry.second);
+				}
+				if (ok) {
+					pDB->onCommit([IDs] { markDeleted(IDs, false); });
+					publishChanges(PPRowChange::Reset, {}, 0);
+					transaction.commit();
+				}
+			}, [IDs] { deleteRows(IDs); }, bytes);
+		}
+		return transaction.commit();
+	}
+
+	static void fetch(const QList<QSharedPointer<Item>>& objects, const QStringList& properties) {
+		fetchColumns(objects, columnsNamed(properties));
+	}
+
+	// A typed query over the properties stored in the table, like
+	// Item::query().rank.equals(value).limit(10).all().
+	class Query : public PPQuery<Query>
+	{
+	public:
+		Query() = default;
+		// Fields point at the query that holds them, so copies only take the clauses.
+		Query(const Query& other) : PPQuery<Query>(other) {}
+		Query& operator=(const Query& other) {
+			PPQuery<Query>::operator=(other);
+			return *this;
+		}
+		PPField<Query, qint32> rank{this, 0};
+		PPField<Query, float> ratio{this, 1};
+		PPField<Query, bool> flag{this, 2};
+
+		PPCursor<Item> stream() const {
+			static const char* const columns[] = {"rank", "ratio", "flag", nullptr };
+			PPCursor<Item> ret(PPQueryBase::statement(QStringLiteral("Item"), Item::selectColumns(), columns));
+			PPQueryBase::bind(ret.query());
+			ret.exec();
+			return ret;
+		}
+
+		QList<QSharedPointer<Item>> all() const {
+			QList<QSharedPointer<Item>> ret;
+			for (const auto& row : stream()) {
+				ret << row;
+			}
+			return ret;
+		}
+
+		QSharedPointer<Item> first() const {
+			auto ret = Query(*this).limit(1).all();
+			return ret.isEmpty() ? QSharedPointer<Item>() : ret.first();
+		}
+	};
+
+	static Query query() {
+		return Query();
+	}
+
+	static QFuture<QSharedPointer<Item>> loadAsync(const QUuid& ID) {
+		return pDB->runAsync<QList<QSqlRecord>, QSharedPointer<Item>>([ID] {
+			PPStatement query(QStringLiteral("SELECT %1 FROM Item WHERE ID = :id").arg(selectColumns()));
+			query->bindValue(":id", PPKey::encode(ID));
+			auto ok = query->exec();
+			if (!ok) {
+				qCritical() << query->lastError() << "when loading an item of type Item";
+			}
+			return PPDatabase::records(query.data());
+		}, [ID](const QList<QSqlRecord>& records) {
+			auto ret = Item::withID(ID);
+			for (const auto& record : records) {
+				ret->hydrate(record, EagerColumns);
+			}
+			return ret;
+		});
+	}
+
+	static QFuture<QList<QSharedPointer<Item>>> whereAsync(PredicateList predicates) {
+		auto tq = QStringLiteral("SELECT %1 FROM Item%2").arg(selectColumns(), predicates.whereClause());
+		auto shared = QSharedPointer<PredicateList>::create(std::move(predicates));
+		return pDB->runAsync<QList<QSqlRecord>, QList<QSharedPointer<Item>>>([tq, shared] {
+			PPStatement query(tq);
+			shared->bindAllPredicates(query.data());
+			auto ok = query->exec();
+			if (!ok) {
+				qCritical() << query->lastError() << "when running a where query on items of type Item";
+			}
+			return PPDatabase::records(query.data());
+		}, [](const QList<QSqlRecord>& records) {
+			QList<QSharedPointer<Item>> ret;
+			for (const auto& record : records) {
+				ret << hydrated(record);
+			}
+			return ret;
+		});
+	}
+
+	static void prepareDatabase() {
+		volatile auto db = PPDatabase::instance();
+		Q_UNUSED(db)
+
+		auto tq = QStringLiteral(R"RJIENRLWEY(
+		CREATE TABLE IF NOT EXISTS Item(
+			ID BLOB NOT NULL,
+			
+			rank INTEGER NOT NULL,
+			ratio REAL NOT NULL,
+			flag INTEGER NOT NULL,
+			PRIMARY KEY (ID))
+		)RJIENRLWEY");
+		QSqlQuery query(PPDatabase::instance()->connection());
+		query.prepare(tq);
+		auto ok = query.exec();
+		if (!ok) {
+			qCritical() << query.lastError();
+		}
+		for (const auto& index : QStringList{
+			QStringLiteral("CREATE INDEX IF NOT EXISTS Item_rank ON Item(rank)"),
+		}) {
+			if (!query.exec(index)) {
+				qCritical() << query.lastError();
+			}
+		}
+		PPDatabase::instance()->migrateKeys(QStringLiteral("Item"), QStringList{
+			QStringLiteral("ID"),
+		});
+	}
+
+};
+
+class ItemModel : public QAbstractListModel {
+	Q_OBJECT
+
+	// Rows are read a page at a time in the order they were inserted, by rowid,
+	// or in ID order for WITHOUT ROWID tables, which have nothing else to go by.
+	// A page starts after the key that ends the page before it, so once that
+	// key is known reading it is an index seek, and only a window of recently
+	// used pages is kept hydrated. Finding the key of a page first reached by
+	// a jump skips the rows since the nearest known one inside SQLite, which
+	// only walks the key's index, so it still grows with the distance.
+	static const int page_size = 256;
+	static const int window_pages = 8;
+
+	static QString orderKey() {
+		return QStringLiteral("rowid");
+	}
+
+	QString m_parentColumn;
+	QUuid m_parentID;
+	int m_rowCount = 0;
+	// m_anchors[k] is the key of the last row of page k - 1. Page 0 has none.
+	// Pages reached by a jump leave gaps before them.
+	mutable QMap<int,QVariant> m_anchors;
+	mutable QCache<int,QVector<QSharedPointer<Item>>> m_pages;
+	QSharedPointer<Item> m_staging;
+	ModelTypes m_parentedKind;
+
+	Q_PROPERTY(Item* staging READ staging NOTIFY stagingItemChanged)
+
+	ItemModel(ModelTypes parentedKind, const QString& parentColumn, const QUuid& parentID) : QAbstractListModel(nullptr), m_parentColumn(parentColumn), m_parentID(parentID), m_pages(window_pages), m_parentedKind(parentedKind)
+	{
+		connect(pDB, &PPDatabase::rowChanged, this, &ItemModel::applyRowChange);
+		refresh();
+	}
+
+	QString select(const QString& columns, const QString& condition, const QString& tail) const {
+		QStringList conditions;
+		if (!m_parentColumn.isEmpty()) {
+			conditions << QStringLiteral("%1 = :parent_id").arg(m_parentColumn);
+		}
+		if (!condition.isEmpty()) {
+			conditions << condition;
+		}
+		auto ret = QStringLiteral("SELECT %1 FROM Item").arg(columns);
+		if (!conditions.isEmpty()) {
+			ret += QStringLiteral(" WHERE ") + conditions.join(QStringLiteral(" AND "));
+		}
+		return ret + tail;
+	}
+
+	void bindParent(QSqlQuery* query) const {
+		if (!m_parentColumn.isEmpty()) {
+			query->bindValue(":parent_id", PPKey::encode(m_parentID));
+		}
+	}
+
+	void refresh() {
+		beginResetModel();
+		m_anchors.clear();
+		m_anchors.insert(0, QVariant());
+		m_pages.clear();
+		PredicateList predicates;
+		if (!m_parentColumn.isEmpty()) {
+			predicates << new Equals(m_parentColumn, PPKey::encode(m_parentID));
+		}
+		m_rowCount = int(Item::count(std::move(predicates)));
+		endResetModel();
+	}
+
+	// Finds the anchor of page with one query that skips to it from the
+	// nearest known anchor before it. Each anchor is found once.
+	bool anchor(int page) const {
+		if (m_anchors.contains(page)) {
+			return true;
+		}
+		auto known = std::prev(m_anchors.lowerBound(page));
+		auto afterAnchor = known.key() > 0;
+		PPStatement query(select(orderKey(), afterAnchor ? orderKey() + QStringLiteral(" > :anchor") : QString(), QStringLiteral(" ORDER BY %1 LIMIT 1 OFFSET %2").arg(orderKey()).arg((page - known.key()) * page_size - 1)));
+		bindParent(query.data());
+		if (afterAnchor) {
+			query->bindValue(":anchor", known.value());
+		}
+		if (!query->exec()) {
+			qCritical() << query->lastError() << "when paging items of type Item";
+			return false;
+		}
+		if (!query->next()) {
+			return false;
+		}
+		m_anchors.insert(page, query->value(0));
+		return true;
+	}
+
+	QVector<QSharedPointer<Item>>* page(int index) const {
+		if (auto cached = m_pages.object(index)) {
+			return cached;
+		}
+		if (!anchor(index)) {
+			return nullptr;
+		}
+		// The key is read after the object's columns, so hydrating ignores it.
+		auto columns = Item::selectColumns();
+		columns += QStringLiteral(", rowid");
+		PPStatement query(select(columns, index > 0 ? orderKey() + QStringLiteral(" > :anchor") : QString(), QStringLiteral(" ORDER BY %1 LIMIT %2").arg(orderKey()).arg(page_size)));
+		bindParent(query.data());
+		if (index > 0) {
+			query->bindValue(":anchor", m_anchors.value(index));
+		}
+		if (!query->exec()) {
+			qCritical() << query->lastError() << "when paging items of type Item";
+			return nullptr;
+		}
+		auto rows = new QVector<QSharedPointer<Item>>;
+		rows->reserve(page_size);
+		QVariant last;
+		while (query->next()) {
+			last = query->value(query->record().count() - 1);
+			*rows << Item::hydrated(*query);
+		}
+		if (rows->size() == page_size && !m_anchors.contains(index + 1)) {
+			m_anchors.insert(index + 1, last);
+		}
+		m_pages.insert(index, rows);
+		return rows;
+	}
+
+	// Committed changes are applied to the rows they touch: inserts and removals
+	// shift the rows after them and drop the pages that moved, updates of rows
+	// that are paged in emit dataChanged() for the properties that changed.
+	void applyRowChange(const PPRowChange& change) {
+		if (change.table != QLatin1String("Item")) {
+			return;
+		}
+		switch (change.kind) {
+		case PPRowChange::Inserted:
+			if (m_parentColumn.isEmpty()) {
+				insertItem(change.ID);
+			}
+			break;
+		case PPRowChange::Deleted:
+			if (m_parentColumn.isEmpty()) {
+				removeItem(change.ID, true, change.rowid);
+			}
+			break;
+		case PPRowChange::Reparented:
+			if (!m_parentColumn.isEmpty() && change.parentColumn == m_parentColumn) {
+				if (change.previousParent == m_parentID) {
+					removeItem(change.ID, false, 0);
+				}
+				if (change.parent == m_parentID) {
+					insertItem(change.ID);
+				}
+			}
+			break;
+		case PPRowChange::Updated:
+			updateItem(change.ID, change.properties);
+			break;
+		case PPRowChange::Reset:
+			refresh();
+			break;
+		}
+	}
+
+	// The row an ID has, or would have, in the model's order. Outside of
+	// WITHOUT ROWID tables that needs the row, or the rowid it had.
+	int position(const QUuid& ID, qint64 rowid = 0) const {
+		PPStatement query(select(QStringLiteral("COUNT(*)"), rowid != 0 ? QStringLiteral("rowid < :rowid") : QStringLiteral("rowid < (SELECT rowid FROM Item WHERE ID = :id)"), QString()));
+		if (rowid != 0) {
+			query->bindValue(":rowid", rowid);
+		} else {
+			query->bindValue(":id", PPKey::encode(ID));
+		}
+		bindParent(query.data());
+		if (!query->exec() || !query->next()) {
+			qCritical() << query->lastError() << "when finding the row of an item of type Item";
+			return -1;
+		}
+		return query->value(0).toInt();
+	}
+
+	// Pages up to the one holding row keep their rows and anchors.
+	void invalidateFrom(int row) {
+		auto page = row / page_size;
+		for (auto it = m_anchors.upperBound(page); it != m_anchors.end();) {
+			it = m_anchors.erase(it);
+		}
+		for (auto key : m_pages.keys()) {
+			if (key >= page) {
+				m_pages.remove(key);
+			}
+		}
+	}
+
+	void insertItem(const QUuid& ID) {
+		auto row = position(ID);
+		if (row < 0) {
+			return;
+		}
+		row = qMin(row, m_rowCount);
+		beginInsertRows(QModelIndex(), row, row);
+		m_rowCount++;
+		invalidateFrom(row);
+		endInsertRows();
+	}
+
+	// The row of an ID that's paged in, or -1.
+	int cachedRow(const QUuid& ID) const {
+		for (auto key : m_pages.keys()) {
+			auto rows = m_pages.object(key);
+			for (int i = 0; i < rows->size(); i++) {
+				if (rows->at(i)->m_ID == ID) {
+					return key * page_size + i;
+				}
+			}
+		}
+		return -1;
+	}
+
+	// rowid is the one a deleted row had, if it's known.
+	void removeItem(const QUuid& ID, bool deleted, qint64 rowid) {
+		auto row = cachedRow(ID);
+		if (row < 0 && (!deleted || rowid != 0)) {
+			row = position(ID, rowid);
+		} else if (row < 0) {
+			// Without its rowid, there's nothing left to find the place of a
+			// deleted row by.
+			refresh();
+			return;
+		}
+		if (row < 0 || m_rowCount == 0) {
+			return;
+		}
+		row = qMin(row, m_rowCount - 1);
+		beginRemoveRows(QModelIndex(), row, row);
+		m_rowCount--;
+		invalidateFrom(row);
+		endRemoveRows();
+	}
+
+	void updateItem(const QUuid& ID, quint64 properties) {
+		auto row = cachedRow(ID);
+		if (row < 0) {
+			return;
+		}
+		QVector<int> roles;
+		for (int bit = 0; bit < 64; bit++) {
+			if (properties & (quint64(1) << bit)) {
+				roles << Qt::UserRole + bit;
+			}
+		}
+		auto changed = index(row);
+		Q_EMIT dataChanged(changed, changed, roles);
+	}
+
+	// The first @lazy property read on a page loads them for the whole page.
+	void fetchLazy(int row, const QSharedPointer<Item>& object) const {
+		if ((object->m_LOADED & Item::LazyColumns) == Item::LazyColumns) {
+			return;
+		}
+		if (auto rows = m_pages.object(row / page_size)) {
+			Item::fetchColumns(*rows, Item::LazyColumns);
+		}
+	}
+
+	QSharedPointer<Item> itemAt(int row) const {
+		auto rows = page(row / page_size);
+		if (rows == nullptr || row % page_size >= rows->size()) {
+			return QSharedPointer<Item>();
+		}
+		return rows->at(row % page_size);
+	}
+
+public:
+
+	Q_SIGNAL void stagingItemChanged();
+
+	enum ItemData {
+		rank = Qt::UserRole,
+		ratio ,
+		flag ,
+		
+		
+		object
+	};
+
+	Item* staging() const {
+		return m_staging.data();
+	}
+
+	Q_INVOKABLE void createStaging() {
+		m_staging = Item::newItem();
+		Q_EMIT stagingItemChanged();
+	}
+
+	Q_INVOKABLE void commitStaging() {
+		PPTransaction transaction;
+		if (!transaction.isOpen()) {
+			return;
+		}
+		if (!m_staging->save()) {
+			return;
+		}
+		if (!m_parentID.isNull()) {
+			
+		}
+		// The new row reaches this and every other model through PPDatabase::rowChanged().
+		if (!transaction.commit()) {
+			return;
+		}
+		m_staging = nullptr;
+		Q_EMIT stagingItemChanged();
+	}
+
+	ItemModel(QObject *parent = nullptr) : QAbstractListModel(parent), m_pages(window_pages)
+	{
+		connect(pDB, &PPDatabase::rowChanged, this, &ItemModel::applyRowChange);
+		refresh();
+	}
+
+	
+
+	int rowCount(const QModelIndex &parent = QModelIndex()) const override {
+		Q_UNUSED(parent)
+		return m_rowCount;
+	}
+
+	QHash<int, QByteArray> roleNames() const override {
+		auto rn = QAbstractItemModel::roleNames();
+		rn[ItemData::rank] = QByteArray("rank");
+		rn[ItemData::ratio] = QByteArray("ratio");
+		rn[ItemData::flag] = QByteArray("flag");
+		
+		
+		rn[ItemData::object] = QByteArray("Item-object");
+		return rn;
+	}
+
+	QVariant data(const QModelIndex &item, int role) const override {
+		if (!item.isValid()) return QVariant();
+
+		auto object = itemAt(item.row());
+		if (object.isNull()) {
+			return QVariant();
+		}
+
+		switch (role) {
+		case ItemData::rank:
+			return QVariant::fromValue(object->rank());
+		case ItemData::ratio:
+			return QVariant::fromValue(object->ratio());
+		case ItemData::flag:
+			return QVariant::fromValue(object->flag());
+		
+		
+		case ItemData::object:
+			return QVariant::fromValue(object.data());
+		}
+
+		return QVariant();
+	}
+
+	Qt::ItemFlags flags(const QModelIndex &index) const override {
+		return Qt::ItemIsEditable | Qt::ItemIsSelectable | Qt::ItemIsEnabled;
+	}
+
+	bool setData(const QModelIndex &item, const QVariant &value, int role = Qt::EditRole) override {
+		auto object = itemAt(item.row());
+		if (object.isNull()) {
+			return false;
+		}
+
+		switch (role) {
+			
+			
+			case ItemData::rank:
+				object->set_rank(value.value<qint32>());
+				Q_EMIT dataChanged(item, item, {role});
+				return true;
+			
+			
+			case ItemData::ratio:
+				object->set_ratio(value.value<float>());
+				Q_EMIT dataChanged(item, item, {role});
+				return true;
+			
+			
+			case ItemData::flag:
+				object->set_flag(value.value<bool>());
+				Q_EMIT dataChanged(item, item, {role});
+				return true;
+			
+		}
+
+		return false;
+	}
+};
+
@@ -0,0 +1,36 @@
+#include <QCoreApplication>
+#include "008.h"
+
+int main(int argc, char* argv[]) {
+    auto app = new QCoreApplication(argc, argv);
+    app->setApplicationName("pokipoki-test-008");
+
+    QSqlQuery query(pDB->connection());
+    query.exec("DROP TABLE IF EXISTS Item");
+
+    QList<QString> tags{"red", "grün", ""};
+    QMap<QString,qint32> scores{{"a", -1}, {"b", 1 << 30}};
+
+    auto item = Item::newItem();
+    item->set_name("compound");
+    item->set_tags(tags);
+    item->set_scores(scores);
+    if (!item->save()) {
+        return 1;
+    }
+    // Let go of the instance so the next lookup decodes the row.
+    item.clear();
+
+    auto found = Item::where(PredicateList(eq(name, QStringLiteral("compound"))));
+    if (found.length() != 1 || found.first()->tags() != tags || found.first()->scores() != scores) {
+        return 1;
+    }
+
+    // Anything else in the column decodes to an empty value.
+    bool ok = true;
+    if (!PPBinary::decode<QList<QString>>(QByteArray("garbage"), &ok).isEmpty() || ok) {
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,95 @@
+#include <QCoreApplication>
+#include "009.h"
+
+int rows(const QString& table) {
+    QSqlQuery query(pDB->connection());
+    query.exec(QStringLiteral("SELECT COUNT(*) FROM %1").arg(table));
+    return query.next() ? query.value(0).toInt() : -1;
+}
+
+int main(int argc, char* argv[]) {
+    auto app = new QCoreApplication(argc, argv);
+    app->setApplicationName("pokipoki-test-009");
+
+    QSqlQuery query(pDB->connection());
+    for (auto table : {"Item", "Item_labels", "Item_tags"}) {
+        query.exec(QStringLiteral("DROP TABLE IF EXISTS %1").arg(table));
+    }
+
+    auto item = Item::newItem();
+    item->set_name("sides");
+    item->insert_labels("colour", "red");
+    item->append_tags("a");
+    item->append_tags("c");
+    if (!item->save() || rows("Item_labels") != 1 || rows("Item_tags") != 2) {
+        return 1;
+    }
+
+    item->insert_labels("size", "large");
+    item->insert_tags(1, "b");
+    if (!item->dirty() || !item->save()) {
+        return 1;
+    }
+    if (item->tags() != QList<QString>{"a", "b", "c"} || rows("Item_tags") != 3) {
+        return 1;
+    }
+
+    auto found = Item::where(PredicateList(Item::labels_has("size", "large")));
+    if (found.length() != 1 || Item::where(PredicateList(Item::tags_contains("b"))).length() != 1) {
+        return 1;
+    }
+
+    // Undo only replays the recorded deltas.
+    item->undo();
+    if (item->labels().contains("size") || item->tags() != QList<QString>{"a", "c"}) {
+        return 1;
+    }
+    item->redo();
+
+    item->remove_tags(0);
+    item->remove_labels("colour");
+    if (!item->save() || rows("Item_labels") != 1) {
+        return 1;
+    }
+
+    // A fresh instance reads the collections back from their tables.
+    found.clear();
+    item.clear();
+    found = Item::where(PredicateList(eq(name, QStringLiteral("sides"))));
+    if (found.length() != 1 || found.first()->tags() != QList<QString>{"b", "c"}) {
+        return 1;
+    }
+    if (found.first()->labels() != QMap<QString,QString>{{"size", "large"}}) {
+        return 1;
+    }
+
+    // Replacing a collection with unsaved deltas undoes back to what was saved.
+    item = found.first();
+    item->append_tags("d");
+    item->set_tags({"x"});
+    if (!item->save()) {
+        return 1;
+    }
+    item->undo();
+    if (item->tags() != QList<QString>{"b", "c"} || rows("Item_tags") != 2) {
+        return 1;
+    }
+
+    // A save that rolls back keeps the value to undo to for the next one.
+    item->set_tags({"y"});
+    {
+        PPTransaction transaction;
+        if (!item->save()) {
+            return 1;
+        }
+    }
+    if (!item->dirty() || !item->save() || rows("Item_tags") != 1) {
+        return 1;
+    }
+    item->undo();
+    if (item->tags() != QList<QString>{"b", "c"} || rows("Item_tags") != 2) {
+        return 1;
+    }
+
+    return 0;
+}
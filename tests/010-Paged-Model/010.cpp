@@ -0,0 +1,68 @@
+#include <QCoreApplication>
+#include "010.h"
+
+const int ROWS = 1000;
+
+int main(int argc, char* argv[]) {
+    auto app = new QCoreApplication(argc, argv);
+    app->setApplicationName("pokipoki-test-010");
+
+    QSqlQuery(pDB->connection()).exec("DROP TABLE IF EXISTS Item");
+
+    {
+        PPTransaction transaction;
+        for (int i = 0; i < ROWS; i++) {
+            auto item = Item::newItem();
+            item->set_prop(QString::number(i));
+            if (!item->save()) {
+                return 1;
+            }
+        }
+        if (!transaction.commit()) {
+            return 1;
+        }
+    }
+
+    auto model = new ItemModel;
+    if (model->rowCount() != ROWS) {
+        return 1;
+    }
+
+    // Jump past pages that were never read, then read every row, which
+    // cycles pages through the window more than once.
+    if (!model->data(model->index(ROWS - 1), ItemModel::prop).isValid()) {
+        return 1;
+    }
+    if (model->data(model->index(ROWS), ItemModel::prop).isValid()) {
+        return 1;
+    }
+    // A page between two jumps seeks from the nearest anchor before it.
+    if (model->data(model->index(ROWS - 1), ItemModel::prop).toString() != QString::number(ROWS - 1)) {
+        return 1;
+    }
+    if (model->data(model->index(300), ItemModel::prop).toString() != QStringLiteral("300")) {
+        return 1;
+    }
+    // Rows keep the order they were inserted in.
+    for (int i = 0; i < ROWS; i++) {
+        if (model->data(model->index(i), ItemModel::prop).toString() != QString::number(i)) {
+            return 1;
+        }
+    }
+
+    auto first = model->data(model->index(0), ItemModel::prop);
+    auto middle = model->data(model->index(ROWS / 2), ItemModel::prop);
+    if (model->data(model->index(ROWS / 2), ItemModel::prop) != middle || model->data(model->index(0), ItemModel::prop) != first) {
+        return 1;
+    }
+
+    model->createStaging();
+    model->staging()->set_prop("staged");
+    model->commitStaging();
+    if (model->rowCount() != ROWS + 1 || model->data(model->index(ROWS), ItemModel::prop).toString() != "staged") {
+        return 1;
+    }
+
+    delete model;
+    return 0;
+}
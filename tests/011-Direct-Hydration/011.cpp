@@ -0,0 +1,47 @@
+#include <QCoreApplication>
+#include "011.h"
+
+int main(int argc, char* argv[]) {
+    auto app = new QCoreApplication(argc, argv);
+    app->setApplicationName("pokipoki-test-011");
+
+    QSqlQuery(pDB->connection()).exec("DROP TABLE IF EXISTS Item");
+
+    auto item = Item::newItem();
+    item->set_title("hydrated");
+    item->set_rank(3);
+    if (!item->save()) {
+        return 1;
+    }
+    item.clear();
+
+    // A fresh instance is filled as is, without being dirty or undoable.
+    auto found = Item::where(PredicateList(eq(rank, 3)));
+    if (found.length() != 1) {
+        return 1;
+    }
+    item = found.first();
+    if (item->title() != "hydrated" || item->rank() != 3 || item->dirty() || item->canUndo()) {
+        return 1;
+    }
+
+    // An instance that is still alive keeps its unsaved edits, and takes the rest from the row.
+    int rankChanges = 0;
+    QObject::connect(item.data(), &Item::rankChanged, [&rankChanges] { rankChanges++; });
+    item->set_title("edited");
+
+    QSqlQuery update(pDB->connection());
+    if (!update.exec("UPDATE Item SET title = 'stored', rank = 7")) {
+        return 1;
+    }
+
+    found = Item::where(PredicateList(eq(rank, 7)));
+    if (found.length() != 1 || found.first().data() != item.data()) {
+        return 1;
+    }
+    if (item->title() != "edited" || item->rank() != 7 || rankChanges != 1 || !item->dirty()) {
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,78 @@
+#include <QCoreApplication>
+#include "012.h"
+
+const int ROWS = 10;
+
+static bool overwrite(const char* statement) {
+    return QSqlQuery(pDB->connection()).exec(statement);
+}
+
+int main(int argc, char* argv[]) {
+    auto app = new QCoreApplication(argc, argv);
+    app->setApplicationName("pokipoki-test-012");
+
+    QSqlQuery(pDB->connection()).exec("DROP TABLE IF EXISTS Item");
+
+    {
+        PPTransaction transaction;
+        for (int i = 0; i < ROWS; i++) {
+            auto item = Item::newItem();
+            item->set_title(QString::number(i));
+            item->set_rank(i);
+            item->set_body("stored");
+            if (!item->save()) {
+                return 1;
+            }
+        }
+        if (!transaction.commit()) {
+            return 1;
+        }
+    }
+
+    // Lazy properties are left out of where() and read when they're first used.
+    auto items = Item::where(PredicateList(eq(title, QStringLiteral("0"))));
+    if (items.length() != 1 || !overwrite("UPDATE Item SET body = 'changed'")) {
+        return 1;
+    }
+    if (items.first()->body() != "changed" || items.first()->title() != "0") {
+        return 1;
+    }
+    items.clear();
+
+    // A projection only reads the properties it names.
+    items = Item::where(PredicateList(eq(title, QStringLiteral("1"))), {QStringLiteral("title")});
+    if (items.length() != 1 || !overwrite("UPDATE Item SET rank = 100")) {
+        return 1;
+    }
+    if (items.first()->title() != "1" || items.first()->rank() != 100) {
+        return 1;
+    }
+    items.clear();
+
+    // fetch() reads a property for many objects at once.
+    items = Item::where(PredicateList(gt(rank, 0)));
+    Item::fetch(items, {QStringLiteral("body")});
+    if (items.length() != ROWS || !overwrite("UPDATE Item SET body = 'fetched'")) {
+        return 1;
+    }
+    for (const auto& item : items) {
+        if (item->body() != "changed") {
+            return 1;
+        }
+    }
+    items.clear();
+
+    // The model reads lazy properties for the whole page on first use.
+    auto model = new ItemModel;
+    if (model->data(model->index(0), ItemModel::body).toByteArray() != "fetched" || !overwrite("UPDATE Item SET body = 'paged'")) {
+        return 1;
+    }
+    for (int i = 0; i < ROWS; i++) {
+        if (model->data(model->index(i), ItemModel::body).toByteArray() != "fetched") {
+            return 1;
+        }
+    }
+
+    delete model;
+    return 0;
+}
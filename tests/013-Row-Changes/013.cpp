@@ -0,0 +1,84 @@
+#include <QCoreApplication>
+#include "013.h"
+
+int main(int argc, char* argv[]) {
+    auto app = new QCoreApplication(argc, argv);
+    app->setApplicationName("pokipoki-test-013");
+
+    QSqlQuery(pDB->connection()).exec("DROP TABLE IF EXISTS Folder");
+    QSqlQuery(pDB->connection()).exec("DROP TABLE IF EXISTS Note");
+
+    auto model = new NoteModel;
+    int inserted = 0, removed = 0, resets = 0;
+    QVector<int> changedRoles;
+    QObject::connect(model, &QAbstractItemModel::rowsInserted, [&inserted] { inserted++; });
+    QObject::connect(model, &QAbstractItemModel::rowsRemoved, [&removed] { removed++; });
+    QObject::connect(model, &QAbstractItemModel::modelReset, [&resets] { resets++; });
+    QObject::connect(model, &QAbstractItemModel::dataChanged, [&changedRoles](const QModelIndex&, const QModelIndex&, const QVector<int>& roles) {
+        changedRoles = roles;
+    });
+
+    // Saving a new object inserts its row into open models.
+    auto note = Note::newNote();
+    note->set_title("first");
+    if (!note->save() || model->rowCount() != 1 || inserted != 1) {
+        return 1;
+    }
+
+    // Changes that are rolled back are never published.
+    {
+        PPTransaction transaction;
+        auto discarded = Note::newNote();
+        discarded->save();
+    }
+    if (model->rowCount() != 1 || inserted != 1) {
+        return 1;
+    }
+
+    // Updates only signal the properties that changed.
+    if (model->data(model->index(0), NoteModel::title).toString() != "first") {
+        return 1;
+    }
+    note->set_rank(5);
+    if (!note->save() || changedRoles != QVector<int>{NoteModel::rank}) {
+        return 1;
+    }
+
+    // Reparenting moves the row between models of children.
+    auto folder = Folder::newFolder();
+    folder->set_title("folder");
+    if (!folder->save()) {
+        return 1;
+    }
+    auto folders = new FolderModel;
+    auto children = folders->data(folders->index(0), FolderModel::childrenNote).value<NoteModel*>();
+    if (children == nullptr || children->rowCount() != 0) {
+        return 1;
+    }
+    if (!folder->addChildNote(note) || children->rowCount() != 1 || model->rowCount() != 1) {
+        return 1;
+    }
+    if (!folder->removeChildNote(note) || children->rowCount() != 0) {
+        return 1;
+    }
+
+    // Deleting an object removes its row.
+    auto deleted = Note::newNote();
+    if (!deleted->save() || model->rowCount() != 2) {
+        return 1;
+    }
+    deleted->stageDelete();
+    deleted.clear();
+    pDB->flushDeletes();
+    if (model->rowCount() != 1 || removed != 1) {
+        return 1;
+    }
+
+    if (resets != 0) {
+        return 1;
+    }
+
+    delete folders;
+    delete model;
+    return 0;
+}
@@ -0,0 +1,77 @@
+#include <QCoreApplication>
+#include "014.h"
+
+const int ROWS = 20;
+
+static QList<int> ranks(const QList<QSharedPointer<Item>>& items) {
+    QList<int> ret;
+    for (const auto& item : items) {
+        ret << item->rank();
+    }
+    return ret;
+}
+
+int main(int argc, char* argv[]) {
+    auto app = new QCoreApplication(argc, argv);
+    app->setApplicationName("pokipoki-test-014");
+
+    QSqlQuery(pDB->connection()).exec("DROP TABLE IF EXISTS Item");
+
+    {
+        PPTransaction transaction;
+        for (int i = 0; i < ROWS; i++) {
+            auto item = Item::newItem();
+            item->set_title(QStringLiteral("item %1").arg(i));
+            item->set_rank(i);
+            if (!item->save()) {
+                return 1;
+            }
+        }
+        if (!transaction.commit()) {
+            return 1;
+        }
+    }
+
+    // Every predicate of a list applies, even two on the same column.
+    if (Item::where(PredicateList(gte(rank, 5), lt(rank, 10))).length() != 5) {
+        return 1;
+    }
+
+    if (Item::query().rank.atLeast(5).rank.lessThan(10).all().length() != 5) {
+        return 1;
+    }
+    if (Item::query().rank.equals(1).orWhere().rank.equals(2).all().length() != 2) {
+        return 1;
+    }
+    // AND binds tighter than OR.
+    if (Item::query().rank.lessThan(3).title.equals("item 1").orWhere().rank.equals(19).all().length() != 2) {
+        return 1;
+    }
+    if (Item::query().title.matches("item 1%").all().length() != 11) {
+        return 1;
+    }
+
+    if (ranks(Item::query().rank.orderBy(Qt::DescendingOrder).limit(3).all()) != QList<int>{19, 18, 17}) {
+        return 1;
+    }
+    if (ranks(Item::query().rank.orderBy().limit(2).offset(5).all()) != QList<int>{5, 6}) {
+        return 1;
+    }
+    auto first = Item::query().rank.orderBy().first();
+    if (first.isNull() || first->rank() != 0) {
+        return 1;
+    }
+
+    // Copies of a query are independent, and the same shape runs again with other values.
+    auto below = Item::query().rank.lessThan(3);
+    auto copy = below;
+    copy.rank.greaterThan(0);
+    if (below.all().length() != 3 || copy.all().length() != 2) {
+        return 1;
+    }
+    if (Item::query().rank.lessThan(10).all().length() != 10) {
+        return 1;
+    }
+
+    return 0;
+}
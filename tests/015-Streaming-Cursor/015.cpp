@@ -0,0 +1,99 @@
+#include <QCoreApplication>
+#include "015.h"
+
+const int ROWS = 1000;
+
+int main(int argc, char* argv[]) {
+    auto app = new QCoreApplication(argc, argv);
+    app->setApplicationName("pokipoki-test-015");
+
+    QSqlQuery(pDB->connection()).exec("DROP TABLE IF EXISTS Box");
+    QSqlQuery(pDB->connection()).exec("DROP TABLE IF EXISTS Item");
+
+    auto box = Box::newBox();
+    {
+        PPTransaction transaction;
+        if (!box->save()) {
+            return 1;
+        }
+        for (int i = 0; i < ROWS; i++) {
+            auto item = Item::newItem();
+            item->set_rank(i);
+            if (!item->save() || (i % 10 == 0 && !box->addChildItem(item))) {
+                return 1;
+            }
+        }
+        if (!transaction.commit()) {
+            return 1;
+        }
+    }
+
+    // Only the row being looked at is alive.
+    auto& map = PPIdentityMap<Item>::instance();
+    int rows = 0;
+    int peak = 0;
+    for (const auto& item : Item::query().stream()) {
+        if (item->rank() < 0) {
+            return 1;
+        }
+        rows++;
+        peak = qMax(peak, map.size());
+    }
+    if (rows != ROWS || peak > 2 || map.size() != 0) {
+        return 1;
+    }
+
+    int batches = 0;
+    auto complete = Item::query().stream().forEachBatch(100, [&batches, &map](const QList<QSharedPointer<Item>>& batch) {
+        batches++;
+        return batch.size() == 100 && map.size() <= 101;
+    });
+    if (!complete || batches != ROWS / 100) {
+        return 1;
+    }
+
+    // Returning false stops the batches.
+    batches = 0;
+    complete = Item::query().stream().forEachBatch(100, [&batches](const QList<QSharedPointer<Item>>&) {
+        return ++batches < 3;
+    });
+    if (complete || batches != 3) {
+        return 1;
+    }
+
+    auto cursor = Item::streamWhere(PredicateList(lt(rank, 10)));
+    rows = 0;
+    while (auto item = cursor.next()) {
+        rows++;
+    }
+    if (!cursor.ok() || rows != 10) {
+        return 1;
+    }
+
+    // An empty list streams every row.
+    auto all = Item::streamWhere(PredicateList());
+    rows = 0;
+    while (auto item = all.next()) {
+        rows++;
+    }
+    if (!all.ok() || rows != ROWS) {
+        return 1;
+    }
+    // A drained cursor can't be run again.
+    if (all.exec() || all.ok() || all.next()) {
+        return 1;
+    }
+
+    rows = 0;
+    for (const auto& item : box->streamChildItems()) {
+        if (item->rank() % 10 != 0) {
+            return 1;
+        }
+        rows++;
+    }
+    if (rows != ROWS / 10) {
+        return 1;
+    }
+
+    return 0;
+}
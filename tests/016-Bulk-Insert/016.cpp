@@ -0,0 +1,65 @@
+#include <QCoreApplication>
+#include "016.h"
+
+const int ROWS = 1000;
+
+int main(int argc, char* argv[]) {
+    auto app = new QCoreApplication(argc, argv);
+    app->setApplicationName("pokipoki-test-016");
+
+    QSqlQuery(pDB->connection()).exec("DROP TABLE IF EXISTS Item");
+
+    auto model = new ItemModel;
+
+    // Rows that don't fill the last batch are written too.
+    QVector<Item::Record> records;
+    for (int i = 0; i < ROWS; i++) {
+        records << Item::Record{QStringLiteral("item %1").arg(i), i};
+    }
+    QVector<QUuid> IDs;
+    if (!Item::importRows(records, &IDs) || IDs.size() != ROWS) {
+        return 1;
+    }
+    if (PPIdentityMap<Item>::instance().size() != 0 || model->rowCount() != ROWS) {
+        return 1;
+    }
+    if (Item::query().rank.atLeast(0).all().length() != ROWS) {
+        return 1;
+    }
+    auto last = Item::query().rank.equals(ROWS - 1).first();
+    if (last.isNull() || last->title() != QStringLiteral("item %1").arg(ROWS - 1)) {
+        return 1;
+    }
+
+    // Objects from insertMany() hold the values they were written with.
+    auto items = Item::insertMany(QList<Item::Record>{{QStringLiteral("many"), -1}, {QStringLiteral("many"), -2}});
+    if (items.length() != 2 || items.first()->rank() != -1 || items.first()->dirty()) {
+        return 1;
+    }
+    if (Item::query().title.equals("many").all().length() != 2 || model->rowCount() != ROWS + 2) {
+        return 1;
+    }
+
+    // Imports join the enclosing transaction.
+    {
+        PPTransaction transaction;
+        Item::importRows(records);
+    }
+    if (Item::query().rank.atLeast(0).all().length() != ROWS) {
+        return 1;
+    }
+
+    // An empty import writes nothing, so models aren't reset.
+    int resets = 0;
+    QObject::connect(pDB, &PPDatabase::rowChanged, [&resets](const PPRowChange& change) {
+        if (change.kind == PPRowChange::Reset) {
+            resets++;
+        }
+    });
+    if (!Item::importRows(QVector<Item::Record>()) || resets != 0) {
+        return 1;
+    }
+
+    delete model;
+    return 0;
+}
@@ -0,0 +1,52 @@
+#include <QCoreApplication>
+#include "017.h"
+
+int main(int argc, char* argv[]) {
+    auto app = new QCoreApplication(argc, argv);
+    app->setApplicationName("pokipoki-test-017");
+
+    QSqlQuery(pDB->connection()).exec("DROP TABLE IF EXISTS Item");
+
+    QVector<Item::Record> records;
+    for (int i = 1; i <= 10; i++) {
+        records << Item::Record{QStringLiteral("item %1").arg(i), i, i * 0.5};
+    }
+    if (!Item::importRows(records)) {
+        return 1;
+    }
+
+    if (Item::count() != 10 || Item::count(PredicateList(gt(rank, 5))) != 5) {
+        return 1;
+    }
+    if (!Item::exists(PredicateList(eq(rank, 3))) || Item::exists(PredicateList(eq(rank, 42)))) {
+        return 1;
+    }
+    if (Item::min_rank() != 1 || Item::max_rank() != 10 || Item::sum_rank() != 55 || Item::avg_rank() != 5.5) {
+        return 1;
+    }
+    if (Item::sum_score() != 27.5 || Item::max_score(PredicateList(lt(rank, 4))) != 1.5) {
+        return 1;
+    }
+    // Aggregates over no rows are 0.
+    if (Item::max_rank(PredicateList(gt(rank, 100))) != 0 || Item::avg_rank(PredicateList(gt(rank, 100))) != 0) {
+        return 1;
+    }
+
+    // None of it read a row into an object.
+    if (PPIdentityMap<Item>::instance().size() != 0 || PPIdentityMap<Item>::instance().misses() != 0) {
+        return 1;
+    }
+
+    // An empty list matches every row.
+    if (Item::where(PredicateList()).size() != 10) {
+        return 1;
+    }
+
+    auto model = new ItemModel;
+    if (model->rowCount() != 10) {
+        return 1;
+    }
+
+    delete model;
+    return 0;
+}
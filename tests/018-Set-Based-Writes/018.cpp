@@ -0,0 +1,94 @@
+#include <QCoreApplication>
+#include "018.h"
+
+int main(int argc, char* argv[]) {
+    auto app = new QCoreApplication(argc, argv);
+    app->setApplicationName("pokipoki-test-018");
+
+    QSqlQuery(pDB->connection()).exec("DROP TABLE IF EXISTS Note");
+    QSqlQuery(pDB->connection()).exec("DROP TABLE IF EXISTS Note_tags");
+
+    QVector<Note::Record> records;
+    for (int i = 1; i <= 10; i++) {
+        records << Note::Record{QStringLiteral("note %1").arg(i), i, false};
+    }
+    if (!Note::importRows(records)) {
+        return 1;
+    }
+
+    auto first = Note::where(PredicateList(eq(rank, 1))).first();
+    auto second = Note::where(PredicateList(eq(rank, 2))).first();
+    auto last = Note::where(PredicateList(eq(rank, 10))).first();
+    last->append_tags(QStringLiteral("old"));
+    if (!last->save()) {
+        return 1;
+    }
+    // An unsaved edit survives the update.
+    second->set_title(QStringLiteral("edited"));
+
+    if (!Note::updateWhere(PredicateList(lte(rank, 5)), Note::Patch().set_archived(true).set_title(QStringLiteral("archived")), true)) {
+        return 1;
+    }
+    if (Note::count(PredicateList(eq(archived, true))) != 5) {
+        return 1;
+    }
+    if (!first->archived() || first->title() != QStringLiteral("archived") || first->dirty()) {
+        return 1;
+    }
+    if (!second->archived() || second->title() != QStringLiteral("edited")) {
+        return 1;
+    }
+    if (last->archived()) {
+        return 1;
+    }
+
+    pUR->undo();
+    if (Note::exists(PredicateList(eq(archived, true))) || first->archived() || first->title() != QStringLiteral("note 1")) {
+        return 1;
+    }
+    pUR->redo();
+    if (Note::count(PredicateList(eq(archived, true))) != 5 || !first->archived()) {
+        return 1;
+    }
+
+    if (!Note::deleteWhere(PredicateList(gt(rank, 8)), true)) {
+        return 1;
+    }
+    if (Note::count() != 8 || Note::exists(PredicateList(gt(rank, 8)))) {
+        return 1;
+    }
+    // Saving a deleted object doesn't bring its row back.
+    last->set_title(QStringLiteral("gone"));
+    if (!last->save() || Note::count() != 8) {
+        return 1;
+    }
+    QSqlQuery tags(pDB->connection());
+    if (!tags.exec("SELECT COUNT(*) FROM Note_tags") || !tags.next() || tags.value(0).toInt() != 0) {
+        return 1;
+    }
+
+    // Undoing the deletion writes the rows back, side tables included.
+    pUR->undo();
+    if (Note::count() != 10 || !tags.exec("SELECT COUNT(*) FROM Note_tags") || !tags.next() || tags.value(0).toInt() != 1) {
+        return 1;
+    }
+    // The rows keep their rowids, so models list them where they were.
+    QSqlQuery order(pDB->connection());
+    if (!order.exec("SELECT rank FROM Note ORDER BY rowid")) {
+        return 1;
+    }
+    for (int i = 1; i <= 10; i++) {
+        if (!order.next() || order.value(0).toInt() != i) {
+            return 1;
+        }
+    }
+
+    if (!Note::deleteWhere(PredicateList())) {
+        return 1;
+    }
+    if (Note::count() != 0) {
+        return 1;
+    }
+
+    return 0;
+}
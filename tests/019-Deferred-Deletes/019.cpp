@@ -0,0 +1,63 @@
+#include <QCoreApplication>
+#include "019.h"
+
+int main(int argc, char* argv[]) {
+    auto app = new QCoreApplication(argc, argv);
+    app->setApplicationName("pokipoki-test-019");
+
+    QSqlQuery(pDB->connection()).exec("DROP TABLE IF EXISTS Item");
+    QSqlQuery(pDB->connection()).exec("DROP TABLE IF EXISTS Item_tags");
+
+    int deleted = 0;
+    QObject::connect(pDB, &PPDatabase::rowChanged, [&deleted](const PPRowChange& change) {
+        if (change.kind == PPRowChange::Deleted) {
+            deleted++;
+        }
+    });
+
+    QList<QSharedPointer<Item>> items;
+    for (int i = 0; i < 4; i++) {
+        auto item = Item::newItem();
+        item->set_title(QStringLiteral("item %1").arg(i));
+        item->append_tags(QStringLiteral("tag"));
+        if (!item->save()) {
+            return 1;
+        }
+        items << item;
+    }
+
+    // Dropping a staged object queues its deletion without writing it.
+    for (int i = 0; i < 3; i++) {
+        items[i]->stageDelete();
+    }
+    items[0].clear();
+    items[1].clear();
+    if (pDB->pendingDeletes() != 2 || Item::count() != 4 || deleted != 0) {
+        return 1;
+    }
+    if (!pDB->flushDeletes() || pDB->pendingDeletes() != 0 || Item::count() != 2 || deleted != 2) {
+        return 1;
+    }
+    QSqlQuery tags(pDB->connection());
+    if (!tags.exec("SELECT COUNT(*) FROM Item_tags") || !tags.next() || tags.value(0).toInt() != 2) {
+        return 1;
+    }
+
+    // Inside a transaction, the queue is written when it commits.
+    {
+        PPTransaction transaction;
+        items[2].clear();
+        if (!pDB->flushDeletes() || pDB->pendingDeletes() != 1) {
+            return 1;
+        }
+        items[3]->set_title(QStringLiteral("renamed"));
+        if (!items[3]->save() || !transaction.commit()) {
+            return 1;
+        }
+    }
+    if (pDB->pendingDeletes() != 0 || Item::count() != 1 || deleted != 3) {
+        return 1;
+    }
+
+    return 0;
+}
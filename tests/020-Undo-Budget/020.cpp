@@ -0,0 +1,88 @@
+#include <QCoreApplication>
+#include "020.h"
+
+int main(int argc, char* argv[]) {
+    auto app = new QCoreApplication(argc, argv);
+    app->setApplicationName("pokipoki-test-020");
+
+    QSqlQuery(pDB->connection()).exec("DROP TABLE IF EXISTS Item");
+
+    pUR->setBudget(PPUndoBudget{3, 0});
+
+    auto item = Item::newItem();
+    item->set_title(QStringLiteral("edit 0"));
+    if (!item->save()) {
+        return 1;
+    }
+    for (int i = 1; i <= 5; i++) {
+        item->set_title(QStringLiteral("edit %1").arg(i));
+        if (!item->save()) {
+            return 1;
+        }
+    }
+
+    // Only the three most recent steps are kept.
+    if (pUR->undoSteps() != 3) {
+        return 1;
+    }
+    for (; pUR->canUndo(); pUR->undo()) {
+    }
+    if (item->title() != QStringLiteral("edit 2") || item->canUndo() || pUR->redoSteps() != 3) {
+        return 1;
+    }
+    for (; pUR->canRedo(); pUR->redo()) {
+    }
+    if (item->title() != QStringLiteral("edit 5") || pUR->undoSteps() != 3) {
+        return 1;
+    }
+
+    // A step only holds the properties that changed, and their previous values.
+    pUR->setBudget(PPUndoBudget{0, 0});
+    auto before = pUR->bytes();
+    item->set_rank(1);
+    if (!item->save()) {
+        return 1;
+    }
+    auto small = pUR->bytes() - before;
+    auto longTitle = QString(1000, QLatin1Char('x'));
+    item->set_title(longTitle);
+    if (!item->save()) {
+        return 1;
+    }
+    auto middle = pUR->bytes();
+    item->set_title(QStringLiteral("short"));
+    if (!item->save()) {
+        return 1;
+    }
+    auto large = pUR->bytes() - middle;
+    if (small <= 0 || large - small < 1000) {
+        return 1;
+    }
+
+    // Shrinking the budget drops the oldest steps from the object too.
+    pUR->setBudget(PPUndoBudget{1, 0});
+    if (pUR->undoSteps() != 1) {
+        return 1;
+    }
+    pUR->undo();
+    if (item->title() != longTitle || item->rank() != 1 || item->canUndo() || !item->canRedo()) {
+        return 1;
+    }
+    pUR->setBudget(PPUndoBudget{0, 1});
+    if (pUR->canRedo() || item->canRedo() || pUR->bytes() != 0) {
+        return 1;
+    }
+
+    // Steps go away with their object.
+    pUR->setBudget(PPUndoBudget());
+    item->set_title(QStringLiteral("again"));
+    if (!item->save() || !pUR->canUndo()) {
+        return 1;
+    }
+    item.clear();
+    if (pUR->canUndo() || pUR->bytes() != 0) {
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,80 @@
+#include <QCoreApplication>
+#include "021.h"
+
+int steps(int state) {
+    QSqlQuery query(pDB->connection());
+    query.prepare("SELECT COUNT(*) FROM pokipoki_undo WHERE STATE = :state");
+    query.bindValue(":state", state);
+    return query.exec() && query.next() ? query.value(0).toInt() : -1;
+}
+
+int main(int argc, char* argv[]) {
+    auto app = new QCoreApplication(argc, argv);
+    app->setApplicationName("pokipoki-test-021");
+
+    QSqlQuery(pDB->connection()).exec("DROP TABLE IF EXISTS Item");
+    QSqlQuery(pDB->connection()).exec("DROP TABLE IF EXISTS pokipoki_undo");
+
+    if (!pUR->setJournaled(true)) {
+        return 1;
+    }
+    pUR->setBudget(PPUndoBudget{2, 0});
+
+    auto item = Item::newItem();
+    item->set_title(QStringLiteral("edit 0"));
+    if (!item->save()) {
+        return 1;
+    }
+    for (int i = 1; i <= 4; i++) {
+        item->set_title(QStringLiteral("edit %1").arg(i));
+        if (!item->save()) {
+            return 1;
+        }
+    }
+
+    // Every step is journaled, only the budget stays in memory.
+    if (steps(0) != 4 || pUR->undoSteps() != 2) {
+        return 1;
+    }
+
+    // Undoing past what's in memory reads the older steps back.
+    for (int i = 0; i < 4; i++) {
+        pUR->undo();
+    }
+    if (item->title() != QStringLiteral("edit 0") || pUR->canUndo() || steps(1) != 4) {
+        return 1;
+    }
+    if (pUR->undoSteps() + pUR->redoSteps() > 2) {
+        return 1;
+    }
+
+    // The journal outlives the object that made the steps.
+    item.clear();
+    if (pUR->undoSteps() + pUR->redoSteps() != 0 || !pUR->canRedo()) {
+        return 1;
+    }
+    auto again = Item::where(PredicateList(eq(rank, 0))).first();
+    pUR->redo();
+    if (again->title() != QStringLiteral("edit 1") || steps(0) != 1 || steps(1) != 3) {
+        return 1;
+    }
+
+    // A new edit drops the redo steps left in the journal.
+    for (int i = 5; i <= 6; i++) {
+        again->set_title(QStringLiteral("edit %1").arg(i));
+        if (!again->save()) {
+            return 1;
+        }
+    }
+    if (pUR->canRedo() || steps(1) != 0) {
+        return 1;
+    }
+
+    // A journal limit deletes the oldest undoable steps.
+    pUR->setBudget(PPUndoBudget{2, 0, 1});
+    if (steps(0) != 1 || !pUR->canUndo()) {
+        return 1;
+    }
+
+    return 0;
+}
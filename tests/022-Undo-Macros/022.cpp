@@ -0,0 +1,92 @@
+#include <QCoreApplication>
+#include "022.h"
+
+qint64 titled(const QString& value) {
+    return Item::count(PredicateList(eq(title, value)));
+}
+
+int main(int argc, char* argv[]) {
+    auto app = new QCoreApplication(argc, argv);
+    app->setApplicationName("pokipoki-test-022");
+
+    QSqlQuery(pDB->connection()).exec("DROP TABLE IF EXISTS Item");
+
+    QList<QSharedPointer<Item>> items;
+    for (int i = 0; i < 3; i++) {
+        auto item = Item::newItem();
+        item->set_title(QStringLiteral("before"));
+        if (!item->save()) {
+            return 1;
+        }
+        items << item;
+    }
+
+    int history = 0, rows = 0;
+    QObject::connect(pUR, &PPUndoRedoStack::historyChanged, [&history] { history++; });
+    QObject::connect(pDB, &PPDatabase::rowChanged, [&rows](const PPRowChange&) { rows++; });
+
+    // The saves inside a macro are one step, committed together, and a row
+    // saved twice is published once.
+    pUR->beginMacro();
+    for (const auto& item : items) {
+        item->set_title(QStringLiteral("after"));
+        if (!item->save()) {
+            return 1;
+        }
+    }
+    pUR->beginMacro();
+    items[0]->set_rank(1);
+    if (!items[0]->save()) {
+        return 1;
+    }
+    pUR->endMacro();
+    if (!pDB->inTransaction() || history != 0 || rows != 0) {
+        return 1;
+    }
+    pUR->endMacro();
+    if (pDB->inTransaction() || history != 1 || rows != 3 || pUR->undoSteps() != 1) {
+        return 1;
+    }
+
+    // Undoing it writes every object back in one transaction.
+    rows = 0;
+    pUR->undo();
+    if (history != 2 || rows != 3 || pUR->undoSteps() != 0 || pUR->redoSteps() != 1) {
+        return 1;
+    }
+    if (titled(QStringLiteral("before")) != 3 || items[0]->rank() != 0 || items[0]->dirty()) {
+        return 1;
+    }
+
+    pUR->redo();
+    if (history != 3 || titled(QStringLiteral("after")) != 3 || items[0]->rank() != 1) {
+        return 1;
+    }
+
+    // Undoing one of the objects by itself takes its step out of the macro.
+    items[1]->undo();
+    if (items[1]->title() != QStringLiteral("before") || titled(QStringLiteral("before")) != 1) {
+        return 1;
+    }
+    if (pUR->undoSteps() != 1 || pUR->redoSteps() != 1) {
+        return 1;
+    }
+    pUR->undo();
+    if (titled(QStringLiteral("before")) != 3 || items[0]->rank() != 0 || pUR->redoSteps() != 2) {
+        return 1;
+    }
+
+    // A macro that would overwrite unsaved edits isn't applied at all.
+    pUR->redo();
+    auto steps = pUR->undoSteps();
+    items[0]->set_title(QStringLiteral("unsaved"));
+    pUR->undo();
+    if (items[0]->title() != QStringLiteral("unsaved") || !items[0]->dirty() || pUR->undoSteps() != steps) {
+        return 1;
+    }
+    if (titled(QStringLiteral("after")) != 2 || items[2]->title() != QStringLiteral("after")) {
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,85 @@
+#include <QCoreApplication>
+#include "023.h"
+
+quint64 hits = 0;
+quint64 misses = 0;
+
+// Whether the cache counted these hits and misses since the last call.
+bool counted(quint64 newHits, quint64 newMisses) {
+    auto ok = pDB->statementCacheHits() - hits == newHits && pDB->statementCacheMisses() - misses == newMisses;
+    hits = pDB->statementCacheHits();
+    misses = pDB->statementCacheMisses();
+    return ok;
+}
+
+bool run(const QString& statement) {
+    PPStatement query(statement);
+    return query->exec() && query->next();
+}
+
+int main(int argc, char* argv[]) {
+    auto app = new QCoreApplication(argc, argv);
+    app->setApplicationName("pokipoki-test-023");
+
+    QSqlQuery(pDB->connection()).exec("DROP TABLE IF EXISTS Item");
+    auto item = Item::newItem();
+    item->set_rank(1);
+    if (!item->save()) {
+        return 1;
+    }
+    counted(0, 0);
+
+    // The first use of a statement prepares it, later ones borrow it back.
+    for (int i = 0; i < 3; i++) {
+        if (!run(QStringLiteral("SELECT COUNT(*) FROM Item"))) {
+            return 1;
+        }
+    }
+    if (!counted(2, 1)) {
+        return 1;
+    }
+
+    // Generated queries go through the cache too.
+    Item::where(PredicateList(eq(rank, 1)));
+    counted(0, 0);
+    auto found = Item::where(PredicateList(eq(rank, 1))).length();
+    auto reused = pDB->statementCacheHits() > hits && pDB->statementCacheMisses() == misses;
+    counted(0, 0);
+    if (found != 1 || !reused) {
+        return 1;
+    }
+
+    // A statement that's already borrowed is prepared a second time.
+    {
+        PPStatement outer(QStringLiteral("SELECT COUNT(*) FROM Item"));
+        PPStatement inner(QStringLiteral("SELECT COUNT(*) FROM Item"));
+        if (!outer->exec() || !inner->exec() || !outer->next() || !inner->next()) {
+            return 1;
+        }
+    }
+    if (!counted(1, 1) || !run(QStringLiteral("SELECT COUNT(*) FROM Item")) || !counted(1, 0)) {
+        return 1;
+    }
+
+    // Past its capacity, the least recently used statement is dropped.
+    pDB->setStatementCacheCapacity(2);
+    if (pDB->statementCacheCapacity() != 2) {
+        return 1;
+    }
+    for (const auto& statement : {"SELECT 1", "SELECT 2", "SELECT 3"}) {
+        if (!run(QLatin1String(statement))) {
+            return 1;
+        }
+    }
+    if (!counted(0, 3)) {
+        return 1;
+    }
+    if (!run(QStringLiteral("SELECT 3")) || !counted(1, 0)) {
+        return 1;
+    }
+    if (!run(QStringLiteral("SELECT 1")) || !counted(0, 1)) {
+        return 1;
+    }
+
+    return 0;
+}